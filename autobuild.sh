@@ -1,11 +1,41 @@
 #!/bin/bash
 
 i686-elf-as ./boot/boot.s -o ./bin/boot.o
-i686-elf-gcc -c ./src/kernel.c -o ./bin/kernel.o -std=gnu99 -ffreestanding -O2 -Wall -Wextra 
-i686-elf-gcc -T linker.ld -o ./bin/foxos.bin -ffreestanding -O2 -nostdlib ./bin/boot.o ./bin/kernel.o -lgcc
+i686-elf-as ./src/isr.s -o ./bin/isr.o
+i686-elf-as ./src/usermode.s -o ./bin/usermode.o
+i686-elf-as ./src/switch.s -o ./bin/switch.o
+i686-elf-as ./src/blit.s -o ./bin/blit.o
+for src in kernel fs klib ramdisk serial trace interrupts timer prof wasm wasm_jit wat gdt paging process shell trie stream task gapbuf history piece gfx fbcon font8x16 font video; do
+    i686-elf-gcc -c ./src/$src.c -o ./bin/$src.o -std=gnu99 -ffreestanding -O2 -fno-omit-frame-pointer -Wall -Wextra
+done
+OBJS="./bin/boot.o ./bin/isr.o ./bin/usermode.o ./bin/switch.o ./bin/blit.o ./bin/kernel.o ./bin/fs.o ./bin/klib.o ./bin/ramdisk.o ./bin/serial.o ./bin/trace.o ./bin/interrupts.o ./bin/timer.o ./bin/prof.o ./bin/wasm.o ./bin/wasm_jit.o ./bin/wat.o ./bin/gdt.o ./bin/paging.o ./bin/process.o ./bin/shell.o ./bin/trie.o ./bin/stream.o ./bin/task.o ./bin/gapbuf.o ./bin/history.o ./bin/piece.o ./bin/gfx.o ./bin/fbcon.o ./bin/font8x16.o ./bin/font.o ./bin/video.o"
+
+# Link twice: the profiler's symbol table comes from the first image and goes
+# last in the second, after all the code, so no function moves
+i686-elf-gcc -T linker.ld -o ./bin/foxos.bin -ffreestanding -O2 -nostdlib $OBJS -lgcc
+python3 ./host/gensyms.py ./bin/foxos.bin -o ./bin/symbols.c
+i686-elf-gcc -c ./bin/symbols.c -o ./bin/symbols.o -std=gnu99 -ffreestanding -O2 -I./src
+i686-elf-gcc -T linker.ld -o ./bin/foxos.bin -ffreestanding -O2 -nostdlib $OBJS ./bin/symbols.o -lgcc
 cp ./bin/foxos.bin foxiso/boot/ 
+
+# User programs, installed into /bin on the disk image
+mkdir -p ./bin/user
+for prog in hello; do
+    i686-elf-gcc -T ./user/user.ld -o ./bin/user/$prog -std=gnu99 -ffreestanding -O2 -nostdlib -Wall -Wextra -DFOXOS_USER -I./src ./user/crt0.s ./user/$prog.c
+done
+
+# Fonts for the framebuffer console: all of Unifont as a module, and kana and box drawing on the disk for when it's missing
+[ -f foxiso/boot/unifont.psf ] || python3 ./host/genfont.py foxiso/boot/grub/font.pf2 --psf foxiso/boot/unifont.psf
+python3 ./host/genfont.py foxiso/boot/grub/font.pf2 --psf ./bin/kana.psf --ranges 20-7e,2500-259f,3000-30ff
+
+# A test video for `play`
+python3 ./host/mkvideo.py --synthetic 300 -o ./bin/demo.vid
+
+# Prebuilt disk image; GRUB loads it as a module and the kernel mounts it in place
+./hostbuild.sh
+./bin/host/mkfoxfs foxiso/boot/disk.img ./test.wasm:/home/test.wasm ./bin/user/hello:/bin/hello ./bin/kana.psf:/usr/unifont.psf ./bin/demo.vid:/home/demo.vid
 i686-elf-grub-mkrescue -o foxos.iso foxiso 
 
 echo "BOOTING UP FOXOS"
 
-qemu-system-i386 -cdrom foxos.iso
\ No newline at end of file
+qemu-system-i386 -cdrom foxos.iso
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Builds the kernel in benchmark mode and runs it headless under QEMU.
+# Arguments go to host/qemu_bench.py (e.g. --script bench/fs.txt --output report.json)
+
+set -e
+
+i686-elf-as ./boot/boot.s -o ./bin/boot.o
+i686-elf-as ./src/isr.s -o ./bin/isr.o
+i686-elf-as ./src/usermode.s -o ./bin/usermode.o
+i686-elf-as ./src/switch.s -o ./bin/switch.o
+i686-elf-as ./src/blit.s -o ./bin/blit.o
+for src in kernel fs klib ramdisk serial trace interrupts timer prof wasm wasm_jit wat gdt paging process shell trie stream task gapbuf history piece gfx fbcon font8x16 font video; do
+    i686-elf-gcc -c ./src/$src.c -o ./bin/$src-bench.o -std=gnu99 -ffreestanding -O2 -fno-omit-frame-pointer -Wall -Wextra -DFOXOS_BENCH
+done
+OBJS="./bin/boot.o ./bin/isr.o ./bin/usermode.o ./bin/switch.o ./bin/blit.o ./bin/kernel-bench.o ./bin/fs-bench.o ./bin/klib-bench.o ./bin/ramdisk-bench.o ./bin/serial-bench.o ./bin/trace-bench.o ./bin/interrupts-bench.o ./bin/timer-bench.o ./bin/prof-bench.o ./bin/wasm-bench.o ./bin/wasm_jit-bench.o ./bin/wat-bench.o ./bin/gdt-bench.o ./bin/paging-bench.o ./bin/process-bench.o ./bin/shell-bench.o ./bin/trie-bench.o ./bin/stream-bench.o ./bin/task-bench.o ./bin/gapbuf-bench.o ./bin/history-bench.o ./bin/piece-bench.o ./bin/gfx-bench.o ./bin/fbcon-bench.o ./bin/font8x16-bench.o ./bin/font-bench.o ./bin/video-bench.o"
+
+# Two links so `prof` in a bench script can name functions, see autobuild.sh
+i686-elf-gcc -T linker.ld -o ./bin/foxos-bench.bin -ffreestanding -O2 -nostdlib $OBJS -lgcc
+python3 ./host/gensyms.py ./bin/foxos-bench.bin -o ./bin/symbols-bench.c
+i686-elf-gcc -c ./bin/symbols-bench.c -o ./bin/symbols-bench.o -std=gnu99 -ffreestanding -O2 -I./src
+i686-elf-gcc -T linker.ld -o ./bin/foxos-bench.bin -ffreestanding -O2 -nostdlib $OBJS ./bin/symbols-bench.o -lgcc
+
+python3 ./host/qemu_bench.py --kernel ./bin/foxos-bench.bin "$@"
@@ -2,7 +2,8 @@
 
 .set ALIGN,    1<<0             /* align loaded modules on page boundaries */
 .set MEMINFO,  1<<1             /* provide memory map */
-.set FLAGS,    ALIGN | MEMINFO  /* this is the Multiboot 'flag' field */
+.set VIDEO,    1<<2             /* ask for the video mode below */
+.set FLAGS,    ALIGN | MEMINFO | VIDEO  /* this is the Multiboot 'flag' field */
 .set MAGIC,    0x1BADB002       /* 'magic number' lets bootloader find the header */
 .set CHECKSUM, -(MAGIC + FLAGS) /* checksum of above, to prove we are multiboot */
 
@@ -11,18 +12,44 @@
 .long MAGIC
 .long FLAGS
 .long CHECKSUM
+/* Load addresses, only used with flag bit 16; ELF headers give them instead */
+.long 0, 0, 0, 0, 0
+/* Preferred mode: a linear framebuffer, 1024x768 at 32 bits per pixel. The
+   loader may pick another or stay in text mode; the kernel copes with both. */
+.long 0
+.long 1024
+.long 768
+.long 32
 
 .section .bss
 .align 16
+.global stack_bottom, stack_top  /* Bounds for the profiler's stack walk */
 stack_bottom:
 .skip 16384 # 16 KiB
 stack_top:
 
+/* TSC when _start began, the first boot profiling timestamp */
+.align 8
+.global boot_tsc_start
+boot_tsc_start:
+.skip 8
+
 .section .text
 .global _start
 .type _start, @function
 _start:
+	/* Timestamp before anything else runs; rdtsc clobbers the Multiboot magic in eax */
+	mov %eax, %ecx
+	rdtsc
+	mov %eax, boot_tsc_start
+	mov %edx, boot_tsc_start + 4
+	mov %ecx, %eax
+
 	mov $stack_top, %esp
+
+	/* kernel_main(magic, multiboot info) */
+	push %ebx
+	push %eax
 	call kernel_main
 
 	cli
@@ -0,0 +1,53 @@
+#include <stdio.h>
+
+#include "klib.h"
+#include "fs.h"
+#include "platform.h"
+#include "fsck.h"
+
+/*
+ * Check a FoxFS image. Mounting it first replays a committed journal
+ * transaction, exactly like the kernel would, then fsck_check() goes over
+ * the result.
+ *
+ *   foxfsck [-v] <image>
+ */
+
+int main(int argc, char** argv) {
+    int argi = 1;
+    if (argi < argc && strcmp(argv[argi], "-v") == 0) {
+        fsck_verbose = true;
+        argi++;
+    }
+    if (argi + 1 != argc) {
+        fprintf(stderr, "usage: foxfsck [-v] <image>\n");
+        return 2;
+    }
+
+    const char* image = argv[argi];
+    if (!host_disk_open_file(image, false)) {
+        perror(image);
+        return 2;
+    }
+
+    int result = fs_init();
+    if (result != FS_OK) {
+        printf("%s: ", image);
+        fs_perror(result);
+        printf("\n");
+        host_disk_close();
+        return 1;
+    }
+    if (fs_journal_replayed > 0) {
+        printf("%s: replayed journal (%u blocks)\n", image, fs_journal_replayed);
+    }
+
+    fsck_result_t summary;
+    fsck_check(&summary);
+    printf("%u files, %u directories, %u/%u blocks used\n",
+           summary.files, summary.directories, summary.used_blocks, summary.block_count);
+    printf("%s: %s (%u errors, %u warnings)\n", image, summary.errors ? "damaged" : "clean",
+           summary.errors, summary.warnings);
+    host_disk_close();
+    return summary.errors ? 1 : 0;
+}
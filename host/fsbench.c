@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "klib.h"
+#include "fs.h"
+#include "platform.h"
+
+/*
+ * Filesystem throughput benchmark. Runs create/write/read/delete mixes against
+ * a memory-backed volume and reports operations per second and the blocks
+ * each operation moved.
+ *
+ *   fsbench [-l fat|extent] [-n ops] [-s seed] [workload...]
+ */
+
+#define BENCH_DIRS          8
+#define BENCH_FILES_PER_DIR 8   // Leaves room for . and .. in an 11-entry directory
+#define BENCH_FILES         (BENCH_DIRS * BENCH_FILES_PER_DIR)
+#define BENCH_MAX_SIZE      4096
+
+typedef struct {
+    const char* name;
+    const char* description;
+    int (*prepare)();
+    int (*op)(uint32_t i);
+} bench_workload_t;
+
+static uint32_t bench_layout = FS_LAYOUT_FAT;
+static uint32_t bench_seed = 1;
+static bool bench_exists[BENCH_FILES];
+static uint8_t bench_data[BENCH_MAX_SIZE];
+static uint8_t bench_buffer[BENCH_MAX_SIZE];
+
+/* ===== Helpers ===== */
+// xorshift32, so runs are reproducible across machines
+static uint32_t bench_rand() {
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static void bench_path(uint32_t i, char* path) {
+    i %= BENCH_FILES;
+    snprintf(path, MAX_PATH_LEN, "/bench/d%u/f%u", i % BENCH_DIRS, i / BENCH_DIRS);
+}
+
+// Small files dominate, like text written from the shell
+static uint32_t bench_size() {
+    uint32_t r = bench_rand() % 100;
+    if (r < 60) return 1 + bench_rand() % 64;
+    if (r < 90) return 65 + bench_rand() % 960;
+    return 1025 + bench_rand() % (BENCH_MAX_SIZE - 1024);
+}
+
+static int bench_volume() {
+    memset(bench_exists, 0, sizeof(bench_exists));
+    int result = fs_format(bench_layout);
+    if (result != FS_OK) return result;
+    result = fs_create("/bench", FS_ATTR_DIR);
+    for (uint32_t d = 0; d < BENCH_DIRS && result == FS_OK; d++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "/bench/d%u", d);
+        result = fs_create(path, FS_ATTR_DIR);
+    }
+    return result == FS_OK ? fs_sync() : result;
+}
+
+static int bench_populate(uint32_t size) {
+    int result = bench_volume();
+    for (uint32_t i = 0; i < BENCH_FILES && result == FS_OK; i++) {
+        char path[MAX_PATH_LEN];
+        bench_path(i, path);
+        result = fs_create(path, FS_ATTR_FILE);
+        if (result == FS_OK) result = fs_write(path, bench_data, size);
+        bench_exists[i] = true;
+    }
+    return result == FS_OK ? fs_sync() : result;
+}
+
+/* ===== Workloads ===== */
+static int prepare_empty() { return bench_volume(); }
+static int prepare_small() { return bench_populate(16); }
+static int prepare_large() { return bench_populate(BENCH_MAX_SIZE); }
+
+static int op_create_delete(uint32_t i) {
+    char path[MAX_PATH_LEN];
+    bench_path(i, path);
+    int result = fs_create(path, FS_ATTR_FILE);
+    return result == FS_OK ? fs_delete(path) : result;
+}
+
+static int op_write_small(uint32_t i) {
+    char path[MAX_PATH_LEN];
+    bench_path(i, path);
+    return fs_write(path, bench_data, 16);
+}
+
+static int op_read_small(uint32_t i) {
+    char path[MAX_PATH_LEN];
+    bench_path(i, path);
+    return fs_read(path, bench_buffer, sizeof(bench_buffer));
+}
+
+static int op_write_large(uint32_t i) {
+    char path[MAX_PATH_LEN];
+    bench_path(i, path);
+    return fs_write(path, bench_data, BENCH_MAX_SIZE);
+}
+
+static int op_read_large(uint32_t i) {
+    char path[MAX_PATH_LEN];
+    bench_path(i, path);
+    return fs_read(path, bench_buffer, sizeof(bench_buffer));
+}
+
+// Random files, random sizes: reads, rewrites, creates and deletes
+static int op_mixed(uint32_t i) {
+    char path[MAX_PATH_LEN];
+    (void)i;
+    uint32_t file = bench_rand() % BENCH_FILES;
+    bench_path(file, path);
+
+    if (!bench_exists[file]) {
+        int result = fs_create(path, FS_ATTR_FILE);
+        if (result != FS_OK) return result;
+        bench_exists[file] = true;
+        return fs_write(path, bench_data, bench_size());
+    }
+
+    uint32_t r = bench_rand() % 100;
+    if (r < 60) {
+        return fs_read(path, bench_buffer, sizeof(bench_buffer));
+    }
+    if (r < 85) {
+        return fs_write(path, bench_data, bench_size());
+    }
+    bench_exists[file] = false;
+    return fs_delete(path);
+}
+
+static const bench_workload_t workloads[] = {
+    {"create-delete", "create and delete an empty file", prepare_empty, op_create_delete},
+    {"write-small", "rewrite a 16-byte file", prepare_small, op_write_small},
+    {"read-small", "read a 16-byte file", prepare_small, op_read_small},
+    {"write-4k", "rewrite a 4 KB file", prepare_large, op_write_large},
+    {"read-4k", "read a 4 KB file", prepare_large, op_read_large},
+    {"mixed", "60% read, 25% rewrite, 15% delete, create on miss", prepare_empty, op_mixed},
+};
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+/* ===== Driver ===== */
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_run(const bench_workload_t* w, uint32_t ops) {
+    int result = w->prepare();
+    if (result != FS_OK) {
+        fprintf(stderr, "%s: setup failed (%d)\n", w->name, result);
+        return result;
+    }
+
+    memset(&host_disk_stats, 0, sizeof(host_disk_stats));
+    double start = bench_now();
+    for (uint32_t i = 0; i < ops; i++) {
+        result = w->op(i);
+        if (result < 0) {
+            fprintf(stderr, "%s: operation %u failed (%d)\n", w->name, i, result);
+            return result;
+        }
+    }
+    // Pending metadata is part of the cost
+    result = fs_sync();
+    double elapsed = bench_now() - start;
+    if (result != FS_OK) {
+        fprintf(stderr, "%s: sync failed (%d)\n", w->name, result);
+        return result;
+    }
+
+    printf("%-14s %10.0f %12.2f %12.2f %10.2f  %s\n", w->name,
+           elapsed > 0 ? ops / elapsed : 0.0,
+           (double)host_disk_stats.blocks_read / ops,
+           (double)host_disk_stats.blocks_written / ops,
+           (double)(host_disk_stats.read_requests + host_disk_stats.write_requests) / ops,
+           w->description);
+    return FS_OK;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: fsbench [-l fat|extent] [-n ops] [-s seed] [workload...]\nworkloads:");
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        fprintf(stderr, " %s", workloads[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    uint32_t ops = 100000;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (argi + 1 >= argc) usage();
+        if (strcmp(argv[argi], "-l") == 0) {
+            const char* layout = argv[++argi];
+            if (strcmp(layout, "extent") == 0) bench_layout = FS_LAYOUT_EXTENT;
+            else if (strcmp(layout, "fat") == 0) bench_layout = FS_LAYOUT_FAT;
+            else usage();
+        } else if (strcmp(argv[argi], "-n") == 0) {
+            ops = strtoul(argv[++argi], NULL, 0);
+        } else if (strcmp(argv[argi], "-s") == 0) {
+            bench_seed = strtoul(argv[++argi], NULL, 0);
+            if (bench_seed == 0) bench_seed = 1;
+        } else {
+            usage();
+        }
+    }
+    if (ops == 0) usage();
+
+    if (!host_disk_open_memory()) {
+        fprintf(stderr, "fsbench: out of memory\n");
+        return 1;
+    }
+    host_terminal_quiet = true;
+    for (size_t i = 0; i < sizeof(bench_data); i++) {
+        bench_data[i] = 'a' + i % 26;
+    }
+
+    printf("layout: %s, %u ops per workload\n", bench_layout == FS_LAYOUT_EXTENT ? "extent" : "fat", ops);
+    printf("%-14s %10s %12s %12s %10s\n", "workload", "ops/sec", "blk read/op", "blk write/op", "reqs/op");
+
+    int status = 0;
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++) {
+        bool selected = (argi == argc);
+        for (int a = argi; a < argc; a++) {
+            if (strcmp(argv[a], workloads[i].name) == 0) selected = true;
+        }
+        if (selected && bench_run(&workloads[i], ops) != FS_OK) {
+            status = 1;
+        }
+    }
+
+    host_disk_close();
+    return status;
+}
@@ -0,0 +1,269 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "klib.h"
+#include "fs.h"
+#include "platform.h"
+#include "fsck.h"
+
+/*
+ * The directory tree is walked from the root and every block it reaches is
+ * checked against the FAT, then the FAT, tail headers and free count are
+ * checked against what the walk found.
+ */
+
+enum {
+    OWNER_NONE = 0,
+    OWNER_DIR,
+    OWNER_DATA,
+    OWNER_EXTENT,
+    OWNER_TAIL,
+};
+
+static fs_superblock_t sb;
+static fat_entry_t fat[FS_MAX_BLOCKS];
+static uint8_t owner[FS_MAX_BLOCKS];
+static uint16_t tail_units[FS_MAX_BLOCKS];  // Units referenced by directory records
+static uint32_t data_start;
+static uint32_t errors, warnings, files, directories;
+bool fsck_verbose = false;
+
+/* ===== Reporting ===== */
+static void report(bool error, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    printf("%s: ", error ? "error" : "warning");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+    if (error) errors++;
+    else warnings++;
+}
+
+/* ===== Block Ownership ===== */
+// Record that 'path' uses 'block'; false if the block can't belong to it
+static bool claim(uint32_t block, uint8_t kind, const char* path) {
+    if (block < data_start || block >= sb.block_count) {
+        report(true, "%s: block %u is outside the data area", path, block);
+        return false;
+    }
+    if (owner[block] != OWNER_NONE) {
+        report(true, "%s: block %u is already in use by another file", path, block);
+        return false;
+    }
+    if (fat[block].next_block == FS_FAT_FREE) {
+        report(true, "%s: block %u is in use but marked free", path, block);
+    }
+    owner[block] = kind;
+    return true;
+}
+
+static uint32_t blocks_for(uint32_t size) {
+    return (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+/* ===== File Checks ===== */
+static void check_chain(const dir_entry_t* entry, const char* path) {
+    uint32_t count = 0;
+    uint32_t block = entry->first_block;
+    while (block != FS_FAT_EOF) {
+        if (!claim(block, OWNER_DATA, path)) return;
+        count++;
+        uint16_t next = fat[block].next_block;
+        if (next == FS_FAT_FREE || next == FS_FAT_RESERVED) {
+            report(true, "%s: chain breaks at block %u", path, block);
+            return;
+        }
+        block = next;
+    }
+    if (count < blocks_for(entry->size)) {
+        report(true, "%s: %u bytes but only %u blocks", path, entry->size, count);
+    }
+}
+
+static void check_extents(const dir_entry_t* entry, const char* path) {
+    uint32_t logical = 0;
+    uint32_t eblock = entry->first_block;
+    while (eblock != FS_FAT_EOF) {
+        if (!claim(eblock, OWNER_EXTENT, path)) return;
+
+        fs_extent_block_t eb;
+        if (!disk_read(eblock, &eb)) {
+            report(true, "%s: can't read extent block %u", path, eblock);
+            return;
+        }
+        if (eb.count > FS_EXTENTS_PER_BLOCK) {
+            report(true, "%s: extent block %u claims %u extents", path, eblock, eb.count);
+            return;
+        }
+        for (uint32_t i = 0; i < eb.count; i++) {
+            const fs_extent_t* ext = &eb.extents[i];
+            if (ext->logical != logical) {
+                report(true, "%s: extent %u starts at file block %u, expected %u", path, i, ext->logical, logical);
+            }
+            for (uint32_t b = 0; b < ext->length; b++) {
+                if (!claim(ext->start + b, OWNER_DATA, path)) return;
+            }
+            logical = ext->logical + ext->length;
+        }
+        eblock = eb.next;
+    }
+    if (logical < blocks_for(entry->size)) {
+        report(true, "%s: %u bytes but only %u blocks mapped", path, entry->size, logical);
+    }
+}
+
+static void check_tail(const dir_entry_t* entry, const char* path) {
+    uint32_t block = entry->first_block;
+    uint32_t units = (entry->size + FS_TAIL_UNIT - 1) / FS_TAIL_UNIT;
+    if (entry->size == 0 || entry->size > FS_TAIL_MAX ||
+        entry->tail_unit == 0 || entry->tail_unit + units > FS_TAIL_UNITS) {
+        report(true, "%s: bad tail placement (unit %u, %u bytes)", path, entry->tail_unit, entry->size);
+        return;
+    }
+
+    if (owner[block] != OWNER_TAIL) {
+        if (!claim(block, OWNER_TAIL, path)) return;
+        fs_tail_header_t header;
+        uint8_t buf[FS_BLOCK_SIZE];
+        if (!disk_read(block, buf)) {
+            report(true, "%s: can't read tail block %u", path, block);
+            return;
+        }
+        memcpy(&header, buf, sizeof(header));
+        if (header.magic != FS_TAIL_MAGIC) {
+            report(true, "%s: block %u is not a tail block", path, block);
+        }
+    }
+
+    uint16_t mask = (uint16_t)(((1u << units) - 1) << entry->tail_unit);
+    if (tail_units[block] & mask) {
+        report(true, "%s: tail units in block %u overlap another file", path, block);
+    }
+    tail_units[block] |= mask;
+}
+
+/* ===== Directory Walk ===== */
+static void check_dir(uint32_t block, uint32_t parent, const char* path) {
+    dir_entry_t entries[DIR_ENTRIES_PER_BLOCK];
+    uint8_t buf[FS_BLOCK_SIZE];
+    if (!disk_read(block, buf)) {
+        report(true, "%s: can't read directory block %u", path, block);
+        return;
+    }
+    memcpy(entries, buf, sizeof(entries));
+    directories++;
+
+    if (strcmp(entries[0].filename, ".") != 0 || entries[0].first_block != block) {
+        report(true, "%s: bad '.' entry", path);
+    }
+    if (strcmp(entries[1].filename, "..") != 0 || entries[1].first_block != parent) {
+        report(true, "%s: bad '..' entry", path);
+    }
+
+    for (size_t i = 2; i < DIR_ENTRIES_PER_BLOCK; i++) {
+        dir_entry_t* entry = &entries[i];
+        if (entry->filename[0] == '\0') continue;
+
+        char child[MAX_PATH_LEN];
+        if (memchr(entry->filename, '\0', FS_FILENAME_LEN) == NULL) {
+            report(true, "%s: entry %zu has an unterminated name", path, i);
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s%s%s", path, strcmp(path, "/") == 0 ? "" : "/", entry->filename);
+        if (fsck_verbose) {
+            printf("  %s%s (%u bytes)\n", child, (entry->attributes & FS_ATTR_DIR) ? "/" : "", entry->size);
+        }
+
+        if (entry->attributes & FS_ATTR_DIR) {
+            if (claim(entry->first_block, OWNER_DIR, child)) {
+                check_dir(entry->first_block, block, child);
+            }
+            continue;
+        }
+
+        files++;
+        if (entry->attributes & FS_ATTR_TAIL) {
+            check_tail(entry, child);
+        } else if (sb.magic == FS_MAGIC_EXTENT) {
+            check_extents(entry, child);
+        } else {
+            check_chain(entry, child);
+        }
+    }
+}
+
+/* ===== Volume Checks ===== */
+static void check_volume(fsck_result_t* result) {
+    uint8_t buf[FS_BLOCK_SIZE];
+    if (!disk_read(0, buf)) {
+        report(true, "can't read the superblock");
+        return;
+    }
+    memcpy(&sb, buf, sizeof(sb));
+    if (sb.block_count > FS_MAX_BLOCKS || sb.root_dir_block != 1 + sb.fat_blocks) {
+        report(true, "superblock geometry is inconsistent");
+        return;
+    }
+    for (uint32_t i = 0; i < sb.fat_blocks; i++) {
+        if (!disk_read(1 + i, (uint8_t*)fat + i * FS_BLOCK_SIZE)) {
+            report(true, "can't read FAT block %u", i);
+            return;
+        }
+    }
+    data_start = sb.journal_blocks ? sb.journal_start + sb.journal_blocks : sb.root_dir_block + 1;
+
+    for (uint32_t b = 0; b < data_start; b++) {
+        if (fat[b].next_block != FS_FAT_RESERVED) {
+            report(true, "metadata block %u is not reserved in the FAT", b);
+        }
+    }
+
+    check_dir(sb.root_dir_block, sb.root_dir_block, "/");
+
+    // Tail block headers have to agree with the records pointing into them
+    for (uint32_t b = data_start; b < sb.block_count; b++) {
+        if (owner[b] != OWNER_TAIL) continue;
+        fs_tail_header_t header;
+        if (!disk_read(b, buf)) continue;
+        memcpy(&header, buf, sizeof(header));
+        uint16_t expected = tail_units[b] | 1;
+        if ((header.used & expected) != expected) {
+            report(true, "tail block %u: referenced units are marked free", b);
+        } else if (header.used != expected) {
+            report(false, "tail block %u: %u units allocated but unreferenced", b,
+                   __builtin_popcount(header.used & ~expected));
+        }
+    }
+    if (sb.tail_block != 0 && owner[sb.tail_block] != OWNER_TAIL) {
+        report(false, "superblock points at tail block %u, which holds no files", sb.tail_block);
+    }
+
+    // Everything allocated must be reachable, and the free count must add up
+    uint32_t free_blocks = 0;
+    for (uint32_t b = data_start; b < sb.block_count; b++) {
+        if (fat[b].next_block == FS_FAT_FREE) {
+            free_blocks++;
+        } else if (owner[b] == OWNER_NONE) {
+            report(false, "block %u is allocated but unreferenced", b);
+        }
+    }
+    if (free_blocks != sb.free_blocks) {
+        report(true, "superblock says %u free blocks, FAT has %u", sb.free_blocks, free_blocks);
+    }
+
+    result->used_blocks = sb.block_count - free_blocks;
+    result->block_count = sb.block_count;
+}
+
+void fsck_check(fsck_result_t* result) {
+    memset(owner, 0, sizeof(owner));
+    memset(tail_units, 0, sizeof(tail_units));
+    errors = warnings = files = directories = 0;
+    memset(result, 0, sizeof(*result));
+    check_volume(result);
+    result->errors = errors;
+    result->warnings = warnings;
+    result->files = files;
+    result->directories = directories;
+}
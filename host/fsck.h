@@ -0,0 +1,22 @@
+#ifndef FOXOS_HOST_FSCK_H
+#define FOXOS_HOST_FSCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Consistency check shared by foxfsck and fscrash; problems are printed as they're found */
+typedef struct {
+    uint32_t errors;
+    uint32_t warnings;
+    uint32_t files;
+    uint32_t directories;
+    uint32_t used_blocks;
+    uint32_t block_count;
+} fsck_result_t;
+
+extern bool fsck_verbose;  // List every file as it's checked
+
+// Check the volume on the host disk; mount it with fs_init() first so the journal is replayed
+void fsck_check(fsck_result_t* result);
+
+#endif
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "klib.h"
+#include "fs.h"
+#include "platform.h"
+#include "fsck.h"
+
+/*
+ * Crash test for the journal. Each scenario builds a committed volume, then
+ * runs a few operations and a sync with the disk losing every write after
+ * the first N blocks, as if the power went. The volume is mounted again,
+ * which replays the journal, and checked with fsck_check(); every file must
+ * also read back as one of the versions it had along the way. That is
+ * repeated for every N up to the number of blocks the operations write.
+ * Rewriting a file overwrites its blocks in place, so scenarios only write
+ * files that are new since the last commit.
+ *
+ *   fscrash [scenario...]
+ */
+
+#define CRASH_FILES    16
+#define CRASH_VERSIONS 16
+#define CRASH_MAX_SIZE 8192
+
+typedef struct {
+    bool exists;
+    uint32_t size;
+    uint32_t version;
+} crash_state_t;
+
+// A file the scenario touches, and every state it has been in since the volume was committed
+typedef struct {
+    char path[MAX_PATH_LEN];
+    crash_state_t states[CRASH_VERSIONS];
+    uint32_t count;
+} crash_file_t;
+
+typedef struct {
+    const char* name;
+    const char* description;
+    uint32_t layout;
+    int (*setup)();
+    int (*run)();
+} crash_scenario_t;
+
+static crash_file_t files[CRASH_FILES];
+static uint32_t file_count;
+static uint8_t data[CRASH_MAX_SIZE];
+static uint8_t buffer[CRASH_MAX_SIZE];
+
+/* ===== Tracked Operations ===== */
+static crash_file_t* crash_file(const char* path) {
+    for (uint32_t i = 0; i < file_count; i++) {
+        if (strcmp(files[i].path, path) == 0) return &files[i];
+    }
+    crash_file_t* file = &files[file_count++];
+    memset(file, 0, sizeof(*file));
+    strcpy(file->path, path);
+    file->count = 1;  // Starts out missing
+    return file;
+}
+
+static void crash_fill(const char* path, uint32_t version, uint32_t size) {
+    uint32_t seed = version * 131;
+    for (const char* c = path; *c; c++) seed = seed * 31 + *c;
+    for (uint32_t i = 0; i < size; i++) data[i] = (uint8_t)(seed + i * 7 + i / 251);
+}
+
+static void crash_record(crash_file_t* file, bool exists, uint32_t size, uint32_t version) {
+    if (file->count < CRASH_VERSIONS) {
+        file->states[file->count++] = (crash_state_t){ exists, size, version };
+    }
+}
+
+// Create the file if needed and give it 'size' bytes of its 'version' pattern
+static int crash_write(const char* path, uint32_t size, uint32_t version) {
+    crash_file_t* file = crash_file(path);
+    if (!file->states[file->count - 1].exists) {
+        int result = fs_create(path, FS_ATTR_FILE);
+        if (result != FS_OK) return result;
+        crash_record(file, true, 0, 0);
+    }
+    crash_fill(path, version, size);
+    int result = fs_write(path, data, size);
+    if (result == FS_OK) crash_record(file, true, size, version);
+    return result;
+}
+
+static int crash_delete(const char* path) {
+    int result = fs_delete(path);
+    if (result == FS_OK) crash_record(crash_file(path), false, 0, 0);
+    return result;
+}
+
+// Forget everything but the state each file was committed in
+static int crash_commit() {
+    int result = fs_sync();
+    for (uint32_t i = 0; i < file_count; i++) {
+        files[i].states[0] = files[i].states[files[i].count - 1];
+        files[i].count = 1;
+    }
+    return result;
+}
+
+/* ===== Scenarios ===== */
+// Multi-block files freed and the space written again in the same transaction
+static int setup_blocks() {
+    int result = FS_OK;
+    for (uint32_t i = 0; i < 4 && result == FS_OK; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "/tmp/f%u", i);
+        result = crash_write(path, 1536 + i * 700, 1);
+    }
+    return result == FS_OK ? crash_commit() : result;
+}
+
+static int run_delete_write() {
+    int result = crash_delete("/tmp/f0");
+    if (result == FS_OK) result = crash_delete("/tmp/f2");
+    if (result == FS_OK) result = crash_write("/tmp/g0", 4000, 2);
+    if (result == FS_OK) result = crash_write("/tmp/g2", 5000, 2);
+    if (result == FS_OK) result = crash_write("/tmp/g1", 300, 2);
+    return result == FS_OK ? fs_sync() : result;
+}
+
+// Files in several extents, so deleting one frees extent blocks as well as data
+static int setup_extents() {
+    int result = FS_OK;
+    for (uint32_t round = 1; round <= 3 && result == FS_OK; round++) {
+        for (uint32_t i = 0; i < 3 && result == FS_OK; i++) {
+            char path[MAX_PATH_LEN];
+            snprintf(path, sizeof(path), "/tmp/f%u", i);
+            result = crash_write(path, round * 1024, round);
+        }
+    }
+    return result == FS_OK ? crash_commit() : result;
+}
+
+// Small files packed into shared tail blocks
+static int setup_tails() {
+    int result = FS_OK;
+    for (uint32_t i = 0; i < 6 && result == FS_OK; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "/tmp/s%u", i);
+        result = crash_write(path, 40 + i * 15, 1);
+    }
+    return result == FS_OK ? crash_commit() : result;
+}
+
+// Empty the tail block, then write a block file and new small files
+static int run_tail_empty() {
+    int result = FS_OK;
+    for (uint32_t i = 0; i < 6 && result == FS_OK; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "/tmp/s%u", i);
+        result = crash_delete(path);
+    }
+    if (result == FS_OK) result = crash_write("/tmp/g0", 1500, 2);
+    if (result == FS_OK) result = crash_write("/tmp/t0", 60, 2);
+    if (result == FS_OK) result = crash_write("/tmp/t1", 100, 2);
+    return result == FS_OK ? fs_sync() : result;
+}
+
+// Free some units, then write small files that would fit in them
+static int run_tail_units() {
+    int result = crash_delete("/tmp/s1");
+    if (result == FS_OK) result = crash_delete("/tmp/s3");
+    if (result == FS_OK) result = crash_write("/tmp/t0", 50, 2);
+    if (result == FS_OK) result = crash_write("/tmp/t1", 80, 2);
+    if (result == FS_OK) result = crash_write("/tmp/s5", 20, 2);
+    return result == FS_OK ? fs_sync() : result;
+}
+
+static const crash_scenario_t scenarios[] = {
+    {"fat-delete-write", "delete chained files, then write into the space", FS_LAYOUT_FAT, setup_blocks, run_delete_write},
+    {"extent-delete-write", "delete extent files, then write into the space", FS_LAYOUT_EXTENT, setup_blocks, run_delete_write},
+    {"extent-fragmented", "delete files split over extents, then write", FS_LAYOUT_EXTENT, setup_extents, run_delete_write},
+    {"tail-empty", "empty a tail block, then write big and small files", FS_LAYOUT_FAT, setup_tails, run_tail_empty},
+    {"tail-units", "free tail units, then write small files", FS_LAYOUT_EXTENT, setup_tails, run_tail_units},
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/* ===== Driver ===== */
+// Every tracked file has to hold one of the states it went through
+static uint32_t crash_verify() {
+    uint32_t bad = 0;
+    for (uint32_t i = 0; i < file_count; i++) {
+        const crash_file_t* file = &files[i];
+        dir_entry_t entry;
+        bool exists = fs_stat(file->path, &entry) == FS_OK;
+        int read = exists ? fs_read_at(file->path, 0, buffer, sizeof(buffer)) : 0;
+        bool matched = false;
+        for (uint32_t s = 0; s < file->count && !matched; s++) {
+            const crash_state_t* state = &file->states[s];
+            if (state->exists != exists) continue;
+            if (!exists) {
+                matched = true;
+                continue;
+            }
+            crash_fill(file->path, state->version, state->size);
+            matched = read == (int)state->size && memcmp(buffer, data, state->size) == 0;
+        }
+        if (!matched) {
+            printf("  %s: %s\n", file->path, exists ? "holds none of its versions" : "is missing");
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// Set up a fresh volume and run the scenario, losing the writes after the first 'crash_after' blocks
+static int crash_run(const crash_scenario_t* s, int64_t crash_after) {
+    file_count = 0;
+    if (!host_disk_open_memory()) return FS_ERROR;
+    int result = fs_format(s->layout);
+    if (result == FS_OK) result = s->setup();
+    if (result != FS_OK) return result;
+
+    memset(&host_disk_stats, 0, sizeof(host_disk_stats));
+    host_disk_crash_after = crash_after;
+    result = s->run();
+    host_disk_crash_after = -1;
+    return result;
+}
+
+static bool crash_scenario(const crash_scenario_t* s) {
+    int result = crash_run(s, -1);
+    if (result != FS_OK) {
+        printf("%s: scenario failed (%d)\n", s->name, result);
+        return false;
+    }
+    uint32_t writes = host_disk_stats.blocks_written;
+
+    uint32_t damaged = 0;
+    for (uint32_t n = 0; n <= writes; n++) {
+        crash_run(s, n);  // Errors are expected once the disk stops writing
+        result = fs_init();
+        if (result != FS_OK) {
+            printf("%s: crash after %u blocks: mount failed (%d)\n", s->name, n, result);
+            damaged++;
+            continue;
+        }
+        fsck_result_t check;
+        fsck_check(&check);
+        uint32_t bad = crash_verify();
+        if (check.errors > 0 || bad > 0) {
+            printf("%s: crash after %u blocks: %u fsck errors, %u files wrong\n", s->name, n, check.errors, bad);
+            damaged++;
+        }
+    }
+    printf("%-20s %4u crash points, %u damaged  %s\n", s->name, writes + 1, damaged, s->description);
+    return damaged == 0;
+}
+
+int main(int argc, char** argv) {
+    host_terminal_quiet = true;
+    int status = 0;
+    for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+        bool selected = (argc == 1);
+        for (int a = 1; a < argc; a++) {
+            if (strcmp(argv[a], scenarios[i].name) == 0) selected = true;
+        }
+        if (selected && !crash_scenario(&scenarios[i])) {
+            status = 1;
+        }
+    }
+    host_disk_close();
+    return status;
+}
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Generate the framebuffer console's fonts from a GRUB font.
+
+Reads glyphs out of a PFF2 file (the Unifont GRUB already carries as
+foxiso/boot/grub/font.pf2). With -o it writes the printable ASCII ones as a
+C array, one byte per pixel row, most significant bit leftmost; that is
+checked in as src/font8x16.c, so rerun it only to change the font. With
+--psf it writes every glyph of the Basic Multilingual Plane (or just the
+--ranges given) as a 16x16 PSF2 font with a Unicode table, which the
+kernel loads as a Multiboot module or from the disk. Narrow glyphs fill the
+left half.
+
+    genfont.py foxiso/boot/grub/font.pf2 -o src/font8x16.c
+    genfont.py foxiso/boot/grub/font.pf2 --psf foxiso/boot/unifont.psf
+    genfont.py foxiso/boot/grub/font.pf2 --psf kana.psf --ranges 20-7e,3000-30ff
+"""
+
+import argparse
+import struct
+
+FIRST, LAST = 0x20, 0x7E
+WIDTH, HEIGHT = 8, 16
+PSF2_MAGIC = 0x864AB572
+PSF2_UNICODE_TABLE = 0x01
+
+
+def sections(data):
+    """Yield (name, payload) for each section of a PFF2 file."""
+    at = 0
+    while at + 8 <= len(data):
+        name = data[at:at + 4].decode("ascii")
+        length = struct.unpack(">I", data[at + 4:at + 8])[0]
+        if name == "DATA":  # Runs to the end of the file
+            return
+        yield name, data[at + 8:at + 8 + length]
+        at += 8 + length
+
+
+def glyph_rows(data, offset, ascent, cell_width=WIDTH):
+    """Render the glyph at 'offset' into HEIGHT rows of 'cell_width' bits, baseline 'ascent' rows down."""
+    width, height, xoff, yoff, _ = struct.unpack(">HHhhH", data[offset:offset + 10])
+    bits = data[offset + 10:]
+    rows = [0] * HEIGHT
+    top = ascent - (yoff + height)
+    for y in range(height):
+        for x in range(width):
+            bit = y * width + x
+            if not bits[bit // 8] & (0x80 >> (bit % 8)):
+                continue
+            row, column = top + y, xoff + x
+            if 0 <= row < HEIGHT and 0 <= column < cell_width:
+                rows[row] |= 1 << (cell_width - 1 - column)
+    return rows
+
+
+def write_c(path, font_name, data, index, ascent, source):
+    lines = [
+        "// Generated by host/genfont.py from %s (%s); do not edit" % (source, font_name),
+        '#include "fbcon.h"',
+        "",
+        "const uint8_t font8x16[FONT_GLYPHS][FONT_HEIGHT] = {",
+    ]
+    for code in range(FIRST, LAST + 1):
+        rows = glyph_rows(data, index[code], ascent) if code in index else [0] * HEIGHT
+        text = ", ".join("0x%02X" % row for row in rows)
+        shown = {0x20: "space", 0x5C: "backslash"}.get(code, chr(code))
+        lines.append("    { %s },  // %s" % (text, shown))
+    lines.append("};")
+    with open(path, "w") as out:
+        out.write("\n".join(lines) + "\n")
+
+
+def parse_ranges(text):
+    ranges = []
+    for part in text.split(","):
+        first, _, last = part.partition("-")
+        ranges.append((int(first, 16), int(last or first, 16)))
+    return ranges
+
+
+def write_psf(path, data, index, ascent, ranges):
+    # The kernel maps the Basic Multilingual Plane only
+    codes = sorted(code for code in index
+                   if code <= 0xFFFF and not 0xD800 <= code <= 0xDFFF
+                   and any(first <= code <= last for first, last in ranges))
+    glyphs = bytearray()
+    table = bytearray()
+    for code in codes:
+        for row in glyph_rows(data, index[code], ascent, 16):
+            glyphs += struct.pack(">H", row)
+        table += chr(code).encode("utf-8") + b"\xff"
+    header = struct.pack("<8I", PSF2_MAGIC, 0, 32, PSF2_UNICODE_TABLE, len(codes), 32, HEIGHT, 16)
+    with open(path, "wb") as out:
+        out.write(header + glyphs + table)
+    return len(codes)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("font")
+    parser.add_argument("-o", "--output", help="C file with the built-in ASCII font")
+    parser.add_argument("--psf", help="PSF2 font with the whole Basic Multilingual Plane")
+    parser.add_argument("--ranges", default="0-ffff", help="Hex code point ranges for --psf, like 20-7e,3000-30ff")
+    args = parser.parse_args()
+    if not args.output and not args.psf:
+        parser.error("nothing to write: give -o and/or --psf")
+
+    data = open(args.font, "rb").read()
+    info = dict(sections(data))
+    ascent = struct.unpack(">H", info["ASCE"])[0]
+    index = {}
+    chix = info["CHIX"]
+    for at in range(0, len(chix), 9):
+        code, _, offset = struct.unpack(">IBI", chix[at:at + 9])
+        index[code] = offset
+
+    if args.output:
+        name = info["NAME"].rstrip(b"\0").decode()
+        write_c(args.output, name, data, index, ascent, args.font.split("/")[-1])
+    if args.psf:
+        count = write_psf(args.psf, data, index, ascent, parse_ranges(args.ranges))
+        print("%s: %d glyphs" % (args.psf, count))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+"""Generate the kernel symbol table the sampling profiler resolves against.
+
+Runs nm on a linked kernel and writes a C file with every text symbol,
+sorted by address. autobuild.sh links the kernel once without the table,
+generates it from that image, then links again with it appended; the table
+only adds read-only data after .text, so function addresses don't move.
+
+    gensyms.py bin/foxos.bin -o bin/symbols.c [--nm i686-elf-nm]
+"""
+
+import argparse
+import subprocess
+
+
+def text_symbols(nm, image):
+    """Return [(address, name)] for functions, one name per address."""
+    output = subprocess.run([nm, "-n", image], check=True, capture_output=True, text=True).stdout
+    symbols = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) != 3 or fields[1] not in "Tt":
+            continue
+        address = int(fields[0], 16)
+        # Prefer a global name when a static one shares the address
+        if address not in symbols or (fields[1] == "T" and symbols[address][1] == "t"):
+            symbols[address] = (fields[2], fields[1])
+    return [(address, symbols[address][0]) for address in sorted(symbols)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image", help="linked kernel (ELF)")
+    parser.add_argument("-o", "--output", required=True, help="C file to write")
+    parser.add_argument("--nm", default="i686-elf-nm", help="nm to run (default: i686-elf-nm)")
+    args = parser.parse_args()
+
+    symbols = text_symbols(args.nm, args.image)
+    with open(args.output, "w") as f:
+        f.write("/* Generated by host/gensyms.py from %s, do not edit */\n" % args.image)
+        f.write('#include "prof.h"\n\n')
+        f.write("const prof_symbol_t kernel_symbols[] = {\n")
+        for address, name in symbols:
+            f.write('    {0x%08x, "%s"},\n' % (address, name))
+        f.write("};\n")
+        f.write("const uint32_t kernel_symbol_count = %d;\n" % len(symbols))
+
+
+if __name__ == "__main__":
+    main()
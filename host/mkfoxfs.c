@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "klib.h"
+#include "fs.h"
+#include "platform.h"
+
+/*
+ * Create a FoxFS image and optionally copy host files into it.
+ *
+ *   mkfoxfs [-l fat|extent] <image> [file[:/path/in/image]...]
+ *
+ * Files without a destination go into the root directory under their base name.
+ */
+
+static void usage() {
+    fprintf(stderr, "usage: mkfoxfs [-l fat|extent] <image> [file[:/path/in/image]...]\n");
+    exit(2);
+}
+
+// Copy one host file into the image
+static int add_file(const char* spec) {
+    char source[MAX_PATH_LEN - 1];
+    char dest[MAX_PATH_LEN];
+
+    strncpy(source, spec, sizeof(source) - 1);
+    source[sizeof(source) - 1] = '\0';
+    char* colon = strchr(source, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        snprintf(dest, sizeof(dest), "%s", colon + 1);
+    } else {
+        const char* base = strrchr(source, '/');
+        snprintf(dest, sizeof(dest), "/%s", base ? base + 1 : source);
+    }
+
+    FILE* f = fopen(source, "rb");
+    if (f == NULL) {
+        perror(source);
+        return FS_ERROR;
+    }
+    uint8_t* data = malloc(FS_MAX_BLOCKS * FS_BLOCK_SIZE);
+    size_t size = data ? fread(data, 1, FS_MAX_BLOCKS * FS_BLOCK_SIZE, f) : 0;
+    fclose(f);
+    if (data == NULL) {
+        return FS_ERROR;
+    }
+
+    int result = fs_create(dest, FS_ATTR_FILE);
+    if (result == FS_OK) {
+        result = fs_write(dest, data, size);
+    }
+    free(data);
+
+    if (result != FS_OK) {
+        printf("mkfoxfs: %s: ", dest);
+        fs_perror(result);
+        printf("\n");
+        return result;
+    }
+    printf("  %s -> %s (%zu bytes)\n", source, dest, size);
+    return FS_OK;
+}
+
+int main(int argc, char** argv) {
+    uint32_t layout = FS_LAYOUT_FAT;
+    int argi = 1;
+    if (argi + 1 < argc && strcmp(argv[argi], "-l") == 0) {
+        if (strcmp(argv[argi + 1], "extent") == 0) layout = FS_LAYOUT_EXTENT;
+        else if (strcmp(argv[argi + 1], "fat") != 0) usage();
+        argi += 2;
+    }
+    if (argi >= argc) usage();
+
+    const char* image = argv[argi++];
+    if (!host_disk_open_file(image, true)) {
+        perror(image);
+        return 1;
+    }
+
+    int result = fs_format(layout);
+    if (result != FS_OK) {
+        fprintf(stderr, "mkfoxfs: format failed (%d)\n", result);
+        return 1;
+    }
+    printf("%s: %u blocks of %u bytes, %s layout\n", image, FS_MAX_BLOCKS, FS_BLOCK_SIZE,
+           layout == FS_LAYOUT_EXTENT ? "extent" : "fat");
+
+    int status = 0;
+    for (; argi < argc; argi++) {
+        if (add_file(argv[argi]) != FS_OK) {
+            status = 1;
+        }
+    }
+
+    if (fs_sync() != FS_OK) {
+        fprintf(stderr, "mkfoxfs: sync failed\n");
+        status = 1;
+    }
+    host_disk_close();
+    return status;
+}
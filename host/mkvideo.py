@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""Encode greyscale frames as a text-mode video for the kernel's `play`.
+
+Reads PGM images (binary P5 or plain P2, several may follow each other in
+one file, or '-' for standard input) and scales each to 80x50 pixels, two
+to a VGA text cell: a half block (0xDF or 0xDC) with the top and bottom
+pixels as foreground and background, or a space or full block when they
+match. Pixels are quantised to black, dark grey, light grey and white.
+Each frame is stored as the cells that changed since the one before, as
+skip, copy and fill runs (src/video.h). A video cut to 80x50 by ffmpeg:
+
+    ffmpeg -i bad_apple.mp4 -vf scale=80:50,fps=30 -f image2pipe -c:v pgm - |
+        mkvideo.py - --fps 30 -o bad_apple.vid
+
+--synthetic N makes an N-frame test pattern instead.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x44495646  # "FVID"
+VERSION = 1
+COLUMNS, ROWS = 80, 25
+WIDTH, HEIGHT = COLUMNS, ROWS * 2
+BLANK = 0x0020
+FRAME_MAX = 8192
+OP_SKIP, OP_COPY, OP_FILL = 0, 1, 2
+
+LEVELS = (0, 8, 7, 15)  # Black, dark grey, light grey, white by brightness
+SPACE, FULL, UPPER, LOWER = 0x20, 0xDB, 0xDF, 0xDC
+
+
+def pgm_images(data):
+    """Yield (width, height, pixels 0-255 row by row) for each PGM image in 'data'."""
+    at = 0
+
+    def token():
+        nonlocal at
+        while True:
+            while at < len(data) and data[at:at + 1].isspace():
+                at += 1
+            if data[at:at + 1] != b"#":
+                break
+            while at < len(data) and data[at:at + 1] != b"\n":
+                at += 1
+        start = at
+        while at < len(data) and not data[at:at + 1].isspace():
+            at += 1
+        return data[start:at]
+
+    while True:
+        magic = token()
+        if not magic:
+            return
+        if magic not in (b"P5", b"P2"):
+            sys.exit("mkvideo: not a PGM image")
+        width, height, maximum = int(token()), int(token()), int(token())
+        if magic == b"P5":
+            at += 1  # The one whitespace byte before the pixels
+            size = 2 if maximum > 255 else 1
+            raw = data[at:at + width * height * size]
+            at += width * height * size
+            if size == 2:
+                raw = [raw[i] << 8 | raw[i + 1] for i in range(0, len(raw), 2)]
+        else:
+            raw = [int(token()) for _ in range(width * height)]
+        if len(raw) < width * height:
+            sys.exit("mkvideo: image cut short")
+        yield width, height, [value * 255 // maximum for value in raw]
+
+
+def scale(width, height, pixels):
+    """Average 'pixels' down (or sample them up) to WIDTH x HEIGHT."""
+    out = []
+    for y in range(HEIGHT):
+        y0, y1 = y * height // HEIGHT, max((y + 1) * height // HEIGHT, y * height // HEIGHT + 1)
+        for x in range(WIDTH):
+            x0, x1 = x * width // WIDTH, max((x + 1) * width // WIDTH, x * width // WIDTH + 1)
+            total = sum(sum(pixels[row * width + x0:row * width + x1]) for row in range(y0, y1))
+            out.append(total // ((y1 - y0) * (x1 - x0)))
+    return out
+
+
+def synthetic(count):
+    """A ball bouncing over slowly scrolling grey bars."""
+    x, y, dx, dy = 10.0, 10.0, 1.3, 0.7
+    for frame in range(count):
+        pixels = []
+        for row in range(HEIGHT):
+            for column in range(WIDTH):
+                pixels.append(90 if (column + frame // 4) % 40 < 4 else 0)
+        for row in range(HEIGHT):
+            for column in range(WIDTH):
+                distance = (column - x) ** 2 + ((row - y) * 1.0) ** 2
+                if distance < 36:
+                    pixels[row * WIDTH + column] = 255 if distance < 20 else 170
+        x, y = x + dx, y + dy
+        if not 6 <= x <= WIDTH - 7:
+            dx = -dx
+        if not 6 <= y <= HEIGHT - 7:
+            dy = -dy
+        yield pixels
+
+
+def level(value):
+    return LEVELS[min(value * len(LEVELS) // 256, len(LEVELS) - 1)]
+
+
+def background(colour):
+    """The nearest colour a cell's background can be: the blink bit takes the top one."""
+    return colour if colour < 8 else (0 if colour == 8 else 7)
+
+
+def cells(pixels):
+    """The VGA cells (character | attribute << 8) for a WIDTH x HEIGHT frame."""
+    out = []
+    for row in range(ROWS):
+        for column in range(COLUMNS):
+            top = level(pixels[row * 2 * WIDTH + column])
+            bottom = level(pixels[(row * 2 + 1) * WIDTH + column])
+            if top == bottom:
+                out.append(SPACE | top << 12 if top < 8 else FULL | top << 8)
+            elif bottom < 8 or top >= 8:
+                out.append(UPPER | (top | background(bottom) << 4) << 8)
+            else:
+                out.append(LOWER | (bottom | top << 4) << 8)
+    return out
+
+
+def number(value):
+    """LEB128."""
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def fill_length(current, i):
+    j = i
+    while j < len(current) and current[j] == current[i]:
+        j += 1
+    return j - i
+
+
+def encode(previous, current):
+    """The operations that turn 'previous' into 'current'."""
+    out = bytearray()
+    i, count = 0, len(current)
+    while i < count:
+        if current[i] == previous[i]:
+            j = i
+            while j < count and current[j] == previous[j]:
+                j += 1
+            if j == count:
+                break  # Nothing more changes
+            out += number((j - i) << 2 | OP_SKIP)
+            i = j
+        elif fill_length(current, i) >= 3:
+            run = fill_length(current, i)
+            out += number(run << 2 | OP_FILL) + struct.pack("<H", current[i])
+            i += run
+        else:
+            # Copy up to where skipping or filling would be cheaper
+            j = i + 1
+            while j < count and fill_length(current, j) < 3 and not (
+                    current[j] == previous[j] and (j + 1 == count or current[j + 1] == previous[j + 1])):
+                j += 1
+            out += number((j - i) << 2 | OP_COPY)
+            for cell in current[i:j]:
+                out += struct.pack("<H", cell)
+            i = j
+    assert len(out) <= FRAME_MAX
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("frames", nargs="*", help="PGM files, or - for standard input")
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--fps", type=int, default=30)
+    parser.add_argument("--synthetic", type=int, metavar="N", help="Encode an N-frame test pattern")
+    args = parser.parse_args()
+    if not 1 <= args.fps <= 255:
+        sys.exit("mkvideo: --fps must be 1-255")
+
+    if args.synthetic:
+        frames = synthetic(args.synthetic)
+    else:
+        def from_files():
+            for name in args.frames:
+                data = sys.stdin.buffer.read() if name == "-" else open(name, "rb").read()
+                for image in pgm_images(data):
+                    yield scale(*image)
+        frames = from_files()
+
+    body = bytearray()
+    previous = [BLANK] * (COLUMNS * ROWS)
+    count = 0
+    for pixels in frames:
+        current = cells(pixels)
+        ops = encode(previous, current)
+        body += struct.pack("<H", len(ops)) + ops
+        previous = current
+        count += 1
+
+    with open(args.output, "wb") as out:
+        out.write(struct.pack("<IBBBBII", MAGIC, VERSION, COLUMNS, ROWS, args.fps, count, 0))
+        out.write(body)
+    print(f"{args.output}: {count} frames, {len(body)} bytes", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,105 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "klib.h"
+#include "fs.h"
+#include "platform.h"
+
+/*
+ * Host side of the filesystem's platform interface: the disk is either a
+ * block of memory or an image file, and the terminal is stdout.
+ */
+
+host_disk_stats_t host_disk_stats;
+bool host_terminal_quiet = false;
+int64_t host_disk_crash_after = -1;
+
+static uint8_t* disk_memory = NULL;
+static int disk_fd = -1;
+
+/* ===== Backing Store ===== */
+bool host_disk_open_memory() {
+    host_disk_close();
+    disk_memory = calloc(FS_MAX_BLOCKS, FS_BLOCK_SIZE);
+    return disk_memory != NULL;
+}
+
+bool host_disk_open_file(const char* path, bool create) {
+    host_disk_close();
+    disk_fd = open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+    if (disk_fd < 0) {
+        return false;
+    }
+    // A fresh image is all zeroes, which reads back as an unformatted disk
+    if (create && ftruncate(disk_fd, (off_t)FS_MAX_BLOCKS * FS_BLOCK_SIZE) != 0) {
+        host_disk_close();
+        return false;
+    }
+    return true;
+}
+
+void host_disk_close() {
+    free(disk_memory);
+    disk_memory = NULL;
+    if (disk_fd >= 0) {
+        close(disk_fd);
+        disk_fd = -1;
+    }
+}
+
+/* ===== Disk Driver Interface ===== */
+bool disk_read_blocks(uint32_t block, uint32_t count, void* buffer) {
+    if (block >= FS_MAX_BLOCKS || count > FS_MAX_BLOCKS - block) return false;
+
+    size_t bytes = (size_t)count * FS_BLOCK_SIZE;
+    if (disk_memory != NULL) {
+        memcpy(buffer, disk_memory + (size_t)block * FS_BLOCK_SIZE, bytes);
+    } else if (disk_fd < 0 || pread(disk_fd, buffer, bytes, (off_t)block * FS_BLOCK_SIZE) != (ssize_t)bytes) {
+        return false;
+    }
+    host_disk_stats.blocks_read += count;
+    host_disk_stats.read_requests++;
+    return true;
+}
+
+bool disk_write_blocks(uint32_t block, uint32_t count, const void* buffer) {
+    if (block >= FS_MAX_BLOCKS || count > FS_MAX_BLOCKS - block) return false;
+
+    // After a simulated power cut writes still succeed, they just never land
+    if (host_disk_crash_after >= 0) {
+        if (count > host_disk_crash_after) count = host_disk_crash_after;
+        host_disk_crash_after -= count;
+        if (count == 0) return true;
+    }
+
+    size_t bytes = (size_t)count * FS_BLOCK_SIZE;
+    if (disk_memory != NULL) {
+        memcpy(disk_memory + (size_t)block * FS_BLOCK_SIZE, buffer, bytes);
+    } else if (disk_fd < 0 || pwrite(disk_fd, buffer, bytes, (off_t)block * FS_BLOCK_SIZE) != (ssize_t)bytes) {
+        return false;
+    }
+    host_disk_stats.blocks_written += count;
+    host_disk_stats.write_requests++;
+    return true;
+}
+
+bool disk_read(uint32_t block, void* buffer) {
+    return disk_read_blocks(block, 1, buffer);
+}
+
+bool disk_write(uint32_t block, const void* buffer) {
+    return disk_write_blocks(block, 1, buffer);
+}
+
+bool disk_detected() {
+    return disk_memory != NULL || disk_fd >= 0;
+}
+
+/* ===== Terminal ===== */
+void terminal_writestring(const char* data) {
+    if (!host_terminal_quiet) {
+        fputs(data, stdout);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef FOXOS_HOST_PLATFORM_H
+#define FOXOS_HOST_PLATFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Block I/O counters, so tools can report how many blocks an operation touched */
+typedef struct {
+    uint64_t blocks_read;
+    uint64_t blocks_written;
+    uint64_t read_requests;
+    uint64_t write_requests;
+} host_disk_stats_t;
+
+extern host_disk_stats_t host_disk_stats;
+extern bool host_terminal_quiet;  // Drop filesystem messages (fs_list, cd, ...)
+extern int64_t host_disk_crash_after;  // Blocks still written before the power goes, -1 for no crash
+
+bool host_disk_open_memory();
+bool host_disk_open_file(const char* path, bool create);
+void host_disk_close();
+
+#endif
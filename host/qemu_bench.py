@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Boot a FOXOS_BENCH kernel in headless QEMU and report what it measured.
+
+The kernel runs a command script (passed as a Multiboot module, or typed in
+over COM1 with --serial), prints "BENCH ..." lines on COM1 and leaves QEMU
+through isa-debug-exit. Runs are repeated and the medians go into a JSON
+report, so boot-to-prompt time and command latency can be compared across
+commits.
+"""
+
+import argparse
+import json
+import statistics
+import subprocess
+import sys
+
+EXIT_OK = (0 << 1) | 1  # isa-debug-exit status for bench_exit(0)
+
+
+def run_once(args):
+    cmd = [args.qemu, "-kernel", args.kernel, "-display", "none", "-serial", "stdio",
+           "-device", "isa-debug-exit,iobase=0xf4,iosize=0x04", "-no-reboot", "-m", str(args.memory)]
+    script = open(args.script, "rb").read()
+    stdin = None
+    modules = [args.disk] if args.disk else []
+    if args.serial:
+        stdin = script + b"\nend\n"
+    else:
+        modules.append(args.script)
+    if modules:
+        cmd += ["-initrd", ",".join(modules)]  # Multiboot modules, in order
+
+    proc = subprocess.run(cmd, input=stdin, stdout=subprocess.PIPE, timeout=args.timeout)
+    if proc.returncode != EXIT_OK:
+        raise RuntimeError("qemu exited with status %d" % proc.returncode)
+
+    run = {"boot": None, "commands": [], "done": None}
+    for raw in proc.stdout.decode("latin-1").splitlines():
+        fields = raw.strip().split(" ", 3)
+        if len(fields) < 3 or fields[0] != "BENCH":
+            continue
+        if fields[1] == "boot":
+            entry, prompt = int(fields[2], 16), int(fields[3], 16)
+            run["boot"] = {"entry_tsc": entry, "prompt_tsc": prompt, "cycles": prompt - entry}
+        elif fields[1] == "cmd":
+            run["commands"].append((fields[3] if len(fields) > 3 else "", int(fields[2], 16)))
+        elif fields[1] == "done":
+            run["done"] = int(fields[2], 16)
+    if run["boot"] is None or run["done"] is None:
+        raise RuntimeError("incomplete benchmark output")
+    return run
+
+
+def summarize(samples):
+    return {"median": int(statistics.median(samples)), "min": min(samples), "max": max(samples), "samples": samples}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--kernel", default="bin/foxos-bench.bin")
+    parser.add_argument("--script", default="bench/fs.txt")
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--serial", action="store_true", help="feed the script over COM1 instead of as a module")
+    parser.add_argument("--disk", help="FoxFS image (from mkfoxfs) to boot with instead of an empty disk")
+    parser.add_argument("--qemu", default="qemu-system-i386")
+    parser.add_argument("--memory", type=int, default=64, help="guest RAM in MB")
+    parser.add_argument("--timeout", type=float, default=120)
+    parser.add_argument("--output", help="write the JSON report here instead of stdout")
+    args = parser.parse_args()
+
+    runs = [run_once(args) for _ in range(args.runs)]
+
+    lines = [line for line, _ in runs[0]["commands"]]
+    for run in runs[1:]:
+        if [line for line, _ in run["commands"]] != lines:
+            raise RuntimeError("runs executed different commands")
+
+    try:
+        commit = subprocess.run(["git", "rev-parse", "HEAD"], stdout=subprocess.PIPE,
+                                stderr=subprocess.DEVNULL, text=True).stdout.strip()
+    except OSError:
+        commit = ""
+
+    report = {
+        "commit": commit,
+        "kernel": args.kernel,
+        "script": args.script,
+        "runs": args.runs,
+        "boot_to_prompt_cycles": summarize([run["boot"]["cycles"] for run in runs]),
+        "kernel_entry_tsc": summarize([run["boot"]["entry_tsc"] for run in runs]),
+        "commands": [
+            dict(command=line, cycles=summarize([run["commands"][i][1] for run in runs]))
+            for i, line in enumerate(lines)
+        ],
+    }
+
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+    width = max([len(line) for line in lines] + [14])
+    print("%-*s %14s" % (width, "boot-to-prompt", report["boot_to_prompt_cycles"]["median"]), file=sys.stderr)
+    for entry in report["commands"]:
+        print("%-*s %14s" % (width, entry["command"], entry["cycles"]["median"]), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Turn a `trace dump` from COM1 into a timeline.
+
+Reads the serial log (e.g. qemu -serial file:serial.log), finds the last
+TRACE begin/end block and writes Chrome trace-event JSON that chrome://tracing
+or https://ui.perfetto.dev can open. A per-event summary goes to stderr.
+
+    trace_timeline.py serial.log -o trace.json
+"""
+
+import argparse
+import collections
+import json
+import sys
+
+DISK_EVENTS = ("disk_read", "disk_write")
+
+
+def parse(lines):
+    """Return (tsc_mhz, lost, records) for the last complete dump."""
+    dump = None
+    current = None
+    for raw in lines:
+        fields = raw.strip().split()
+        if not fields:
+            continue
+        if fields[0] == "TRACE" and len(fields) >= 5 and fields[1] == "begin":
+            current = {"mhz": int(fields[2]) or 1, "lost": int(fields[4]), "records": []}
+        elif fields[0] == "TRACE" and len(fields) >= 2 and fields[1] == "end" and current is not None:
+            dump, current = current, None
+        elif fields[0] == "T" and len(fields) == 6 and current is not None:
+            current["records"].append({
+                "tsc": int(fields[1], 16),
+                "event": fields[2],
+                "phase": fields[3],
+                "arg": int(fields[4], 16),
+                "aux": int(fields[5], 16),
+            })
+    if dump is None:
+        raise SystemExit("no complete TRACE dump found")
+    return dump["mhz"], dump["lost"], dump["records"]
+
+
+def signed(value):
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def to_chrome(mhz, records):
+    events = []
+    if not records:
+        return events
+    base = records[0]["tsc"]
+    for r in records:
+        ts = (r["tsc"] - base) / mhz  # microseconds
+        event = {"name": r["event"], "ts": ts, "pid": 1, "tid": 1}
+        if r["phase"] == "B":
+            event["ph"] = "B"
+            event["args"] = {"arg": r["arg"], "aux": r["aux"]}
+        elif r["phase"] == "E":
+            event["ph"] = "E"
+            event["args"] = {"result": signed(r["arg"])}
+        else:
+            event["ph"] = "i"
+            event["s"] = "t"
+            if r["event"] in DISK_EVENTS:
+                event["args"] = {"block": r["arg"], "count": r["aux"]}
+            else:
+                event["args"] = {"arg": r["arg"], "aux": r["aux"]}
+        events.append(event)
+    return events
+
+
+def summarize(mhz, records):
+    """Inclusive time per begin/end event, and counts of instant events."""
+    stack = []
+    totals = collections.defaultdict(lambda: [0, 0.0])
+    for r in records:
+        if r["phase"] == "B":
+            stack.append(r)
+        elif r["phase"] == "E":
+            # Pop to the matching begin; unmatched ends come from a wrapped ring
+            for i in range(len(stack) - 1, -1, -1):
+                if stack[i]["event"] == r["event"]:
+                    begin = stack[i]
+                    del stack[i:]
+                    totals[r["event"]][0] += 1
+                    totals[r["event"]][1] += (r["tsc"] - begin["tsc"]) / mhz
+                    break
+        else:
+            blocks = r["aux"] if r["event"] in DISK_EVENTS else 1
+            totals[r["event"]][0] += blocks
+    return totals
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="serial log containing a trace dump ('-' for stdin)")
+    parser.add_argument("-o", "--output", help="Chrome trace JSON output (default: stdout)")
+    args = parser.parse_args()
+
+    source = sys.stdin if args.log == "-" else open(args.log, errors="replace")
+    mhz, lost, records = parse(source)
+
+    text = json.dumps({"traceEvents": to_chrome(mhz, records), "displayTimeUnit": "ns"})
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text)
+    else:
+        print(text)
+
+    print("%d records at %d MHz, %d overwritten" % (len(records), mhz, lost), file=sys.stderr)
+    print("%-16s %10s %14s" % ("event", "count", "total us"), file=sys.stderr)
+    totals = summarize(mhz, records)
+    for name, (count, us) in sorted(totals.items(), key=lambda item: -item[1][1]):
+        print("%-16s %10d %14.1f" % (name, count, us), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "klib.h"
+#include "wat.h"
+#include "platform.h"
+
+/*
+ * Runs the text format assembler over a set of small modules and checks
+ * each one assembles, or fails with the error it should. Bad input must
+ * end in an error rather than a loop, so every case runs under an alarm.
+ *
+ *   watcheck
+ */
+
+#define CHECK_TIMEOUT 2  // Seconds
+
+typedef struct {
+    const char* name;
+    const char* source;
+    int expected;
+} wat_case_t;
+
+static const wat_case_t cases[] = {
+    {"empty module", "(module)", WAT_OK},
+    {"flat", "(module (func (export \"main\") (result i32) i32.const 2 i32.const 3 i32.add))", WAT_OK},
+    {"folded", "(module (func (export \"main\") (result i32) (i32.add (i32.const 2) (i32.const 3))))", WAT_OK},
+    {"comments", "(module ;; line\n (; block (; nested ;) ;) (func))", WAT_OK},
+    {"stray semicolon", "(module (func ;x))", WAT_SYNTAX},
+    {"trailing semicolon", "(module (func) ;", WAT_SYNTAX},
+    {"unterminated comment", "(module (; open", WAT_SYNTAX},
+    {"unterminated string", "(module (func (export \"main)))", WAT_SYNTAX},
+    {"unbalanced", "(module (func", WAT_SYNTAX},
+    {"unknown instruction", "(module (func i32.frobnicate))", WAT_UNKNOWN},
+};
+#define CASE_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+static uint8_t binary[WAT_MAX_SOURCE];
+
+int main() {
+    host_terminal_quiet = true;
+    int status = 0;
+    for (size_t i = 0; i < CASE_COUNT; i++) {
+        const wat_case_t* c = &cases[i];
+        uint32_t size = 0;
+        printf("%-22s ", c->name);
+        fflush(stdout);  // So a hang shows which case it was
+        alarm(CHECK_TIMEOUT);  // A hang kills the tool, which fails the run
+        int result = wat_assemble(c->source, strlen(c->source), binary, sizeof(binary), &size);
+        alarm(0);
+        bool ok = result == c->expected;
+        printf("%s (got %d, expected %d)\n", ok ? "ok" : "FAILED", result, c->expected);
+        if (!ok) status = 1;
+    }
+    return status;
+}
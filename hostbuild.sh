@@ -0,0 +1,15 @@
+#!/bin/bash
+# Builds the filesystem for Linux together with the host tools (fsbench, mkfoxfs, foxfsck, fscrash, watcheck)
+
+set -e
+mkdir -p ./bin/host
+
+CFLAGS="-std=gnu99 -O2 -Wall -Wextra -DFOX_HOSTED -I./src -I./host"
+FS_SOURCES="./src/fs.c ./src/klib.c ./host/platform.c ./host/fsck.c"
+
+for tool in fsbench mkfoxfs foxfsck fscrash; do
+    cc $CFLAGS -o ./bin/host/$tool $FS_SOURCES ./host/$tool.c
+done
+cc $CFLAGS -o ./bin/host/watcheck ./src/wat.c ./src/klib.c ./host/platform.c ./host/watcheck.c
+
+echo "Host tools are in bin/host"
@@ -0,0 +1,84 @@
+/* SSE2 pixel row kernels for the framebuffer, see gfx.c. Each handles one
+   row of 32-bit pixels: a few single pixels until the destination is 16-byte
+   aligned, 16 pixels (a 64-byte cache line) per loop, then the rest. The
+   caller has checked for SSE2 and saved the XMM registers. */
+
+.section .text
+
+/* void blit_fill_sse2(uint32_t* dst, uint32_t count, uint32_t color) */
+.global blit_fill_sse2
+blit_fill_sse2:
+	push %edi
+	mov 8(%esp), %edi
+	mov 12(%esp), %ecx
+	mov 16(%esp), %eax
+1:	test $15, %edi
+	jz 2f
+	test %ecx, %ecx
+	jz 5f
+	stosl
+	dec %ecx
+	jmp 1b
+2:	movd %eax, %xmm0
+	pshufd $0, %xmm0, %xmm0
+	mov %ecx, %edx
+	shr $4, %edx
+	jz 4f
+3:	movdqa %xmm0, (%edi)
+	movdqa %xmm0, 16(%edi)
+	movdqa %xmm0, 32(%edi)
+	movdqa %xmm0, 48(%edi)
+	add $64, %edi
+	dec %edx
+	jnz 3b
+4:	and $15, %ecx
+	rep stosl
+5:	pop %edi
+	ret
+
+/* Copies 'count' pixels forward, so overlapping is only safe with dst below
+   src. 'store' is movdqa for memory that's read again, movntdq for video
+   memory, where going around the cache saves evicting everything else. */
+.macro COPY_ROW name, store
+.global \name
+\name:
+	push %esi
+	push %edi
+	mov 12(%esp), %edi
+	mov 16(%esp), %esi
+	mov 20(%esp), %ecx
+1:	test $15, %edi
+	jz 2f
+	test %ecx, %ecx
+	jz 5f
+	movsl
+	dec %ecx
+	jmp 1b
+2:	mov %ecx, %edx
+	shr $4, %edx
+	jz 4f
+3:	movdqu (%esi), %xmm0
+	movdqu 16(%esi), %xmm1
+	movdqu 32(%esi), %xmm2
+	movdqu 48(%esi), %xmm3
+	\store %xmm0, (%edi)
+	\store %xmm1, 16(%edi)
+	\store %xmm2, 32(%edi)
+	\store %xmm3, 48(%edi)
+	add $64, %esi
+	add $64, %edi
+	dec %edx
+	jnz 3b
+4:	and $15, %ecx
+	rep movsl
+5:	pop %edi
+	pop %esi
+	ret
+.endm
+
+/* void blit_copy_sse2(uint32_t* dst, const uint32_t* src, uint32_t count) */
+COPY_ROW blit_copy_sse2, movdqa
+
+/* void blit_stream_sse2(uint32_t* dst, const uint32_t* src, uint32_t count):
+   the stores are weakly ordered, so the caller ends a batch with sfence */
+COPY_ROW blit_stream_sse2, movntdq
@@ -0,0 +1,203 @@
+#include "klib.h"
+#include "fbcon.h"
+#include "font.h"
+#include "gfx.h"
+#include "timer.h"
+
+#define CELLS (FBCON_COLUMNS * FBCON_ROWS)
+#define CURSOR_TOP 14  // Scanlines the cursor covers, like enable_cursor(14, 15)
+
+uint16_t fbcon_cells[CELLS];
+static uint16_t shown[CELLS];   // What each cell looks like on screen
+static bool active = false;
+static int32_t origin_x, origin_y;  // Top left of the grid, which is centred
+static int32_t cursor = -1;         // Cell the cursor should be in, -1 for none
+static int32_t cursor_drawn = -1;   // And where it is
+static uint32_t last_present;
+static uint32_t extended[FBCON_EXTENDED_SLOTS];  // Code point in each slot, 0 when free
+
+static const uint32_t palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+void fbcon_init() {
+    if (!gfx_active()) return;
+    origin_x = (gfx_width() - FBCON_COLUMNS * FONT_WIDTH) / 2;
+    origin_y = (gfx_height() - FBCON_ROWS * FONT_HEIGHT) / 2;
+    active = true;
+    fbcon_redraw();
+    fbcon_present(true);
+}
+
+void fbcon_redraw() {
+    for (uint32_t i = 0; i < CELLS; i++) shown[i] = ~fbcon_cells[i];
+    cursor_drawn = -1;
+}
+
+bool fbcon_active() {
+    return active;
+}
+
+void fbcon_cursor(uint32_t x, uint32_t y) {
+    cursor = x < FBCON_COLUMNS && y < FBCON_ROWS ? (int32_t)(y * FBCON_COLUMNS + x) : -1;
+}
+
+/* ===== Extended Characters ===== */
+// Frees the slots no cell refers to
+static void reclaim() {
+    bool used[FBCON_EXTENDED_SLOTS] = { false };
+    for (uint32_t i = 0; i < CELLS; i++) {
+        uint8_t c = fbcon_cells[i] & 0xFF;
+        if (c >= FBCON_EXTENDED_FIRST && c != FBCON_WIDE_RIGHT) used[c - FBCON_EXTENDED_FIRST] = true;
+    }
+    for (uint32_t slot = 0; slot < FBCON_EXTENDED_SLOTS; slot++) {
+        if (!used[slot]) extended[slot] = 0;
+    }
+}
+
+uint8_t fbcon_intern(uint32_t code_point) {
+    for (int pass = 0; pass < 2; pass++) {
+        int32_t free = -1;
+        for (uint32_t slot = 0; slot < FBCON_EXTENDED_SLOTS; slot++) {
+            if (extended[slot] == code_point) return FBCON_EXTENDED_FIRST + slot;
+            if (extended[slot] == 0 && free < 0) free = slot;
+        }
+        if (free >= 0) {
+            extended[free] = code_point;
+            return FBCON_EXTENDED_FIRST + free;
+        }
+        reclaim();
+    }
+    return '?';
+}
+
+uint32_t fbcon_code_point(uint8_t c) {
+    if (c < FBCON_EXTENDED_FIRST || c == FBCON_WIDE_RIGHT) return 0;
+    return extended[c - FBCON_EXTENDED_FIRST];
+}
+
+/* ===== Drawing ===== */
+static gfx_rect_t cell_rect(uint32_t index, uint32_t count) {
+    return (gfx_rect_t){ origin_x + index % FBCON_COLUMNS * FONT_WIDTH,
+                         origin_y + index / FBCON_COLUMNS * FONT_HEIGHT,
+                         count * FONT_WIDTH, FONT_HEIGHT };
+}
+
+// The character's glyph as 16-pixel rows, NULL for a blank cell
+static const font_glyph_t* extended_glyph(uint8_t c) {
+    if (c < FBCON_EXTENDED_FIRST || c == FBCON_WIDE_RIGHT) return NULL;
+    return font_glyph(extended[c - FBCON_EXTENDED_FIRST]);
+}
+
+// Into the back buffer only; the caller marks it damaged
+static void draw_cell(uint32_t index, uint16_t cell, bool underline) {
+    uint8_t c = cell & 0xFF;
+    uint32_t fg = palette[(cell >> 8) & 0x0F];
+    uint32_t bg = palette[(cell >> 12) & 0x0F];
+    static const uint8_t blank[FONT_HEIGHT];
+    const uint8_t* glyph = blank;
+    const uint16_t* rows = NULL;  // Set for font glyphs, 'shift' picks the half
+    uint32_t shift = 8;
+    if (c >= FONT_FIRST && c < FONT_FIRST + FONT_GLYPHS) {
+        glyph = font8x16[c - FONT_FIRST];
+    } else if (c == FBCON_WIDE_RIGHT) {
+        // The right half of whatever two-cell character is to the left
+        const font_glyph_t* left = index % FBCON_COLUMNS > 0 ? extended_glyph(fbcon_cells[index - 1] & 0xFF) : NULL;
+        if (left != NULL && left->wide) {
+            rows = left->rows;
+            shift = 0;
+        }
+    } else if (c >= FBCON_EXTENDED_FIRST) {
+        const font_glyph_t* found = extended_glyph(c);
+        if (found != NULL) {
+            rows = found->rows;
+        } else {
+            glyph = font8x16['?' - FONT_FIRST];
+        }
+    }
+
+    gfx_rect_t rect = cell_rect(index, 1);
+    uint32_t* row = gfx_pixels() + rect.y * gfx_width() + rect.x;
+    for (uint32_t y = 0; y < FONT_HEIGHT; y++, row += gfx_width()) {
+        uint8_t bits = rows != NULL ? (uint8_t)(rows[y] >> shift) : glyph[y];
+        if (underline && y >= CURSOR_TOP) bits = 0xFF;
+        for (uint32_t x = 0; x < FONT_WIDTH; x++) {
+            row[x] = bits & (0x80 >> x) ? fg : bg;
+        }
+    }
+    shown[index] = cell;
+}
+
+static void redraw_cell(int32_t index) {
+    if (index < 0) return;
+    draw_cell(index, fbcon_cells[index], index == cursor);
+    gfx_damage(cell_rect(index, 1));
+}
+
+static bool same_cells(const uint16_t* a, const uint16_t* b, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+// Rows the grid moved up since it was drawn, 0 if it didn't (or changed too much to tell)
+static uint32_t scrolled() {
+    if (same_cells(fbcon_cells, shown, FBCON_COLUMNS)) return 0;
+    for (uint32_t rows = 1; rows < FBCON_ROWS; rows++) {
+        if (same_cells(fbcon_cells, shown + rows * FBCON_COLUMNS, (FBCON_ROWS - rows) * FBCON_COLUMNS)) return rows;
+    }
+    return 0;
+}
+
+void fbcon_present(bool now) {
+    if (!active) return;
+    if (!now && timer_ticks - last_present < FBCON_FRAME_MS * TIMER_HZ / 1000) return;
+    last_present = timer_ticks;
+
+    uint32_t rows = scrolled();
+    if (rows > 0) {
+        // The cursor would move with the pixels
+        if (cursor_drawn >= 0) {
+            draw_cell(cursor_drawn, shown[cursor_drawn], false);
+            cursor_drawn = -1;
+        }
+        gfx_rect_t grid = { origin_x, origin_y, FBCON_COLUMNS * FONT_WIDTH, FBCON_ROWS * FONT_HEIGHT };
+        gfx_scroll(grid, rows * FONT_HEIGHT);
+        uint32_t kept = (FBCON_ROWS - rows) * FBCON_COLUMNS;
+        memmove(shown, shown + rows * FBCON_COLUMNS, kept * sizeof(uint16_t));
+        for (uint32_t i = kept; i < CELLS; i++) shown[i] = ~fbcon_cells[i];
+    }
+
+    // Each run of changed cells in a row is one rectangle
+    for (uint32_t y = 0; y < FBCON_ROWS; y++) {
+        uint32_t x = 0;
+        while (x < FBCON_COLUMNS) {
+            uint32_t index = y * FBCON_COLUMNS + x;
+            if (fbcon_cells[index] == shown[index]) {
+                x++;
+                continue;
+            }
+            uint32_t run = 0;
+            while (x + run < FBCON_COLUMNS && fbcon_cells[index + run] != shown[index + run]) {
+                draw_cell(index + run, fbcon_cells[index + run], (int32_t)(index + run) == cursor);
+                run++;
+                // A right half is drawn from the cell before it, so it changes with it
+                if (x + run < FBCON_COLUMNS && (fbcon_cells[index + run] & 0xFF) == FBCON_WIDE_RIGHT) {
+                    shown[index + run] = ~fbcon_cells[index + run];
+                }
+            }
+            gfx_damage(cell_rect(index, run));
+            x += run;
+        }
+    }
+
+    if (cursor != cursor_drawn) {
+        int32_t old = cursor_drawn;
+        cursor_drawn = cursor;
+        redraw_cell(old);
+        redraw_cell(cursor);
+    }
+    gfx_present();
+}
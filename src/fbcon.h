@@ -0,0 +1,45 @@
+#ifndef FOXOS_FBCON_H
+#define FOXOS_FBCON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Text console on the framebuffer. The terminal keeps writing VGA text
+ * cells (character | attribute << 8), only into fbcon_cells instead of
+ * 0xB8000, and fbcon_present() draws the ones that changed since the last
+ * time as 8x16 glyphs in the middle of the screen. A screen that scrolled
+ * is recognised and moved with one copy instead of being drawn again.
+ *
+ * Cells keep their 16 bits, so characters past ASCII are interned: a cell
+ * byte from FBCON_EXTENDED_FIRST on names a slot holding the code point,
+ * drawn from the font (font.h). A two-cell character has its slot in the
+ * left cell and FBCON_WIDE_RIGHT in the right one. Slots no cell uses any
+ * more are taken back when they run out.
+ */
+#define FBCON_COLUMNS 80
+#define FBCON_ROWS    25
+#define FONT_WIDTH    8
+#define FONT_HEIGHT   16
+#define FONT_FIRST    0x20  // The font has the printable ASCII characters
+#define FONT_GLYPHS   95
+#define FBCON_FRAME_MS 16   // fbcon_present(false) draws at most this often
+#define FBCON_EXTENDED_FIRST 0x80
+#define FBCON_EXTENDED_SLOTS 127
+#define FBCON_WIDE_RIGHT     0xFF
+
+extern uint16_t fbcon_cells[FBCON_COLUMNS * FBCON_ROWS];
+extern const uint8_t font8x16[FONT_GLYPHS][FONT_HEIGHT];
+
+void fbcon_init();  // After gfx_init()
+bool fbcon_active();
+void fbcon_cursor(uint32_t x, uint32_t y);  // Off the grid hides it
+void fbcon_present(bool now);  // Without 'now' it waits until a frame has passed
+void fbcon_redraw();  // Something else drew over the grid: the next present draws all of it
+
+// The cell byte for a code point past ASCII, or '?' when every slot is on screen
+uint8_t fbcon_intern(uint32_t code_point);
+// What an interned cell byte stands for, 0 if it isn't one
+uint32_t fbcon_code_point(uint8_t c);
+
+#endif
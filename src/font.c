@@ -0,0 +1,188 @@
+#include "klib.h"
+#include "font.h"
+#include "fs.h"
+
+#define PSF2_MAGIC         0x864AB572
+#define PSF2_UNICODE_TABLE 0x01
+#define PSF2_SEPARATOR     0xFF  // Ends a glyph's entry in the Unicode table
+#define PSF2_SEQUENCE      0xFE  // Starts a combining sequence, which we don't draw
+#define NO_GLYPH           0xFFFF
+#define NONE               0xFFFF
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t flags;
+    uint32_t length;      // Glyphs
+    uint32_t glyph_size;  // Bytes each
+    uint32_t height;
+    uint32_t width;
+} psf2_header_t;
+
+static const psf2_header_t* font;
+static const uint8_t* glyph_data;
+static uint16_t glyph_of[0x10000];  // Basic Multilingual Plane code point to glyph, NO_GLYPH if missing
+static uint8_t file_buffer[FONT_FILE_MAX];
+static font_stats_t stats;
+
+// Cached glyphs: a hash chain per bucket, and one list from most to least recently used
+typedef struct {
+    font_glyph_t glyph;
+    uint16_t chain;
+    uint16_t newer;
+    uint16_t older;
+} cache_entry_t;
+
+static cache_entry_t cache[FONT_CACHE_SIZE];
+static uint16_t buckets[FONT_CACHE_BUCKETS];
+static uint16_t newest, oldest;
+
+/* ===== Loading ===== */
+static void cache_clear() {
+    // Every entry in one list, holding nothing that can be found
+    for (uint32_t i = 0; i < FONT_CACHE_SIZE; i++) {
+        cache[i].glyph.code_point = 0xFFFFFFFF;
+        cache[i].chain = NONE;
+        cache[i].newer = i == 0 ? NONE : i - 1;
+        cache[i].older = i == FONT_CACHE_SIZE - 1 ? NONE : i + 1;
+    }
+    newest = 0;
+    oldest = FONT_CACHE_SIZE - 1;
+    memset(buckets, 0xFF, sizeof(buckets));
+}
+
+bool font_is_psf2(const void* data, uint32_t size) {
+    const psf2_header_t* header = data;
+    if (size < sizeof(psf2_header_t) || header->magic != PSF2_MAGIC) return false;
+    if (header->width == 0 || header->width > 16 || header->height == 0 || header->height > FONT_ROWS) return false;
+    if (header->glyph_size < header->height * ((header->width + 7) / 8) || header->glyph_size > 64) return false;
+    if (header->length == 0 || header->length > NO_GLYPH) return false;
+    return header->header_size <= size && header->length * header->glyph_size <= size - header->header_size;
+}
+
+bool font_load(const void* data, uint32_t size) {
+    if (!font_is_psf2(data, size)) return false;
+    font = data;
+    glyph_data = (const uint8_t*)data + font->header_size;
+    memset(glyph_of, 0xFF, sizeof(glyph_of));
+    stats.glyphs = font->length;
+
+    if (!(font->flags & PSF2_UNICODE_TABLE)) {
+        // Glyph n is character n
+        for (uint32_t i = 0; i < font->length && i < NO_GLYPH; i++) glyph_of[i] = i;
+    } else {
+        const uint8_t* table = glyph_data + font->length * font->glyph_size;
+        const uint8_t* end = (const uint8_t*)data + size;
+        uint32_t glyph = 0;
+        bool sequence = false;
+        utf8_decoder_t decoder = { 0 };
+        for (; table < end && glyph < font->length; table++) {
+            if (*table == PSF2_SEPARATOR) {
+                glyph++;
+                sequence = false;
+                decoder.needed = 0;
+            } else if (*table == PSF2_SEQUENCE) {
+                sequence = true;
+            } else if (!sequence) {
+                uint32_t code_points[2];
+                int count = utf8_decode(&decoder, *table, code_points);
+                for (int i = 0; i < count; i++) {
+                    if (code_points[i] < 0x10000 && glyph_of[code_points[i]] == NO_GLYPH) {
+                        glyph_of[code_points[i]] = glyph;
+                    }
+                }
+            }
+        }
+    }
+    cache_clear();
+    return true;
+}
+
+int font_load_file(const char* path) {
+    dir_entry_t entry;
+    int result = fs_stat(path, &entry);
+    if (result != FS_OK) return result;
+    if (entry.size > FONT_FILE_MAX) return FS_ERROR;
+    if ((const void*)font == file_buffer) font = NULL;  // About to change under it
+    result = fs_read(path, file_buffer, sizeof(file_buffer));
+    if (result != FS_OK) return result;
+    return font_load(file_buffer, entry.size) ? FS_OK : FS_ERROR;
+}
+
+bool font_loaded() {
+    return font != NULL;
+}
+
+const font_stats_t* font_stats() {
+    return &stats;
+}
+
+/* ===== Glyph Cache ===== */
+// The ranges East Asian Width calls wide, which a font may leave blank on the right
+static bool wide_range(uint32_t c) {
+    return (c >= 0x1100 && c <= 0x115F) || (c >= 0x2E80 && c <= 0x303E) || (c >= 0x3041 && c <= 0x33FF) ||
+           (c >= 0x3400 && c <= 0x4DBF) || (c >= 0x4E00 && c <= 0x9FFF) || (c >= 0xA000 && c <= 0xA4CF) ||
+           (c >= 0xAC00 && c <= 0xD7A3) || (c >= 0xF900 && c <= 0xFAFF) || (c >= 0xFE30 && c <= 0xFE4F) ||
+           (c >= 0xFF00 && c <= 0xFF60) || (c >= 0xFFE0 && c <= 0xFFE6);
+}
+
+static void unpack(font_glyph_t* out, uint32_t code_point, uint32_t glyph) {
+    const uint8_t* data = glyph_data + glyph * font->glyph_size;
+    uint32_t row_bytes = (font->width + 7) / 8;
+    uint16_t right = 0;
+    memset(out->rows, 0, sizeof(out->rows));
+    for (uint32_t y = 0; y < font->height; y++, data += row_bytes) {
+        out->rows[y] = data[0] << 8 | (row_bytes > 1 ? data[1] : 0);
+        right |= out->rows[y] & 0xFF;
+    }
+    out->code_point = code_point;
+    out->wide = right != 0 || (font->width > 8 && wide_range(code_point));
+}
+
+static uint32_t bucket_of(uint32_t code_point) {
+    return (code_point * 2654435761u) >> 22;  // Top 10 bits: one of 1024 buckets
+}
+
+// Moves entry 'i' to the newest end of the list
+static void touch(uint16_t i) {
+    if (i == newest) return;
+    cache[cache[i].newer].older = cache[i].older;
+    if (cache[i].older != NONE) {
+        cache[cache[i].older].newer = cache[i].newer;
+    } else {
+        oldest = cache[i].newer;
+    }
+    cache[i].newer = NONE;
+    cache[i].older = newest;
+    cache[newest].newer = i;
+    newest = i;
+}
+
+static void unchain(uint16_t i) {
+    if (cache[i].glyph.code_point == 0xFFFFFFFF) return;
+    uint16_t* link = &buckets[bucket_of(cache[i].glyph.code_point)];
+    while (*link != i) link = &cache[*link].chain;
+    *link = cache[i].chain;
+}
+
+const font_glyph_t* font_glyph(uint32_t code_point) {
+    if (font == NULL || code_point >= 0x10000 || glyph_of[code_point] == NO_GLYPH) return NULL;
+    uint32_t bucket = bucket_of(code_point);
+    for (uint16_t i = buckets[bucket]; i != NONE; i = cache[i].chain) {
+        if (cache[i].glyph.code_point == code_point) {
+            stats.hits++;
+            touch(i);
+            return &cache[i].glyph;
+        }
+    }
+
+    stats.misses++;
+    uint16_t i = oldest;
+    unchain(i);
+    unpack(&cache[i].glyph, code_point, glyph_of[code_point]);
+    cache[i].chain = buckets[bucket];
+    buckets[bucket] = i;
+    touch(i);
+    return &cache[i].glyph;
+}
@@ -0,0 +1,46 @@
+#ifndef FOXOS_FONT_H
+#define FOXOS_FONT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Unicode glyphs for the framebuffer console, from a PSF2 font: GRUB's
+ * Unifont converted by host/genfont.py --psf, loaded as a Multiboot module
+ * or read from FONT_FILE. Glyphs are up to 16x16, and the characters that
+ * take two cells (CJK, Hangul, fullwidth forms) are the 16-wide ones.
+ *
+ * The font's Unicode table is read once into a direct map from code point
+ * to glyph. font_glyph() keeps the last FONT_CACHE_SIZE glyphs it was asked
+ * for already unpacked into one 16-bit word per row, hashed by code point
+ * and evicted least recently used first, so redrawing a screen of kanji
+ * costs a hash lookup per character and never touches the font data.
+ */
+#define FONT_FILE        "/usr/unifont.psf"
+#define FONT_FILE_MAX    (256 * 1024)   // Subsets only; the whole font comes as a module
+#define FONT_CACHE_SIZE  512
+#define FONT_CACHE_BUCKETS 1024
+#define FONT_ROWS        16
+
+typedef struct {
+    uint32_t code_point;
+    uint16_t rows[FONT_ROWS];  // Bit 15 is the leftmost pixel
+    bool wide;                 // Takes two cells: the right half is in the low byte
+} font_glyph_t;
+
+typedef struct {
+    uint32_t glyphs;     // In the font
+    uint32_t hits;       // font_glyph() found it cached
+    uint32_t misses;     // And had to unpack it
+} font_stats_t;
+
+bool font_load(const void* data, uint32_t size);  // A PSF2 image, used in place; false if it isn't one
+int font_load_file(const char* path);             // An FS_* code
+bool font_loaded();
+bool font_is_psf2(const void* data, uint32_t size);
+
+// The glyph for a code point, NULL if the font has none. Valid until the next call.
+const font_glyph_t* font_glyph(uint32_t code_point);
+const font_stats_t* font_stats();
+
+#endif
@@ -0,0 +1,1879 @@
+#include "klib.h"
+#include "fs.h"
+#include "trace.h"
+
+/* ===== Checksums ===== */
+// Bitwise CRC-32 (IEEE 802.3), used to checksum journal commit records
+static uint32_t crc32_update(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+/* ===== File System Global State ===== */
+char current_path[MAX_PATH_LEN] = "/";
+static fat_entry_t fat_table[FS_MAX_BLOCKS];
+static dir_entry_t current_dir[DIR_ENTRIES_PER_BLOCK];
+static uint32_t current_dir_block = FS_ROOT_DIR_BLOCK;
+static fs_dir_hook_t dir_hook;
+static fs_superblock_t superblock;
+bool fs_initialized = false;  // Track if filesystem is initialized
+static bool fs_extent_layout = false;  // Mounted volume stores files as extent lists
+static uint32_t fat_dirty[(FS_FAT_BLOCKS + 31) / 32];  // FAT blocks changed since the last log
+static bool superblock_dirty = false;
+static uint32_t fs_freed[(FS_MAX_BLOCKS + 31) / 32];  // Blocks freed by the running transaction
+static uint32_t fs_freed_count = 0;
+static uint16_t tail_freed[FS_MAX_BLOCKS];  // Tail units freed by the running transaction, per block
+
+/* Running transaction: metadata block images waiting for the next group commit */
+static struct {
+    uint32_t count;
+    uint32_t ops;
+    uint32_t sequence;
+    uint32_t blocks[FS_TXN_MAX_BLOCKS];
+    uint8_t data[FS_TXN_MAX_BLOCKS][FS_BLOCK_SIZE];
+} fs_txn;
+uint32_t fs_journal_replayed = 0;  // Blocks restored by the last fs_init()
+
+/* ===== Metadata Journal ===== */
+/*
+ * Directory blocks, the FAT and the superblock are never written in place
+ * directly. Operations stage block images in fs_txn; a group commit writes
+ * them to the journal region as descriptor + images + checksummed commit
+ * record, and only then copies them to their home locations. File data is
+ * written straight to newly allocated blocks before the metadata that
+ * references it commits (ordered mode). A block freed by the running
+ * transaction is still referenced by the committed metadata, so it isn't
+ * handed out again until the commit record is on disk. A crash at any point
+ * then leaves either the old or the new metadata, never a mix, and nothing
+ * the old metadata points at has been overwritten.
+ */
+
+// Look up a block image in the running transaction
+static uint8_t* journal_find(uint32_t block) {
+    for (uint32_t i = 0; i < fs_txn.count; i++) {
+        if (fs_txn.blocks[i] == block) return fs_txn.data[i];
+    }
+    return NULL;
+}
+
+// Read a metadata block, preferring the image that hasn't been committed yet
+static bool fs_meta_read(uint32_t block, void* buffer) {
+    uint8_t* image = journal_find(block);
+    if (image != NULL) {
+        memcpy(buffer, image, FS_BLOCK_SIZE);
+        return true;
+    }
+    return disk_read(block, buffer);
+}
+
+// Stage a metadata block in the running transaction (written through on unjournaled volumes)
+static bool fs_meta_write(uint32_t block, const void* buffer) {
+    if (superblock.journal_blocks == 0) {
+        return disk_write(block, (void*)buffer);
+    }
+
+    uint8_t* image = journal_find(block);
+    if (image == NULL) {
+        if (fs_txn.count >= FS_TXN_MAX_BLOCKS) return false;
+        fs_txn.blocks[fs_txn.count] = block;
+        image = fs_txn.data[fs_txn.count++];
+    }
+    memcpy(image, buffer, FS_BLOCK_SIZE);
+    return true;
+}
+
+// Drop the staged image of a block that was just freed, so the checkpoint
+// can't overwrite whatever the block gets reused for before the commit
+static void journal_revoke(uint32_t block) {
+    for (uint32_t i = 0; i < fs_txn.count; i++) {
+        if (fs_txn.blocks[i] == block) {
+            fs_txn.count--;
+            if (i != fs_txn.count) {
+                fs_txn.blocks[i] = fs_txn.blocks[fs_txn.count];
+                memcpy(fs_txn.data[i], fs_txn.data[fs_txn.count], FS_BLOCK_SIZE);
+            }
+            return;
+        }
+    }
+}
+
+static bool fs_block_freed(uint32_t block) {
+    return fs_freed[block / 32] & (1u << (block % 32));
+}
+
+// The committed metadata no longer refers to anything freed since the last commit
+static void fs_freed_reset() {
+    memset(fs_freed, 0, sizeof(fs_freed));
+    fs_freed_count = 0;
+    memset(tail_freed, 0, sizeof(tail_freed));
+}
+
+// Write the running transaction to the journal, then checkpoint it to its home blocks
+static int journal_commit() {
+    if (fs_txn.count == 0) {
+        fs_txn.ops = 0;
+        fs_freed_reset();
+        return FS_OK;
+    }
+
+    uint8_t block[FS_BLOCK_SIZE];
+    uint32_t jstart = superblock.journal_start;
+
+    // Descriptor
+    memset(block, 0, sizeof(block));
+    fs_journal_header_t* header = (fs_journal_header_t*)block;
+    header->magic = FS_JOURNAL_MAGIC;
+    header->sequence = ++fs_txn.sequence;
+    header->count = fs_txn.count;
+    memcpy(header->blocks, fs_txn.blocks, fs_txn.count * sizeof(uint32_t));
+    uint32_t checksum = crc32_update(0, block, FS_BLOCK_SIZE);
+    if (!disk_write(jstart, block)) return FS_IO_ERROR;
+
+    // Block images
+    for (uint32_t i = 0; i < fs_txn.count; i++) {
+        checksum = crc32_update(checksum, fs_txn.data[i], FS_BLOCK_SIZE);
+        if (!disk_write(jstart + 1 + i, fs_txn.data[i])) return FS_IO_ERROR;
+    }
+
+    // Commit record - once this is on disk the transaction survives a crash
+    memset(block, 0, sizeof(block));
+    fs_journal_commit_t* commit = (fs_journal_commit_t*)block;
+    commit->magic = FS_COMMIT_MAGIC;
+    commit->sequence = fs_txn.sequence;
+    commit->count = fs_txn.count;
+    commit->checksum = checksum;
+    if (!disk_write(jstart + 1 + fs_txn.count, block)) return FS_IO_ERROR;
+    fs_freed_reset();
+
+    // Checkpoint
+    for (uint32_t i = 0; i < fs_txn.count; i++) {
+        if (!disk_write(fs_txn.blocks[i], fs_txn.data[i])) return FS_IO_ERROR;
+    }
+
+    // Retire the transaction so the next mount doesn't replay it
+    memset(block, 0, sizeof(block));
+    if (!disk_write(jstart, block)) return FS_IO_ERROR;
+
+    fs_txn.count = 0;
+    fs_txn.ops = 0;
+    return FS_OK;
+}
+
+// Replay a committed but not yet retired transaction; returns the number of blocks restored
+static int journal_replay(uint32_t jstart, uint32_t jblocks) {
+    uint8_t header_block[FS_BLOCK_SIZE];
+    uint8_t block[FS_BLOCK_SIZE];
+    if (!disk_read(jstart, header_block)) return FS_IO_ERROR;
+
+    fs_journal_header_t* header = (fs_journal_header_t*)header_block;
+    if (header->magic != FS_JOURNAL_MAGIC || header->count == 0 ||
+        header->count > FS_TXN_MAX_BLOCKS || header->count + 2 > jblocks) {
+        return 0;  // Clean journal
+    }
+
+    // Validate the commit record before touching any home block
+    if (!disk_read(jstart + 1 + header->count, block)) return FS_IO_ERROR;
+    fs_journal_commit_t* commit = (fs_journal_commit_t*)block;
+    if (commit->magic != FS_COMMIT_MAGIC || commit->sequence != header->sequence ||
+        commit->count != header->count) {
+        return 0;  // Torn transaction, its home blocks were never touched
+    }
+    uint32_t expected = commit->checksum;
+    uint32_t checksum = crc32_update(0, header_block, FS_BLOCK_SIZE);
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (header->blocks[i] >= FS_MAX_BLOCKS) return 0;
+        if (!disk_read(jstart + 1 + i, block)) return FS_IO_ERROR;
+        checksum = crc32_update(checksum, block, FS_BLOCK_SIZE);
+    }
+    if (checksum != expected) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (!disk_read(jstart + 1 + i, block)) return FS_IO_ERROR;
+        if (!disk_write(header->blocks[i], block)) return FS_IO_ERROR;
+    }
+
+    int restored = header->count;
+    fs_txn.sequence = header->sequence;
+    memset(block, 0, sizeof(block));
+    if (!disk_write(jstart, block)) return FS_IO_ERROR;
+    return restored;
+}
+
+// Free blocks that can be allocated before the next commit
+static uint32_t fs_available_blocks() {
+    return superblock.free_blocks - fs_freed_count;
+}
+
+// Make sure the running transaction can absorb one more operation allocating
+// up to 'blocks' blocks, committing early if only blocks it freed would do
+static int fs_txn_begin(uint32_t blocks) {
+    if (fs_txn.count + FS_TXN_OP_RESERVE > FS_TXN_MAX_BLOCKS ||
+        (fs_freed_count > 0 && fs_available_blocks() < blocks)) {
+        return journal_commit();
+    }
+    return FS_OK;
+}
+
+// Log the FAT and superblock changes of a finished operation, committing once the batch is full
+static int fs_txn_end() {
+    for (uint32_t i = 0; i < superblock.fat_blocks; i++) {
+        if (fat_dirty[i / 32] & (1u << (i % 32))) {
+            if (!fs_meta_write(1 + i, (uint8_t*)fat_table + i * FS_BLOCK_SIZE)) {
+                return FS_IO_ERROR;
+            }
+        }
+    }
+    memset(fat_dirty, 0, sizeof(fat_dirty));
+
+    if (superblock_dirty) {
+        uint8_t block[FS_BLOCK_SIZE];
+        memset(block, 0, sizeof(block));
+        memcpy(block, &superblock, sizeof(superblock));
+        if (!fs_meta_write(0, block)) return FS_IO_ERROR;
+        superblock_dirty = false;
+    }
+
+    if (++fs_txn.ops >= FS_TXN_BATCH_OPS) {
+        return journal_commit();
+    }
+    return FS_OK;
+}
+
+// Commit every pending metadata change (called when the shell goes idle and by 'sync')
+static int fs_sync_impl() {
+    if (!fs_initialized) return FS_OK;
+    return journal_commit();
+}
+
+int fs_sync() {
+    TRACE_BEGIN_EVENT(TRACE_FS_SYNC, 0, 0);
+    int result = fs_sync_impl();
+    TRACE_END_EVENT(TRACE_FS_SYNC, result);
+    return result;
+}
+
+/* ===== Dentry Cache ===== */
+/*
+ * Maps (directory block, name) to the directory record, or remembers that
+ * the name doesn't exist, so resolving the same paths again never reads a
+ * directory block. Every directory write refreshes the cached names of that
+ * directory in place, which keeps the cache exact without invalidation
+ * rules scattered across the callers.
+ */
+#define FS_DCACHE_ENTRIES 64
+#define FS_DCACHE_BUCKETS 32
+
+typedef struct fs_dentry {
+    bool used;
+    int16_t slot;                   // Index in the directory block, -1 for a negative entry
+    uint32_t dir_block;
+    char name[FS_FILENAME_LEN];
+    dir_entry_t entry;              // Copy of the record for positive entries
+    struct fs_dentry* hash_next;
+    struct fs_dentry* lru_prev;     // Towards most recently used
+    struct fs_dentry* lru_next;     // Towards least recently used
+} fs_dentry_t;
+
+static fs_dentry_t dcache[FS_DCACHE_ENTRIES];
+static fs_dentry_t* dcache_buckets[FS_DCACHE_BUCKETS];
+static fs_dentry_t* dcache_mru = NULL;
+static fs_dentry_t* dcache_lru = NULL;
+
+static uint32_t dcache_hash(uint32_t dir_block, const char* name) {
+    uint32_t h = 2166136261u ^ dir_block;  // FNV-1a
+    while (*name) {
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    }
+    return h % FS_DCACHE_BUCKETS;
+}
+
+static void dcache_lru_unlink(fs_dentry_t* d) {
+    if (d->lru_prev) d->lru_prev->lru_next = d->lru_next;
+    else dcache_mru = d->lru_next;
+    if (d->lru_next) d->lru_next->lru_prev = d->lru_prev;
+    else dcache_lru = d->lru_prev;
+    d->lru_prev = d->lru_next = NULL;
+}
+
+static void dcache_lru_push(fs_dentry_t* d) {
+    d->lru_prev = NULL;
+    d->lru_next = dcache_mru;
+    if (dcache_mru) dcache_mru->lru_prev = d;
+    dcache_mru = d;
+    if (dcache_lru == NULL) dcache_lru = d;
+}
+
+static void dcache_hash_unlink(fs_dentry_t* d) {
+    fs_dentry_t** link = &dcache_buckets[dcache_hash(d->dir_block, d->name)];
+    while (*link && *link != d) link = &(*link)->hash_next;
+    if (*link) *link = d->hash_next;
+    d->hash_next = NULL;
+}
+
+static void dcache_reset() {
+    memset(dcache, 0, sizeof(dcache));
+    memset(dcache_buckets, 0, sizeof(dcache_buckets));
+    dcache_mru = dcache_lru = NULL;
+    for (int i = 0; i < FS_DCACHE_ENTRIES; i++) {
+        dcache_lru_push(&dcache[i]);
+    }
+}
+
+static fs_dentry_t* dcache_find(uint32_t dir_block, const char* name) {
+    fs_dentry_t* d = dcache_buckets[dcache_hash(dir_block, name)];
+    while (d) {
+        if (d->dir_block == dir_block && strcmp(d->name, name) == 0) {
+            dcache_lru_unlink(d);
+            dcache_lru_push(d);
+            return d;
+        }
+        d = d->hash_next;
+    }
+    return NULL;
+}
+
+// Cache a lookup result, recycling the least recently used entry
+static void dcache_insert(uint32_t dir_block, const char* name, int slot, const dir_entry_t* entry) {
+    fs_dentry_t* d = dcache_lru;
+    if (d == NULL) return;
+    if (d->used) dcache_hash_unlink(d);
+    dcache_lru_unlink(d);
+
+    d->used = true;
+    d->dir_block = dir_block;
+    strcpy(d->name, name);  // fs_walk already bounded it
+    d->slot = slot;
+    if (slot >= 0) d->entry = *entry;
+
+    uint32_t h = dcache_hash(dir_block, name);
+    d->hash_next = dcache_buckets[h];
+    dcache_buckets[h] = d;
+    dcache_lru_push(d);
+}
+
+// Bring every cached name of a directory in line with its new contents
+static void dcache_refresh(uint32_t dir_block, const dir_entry_t* entries) {
+    for (int i = 0; i < FS_DCACHE_ENTRIES; i++) {
+        fs_dentry_t* d = &dcache[i];
+        if (!d->used || d->dir_block != dir_block) continue;
+
+        d->slot = -1;
+        for (size_t j = 0; j < DIR_ENTRIES_PER_BLOCK; j++) {
+            if (entries[j].filename[0] != '\0' && strcmp(entries[j].filename, d->name) == 0) {
+                d->slot = j;
+                d->entry = entries[j];
+                break;
+            }
+        }
+    }
+}
+
+
+
+/* ===== Directory Block I/O Helpers (prevent 512-byte over/underflow) ===== */
+static bool dir_read_block(uint32_t block, dir_entry_t* out_entries) {
+    uint8_t buf[FS_BLOCK_SIZE];
+    if (!fs_meta_read(block, buf)) return false;
+    // Copy only up to our in-memory directory size
+    memcpy(out_entries, buf, sizeof(dir_entry_t) * DIR_ENTRIES_PER_BLOCK);
+    return true;
+}
+
+static bool dir_write_block(uint32_t block, const dir_entry_t* in_entries) {
+    uint8_t buf[FS_BLOCK_SIZE];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, in_entries, sizeof(dir_entry_t) * DIR_ENTRIES_PER_BLOCK);
+    if (!fs_meta_write(block, buf)) return false;
+
+    // Keep the cached views of this directory in step with the new contents
+    dcache_refresh(block, in_entries);
+    if (block == current_dir_block && in_entries != current_dir) {
+        memcpy(current_dir, in_entries, sizeof(current_dir));
+    }
+    return true;
+}
+
+/* ===== FAT Helpers ===== */
+static void fat_set(uint32_t block, uint16_t next) {
+    fat_table[block].next_block = next;
+    if (next == FS_FAT_FREE) {
+        journal_revoke(block);
+        if (superblock.journal_blocks > 0 && !fs_block_freed(block)) {
+            fs_freed[block / 32] |= 1u << (block % 32);
+            fs_freed_count++;
+        }
+    }
+    uint32_t fat_block = block * sizeof(fat_entry_t) / FS_BLOCK_SIZE;
+    fat_dirty[fat_block / 32] |= 1u << (fat_block % 32);
+}
+
+/* ===== FAT Chain Index ===== */
+/*
+ * On FAT volumes finding block N of a file means following N links. The
+ * chain index caches a file's chain as run-length encoded contiguous runs,
+ * built by one walk the first time the file is accessed, so later seeks are
+ * a binary search and appends find the tail without walking. Slots are
+ * recycled LRU; a chain with more runs than a slot holds keeps its first
+ * runs and walks on from the last one.
+ */
+#define FS_CHAIN_INDEX_BUDGET 4096  // Bytes of run storage shared by all slots
+#define FS_CHAIN_INDEX_SLOTS  8
+#define FS_CHAIN_INDEX_RUNS   (FS_CHAIN_INDEX_BUDGET / FS_CHAIN_INDEX_SLOTS / sizeof(fs_chain_run_t))
+
+typedef struct {
+    uint16_t logical;   // First file block of the run
+    uint16_t start;     // First disk block
+    uint16_t length;
+} fs_chain_run_t;
+
+typedef struct {
+    uint16_t first_block;   // FS_FAT_EOF when the slot is unused
+    uint16_t count;
+    bool truncated;         // The chain continues past the last run
+    uint32_t last_used;
+    fs_chain_run_t runs[FS_CHAIN_INDEX_RUNS];
+} fs_chain_index_t;
+
+static fs_chain_index_t chain_index[FS_CHAIN_INDEX_SLOTS];
+static uint32_t chain_index_clock = 0;
+
+static void chain_index_reset() {
+    for (int i = 0; i < FS_CHAIN_INDEX_SLOTS; i++) {
+        chain_index[i].first_block = FS_FAT_EOF;
+    }
+}
+
+// Forget a chain whose layout changed or that was freed
+static void chain_index_drop(uint16_t first_block) {
+    for (int i = 0; i < FS_CHAIN_INDEX_SLOTS; i++) {
+        if (chain_index[i].first_block == first_block) {
+            chain_index[i].first_block = FS_FAT_EOF;
+        }
+    }
+}
+
+// Add a block to the end of an indexed run list; returns false once the slot is full
+static bool chain_index_push(fs_chain_index_t* idx, uint16_t logical, uint16_t block) {
+    if (idx->count > 0) {
+        fs_chain_run_t* last = &idx->runs[idx->count - 1];
+        if (last->start + last->length == block && last->length < 0xFFFF) {
+            last->length++;
+            return true;
+        }
+    }
+    if (idx->count == FS_CHAIN_INDEX_RUNS) {
+        idx->truncated = true;
+        return false;
+    }
+    idx->runs[idx->count].logical = logical;
+    idx->runs[idx->count].start = block;
+    idx->runs[idx->count].length = 1;
+    idx->count++;
+    return true;
+}
+
+// Find the index for a chain, building it (and evicting the least recently used slot) if needed
+static fs_chain_index_t* chain_index_get(uint16_t first_block) {
+    if (first_block == FS_FAT_EOF) return NULL;
+
+    fs_chain_index_t* victim = &chain_index[0];
+    for (int i = 0; i < FS_CHAIN_INDEX_SLOTS; i++) {
+        fs_chain_index_t* idx = &chain_index[i];
+        if (idx->first_block == first_block) {
+            idx->last_used = ++chain_index_clock;
+            return idx;
+        }
+        if (idx->first_block == FS_FAT_EOF) {
+            if (victim->first_block != FS_FAT_EOF) victim = idx;
+        } else if (victim->first_block != FS_FAT_EOF && idx->last_used < victim->last_used) {
+            victim = idx;
+        }
+    }
+
+    victim->first_block = first_block;
+    victim->count = 0;
+    victim->truncated = false;
+    victim->last_used = ++chain_index_clock;
+
+    uint16_t block = first_block;
+    uint16_t logical = 0;
+    while (block != FS_FAT_EOF && block < FS_MAX_BLOCKS) {
+        if (!chain_index_push(victim, logical, block)) break;
+        block = fat_table[block].next_block;
+        logical++;
+    }
+    return victim;
+}
+
+// Record blocks appended to an indexed chain, so growing a file keeps its index warm
+static void chain_index_append(uint16_t first_block, uint32_t logical, uint16_t block) {
+    for (int i = 0; i < FS_CHAIN_INDEX_SLOTS; i++) {
+        fs_chain_index_t* idx = &chain_index[i];
+        if (idx->first_block == first_block) {
+            if (!idx->truncated) chain_index_push(idx, logical, block);
+            return;
+        }
+    }
+}
+
+// Map a file block through the chain index
+static uint16_t chain_index_map(uint16_t first_block, uint32_t lblock, uint32_t* run) {
+    fs_chain_index_t* idx = chain_index_get(first_block);
+    *run = 0;
+    if (idx == NULL || idx->count == 0) return FS_FAT_EOF;
+
+    const fs_chain_run_t* last = &idx->runs[idx->count - 1];
+    if (lblock >= (uint32_t)last->logical + last->length) {
+        if (!idx->truncated) return FS_FAT_EOF;
+
+        // Past what the slot could hold: walk on from the last indexed block
+        uint16_t block = last->start + last->length - 1;
+        uint32_t i = last->logical + last->length - 1;
+        while (i < lblock && block != FS_FAT_EOF) {
+            block = fat_table[block].next_block;
+            i++;
+        }
+        if (block == FS_FAT_EOF) return FS_FAT_EOF;
+        uint16_t cur = block;
+        *run = 1;
+        while (fat_table[cur].next_block == cur + 1) {
+            cur++;
+            (*run)++;
+        }
+        return block;
+    }
+
+    uint32_t lo = 0, hi = idx->count - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (idx->runs[mid].logical <= lblock) lo = mid;
+        else hi = mid - 1;
+    }
+    const fs_chain_run_t* r = &idx->runs[lo];
+    uint32_t offset = lblock - r->logical;
+    *run = r->length - offset;
+    return r->start + offset;
+}
+
+/* ===== File System Core Functions ===== */
+
+// Initialize the file system (read superblock, FAT, and root directory)
+static int fs_init_impl() {
+    // Check if disk is detected first
+    if (!disk_detected()) {
+        return FS_NO_DISK;
+    }
+
+    // Read superblock (block 0)
+    uint8_t block[FS_BLOCK_SIZE];
+    if (!disk_read(0, block)) {
+        return FS_IO_ERROR;
+    }
+    memcpy(&superblock, block, sizeof(superblock));
+
+    // Check if filesystem exists
+    if ((superblock.magic != FS_MAGIC && superblock.magic != FS_MAGIC_EXTENT) ||
+        superblock.version != FS_VERSION ||
+        superblock.fat_blocks > FS_FAT_BLOCKS) {
+        return FS_UNFORMATTED;
+    }
+
+    // Finish a transaction that committed before an unclean shutdown
+    fs_txn.count = 0;
+    fs_txn.ops = 0;
+    fs_freed_reset();
+    fs_journal_replayed = 0;
+    if (superblock.journal_blocks > 0) {
+        int replayed = journal_replay(superblock.journal_start, superblock.journal_blocks);
+        if (replayed < 0) {
+            return replayed;
+        }
+        if (replayed > 0) {
+            fs_journal_replayed = replayed;
+            if (!disk_read(0, block)) {
+                return FS_IO_ERROR;
+            }
+            memcpy(&superblock, block, sizeof(superblock));
+        }
+    }
+
+    // Read FAT (starts at block 1)
+    uint32_t fat_size = superblock.fat_blocks;
+    for (uint32_t i = 0; i < fat_size; i++) {
+        if (!disk_read(1 + i, (uint8_t*)fat_table + i * FS_BLOCK_SIZE)) {
+            return FS_IO_ERROR;
+        }
+    }
+
+    // Read root directory
+    if (!dir_read_block(superblock.root_dir_block, current_dir)) {
+        return FS_IO_ERROR;
+    }
+
+    current_dir_block = superblock.root_dir_block;
+    fs_extent_layout = (superblock.magic == FS_MAGIC_EXTENT);
+    chain_index_reset();
+    dcache_reset();
+    strcpy(current_path, "/");
+    memset(fat_dirty, 0, sizeof(fat_dirty));
+    superblock_dirty = false;
+    fs_initialized = true;
+    if (dir_hook) dir_hook(NULL, true);
+    return FS_OK;
+}
+
+int fs_init() {
+    TRACE_BEGIN_EVENT(TRACE_FS_INIT, 0, 0);
+    int result = fs_init_impl();
+    TRACE_END_EVENT(TRACE_FS_INIT, result);
+    return result;
+}
+
+// Create default directories during formatting
+void create_default_directories() {
+    const char* default_dirs[] = {"bin", "home", "tmp", "usr", "var"};
+    size_t num_dirs = sizeof(default_dirs)/sizeof(default_dirs[0]);
+    for (size_t i = 0; i < num_dirs; i++) {
+        fs_create(default_dirs[i], FS_ATTR_DIR);
+    }
+}
+
+// Format a new filesystem using one of the FS_LAYOUT_* file layouts
+static int fs_format_impl(uint32_t layout) {
+    // Check if disk is detected first
+    if (!disk_detected()) {
+        return FS_NO_DISK;
+    }
+
+    // Anything still pending belongs to the volume we're about to wipe
+    fs_txn.count = 0;
+    fs_txn.ops = 0;
+    fs_freed_reset();
+    memset(fat_dirty, 0, sizeof(fat_dirty));
+    superblock_dirty = false;
+
+    // Layout: superblock | FAT | root directory | journal | data
+    memset(&superblock, 0, sizeof(superblock));
+    superblock.magic = (layout == FS_LAYOUT_EXTENT) ? FS_MAGIC_EXTENT : FS_MAGIC;
+    superblock.version = FS_VERSION;
+    superblock.block_count = FS_MAX_BLOCKS;
+    superblock.fat_blocks = FS_FAT_BLOCKS;
+    superblock.root_dir_block = FS_ROOT_DIR_BLOCK;
+    superblock.journal_start = FS_ROOT_DIR_BLOCK + 1;
+    superblock.journal_blocks = FS_JOURNAL_BLOCKS;
+    uint32_t data_start = superblock.journal_start + superblock.journal_blocks;
+    superblock.free_blocks = FS_MAX_BLOCKS - data_start;
+
+    // Initialize FAT table, reserving every block before the data area
+    for (uint32_t i = 0; i < FS_MAX_BLOCKS; i++) {
+        fat_table[i].next_block = (i < data_start) ? FS_FAT_RESERVED : FS_FAT_FREE;
+    }
+
+    // Write FAT table
+    for (uint32_t i = 0; i < superblock.fat_blocks; i++) {
+        if (!disk_write(1 + i, (uint8_t*)fat_table + i * FS_BLOCK_SIZE)) {
+            return FS_IO_ERROR;
+        }
+    }
+
+    // Start with an empty journal
+    uint8_t block[FS_BLOCK_SIZE];
+    memset(block, 0, sizeof(block));
+    if (!disk_write(superblock.journal_start, block)) {
+        return FS_IO_ERROR;
+    }
+
+    // Initialize root directory
+    dir_entry_t root_dir[DIR_ENTRIES_PER_BLOCK] = {0};
+    root_dir[0].attributes = FS_ATTR_DIR;
+    strcpy(root_dir[0].filename, ".");
+    root_dir[0].first_block = FS_ROOT_DIR_BLOCK;
+    
+    root_dir[1].attributes = FS_ATTR_DIR;
+    strcpy(root_dir[1].filename, "..");
+    root_dir[1].first_block = FS_ROOT_DIR_BLOCK;
+
+    memcpy(block, root_dir, sizeof(root_dir));
+    if (!disk_write(FS_ROOT_DIR_BLOCK, block)) {
+        return FS_IO_ERROR;
+    }
+
+    // Write the superblock last so a half-formatted disk is never mounted
+    memset(block, 0, sizeof(block));
+    memcpy(block, &superblock, sizeof(superblock));
+    if (!disk_write(0, block)) {
+        return FS_IO_ERROR;
+    }
+
+    // Update current directory in memory
+    memcpy(current_dir, root_dir, sizeof(current_dir));
+    current_dir_block = FS_ROOT_DIR_BLOCK;
+    fs_extent_layout = (layout == FS_LAYOUT_EXTENT);
+    chain_index_reset();
+    dcache_reset();
+    strcpy(current_path, "/");
+    fs_initialized = true;
+    if (dir_hook) dir_hook(NULL, true);
+
+    // Create default directories
+    create_default_directories();
+
+    return fs_sync();
+}
+
+int fs_format(uint32_t layout) {
+    TRACE_BEGIN_EVENT(TRACE_FS_FORMAT, layout, 0);
+    int result = fs_format_impl(layout);
+    TRACE_END_EVENT(TRACE_FS_FORMAT, result);
+    return result;
+}
+
+// Free, and not still used by the committed metadata (see the journal)
+static bool fs_block_available(uint32_t block) {
+    return fat_table[block].next_block == FS_FAT_FREE && !fs_block_freed(block);
+}
+
+// Find a free block in the FAT
+int fs_find_free_block() {
+    for (uint32_t i = 1; i < superblock.block_count && i < FS_MAX_BLOCKS; i++) {
+        if (fs_block_available(i)) {
+            return i;
+        }
+    }
+    return -1;  // No free blocks
+}
+
+// Allocate a block as a one-block chain
+static int fs_alloc_block() {
+    int block = fs_find_free_block();
+    if (block == -1) return -1;
+
+    fat_set(block, FS_FAT_EOF);
+    superblock.free_blocks--;
+    superblock_dirty = true;
+    return block;
+}
+
+// Return every block of a chain to the free pool
+static void fs_free_chain(uint16_t block) {
+    while (block != FS_FAT_EOF && block < FS_MAX_BLOCKS) {
+        uint16_t next_block = fat_table[block].next_block;
+        if (next_block == FS_FAT_FREE || next_block == FS_FAT_RESERVED) {
+            break;  // Not part of a chain
+        }
+        fat_set(block, FS_FAT_FREE);
+        superblock.free_blocks++;
+        superblock_dirty = true;
+        block = next_block;
+    }
+}
+
+/* ===== Tail Packing ===== */
+/*
+ * Files of at most FS_TAIL_MAX bytes are stored as runs of 32-byte units in
+ * shared tail blocks. Tail blocks are written through the journal like the
+ * directory that points into them, so a tiny file costs a fraction of one
+ * block image in the next commit instead of a data block plus a FAT update.
+ * Units freed by the running transaction, like whole blocks, aren't used
+ * again until it commits.
+ */
+static bool tail_read_block(uint32_t block, uint8_t* buf) {
+    if (!fs_meta_read(block, buf)) return false;
+    return ((fs_tail_header_t*)buf)->magic == FS_TAIL_MAGIC;
+}
+
+static uint16_t tail_mask(uint32_t unit, uint32_t size) {
+    uint32_t units = (size + FS_TAIL_UNIT - 1) / FS_TAIL_UNIT;
+    return (uint16_t)(((1u << units) - 1) << unit);
+}
+
+// Find 'units' free units in a row, returns 0 if the block can't take them
+static uint32_t tail_find_units(uint16_t used, uint32_t size) {
+    for (uint32_t unit = 1; unit + (size + FS_TAIL_UNIT - 1) / FS_TAIL_UNIT <= FS_TAIL_UNITS; unit++) {
+        if ((used & tail_mask(unit, size)) == 0) return unit;
+    }
+    return 0;
+}
+
+// Pack 'data' into a tail block and point 'entry' at it; the entry is untouched on failure
+static int tail_store(dir_entry_t* entry, const void* data, uint32_t size) {
+    uint8_t buf[FS_BLOCK_SIZE];
+    fs_tail_header_t* header = (fs_tail_header_t*)buf;
+    uint32_t block = superblock.tail_block;
+    uint32_t unit = 0;
+
+    if (block != 0 && tail_read_block(block, buf)) {
+        unit = tail_find_units(header->used | tail_freed[block], size);
+    }
+    if (unit == 0) {
+        // Start a new tail block
+        int new_block = fs_alloc_block();
+        if (new_block == -1) return FS_FULL;
+        block = new_block;
+        memset(buf, 0, sizeof(buf));
+        header->magic = FS_TAIL_MAGIC;
+        header->used = 1;
+        unit = 1;
+        superblock.tail_block = block;
+        superblock_dirty = true;
+    }
+
+    uint8_t* dest = buf + unit * FS_TAIL_UNIT;
+    memset(dest, 0, ((size + FS_TAIL_UNIT - 1) / FS_TAIL_UNIT) * FS_TAIL_UNIT);
+    memcpy(dest, data, size);
+    header->used |= tail_mask(unit, size);
+    if (!fs_meta_write(block, buf)) return FS_IO_ERROR;
+
+    entry->first_block = block;
+    entry->tail_unit = unit;
+    entry->attributes |= FS_ATTR_TAIL;
+    return FS_OK;
+}
+
+// Give a file's units back, freeing the tail block once nothing is left in it
+static void tail_release(const dir_entry_t* entry) {
+    uint8_t buf[FS_BLOCK_SIZE];
+    fs_tail_header_t* header = (fs_tail_header_t*)buf;
+    if (!tail_read_block(entry->first_block, buf)) return;
+
+    header->used &= ~tail_mask(entry->tail_unit, entry->size);
+    if (superblock.journal_blocks > 0) {
+        tail_freed[entry->first_block] |= tail_mask(entry->tail_unit, entry->size);
+    }
+    if (header->used == 1) {
+        fat_set(entry->first_block, FS_FAT_FREE);
+        superblock.free_blocks++;
+        if (superblock.tail_block == entry->first_block) {
+            superblock.tail_block = 0;
+        }
+        superblock_dirty = true;
+        return;
+    }
+
+    fs_meta_write(entry->first_block, buf);
+    if (superblock.tail_block == 0) {
+        // Refill partly used blocks before starting new ones
+        superblock.tail_block = entry->first_block;
+        superblock_dirty = true;
+    }
+}
+
+// Copy part of a packed file out of its tail block
+static int tail_read(const dir_entry_t* entry, uint32_t offset, void* buffer, uint32_t length) {
+    uint8_t buf[FS_BLOCK_SIZE];
+    if (!tail_read_block(entry->first_block, buf)) return FS_IO_ERROR;
+    memcpy(buffer, buf + entry->tail_unit * FS_TAIL_UNIT + offset, length);
+    return length;
+}
+
+/* ===== Block Mapping ===== */
+/*
+ * Both layouts answer the same question - which disk block holds file
+ * block N, and how many blocks after it are contiguous on disk - so the
+ * read and write paths move whole runs with disk_read_blocks/disk_write_blocks.
+ */
+
+static bool extent_read_block(uint32_t block, fs_extent_block_t* eb) {
+    return fs_meta_read(block, eb);
+}
+
+static bool extent_write_block(uint32_t block, const fs_extent_block_t* eb) {
+    return fs_meta_write(block, eb);
+}
+
+// Map file block 'lblock' to a disk block; *run receives the contiguous blocks from there on
+static uint16_t fs_bmap(const dir_entry_t* entry, uint32_t lblock, uint32_t* run) {
+    *run = 0;
+    if (!fs_extent_layout) {
+        return chain_index_map(entry->first_block, lblock, run);
+    }
+
+    fs_extent_block_t eb;
+    uint16_t eblock = entry->first_block;
+    while (eblock != FS_FAT_EOF) {
+        if (!extent_read_block(eblock, &eb) || eb.count == 0 || eb.count > FS_EXTENTS_PER_BLOCK) return FS_FAT_EOF;
+
+        const fs_extent_t* last = &eb.extents[eb.count - 1];
+        if (lblock < last->logical + last->length) {
+            // Binary search for the last extent starting at or before lblock
+            uint32_t lo = 0, hi = eb.count - 1;
+            while (lo < hi) {
+                uint32_t mid = (lo + hi + 1) / 2;
+                if (eb.extents[mid].logical <= lblock) lo = mid;
+                else hi = mid - 1;
+            }
+            const fs_extent_t* ext = &eb.extents[lo];
+            if (lblock < ext->logical) return FS_FAT_EOF;
+            uint32_t offset = lblock - ext->logical;
+            *run = ext->length - offset;
+            return ext->start + offset;
+        }
+        eblock = eb.next;
+    }
+    return FS_FAT_EOF;
+}
+
+// Find a free run of up to 'want' blocks, trying 'goal' first so files stay contiguous
+static uint32_t fs_find_free_run(uint32_t goal, uint32_t want, uint32_t* start) {
+    uint32_t limit = superblock.block_count < FS_MAX_BLOCKS ? superblock.block_count : FS_MAX_BLOCKS;
+    uint32_t best_start = 0, best_len = 0;
+
+    if (goal > 0 && goal < limit && fs_block_available(goal)) {
+        best_start = goal;
+        while (best_len < want && goal + best_len < limit && fs_block_available(goal + best_len)) {
+            best_len++;
+        }
+        *start = best_start;
+        return best_len;
+    }
+
+    // First run long enough, otherwise the longest one
+    uint32_t i = 1;
+    while (i < limit) {
+        if (!fs_block_available(i)) {
+            i++;
+            continue;
+        }
+        uint32_t len = 0;
+        while (i + len < limit && len < want && fs_block_available(i + len)) {
+            len++;
+        }
+        if (len > best_len) {
+            best_start = i;
+            best_len = len;
+            if (len == want) break;
+        }
+        i += len;
+    }
+    *start = best_start;
+    return best_len;
+}
+
+// Add a run to the end of a file's extent list, merging with the last extent when adjacent
+static int extent_append(dir_entry_t* entry, uint32_t logical, uint16_t start, uint16_t length) {
+    fs_extent_block_t eb;
+    uint32_t eblock;
+
+    if (entry->first_block == FS_FAT_EOF) {
+        int new_block = fs_alloc_block();
+        if (new_block == -1) return FS_FULL;
+        memset(&eb, 0, sizeof(eb));
+        eb.next = FS_FAT_EOF;
+        entry->first_block = new_block;
+        eblock = new_block;
+    } else {
+        eblock = entry->first_block;
+        if (!extent_read_block(eblock, &eb)) return FS_IO_ERROR;
+        while (eb.next != FS_FAT_EOF) {
+            eblock = eb.next;
+            if (!extent_read_block(eblock, &eb)) return FS_IO_ERROR;
+        }
+    }
+
+    if (eb.count > 0) {
+        fs_extent_t* last = &eb.extents[eb.count - 1];
+        if (last->start + last->length == start && last->logical + last->length == logical &&
+            (uint32_t)last->length + length <= 0xFFFF) {
+            last->length += length;
+            return extent_write_block(eblock, &eb) ? FS_OK : FS_IO_ERROR;
+        }
+    }
+
+    if (eb.count == FS_EXTENTS_PER_BLOCK) {
+        // Spill into an indirect extent block
+        int new_block = fs_alloc_block();
+        if (new_block == -1) return FS_FULL;
+        eb.next = new_block;
+        if (!extent_write_block(eblock, &eb)) return FS_IO_ERROR;
+        memset(&eb, 0, sizeof(eb));
+        eb.next = FS_FAT_EOF;
+        eblock = new_block;
+    }
+
+    eb.extents[eb.count].logical = logical;
+    eb.extents[eb.count].start = start;
+    eb.extents[eb.count].length = length;
+    eb.count++;
+    return extent_write_block(eblock, &eb) ? FS_OK : FS_IO_ERROR;
+}
+
+// Blocks currently mapped by a file; *tail receives the last disk block (FS_FAT_EOF if none)
+static uint32_t fs_file_blocks(const dir_entry_t* entry, uint16_t* tail) {
+    *tail = FS_FAT_EOF;
+    if (entry->first_block == FS_FAT_EOF) return 0;
+
+    if (!fs_extent_layout) {
+        fs_chain_index_t* idx = chain_index_get(entry->first_block);
+        if (idx != NULL && !idx->truncated && idx->count > 0) {
+            const fs_chain_run_t* last = &idx->runs[idx->count - 1];
+            *tail = last->start + last->length - 1;
+            return last->logical + last->length;
+        }
+
+        uint32_t count = 1;
+        uint16_t block = entry->first_block;
+        while (fat_table[block].next_block != FS_FAT_EOF) {
+            block = fat_table[block].next_block;
+            count++;
+        }
+        *tail = block;
+        return count;
+    }
+
+    fs_extent_block_t eb;
+    uint16_t eblock = entry->first_block;
+    do {
+        if (!extent_read_block(eblock, &eb)) return 0;
+        eblock = eb.next;
+    } while (eblock != FS_FAT_EOF);
+    if (eb.count == 0) return 0;
+
+    const fs_extent_t* last = &eb.extents[eb.count - 1];
+    *tail = last->start + last->length - 1;
+    return last->logical + last->length;
+}
+
+// Grow a file to at least 'blocks_needed' blocks
+static int fs_extend(dir_entry_t* entry, uint32_t blocks_needed) {
+    uint16_t tail;
+    uint32_t current_blocks = fs_file_blocks(entry, &tail);
+    if (blocks_needed <= current_blocks) return FS_OK;
+
+    uint32_t additional = blocks_needed - current_blocks;
+    if (!fs_extent_layout) {
+        if (fs_available_blocks() < additional) return FS_FULL;
+
+        for (uint32_t i = 0; i < additional; i++) {
+            int new_block = fs_alloc_block();
+            if (new_block == -1) return FS_FULL;
+
+            if (tail == FS_FAT_EOF) {
+                entry->first_block = new_block;
+            } else {
+                fat_set(tail, new_block);
+            }
+            chain_index_append(entry->first_block, current_blocks + i, new_block);
+            tail = new_block;
+        }
+        return FS_OK;
+    }
+
+    // Room for the data and the root extent block. Running out of space for
+    // indirect extent blocks part way through still leaves a consistent file,
+    // it just keeps the runs that were attached.
+    if (fs_available_blocks() < additional + (entry->first_block == FS_FAT_EOF ? 1u : 0u)) return FS_FULL;
+
+    uint32_t goal = (tail == FS_FAT_EOF) ? 0 : tail + 1u;
+    while (additional > 0) {
+        uint32_t start;
+        uint32_t want = additional > 0xFFFF ? 0xFFFF : additional;
+        uint32_t len = fs_find_free_run(goal, want, &start);
+        if (len == 0) return FS_FULL;
+
+        for (uint32_t b = start; b < start + len; b++) {
+            fat_set(b, FS_FAT_EOF);
+        }
+        superblock.free_blocks -= len;
+        superblock_dirty = true;
+
+        int result = extent_append(entry, current_blocks, start, len);
+        if (result != FS_OK) return result;
+
+        current_blocks += len;
+        additional -= len;
+        goal = start + len;
+    }
+    return FS_OK;
+}
+
+// Release every block owned by a directory entry
+static void fs_release(const dir_entry_t* entry) {
+    if (entry->attributes & FS_ATTR_TAIL) {
+        tail_release(entry);
+        return;
+    }
+    if (!fs_extent_layout || (entry->attributes & FS_ATTR_DIR)) {
+        chain_index_drop(entry->first_block);
+        fs_free_chain(entry->first_block);
+        return;
+    }
+
+    fs_extent_block_t eb;
+    uint16_t eblock = entry->first_block;
+    while (eblock != FS_FAT_EOF && eblock < FS_MAX_BLOCKS) {
+        if (!extent_read_block(eblock, &eb)) return;
+        for (uint32_t i = 0; i < eb.count; i++) {
+            for (uint32_t b = 0; b < eb.extents[i].length; b++) {
+                fat_set(eb.extents[i].start + b, FS_FAT_FREE);
+            }
+            superblock.free_blocks += eb.extents[i].length;
+        }
+        fat_set(eblock, FS_FAT_FREE);
+        superblock.free_blocks++;
+        superblock_dirty = true;
+        eblock = eb.next;
+    }
+}
+
+/* ===== Path Resolution ===== */
+static dir_entry_t fs_dir_scratch[DIR_ENTRIES_PER_BLOCK];
+
+// Load a directory block for modification; the current directory is edited in place
+static dir_entry_t* fs_dir_load(uint32_t block) {
+    if (block == current_dir_block) return current_dir;
+    if (!dir_read_block(block, fs_dir_scratch)) return NULL;
+    return fs_dir_scratch;
+}
+
+// Look up 'name' in a directory through the dentry cache; *slot is -1 if it doesn't exist
+static int fs_lookup(uint32_t dir_block, const char* name, int* slot, dir_entry_t* entry) {
+    dir_entry_t entries[DIR_ENTRIES_PER_BLOCK];
+    const dir_entry_t* record = NULL;
+    int found = -1;
+
+    fs_dentry_t* d = dcache_find(dir_block, name);
+    if (d != NULL) {
+        found = d->slot;
+        record = &d->entry;
+    } else {
+        const dir_entry_t* dir = entries;
+        if (dir_block == current_dir_block) {
+            dir = current_dir;
+        } else if (!dir_read_block(dir_block, entries)) {
+            return FS_IO_ERROR;
+        }
+
+        for (size_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+            if (dir[i].filename[0] != '\0' && strcmp(dir[i].filename, name) == 0) {
+                found = i;
+                record = &dir[i];
+                break;
+            }
+        }
+        dcache_insert(dir_block, name, found, record);
+    }
+
+    if (slot) *slot = found;
+    if (found < 0) return FS_NOT_FOUND;
+    if (entry) *entry = *record;
+    return FS_OK;
+}
+
+// Walk every component of 'path' but the last, which is copied to 'leaf' (empty for "/")
+static int fs_walk(const char* path, uint32_t* dir_block, char* leaf) {
+    if (path == NULL) return FS_INVALID_NAME;
+
+    uint32_t dir = (path[0] == '/') ? superblock.root_dir_block : current_dir_block;
+    const char* p = path;
+    leaf[0] = '\0';
+
+    while (1) {
+        while (*p == '/') p++;
+        if (*p == '\0') break;
+
+        const char* end = p;
+        while (*end != '\0' && *end != '/') end++;
+        size_t len = end - p;
+        if (len >= FS_FILENAME_LEN) return FS_INVALID_NAME;
+
+        char name[FS_FILENAME_LEN];
+        memcpy(name, p, len);
+        name[len] = '\0';
+
+        p = end;
+        while (*p == '/') p++;
+        if (*p == '\0') {
+            strcpy(leaf, name);
+            break;
+        }
+
+        // Intermediate components must be directories; . and .. resolve through their records
+        dir_entry_t entry;
+        int result = fs_lookup(dir, name, NULL, &entry);
+        if (result != FS_OK) return result;
+        if (!(entry.attributes & FS_ATTR_DIR)) return FS_NOT_FOUND;
+        dir = entry.first_block;
+    }
+
+    *dir_block = dir;
+    return FS_OK;
+}
+
+// Resolve a path to its directory record; *dir_block and *slot locate it on disk
+static int fs_resolve(const char* path, uint32_t* dir_block, int* slot, dir_entry_t* entry) {
+    char leaf[FS_FILENAME_LEN];
+    int result = fs_walk(path, dir_block, leaf);
+    if (result != FS_OK) return result;
+
+    if (leaf[0] == '\0') {
+        // "/" (or only slashes) names the walked-to directory itself
+        memset(entry, 0, sizeof(dir_entry_t));
+        strcpy(entry->filename, ".");
+        entry->attributes = FS_ATTR_DIR;
+        entry->first_block = *dir_block;
+        *slot = -1;
+        return FS_OK;
+    }
+    return fs_lookup(*dir_block, leaf, slot, entry);
+}
+
+// Combine an absolute 'base' with 'path' into a canonical absolute path without . or ..
+bool fs_normalize_path(const char* base, const char* path, char* out, size_t size) {
+    size_t len = 0;
+    if (size < 2) return false;
+
+    if (path[0] != '/') {
+        len = strlen(base);
+        if (len >= size) return false;
+        strcpy(out, base);
+        if (len == 1) len = 0;  // Root is just "/"
+    }
+    out[len] = '\0';
+
+    const char* p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        if (*p == '\0') break;
+        const char* end = p;
+        while (*end != '\0' && *end != '/') end++;
+        size_t comp = end - p;
+
+        if (comp == 2 && p[0] == '.' && p[1] == '.') {
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;  // Drop the separator too
+            out[len] = '\0';
+        } else if (!(comp == 1 && p[0] == '.')) {
+            if (len + 1 + comp >= size) return false;
+            out[len++] = '/';
+            memcpy(out + len, p, comp);
+            len += comp;
+            out[len] = '\0';
+        }
+        p = end;
+    }
+
+    if (len == 0) {
+        strcpy(out, "/");
+    }
+    return true;
+}
+
+
+// Validate filename
+bool fs_is_valid_filename(const char* filename) {
+    if (filename == NULL || strlen(filename) == 0 || strlen(filename) >= FS_FILENAME_LEN) {
+        return false;
+    }
+    
+    // Check for invalid characters
+    const char* invalid_chars = "/\\?*:|\"<>";
+    for (size_t i = 0; i < strlen(filename); i++) {
+        if (strchr(invalid_chars, filename[i]) != NULL) {
+            return false;
+        }
+    }
+    
+    // Check for reserved names
+    const char* reserved_names[] = {"CON", "PRN", "AUX", "NUL", "COM1", "COM2", "LPT1", "LPT2", NULL};
+    for (int i = 0; reserved_names[i] != NULL; i++) {
+        if (strcasecmp(filename, reserved_names[i]) == 0) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Create a new file or directory at 'path'
+static int fs_create_impl(const char* path, uint8_t attributes) {
+    // Check if disk is detected first
+    if (!disk_detected()) {
+        return FS_NO_DISK;
+    }
+
+    uint32_t dir_block;
+    char filename[FS_FILENAME_LEN];
+    int result = fs_walk(path, &dir_block, filename);
+    if (result != FS_OK) {
+        return result;
+    }
+
+    // Validate filename
+    if (!fs_is_valid_filename(filename)) {
+        return FS_INVALID_NAME;
+    }
+
+    // Check if file exists
+    result = fs_lookup(dir_block, filename, NULL, NULL);
+    if (result != FS_NOT_FOUND) {
+        return result == FS_OK ? FS_EXISTS : result;
+    }
+
+    dir_entry_t* dir = fs_dir_load(dir_block);
+    if (dir == NULL) {
+        return FS_IO_ERROR;
+    }
+
+    // Find empty directory entry
+    int entry_index = -1;
+    for (size_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+        if (dir[i].filename[0] == '\0') {
+            entry_index = i;
+            break;
+        }
+    }
+    if (entry_index == -1) {
+        return FS_FULL;
+    }
+
+    result = fs_txn_begin((attributes & FS_ATTR_DIR) ? 1 : 0);
+    if (result != FS_OK) {
+        return result;
+    }
+
+    // Create new entry
+    dir_entry_t* entry = &dir[entry_index];
+    memset(entry, 0, sizeof(dir_entry_t));
+    strncpy(entry->filename, filename, FS_FILENAME_LEN);
+    entry->size = 0;
+    entry->attributes = attributes;
+    entry->first_block = FS_FAT_EOF;  // No blocks allocated yet for files
+
+    if (attributes & FS_ATTR_DIR) {
+        // Allocate a block for the directory
+        int new_block = fs_alloc_block();
+        if (new_block == -1) {
+            // Free the directory entry we just took
+            memset(entry, 0, sizeof(dir_entry_t));
+            return FS_FULL;
+        }
+        entry->first_block = new_block;
+
+        // Initialize the directory block with . and ..
+        dir_entry_t new_dir[DIR_ENTRIES_PER_BLOCK] = {0};
+        
+        // Create . entry
+        strcpy(new_dir[0].filename, ".");
+        new_dir[0].attributes = FS_ATTR_DIR;
+        new_dir[0].first_block = new_block;
+        
+        // Create .. entry
+        strcpy(new_dir[1].filename, "..");
+        new_dir[1].attributes = FS_ATTR_DIR;
+        new_dir[1].first_block = dir_block; // Parent directory block
+
+        // Stage the new directory block
+        if (!dir_write_block(new_block, new_dir)) {
+            // If staging fails, free the block and the directory entry
+            fs_free_chain(new_block);
+            memset(entry, 0, sizeof(dir_entry_t));
+            return FS_IO_ERROR;
+        }
+    }
+
+    // Write directory back in the same transaction as the FAT and superblock
+    if (!dir_write_block(dir_block, dir)) {
+        // If we created a directory, we need to free the block
+        if (attributes & FS_ATTR_DIR) {
+            fs_free_chain(entry->first_block);
+        }
+        // Free the directory entry
+        memset(entry, 0, sizeof(dir_entry_t));
+        return FS_IO_ERROR;
+    }
+
+    result = fs_txn_end();
+    if (result == FS_OK && dir_block == current_dir_block && dir_hook) {
+        dir_hook(filename, true);
+    }
+    return result;
+}
+
+int fs_create(const char* path, uint8_t attributes) {
+    TRACE_BEGIN_EVENT(TRACE_FS_CREATE, attributes, 0);
+    int result = fs_create_impl(path, attributes);
+    TRACE_END_EVENT(TRACE_FS_CREATE, result);
+    return result;
+}
+
+// Write data to a file
+// Point a directory record at 'size' bytes of 'data', inside the running transaction
+static int fs_write_entry(uint32_t dir_block, dir_entry_t* dir, dir_entry_t* entry, const void* data, uint32_t size) {
+    dir_entry_t old = *entry;
+    if (size > 0 && size <= FS_TAIL_MAX) {
+        // Small enough to pack; any blocks or units it had go back afterwards
+        int result = tail_store(entry, data, size);
+        if (result != FS_OK) {
+            return result;
+        }
+        fs_release(&old);
+        entry->size = size;
+        return dir_write_block(dir_block, dir) ? FS_OK : FS_IO_ERROR;
+    }
+
+    if (old.attributes & FS_ATTR_TAIL) {
+        // Outgrew its tail units: move it onto blocks of its own
+        entry->attributes &= ~FS_ATTR_TAIL;
+        entry->tail_unit = 0;
+        entry->first_block = FS_FAT_EOF;
+        entry->size = 0;
+    }
+
+    // Allocate new blocks if needed
+    uint32_t blocks_needed = (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    int result = fs_extend(entry, blocks_needed);
+    if (result != FS_OK) {
+        if (old.attributes & FS_ATTR_TAIL) {
+            // Keep the packed copy rather than a half-moved file
+            fs_release(entry);
+            *entry = old;
+        }
+        // Whatever got attached is consistent, just not filled yet
+        dir_write_block(dir_block, dir);
+        return result;
+    }
+
+    // Write data one contiguous run at a time. Data goes straight to disk
+    // ahead of the metadata commit that makes the new blocks reachable.
+    uint32_t bytes_written = 0;
+    uint32_t lblock = 0;
+    const uint8_t* data_ptr = (const uint8_t*)data;
+    uint8_t tail[FS_BLOCK_SIZE];
+    
+    while (bytes_written < size) {
+        uint32_t run;
+        uint16_t block = fs_bmap(entry, lblock, &run);
+        if (block == FS_FAT_EOF) {
+            result = FS_IO_ERROR;
+            break;
+        }
+
+        uint32_t full_blocks = (size - bytes_written) / FS_BLOCK_SIZE;
+        if (run > full_blocks) run = full_blocks;
+
+        if (run > 0) {
+            if (!disk_write_blocks(block, run, data_ptr + bytes_written)) {
+                result = FS_IO_ERROR;
+                break;
+            }
+            bytes_written += run * FS_BLOCK_SIZE;
+            lblock += run;
+        } else {
+            // Don't read past the end of the caller's buffer
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, data_ptr + bytes_written, size - bytes_written);
+            if (!disk_write(block, tail)) {
+                result = FS_IO_ERROR;
+                break;
+            }
+            bytes_written = size;
+        }
+    }
+
+    if (result == FS_OK) {
+        entry->size = size;
+        if (old.attributes & FS_ATTR_TAIL) {
+            fs_release(&old);
+        }
+    } else if (old.attributes & FS_ATTR_TAIL) {
+        fs_release(entry);
+        *entry = old;
+    }
+
+    // Update directory; on failure the blocks stay attached, like a failed extend
+    if (!dir_write_block(dir_block, dir)) {
+        return FS_IO_ERROR;
+    }
+    return result;
+}
+
+static int fs_write_impl(const char* path, const void* data, uint32_t size) {
+    // Check if disk is detected first
+    if (!disk_detected()) {
+        return FS_NO_DISK;
+    }
+
+    // Find the file
+    uint32_t dir_block;
+    int slot;
+    dir_entry_t found;
+    int result = fs_resolve(path, &dir_block, &slot, &found);
+    if (result != FS_OK) {
+        return result;
+    }
+    if (found.attributes & FS_ATTR_DIR) {
+        return FS_ERROR;
+    }
+
+    dir_entry_t* dir = fs_dir_load(dir_block);
+    if (dir == NULL) {
+        return FS_IO_ERROR;
+    }
+
+    // The data, plus a tail or extent block
+    result = fs_txn_begin((size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE + 1);
+    if (result != FS_OK) {
+        return result;
+    }
+
+    // FAT, extent blocks and superblock go into the same transaction, even
+    // when the write failed part way
+    result = fs_write_entry(dir_block, dir, &dir[slot], data, size);
+    int end = fs_txn_end();
+    return result != FS_OK ? result : end;
+}
+
+int fs_write(const char* path, const void* data, uint32_t size) {
+    TRACE_BEGIN_EVENT(TRACE_FS_WRITE, size, 0);
+    int result = fs_write_impl(path, data, size);
+    TRACE_END_EVENT(TRACE_FS_WRITE, result);
+    return result;
+}
+
+// Get the directory record for a path
+static int fs_stat_impl(const char* path, dir_entry_t* entry) {
+    if (!disk_detected()) {
+        return FS_NO_DISK;
+    }
+
+    uint32_t dir_block;
+    int slot;
+    return fs_resolve(path, &dir_block, &slot, entry);
+}
+
+int fs_stat(const char* path, dir_entry_t* entry) {
+    TRACE_BEGIN_EVENT(TRACE_FS_STAT, 0, 0);
+    int result = fs_stat_impl(path, entry);
+    TRACE_END_EVENT(TRACE_FS_STAT, result);
+    return result;
+}
+
+// Read up to 'length' bytes starting at 'offset'; returns the number of bytes read or an error code
+static int fs_read_at_impl(const char* path, uint32_t offset, void* buffer, uint32_t length) {
+    // Check if disk is detected first
+    if (!disk_detected()) {
+        return FS_NO_DISK;
+    }
+
+    // Find the file; the record comes from the dentry cache, no directory read needed
+    uint32_t dir_block;
+    int slot;
+    dir_entry_t entry;
+    int result = fs_resolve(path, &dir_block, &slot, &entry);
+    if (result != FS_OK) {
+        return result;
+    }
+    if (entry.attributes & FS_ATTR_DIR) {
+        return FS_ERROR;
+    }
+
+    if (offset >= entry.size) {
+        return 0;
+    }
+    if (length > entry.size - offset) {
+        length = entry.size - offset;
+    }
+    if (entry.attributes & FS_ATTR_TAIL) {
+        return tail_read(&entry, offset, buffer, length);
+    }
+
+    uint32_t bytes_read = 0;
+    uint8_t* buffer_ptr = (uint8_t*)buffer;
+    uint8_t tail[FS_BLOCK_SIZE];
+
+    while (bytes_read < length) {
+        uint32_t pos = offset + bytes_read;
+        uint32_t within = pos % FS_BLOCK_SIZE;
+        uint32_t run;
+        uint16_t block = fs_bmap(&entry, pos / FS_BLOCK_SIZE, &run);
+        if (block == FS_FAT_EOF) {
+            return FS_IO_ERROR;
+        }
+
+        uint32_t full_blocks = (length - bytes_read) / FS_BLOCK_SIZE;
+        if (within == 0 && full_blocks > 0) {
+            // Block aligned: move the whole run straight into the caller's buffer
+            if (run > full_blocks) run = full_blocks;
+            if (!disk_read_blocks(block, run, buffer_ptr + bytes_read)) {
+                return FS_IO_ERROR;
+            }
+            bytes_read += run * FS_BLOCK_SIZE;
+        } else {
+            // Partial block: bounce it so we don't overrun the caller's buffer
+            uint32_t chunk = FS_BLOCK_SIZE - within;
+            if (chunk > length - bytes_read) chunk = length - bytes_read;
+            if (!disk_read(block, tail)) {
+                return FS_IO_ERROR;
+            }
+            memcpy(buffer_ptr + bytes_read, tail + within, chunk);
+            bytes_read += chunk;
+        }
+    }
+
+    return bytes_read;
+}
+
+int fs_read_at(const char* path, uint32_t offset, void* buffer, uint32_t length) {
+    TRACE_BEGIN_EVENT(TRACE_FS_READ, offset, length > 0xFFFF ? 0xFFFF : length);
+    int result = fs_read_at_impl(path, offset, buffer, length);
+    TRACE_END_EVENT(TRACE_FS_READ, result);
+    return result;
+}
+
+// Read a whole file
+int fs_read(const char* path, void* buffer, uint32_t max_size) {
+    dir_entry_t entry;
+    int result = fs_stat(path, &entry);
+    if (result != FS_OK) {
+        return result;
+    }
+
+    // Check buffer size
+    if (max_size < entry.size) {
+        return FS_ERROR;  // Buffer too small
+    }
+
+    result = fs_read_at(path, 0, buffer, entry.size);
+    return result < 0 ? result : FS_OK;
+}
+
+// Copy the used entries of a directory (the current one if path is NULL)
+static int fs_read_dir_impl(const char* path, dir_entry_t* out, uint32_t max) {
+    dir_entry_t entries[DIR_ENTRIES_PER_BLOCK];
+    const dir_entry_t* dir = current_dir;
+
+    if (path != NULL) {
+        dir_entry_t entry;
+        int result = fs_stat(path, &entry);
+        if (result != FS_OK) {
+            return result;
+        }
+        if (!(entry.attributes & FS_ATTR_DIR)) {
+            return FS_NOT_FOUND;
+        }
+        if (!dir_read_block(entry.first_block, entries)) {
+            return FS_IO_ERROR;
+        }
+        dir = entries;
+    }
+
+    uint32_t count = 0;
+    for (size_t i = 0; i < DIR_ENTRIES_PER_BLOCK && count < max; i++) {
+        if (dir[i].filename[0] != '\0') {
+            out[count++] = dir[i];
+        }
+    }
+    return count;
+}
+
+int fs_read_dir(const char* path, dir_entry_t* entries, uint32_t max) {
+    if (!fs_initialized) return FS_UNFORMATTED;
+    return fs_read_dir_impl(path, entries, max);
+}
+
+// List files in a directory (the current one if path is NULL)
+static int fs_list_impl(const char* path) {
+    dir_entry_t dir[DIR_ENTRIES_PER_BLOCK];
+    int count = fs_read_dir_impl(path, dir, DIR_ENTRIES_PER_BLOCK);
+    if (count < 0) {
+        return count;
+    }
+
+    for (int i = 0; i < count; i++) {
+        // File/directory indicator
+        if (dir[i].attributes & FS_ATTR_DIR) {
+            terminal_writestring("  [D] ");
+        } else {
+            terminal_writestring("  [F] ");
+        }
+
+        // Filename
+        terminal_writestring(dir[i].filename);
+
+        // Size (for files)
+        if (!(dir[i].attributes & FS_ATTR_DIR)) {
+            terminal_writestring(" (");
+            char size_str[16];
+            itoa(dir[i].size, size_str, 10);
+            terminal_writestring(size_str);
+            terminal_writestring(" bytes)");
+        }
+
+        terminal_writestring("\n");
+    }
+    return FS_OK;
+}
+
+int fs_list(const char* path) {
+    TRACE_BEGIN_EVENT(TRACE_FS_LIST, 0, 0);
+    int result = fs_list_impl(path);
+    TRACE_END_EVENT(TRACE_FS_LIST, result);
+    return result;
+}
+
+// Delete a file or an empty directory
+static int fs_delete_impl(const char* path) {
+    // Check if disk is detected first
+    if (!disk_detected()) {
+        return FS_NO_DISK;
+    }
+
+    uint32_t dir_block;
+    char filename[FS_FILENAME_LEN];
+    int result = fs_walk(path, &dir_block, filename);
+    if (result != FS_OK) {
+        return result;
+    }
+
+    // The . and .. entries belong to the directory itself
+    if (filename[0] == '\0' || strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0) {
+        return FS_INVALID_NAME;
+    }
+
+    // Find the file
+    int entry_index;
+    dir_entry_t entry;
+    result = fs_lookup(dir_block, filename, &entry_index, &entry);
+    if (result != FS_OK) {
+        return result;
+    }
+
+    if (entry.attributes & FS_ATTR_DIR) {
+        // Removing a directory would orphan its contents (or pull the current directory away)
+        if (entry.first_block == current_dir_block) {
+            return FS_ERROR;
+        }
+        dir_entry_t children[DIR_ENTRIES_PER_BLOCK];
+        if (!dir_read_block(entry.first_block, children)) {
+            return FS_IO_ERROR;
+        }
+        for (size_t i = 2; i < DIR_ENTRIES_PER_BLOCK; i++) {
+            if (children[i].filename[0] != '\0') {
+                return FS_NOT_EMPTY;
+            }
+        }
+    }
+
+    dir_entry_t* dir = fs_dir_load(dir_block);
+    if (dir == NULL) {
+        return FS_IO_ERROR;
+    }
+
+    result = fs_txn_begin(0);
+    if (result != FS_OK) {
+        return result;
+    }
+
+    // Clear directory entry, then free all blocks used by the file
+    dir_entry_t removed = dir[entry_index];
+    memset(&dir[entry_index], 0, sizeof(dir_entry_t));
+    if (!dir_write_block(dir_block, dir)) {
+        dir[entry_index] = removed;
+        return FS_IO_ERROR;
+    }
+    fs_release(&removed);
+
+    // Directory, FAT and superblock commit together
+
+    result = fs_txn_end();
+    if (result == FS_OK && dir_block == current_dir_block && dir_hook) {
+        dir_hook(filename, false);
+    }
+    return result;
+}
+
+int fs_delete(const char* path) {
+    TRACE_BEGIN_EVENT(TRACE_FS_DELETE, 0, 0);
+    int result = fs_delete_impl(path);
+    TRACE_END_EVENT(TRACE_FS_DELETE, result);
+    return result;
+}
+
+void fs_get_current_path(char* buffer, size_t size) {
+    if (buffer == NULL || size == 0) return;
+    strncpy(buffer, current_path, size);
+    buffer[size-1] = '\0';
+}
+
+void fs_set_current_path(const char* path) {
+    if (path == NULL) return;
+    strncpy(current_path, path, MAX_PATH_LEN);
+    current_path[MAX_PATH_LEN-1] = '\0';
+}
+
+// Change directory. The path is normalized against current_path first, so the
+// prompt string and current_dir_block always describe the same directory.
+void handle_cd_command(const char* path) {
+    if (path == NULL || strlen(path) == 0) {
+        // No argument - go to root
+        path = "/";
+    }
+
+    char new_path[MAX_PATH_LEN];
+    if (!fs_normalize_path(current_path, path, new_path, sizeof(new_path))) {
+        terminal_writestring("Path too long\n");
+        return;
+    }
+
+    dir_entry_t entry;
+    int result = fs_stat(new_path, &entry);
+    if (result != FS_OK) {
+        terminal_writestring("Directory not found: ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
+        return;
+    }
+
+    if (!(entry.attributes & FS_ATTR_DIR)) {
+        terminal_writestring("Not a directory: ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
+        return;
+    }
+
+    // Read the new directory contents
+    dir_entry_t entries[DIR_ENTRIES_PER_BLOCK];
+    if (!dir_read_block(entry.first_block, entries)) {
+        terminal_writestring("Error reading directory\n");
+        return;
+    }
+
+    // Only update path and directory block after successful read
+    memcpy(current_dir, entries, sizeof(current_dir));
+    current_dir_block = entry.first_block;
+    fs_set_current_path(new_path);
+    if (dir_hook) dir_hook(NULL, true);
+
+    terminal_writestring("Changed to directory: ");
+    terminal_writestring(new_path);
+    terminal_writestring("\n");
+}
+
+void fs_set_dir_hook(fs_dir_hook_t hook) {
+    dir_hook = hook;
+}
+
+// Improved error reporting
+void fs_perror(int error_code) {
+    switch(error_code) {
+        case FS_OK: terminal_writestring("Operation successful"); break;
+        case FS_ERROR: terminal_writestring("General filesystem error"); break;
+        case FS_NOT_FOUND: terminal_writestring("File or directory not found"); break;
+        case FS_EXISTS: terminal_writestring("File already exists"); break;
+        case FS_FULL: terminal_writestring("Disk full"); break;
+        case FS_IO_ERROR: terminal_writestring("Disk I/O error"); break;
+        case FS_INVALID_NAME: terminal_writestring("Invalid filename"); break;
+        case FS_NO_DISK: terminal_writestring("No disk detected"); break;
+        case FS_UNFORMATTED: terminal_writestring("Filesystem not found or formatted"); break;
+        case FS_NOT_EMPTY: terminal_writestring("Directory not empty"); break;
+    }
+}
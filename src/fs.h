@@ -0,0 +1,176 @@
+#ifndef FOXOS_FS_H
+#define FOXOS_FS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * FoxFS. The filesystem only talks to the outside world through the platform
+ * interface below, so the same fs.c runs in the kernel (RAM disk, VGA
+ * terminal) and in the host tools (image file or memory, stdout).
+ */
+
+/* ===== File System Constants ===== */
+#define FS_BLOCK_SIZE 512
+#define FS_MAX_BLOCKS 1024        // 512KB total storage
+#define FS_MAX_FILES 128
+#define FS_FILENAME_LEN 32
+#define DIR_ENTRIES_PER_BLOCK (FS_BLOCK_SIZE / sizeof(dir_entry_t))
+
+#define FS_MAGIC 0x464F5800       // "FOX\0" - files are FAT chains
+#define FS_MAGIC_EXTENT 0x464F5845  // "FOXE" - files are extent lists, the FAT only tracks allocation
+#define FS_VERSION 2              // Bumped when the on-disk layout changes
+#define FS_FAT_BLOCKS ((FS_MAX_BLOCKS * sizeof(fat_entry_t) + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE)
+#define FS_ROOT_DIR_BLOCK (1 + FS_FAT_BLOCKS)  // Root directory follows the FAT
+
+/* FAT markers */
+#define FS_FAT_FREE     0x0000    // Block 0 is the superblock, so 0 never appears in a chain
+#define FS_FAT_RESERVED 0xFFFE    // Superblock, FAT, root directory and journal
+#define FS_FAT_EOF      0xFFFF    // Last block of a chain
+
+/* Metadata journal */
+#define FS_JOURNAL_BLOCKS   32    // Journal region size, placed right after the root directory
+#define FS_TXN_MAX_BLOCKS   (FS_JOURNAL_BLOCKS - 2)  // Minus descriptor and commit record
+#define FS_TXN_OP_RESERVE   10    // Worst case metadata blocks dirtied by one operation
+#define FS_TXN_BATCH_OPS    16    // Operations grouped into one commit before forcing it
+#define FS_JOURNAL_MAGIC    0x4A584F46  // "FOXJ"
+#define FS_COMMIT_MAGIC     0x43584F46  // "FOXC"
+
+/* Tail packing: small files share blocks instead of taking one each */
+#define FS_TAIL_UNIT        32    // Allocation unit inside a tail block
+#define FS_TAIL_UNITS       (FS_BLOCK_SIZE / FS_TAIL_UNIT)  // Unit 0 holds the header
+#define FS_TAIL_MAX         128   // Files up to this size are packed
+#define FS_TAIL_MAGIC       0x4C494154  // "TAIL"
+
+/* File attributes */
+#define FS_ATTR_DIR     0x01
+#define FS_ATTR_FILE    0x02
+#define FS_ATTR_SYSTEM  0x04
+#define FS_ATTR_HIDDEN  0x08
+#define FS_ATTR_TAIL    0x10      // Data is packed into the tail block in first_block
+
+/* Volume layouts accepted by fs_format() */
+#define FS_LAYOUT_FAT    0
+#define FS_LAYOUT_EXTENT 1
+
+/* Error codes */
+#define FS_OK           0
+#define FS_ERROR        -1
+#define FS_NOT_FOUND    -2
+#define FS_EXISTS       -3
+#define FS_FULL         -4
+#define FS_IO_ERROR     -5
+#define FS_INVALID_NAME -6
+#define FS_NO_DISK      -7
+#define FS_UNFORMATTED  -8
+#define FS_NOT_EMPTY    -9
+
+#define MAX_PATH_LEN 256
+
+/* ===== File System Structures ===== */
+typedef struct {
+    uint32_t magic;
+    uint32_t block_count;
+    uint32_t free_blocks;
+    uint32_t root_dir_block;
+    uint32_t fat_blocks;
+    uint32_t version;
+    uint32_t journal_start;
+    uint32_t journal_blocks;  // 0 if the volume has no journal
+    uint32_t tail_block;      // Tail block new small files are packed into, 0 if none
+    uint32_t reserved[7];     // Padding to 64 bytes
+} fs_superblock_t;
+
+typedef struct {
+    uint16_t next_block;  // FS_FAT_FREE, FS_FAT_RESERVED, FS_FAT_EOF or the next block in the chain
+} fat_entry_t;
+
+typedef struct {
+    char filename[FS_FILENAME_LEN];
+    uint32_t size;
+    uint32_t first_block;
+    uint8_t attributes;
+    uint8_t tail_unit;    // First unit of the data in the tail block (FS_ATTR_TAIL only)
+    uint8_t reserved[2];  // Padding
+} dir_entry_t;
+
+/* One contiguous run of a file on an extent volume */
+typedef struct {
+    uint32_t logical;   // First file block covered by the run
+    uint16_t start;     // First disk block
+    uint16_t length;    // Blocks in the run
+} fs_extent_t;
+
+#define FS_EXTENTS_PER_BLOCK ((FS_BLOCK_SIZE - 8) / sizeof(fs_extent_t))
+
+/* Extent block: a file's first_block points at one, large files chain more through 'next' */
+typedef struct {
+    uint16_t count;
+    uint16_t next;      // Next extent block, FS_FAT_EOF if this is the last one
+    uint32_t reserved;
+    fs_extent_t extents[FS_EXTENTS_PER_BLOCK];
+} fs_extent_block_t;
+
+/* Header of a tail block, occupying its first unit */
+typedef struct {
+    uint32_t magic;
+    uint16_t used;      // Bitmap of allocated units, bit 0 is the header itself
+    uint16_t reserved;
+} fs_tail_header_t;
+
+/* Journal descriptor: the home locations of the block images that follow it */
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t blocks[FS_TXN_MAX_BLOCKS];
+} fs_journal_header_t;
+
+/* Commit record, written after the descriptor and all block images */
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t checksum;  // CRC-32 over the descriptor block and every block image
+} fs_journal_commit_t;
+
+/* ===== Platform Interface ===== */
+bool disk_read(uint32_t block, void* buffer);
+bool disk_write(uint32_t block, const void* buffer);
+bool disk_read_blocks(uint32_t block, uint32_t count, void* buffer);
+bool disk_write_blocks(uint32_t block, uint32_t count, const void* buffer);
+bool disk_detected();
+void terminal_writestring(const char* data);
+
+/* ===== File System API ===== */
+extern bool fs_initialized;
+extern uint32_t fs_journal_replayed;
+extern char current_path[MAX_PATH_LEN];
+
+int fs_init();
+int fs_format(uint32_t layout);
+int fs_sync();
+void create_default_directories();
+int fs_find_free_block();
+bool fs_normalize_path(const char* base, const char* path, char* out, size_t size);
+bool fs_is_valid_filename(const char* filename);
+int fs_create(const char* path, uint8_t attributes);
+int fs_write(const char* path, const void* data, uint32_t size);
+int fs_stat(const char* path, dir_entry_t* entry);
+int fs_read_at(const char* path, uint32_t offset, void* buffer, uint32_t length);
+int fs_read(const char* path, void* buffer, uint32_t max_size);
+int fs_list(const char* path);
+int fs_read_dir(const char* path, dir_entry_t* entries, uint32_t max);  // Returns the entry count
+int fs_delete(const char* path);
+void fs_get_current_path(char* buffer, size_t size);
+void fs_set_current_path(const char* path);
+void handle_cd_command(const char* path);
+void fs_perror(int error_code);
+
+// Told about every name created in or deleted from the current directory, and
+// with a NULL name whenever the current directory is replaced altogether
+typedef void (*fs_dir_hook_t)(const char* name, bool added);
+void fs_set_dir_hook(fs_dir_hook_t hook);
+
+#endif
@@ -0,0 +1,61 @@
+#include "klib.h"
+#include "gapbuf.h"
+
+void gapbuf_init(gapbuf_t* buffer, char* data, uint32_t capacity) {
+    buffer->data = data;
+    buffer->capacity = capacity;
+    gapbuf_clear(buffer);
+}
+
+void gapbuf_clear(gapbuf_t* buffer) {
+    buffer->gap_start = 0;
+    buffer->gap_end = buffer->capacity;
+}
+
+void gapbuf_move(gapbuf_t* buffer, uint32_t index) {
+    uint32_t length = gapbuf_length(buffer);
+    if (index > length) index = length;
+    if (index < buffer->gap_start) {
+        // The characters between the new cursor and the old one go to the far side of the gap
+        uint32_t count = buffer->gap_start - index;
+        memmove(buffer->data + buffer->gap_end - count, buffer->data + index, count);
+        buffer->gap_start -= count;
+        buffer->gap_end -= count;
+    } else if (index > buffer->gap_start) {
+        uint32_t count = index - buffer->gap_start;
+        memmove(buffer->data + buffer->gap_start, buffer->data + buffer->gap_end, count);
+        buffer->gap_start += count;
+        buffer->gap_end += count;
+    }
+}
+
+bool gapbuf_insert(gapbuf_t* buffer, const char* text, uint32_t length) {
+    if (length > buffer->gap_end - buffer->gap_start) return false;
+    memcpy(buffer->data + buffer->gap_start, text, length);
+    buffer->gap_start += length;
+    return true;
+}
+
+uint32_t gapbuf_delete_before(gapbuf_t* buffer, uint32_t count) {
+    if (count > buffer->gap_start) count = buffer->gap_start;
+    buffer->gap_start -= count;
+    return count;
+}
+
+uint32_t gapbuf_delete_after(gapbuf_t* buffer, uint32_t count) {
+    if (count > buffer->capacity - buffer->gap_end) count = buffer->capacity - buffer->gap_end;
+    buffer->gap_end += count;
+    return count;
+}
+
+uint32_t gapbuf_copy(const gapbuf_t* buffer, char* out, uint32_t max) {
+    if (max == 0) return 0;
+    uint32_t before = buffer->gap_start;
+    uint32_t after = buffer->capacity - buffer->gap_end;
+    if (before > max - 1) before = max - 1;
+    if (after > max - 1 - before) after = max - 1 - before;
+    memcpy(out, buffer->data, before);
+    memcpy(out + before, buffer->data + buffer->gap_end, after);
+    out[before + after] = '\0';
+    return before + after;
+}
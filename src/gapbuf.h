@@ -0,0 +1,48 @@
+#ifndef FOXOS_GAPBUF_H
+#define FOXOS_GAPBUF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Text with a gap at the cursor, for editing a line. Typing and deleting at
+ * the cursor only move the ends of the gap; moving the cursor moves just the
+ * characters it passes over. The text before the cursor is always the start
+ * of 'data', so it can be read in place. The owner supplies the storage.
+ */
+typedef struct {
+    char* data;
+    uint32_t capacity;
+    uint32_t gap_start;  // The cursor: data[0..gap_start) is the text before it
+    uint32_t gap_end;    // data[gap_end..capacity) is the text after it
+} gapbuf_t;
+
+void gapbuf_init(gapbuf_t* buffer, char* data, uint32_t capacity);
+void gapbuf_clear(gapbuf_t* buffer);
+
+static inline uint32_t gapbuf_length(const gapbuf_t* buffer) {
+    return buffer->capacity - (buffer->gap_end - buffer->gap_start);
+}
+
+static inline uint32_t gapbuf_cursor(const gapbuf_t* buffer) {
+    return buffer->gap_start;
+}
+
+static inline char gapbuf_at(const gapbuf_t* buffer, uint32_t index) {
+    return index < buffer->gap_start ? buffer->data[index]
+                                     : buffer->data[index + buffer->gap_end - buffer->gap_start];
+}
+
+void gapbuf_move(gapbuf_t* buffer, uint32_t index);  // Clamped to the length
+
+// Inserts at the cursor and leaves the cursor after it; false if it doesn't fit (nothing is inserted)
+bool gapbuf_insert(gapbuf_t* buffer, const char* text, uint32_t length);
+
+// Delete up to 'count' characters before / after the cursor; return how many went
+uint32_t gapbuf_delete_before(gapbuf_t* buffer, uint32_t count);
+uint32_t gapbuf_delete_after(gapbuf_t* buffer, uint32_t count);
+
+// Copies the text out NUL-terminated, up to max - 1 characters; returns the length copied
+uint32_t gapbuf_copy(const gapbuf_t* buffer, char* out, uint32_t max);
+
+#endif
@@ -0,0 +1,84 @@
+#include "klib.h"
+#include "gdt.h"
+
+/* ===== Descriptors ===== */
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t granularity;  // Limit bits 16-19 in the low nibble, flags in the high one
+    uint8_t base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_pointer_t;
+
+// Only ss0/esp0 matter without hardware task switching
+typedef struct {
+    uint32_t prev_task;
+    uint32_t esp0, ss0;
+    uint32_t esp1, ss1;
+    uint32_t esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+#define GDT_ENTRIES 6
+
+#define ACCESS_KERNEL_CODE 0x9A  // Present, ring 0, code, readable
+#define ACCESS_KERNEL_DATA 0x92  // Present, ring 0, data, writable
+#define ACCESS_USER_CODE   0xFA
+#define ACCESS_USER_DATA   0xF2
+#define ACCESS_TSS         0x89  // Present, ring 0, available 32-bit TSS
+#define FLAGS_FLAT         0xC0  // 4 KB granularity, 32-bit
+
+static gdt_entry_t gdt[GDT_ENTRIES];
+static tss_t tss;
+
+static void gdt_set(uint32_t index, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[index].limit_low = limit & 0xFFFF;
+    gdt[index].base_low = base & 0xFFFF;
+    gdt[index].base_middle = (base >> 16) & 0xFF;
+    gdt[index].access = access;
+    gdt[index].granularity = ((limit >> 16) & 0x0F) | flags;
+    gdt[index].base_high = base >> 24;
+}
+
+void gdt_init() {
+    gdt_set(0, 0, 0, 0, 0);
+    gdt_set(GDT_KERNEL_CODE >> 3, 0, 0xFFFFF, ACCESS_KERNEL_CODE, FLAGS_FLAT);
+    gdt_set(GDT_KERNEL_DATA >> 3, 0, 0xFFFFF, ACCESS_KERNEL_DATA, FLAGS_FLAT);
+    gdt_set(GDT_USER_CODE >> 3, 0, 0xFFFFF, ACCESS_USER_CODE, FLAGS_FLAT);
+    gdt_set(GDT_USER_DATA >> 3, 0, 0xFFFFF, ACCESS_USER_DATA, FLAGS_FLAT);
+
+    memset(&tss, 0, sizeof(tss));
+    tss.ss0 = GDT_KERNEL_DATA;
+    tss.iomap_base = sizeof(tss);  // No I/O bitmap: ring 3 gets no ports
+    gdt_set(GDT_TSS >> 3, (uint32_t)&tss, sizeof(tss) - 1, ACCESS_TSS, 0);
+
+    gdt_pointer_t pointer = { sizeof(gdt) - 1, (uint32_t)gdt };
+    __asm__ volatile (
+        "lgdt %0\n"
+        "ljmp %1, $1f\n"
+        "1:\n"
+        "mov %2, %%ds\n"
+        "mov %2, %%es\n"
+        "mov %2, %%fs\n"
+        "mov %2, %%gs\n"
+        "mov %2, %%ss\n"
+        "ltr %3\n"
+        : : "m"(pointer), "i"(GDT_KERNEL_CODE), "r"((uint32_t)GDT_KERNEL_DATA), "r"((uint16_t)GDT_TSS)
+        : "memory");
+}
+
+// Stack the CPU switches to when an interrupt or int 0x80 arrives from ring 3
+void gdt_set_kernel_stack(uint32_t esp0) {
+    tss.esp0 = esp0;
+}
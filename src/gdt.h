@@ -0,0 +1,20 @@
+#ifndef FOXOS_GDT_H
+#define FOXOS_GDT_H
+
+#include <stdint.h>
+
+/*
+ * Flat 4 GB segments for ring 0 and ring 3, plus the TSS the CPU reads the
+ * kernel stack from when ring 3 is interrupted. The order is fixed by
+ * sysenter/sysexit, which derive every selector from the kernel code one.
+ */
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x1B  // Index 3, RPL 3
+#define GDT_USER_DATA   0x23  // Index 4, RPL 3
+#define GDT_TSS         0x28
+
+void gdt_init();  // Replaces the loader's GDT and reloads every segment register
+void gdt_set_kernel_stack(uint32_t esp0);
+
+#endif
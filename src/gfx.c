@@ -0,0 +1,282 @@
+#include "klib.h"
+#include "gfx.h"
+#include "io.h"
+#include "paging.h"
+
+#define CPUID_FXSR (1u << 24)
+#define CPUID_SSE  (1u << 25)
+#define CPUID_SSE2 (1u << 26)
+#define CR0_MP         0x00000002  // wait/fwait honour TS
+#define CR0_EM         0x00000004  // No FPU: SSE instructions fault
+#define CR4_OSFXSR     0x00000200  // fxsave/fxrstor and SSE enabled
+#define CR4_OSXMMEXCPT 0x00000400  // SSE exceptions raise #XM
+
+void blit_fill_sse2(uint32_t* dst, uint32_t count, uint32_t color);
+void blit_copy_sse2(uint32_t* dst, const uint32_t* src, uint32_t count);
+void blit_stream_sse2(uint32_t* dst, const uint32_t* src, uint32_t count);
+
+static uint32_t back_buffer[GFX_MAX_WIDTH * GFX_MAX_HEIGHT] __attribute__((aligned(16)));
+static uint32_t width, height;
+static uint8_t* framebuffer;
+static gfx_mode_t mode;
+static bool detected = false;
+static bool active = false;
+static bool native;  // The framebuffer's pixels are the back buffer's: 32 bits, 0x00RRGGBB
+
+// Channel layout of the framebuffer's pixels when they aren't
+static uint8_t red_position, red_size, green_position, green_size, blue_position, blue_size;
+
+static gfx_rect_t dirty[GFX_DIRTY_MAX];
+static uint32_t dirty_count = 0;
+static gfx_stats_t stats;
+
+// Where the XMM registers go while a kernel uses them
+static uint8_t fx_state[512] __attribute__((aligned(16)));
+
+/* ===== Setup ===== */
+bool gfx_detect(const multiboot_info_t* info) {
+    if (info == NULL || !(info->flags & MULTIBOOT_INFO_FRAMEBUFFER)) return false;
+    if (info->framebuffer_type != MULTIBOOT_FRAMEBUFFER_RGB) return false;  // Text mode, or a palette
+    if (info->framebuffer_addr >> 32) return false;
+    uint8_t bpp = info->framebuffer_bpp;
+    if (bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32) return false;
+    if (info->framebuffer_width < 640 || info->framebuffer_height < 400) return false;  // Room for the console
+
+    mode.address = (uint32_t)info->framebuffer_addr;
+    mode.pitch = info->framebuffer_pitch;
+    mode.bpp = bpp;
+    width = info->framebuffer_width < GFX_MAX_WIDTH ? info->framebuffer_width : GFX_MAX_WIDTH;
+    height = info->framebuffer_height < GFX_MAX_HEIGHT ? info->framebuffer_height : GFX_MAX_HEIGHT;
+    red_position = info->framebuffer_red_position;
+    red_size = info->framebuffer_red_size;
+    green_position = info->framebuffer_green_position;
+    green_size = info->framebuffer_green_size;
+    blue_position = info->framebuffer_blue_position;
+    blue_size = info->framebuffer_blue_size;
+    native = bpp == 32 && red_position == 16 && green_position == 8 && blue_position == 0 &&
+             red_size == 8 && green_size == 8 && blue_size == 8;
+    detected = true;
+    return true;
+}
+
+static void sse_enable() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if ((edx & (CPUID_FXSR | CPUID_SSE | CPUID_SSE2)) != (CPUID_FXSR | CPUID_SSE | CPUID_SSE2)) return;
+
+    uint32_t cr0, cr4;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile ("mov %0, %%cr0" : : "r"((cr0 & ~CR0_EM) | CR0_MP));
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT));
+    mode.sse2 = true;
+}
+
+bool gfx_init() {
+    if (!detected) return false;
+    if (!paging_map_device(mode.address, mode.pitch * height)) return false;
+    framebuffer = (uint8_t*)mode.address;
+    sse_enable();
+    active = true;
+    gfx_fill((gfx_rect_t){ 0, 0, width, height }, 0);
+    return true;
+}
+
+bool gfx_active() {
+    return active;
+}
+
+uint32_t gfx_width() {
+    return width;
+}
+
+uint32_t gfx_height() {
+    return height;
+}
+
+uint32_t* gfx_pixels() {
+    return back_buffer;
+}
+
+const gfx_mode_t* gfx_mode() {
+    return &mode;
+}
+
+const gfx_stats_t* gfx_stats() {
+    return &stats;
+}
+
+/* ===== Row Kernels ===== */
+static void sse_begin() {
+    if (mode.sse2) __asm__ volatile ("fxsave %0" : "=m"(fx_state));
+}
+
+static void sse_end() {
+    if (mode.sse2) __asm__ volatile ("fxrstor %0" : : "m"(fx_state));
+}
+
+static void fill_row(uint32_t* dst, uint32_t count, uint32_t color) {
+    if (mode.sse2) {
+        blit_fill_sse2(dst, count, color);
+    } else {
+        while (count-- > 0) *dst++ = color;
+    }
+}
+
+static void copy_row(uint32_t* dst, const uint32_t* src, uint32_t count) {
+    if (mode.sse2) {
+        blit_copy_sse2(dst, src, count);
+    } else {
+        memmove(dst, src, count * sizeof(uint32_t));
+    }
+}
+
+// A 0x00RRGGBB pixel in the framebuffer's layout, for modes that aren't native
+static uint32_t pack(uint32_t color) {
+    uint32_t r = (color >> 16) & 0xFF, g = (color >> 8) & 0xFF, b = color & 0xFF;
+    return (r >> (8 - red_size)) << red_position |
+           (g >> (8 - green_size)) << green_position |
+           (b >> (8 - blue_size)) << blue_position;
+}
+
+static void upload_row(uint32_t x, uint32_t y, uint32_t count) {
+    const uint32_t* src = back_buffer + y * width + x;
+    uint8_t* dst = framebuffer + y * mode.pitch;
+    if (native) {
+        if (mode.sse2) {
+            blit_stream_sse2((uint32_t*)dst + x, src, count);
+        } else {
+            memcpy((uint32_t*)dst + x, src, count * sizeof(uint32_t));
+        }
+        return;
+    }
+    uint32_t bytes = (mode.bpp + 7) / 8;
+    dst += x * bytes;
+    for (uint32_t i = 0; i < count; i++, dst += bytes) {
+        uint32_t pixel = pack(src[i]);
+        if (bytes == 4) {
+            *(uint32_t*)dst = pixel;
+        } else if (bytes == 3) {
+            dst[0] = pixel;
+            dst[1] = pixel >> 8;
+            dst[2] = pixel >> 16;
+        } else {
+            *(uint16_t*)dst = pixel;
+        }
+    }
+}
+
+/* ===== Drawing ===== */
+// Cuts 'rect' down to the screen; false if nothing is left
+static bool clip(gfx_rect_t* rect) {
+    if (rect->x < 0) {
+        rect->width += rect->x;
+        rect->x = 0;
+    }
+    if (rect->y < 0) {
+        rect->height += rect->y;
+        rect->y = 0;
+    }
+    if (rect->x + rect->width > (int32_t)width) rect->width = width - rect->x;
+    if (rect->y + rect->height > (int32_t)height) rect->height = height - rect->y;
+    return rect->width > 0 && rect->height > 0;
+}
+
+void gfx_fill(gfx_rect_t rect, uint32_t color) {
+    if (!active || !clip(&rect)) return;
+    sse_begin();
+    for (int32_t y = rect.y; y < rect.y + rect.height; y++) {
+        fill_row(back_buffer + y * width + rect.x, rect.width, color);
+    }
+    sse_end();
+    gfx_damage(rect);
+}
+
+void gfx_blit(int32_t x, int32_t y, const uint32_t* pixels, uint32_t w, uint32_t h, uint32_t stride) {
+    gfx_rect_t rect = { x, y, w, h };
+    if (!active || !clip(&rect)) return;
+    pixels += (rect.y - y) * stride + (rect.x - x);
+    sse_begin();
+    for (int32_t row = 0; row < rect.height; row++) {
+        copy_row(back_buffer + (rect.y + row) * width + rect.x, pixels + row * stride, rect.width);
+    }
+    sse_end();
+    gfx_damage(rect);
+}
+
+void gfx_scroll(gfx_rect_t rect, int32_t dy) {
+    if (!active || !clip(&rect)) return;
+    int32_t rows = rect.height - (dy < 0 ? -dy : dy);
+    if (rows <= 0) return;
+    sse_begin();
+    // Rows never overlap themselves, only each other: go from the end being written to
+    for (int32_t i = 0; i < rows; i++) {
+        int32_t y = dy > 0 ? rect.y + i : rect.y + rect.height - 1 - i;
+        copy_row(back_buffer + y * width + rect.x, back_buffer + (y + dy) * width + rect.x, rect.width);
+    }
+    sse_end();
+    gfx_damage(rect);
+}
+
+/* ===== Compositor ===== */
+static uint32_t area(gfx_rect_t rect) {
+    return (uint32_t)rect.width * rect.height;
+}
+
+static gfx_rect_t bounds(gfx_rect_t a, gfx_rect_t b) {
+    int32_t left = a.x < b.x ? a.x : b.x;
+    int32_t top = a.y < b.y ? a.y : b.y;
+    int32_t right = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int32_t bottom = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    return (gfx_rect_t){ left, top, right - left, bottom - top };
+}
+
+// Worth uploading as one: the pixels between them cost less than a second pass
+static bool mergeable(gfx_rect_t a, gfx_rect_t b) {
+    return area(bounds(a, b)) <= area(a) + area(b) + 64 * 16;
+}
+
+void gfx_damage(gfx_rect_t rect) {
+    if (!active || !clip(&rect)) return;
+    // Absorb every rectangle it merges with; the result may reach others, so start over
+    for (uint32_t i = 0; i < dirty_count; ) {
+        if (mergeable(dirty[i], rect)) {
+            rect = bounds(dirty[i], rect);
+            dirty[i] = dirty[--dirty_count];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    if (dirty_count < GFX_DIRTY_MAX) {
+        dirty[dirty_count++] = rect;
+        return;
+    }
+    uint32_t best = 0;
+    uint32_t best_growth = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < dirty_count; i++) {
+        uint32_t growth = area(bounds(dirty[i], rect)) - area(dirty[i]);
+        if (growth < best_growth) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    dirty[best] = bounds(dirty[best], rect);
+}
+
+void gfx_present() {
+    if (!active || dirty_count == 0) return;
+    sse_begin();
+    for (uint32_t i = 0; i < dirty_count; i++) {
+        gfx_rect_t* rect = &dirty[i];
+        for (int32_t y = rect->y; y < rect->y + rect->height; y++) {
+            upload_row(rect->x, y, rect->width);
+        }
+        stats.pixels += area(*rect);
+    }
+    if (mode.sse2) __asm__ volatile ("sfence" : : : "memory");
+    sse_end();
+    stats.presents++;
+    stats.rects += dirty_count;
+    dirty_count = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef FOXOS_GFX_H
+#define FOXOS_GFX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "multiboot.h"
+
+/*
+ * Linear framebuffer graphics. Everything is drawn into a back buffer in
+ * RAM, 0x00RRGGBB pixels 'gfx_width()' to a row, and every change records
+ * the rectangle it touched. gfx_present() copies just those rectangles to
+ * video memory, which is slow to write and never read, so a frame that
+ * changes one character uploads one character's worth of pixels.
+ *
+ * Rectangles that overlap or nearly touch are merged as they're added, and
+ * when the list is full the new one joins whichever grows least, so the
+ * list stays short without covering much that didn't change.
+ *
+ * Fills and copies use SSE2 when the CPU has it (saving the XMM registers
+ * around it, user programs may have them in use), with plain loops otherwise.
+ */
+#define GFX_MAX_WIDTH  1024  // Bigger modes show the top-left corner
+#define GFX_MAX_HEIGHT 768
+#define GFX_DIRTY_MAX  32
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+} gfx_rect_t;
+
+// True if the loader left a framebuffer this can draw on; call before gfx_init()
+bool gfx_detect(const multiboot_info_t* info);
+bool gfx_init();    // Maps the framebuffer and turns on SSE; needs paging
+bool gfx_active();  // gfx_init() succeeded
+
+uint32_t gfx_width();
+uint32_t gfx_height();
+uint32_t* gfx_pixels();  // The back buffer, for drawing directly; then gfx_damage()
+
+void gfx_fill(gfx_rect_t rect, uint32_t color);
+// Copies a block of pixels 'stride' apart per row to (x, y)
+void gfx_blit(int32_t x, int32_t y, const uint32_t* pixels, uint32_t width, uint32_t height, uint32_t stride);
+// Moves what's in 'rect' up by 'dy' rows (down if negative); what it uncovers is left as it was
+void gfx_scroll(gfx_rect_t rect, int32_t dy);
+
+void gfx_damage(gfx_rect_t rect);  // Marks part of the back buffer changed
+void gfx_present();                // Uploads the changed parts
+
+/* For the gfx command */
+typedef struct {
+    uint32_t address;  // Of the framebuffer
+    uint32_t pitch;    // Its bytes per row
+    uint8_t bpp;
+    bool sse2;
+} gfx_mode_t;
+
+typedef struct {
+    uint32_t presents;
+    uint32_t rects;    // Uploaded by those presents
+    uint64_t pixels;
+} gfx_stats_t;
+
+const gfx_mode_t* gfx_mode();
+const gfx_stats_t* gfx_stats();
+
+#endif
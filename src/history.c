@@ -0,0 +1,164 @@
+#include "klib.h"
+#include "fs.h"
+#include "history.h"
+
+typedef struct {
+    uint32_t offset;  // Into history_text, NUL-terminated
+    uint32_t length;
+} history_entry_t;
+
+static history_entry_t entries[HISTORY_MAX];  // Line n is in entries[n % HISTORY_MAX]
+static char history_text[HISTORY_BYTES];
+static uint32_t next_line = 0;  // Number of the next line added
+static uint32_t count = 0;
+static uint32_t head = 0;       // Where the next line's text goes
+static bool dirty = false;      // Lines added since the last save
+
+// Bit n % HISTORY_MAX of a bucket is set if line n has a trigram hashing to it
+static uint32_t trigram_lines[HISTORY_TRIGRAM_BUCKETS][HISTORY_MAX / 32];
+
+static char file_buffer[HISTORY_FILE_MAX];
+
+/* ===== Trigram Index ===== */
+static uint32_t trigram_bucket(const char* text) {
+    uint32_t key = (uint8_t)text[0] | ((uint8_t)text[1] << 8) | ((uint8_t)text[2] << 16);
+    return (key * 2654435761u) >> 23;  // Top 9 bits: one of 512 buckets
+}
+
+static void index_line(uint32_t slot, const char* text, uint32_t length, bool present) {
+    for (uint32_t i = 0; i + 3 <= length; i++) {
+        uint32_t* word = &trigram_lines[trigram_bucket(text + i)][slot / 32];
+        if (present) {
+            *word |= 1u << (slot % 32);
+        } else {
+            *word &= ~(1u << (slot % 32));
+        }
+    }
+}
+
+/* ===== Lines ===== */
+static history_entry_t* oldest() {
+    return &entries[(next_line - count) % HISTORY_MAX];
+}
+
+static void drop_oldest() {
+    history_entry_t* entry = oldest();
+    index_line((next_line - count) % HISTORY_MAX, history_text + entry->offset, entry->length, false);
+    count--;
+}
+
+void history_add(const char* line) {
+    uint32_t length = strlen(line);
+    if (length == 0 || length > HISTORY_LINE_MAX) return;
+    if (count > 0 && strcmp(history_get(0), line) == 0) return;
+
+    if (count == HISTORY_MAX) drop_oldest();
+    // The text ahead of 'head' is the oldest; make room there, starting over at
+    // the beginning when the line won't fit before the end
+    uint32_t size = length + 1;
+    if (head + size > HISTORY_BYTES) {
+        while (count > 0 && oldest()->offset >= head) drop_oldest();
+        head = 0;
+    }
+    while (count > 0 && oldest()->offset >= head && oldest()->offset < head + size) drop_oldest();
+
+    uint32_t slot = next_line % HISTORY_MAX;
+    entries[slot].offset = head;
+    entries[slot].length = length;
+    memcpy(history_text + head, line, size);
+    index_line(slot, line, length, true);
+    head += size;
+    next_line++;
+    count++;
+    dirty = true;
+}
+
+uint32_t history_count() {
+    return count;
+}
+
+const char* history_get(uint32_t age) {
+    if (age >= count) return NULL;
+    return history_text + entries[(next_line - 1 - age) % HISTORY_MAX].offset;
+}
+
+static bool contains(const char* text, const char* part, uint32_t length) {
+    for (; *text != '\0'; text++) {
+        if (strncmp(text, part, length) == 0) return true;
+    }
+    return length == 0;
+}
+
+int history_search(const char* text, uint32_t from) {
+    uint32_t length = strlen(text);
+    uint32_t candidates[HISTORY_MAX / 32];
+    if (length < 3) {
+        memset(candidates, 0xFF, sizeof(candidates));  // No trigram to go on
+    } else {
+        memcpy(candidates, trigram_lines[trigram_bucket(text)], sizeof(candidates));
+        for (uint32_t i = 1; i + 3 <= length; i++) {
+            const uint32_t* lines = trigram_lines[trigram_bucket(text + i)];
+            for (uint32_t w = 0; w < HISTORY_MAX / 32; w++) candidates[w] &= lines[w];
+        }
+    }
+    // Buckets are shared, so a surviving bit is only a candidate
+    for (uint32_t age = from; age < count; age++) {
+        uint32_t slot = (next_line - 1 - age) % HISTORY_MAX;
+        if (!(candidates[slot / 32] & (1u << (slot % 32)))) continue;
+        if (contains(history_text + entries[slot].offset, text, length)) return age;
+    }
+    return -1;
+}
+
+/* ===== File ===== */
+int history_load() {
+    dir_entry_t entry;
+    int result = fs_stat(HISTORY_FILE, &entry);
+    if (result != FS_OK) return result;
+    if (entry.size > HISTORY_FILE_MAX) return FS_ERROR;
+    result = fs_read(HISTORY_FILE, file_buffer, sizeof(file_buffer));
+    if (result != FS_OK) return result;
+
+    char line[HISTORY_LINE_MAX + 1];
+    uint32_t length = 0;
+    for (uint32_t i = 0; i <= entry.size; i++) {
+        char c = i < entry.size ? file_buffer[i] : '\n';
+        if (c == '\n') {
+            if (length <= HISTORY_LINE_MAX) {
+                line[length] = '\0';
+                history_add(line);
+            }
+            length = 0;
+        } else if (c != '\r') {
+            if (length < sizeof(line)) line[length] = c;
+            length++;
+        }
+    }
+    dirty = false;  // It's all in the file already
+    return FS_OK;
+}
+
+int history_save() {
+    if (!dirty) return FS_OK;
+    // The newest lines that fit, oldest of them first
+    uint32_t size = 0;
+    uint32_t lines = 0;
+    while (lines < count && size + entries[(next_line - 1 - lines) % HISTORY_MAX].length + 1 <= HISTORY_FILE_MAX) {
+        size += entries[(next_line - 1 - lines) % HISTORY_MAX].length + 1;
+        lines++;
+    }
+    uint32_t at = 0;
+    while (lines > 0) {
+        const history_entry_t* entry = &entries[(next_line - lines) % HISTORY_MAX];
+        memcpy(file_buffer + at, history_text + entry->offset, entry->length);
+        at += entry->length;
+        file_buffer[at++] = '\n';
+        lines--;
+    }
+
+    int result = fs_create(HISTORY_FILE, FS_ATTR_FILE);
+    if (result != FS_OK && result != FS_EXISTS) return result;
+    result = fs_write(HISTORY_FILE, file_buffer, size);
+    if (result == FS_OK) dirty = false;
+    return result;
+}
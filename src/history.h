@@ -0,0 +1,34 @@
+#ifndef FOXOS_HISTORY_H
+#define FOXOS_HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Command history. Lines are packed one after another into a ring of text,
+ * and the oldest go when it or the entry table fills. Every line's trigrams
+ * are hashed into a bitmap of the entries that contain them, so a substring
+ * search only compares the lines whose bits survive ANDing the bitmaps of
+ * the search text's trigrams.
+ *
+ * The newest lines that fit in HISTORY_FILE_MAX are kept in HISTORY_FILE,
+ * one per line, and loaded again at boot.
+ */
+#define HISTORY_MAX      2048    // Lines kept in memory
+#define HISTORY_BYTES    65536   // Text of those lines
+#define HISTORY_LINE_MAX 255     // Longer lines aren't kept
+#define HISTORY_TRIGRAM_BUCKETS 512
+#define HISTORY_FILE     "/home/.history"
+#define HISTORY_FILE_MAX 16384
+
+void history_add(const char* line);   // Empty lines and repeats of the last one are skipped
+uint32_t history_count();
+const char* history_get(uint32_t age);  // 0 is the newest line; NULL past the oldest
+
+// Age of the newest line at least 'from' old that contains 'text', or -1
+int history_search(const char* text, uint32_t from);
+
+int history_load();  // Adds the lines in HISTORY_FILE; an FS_* code
+int history_save();  // Writes HISTORY_FILE if anything was added since the last save
+
+#endif
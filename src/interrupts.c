@@ -0,0 +1,183 @@
+#include "klib.h"
+#include "interrupts.h"
+#include "io.h"
+
+/*
+ * IDT and 8259 PIC setup. The PICs are remapped above the CPU exceptions and
+ * every line stays masked until someone registers a handler for it; the
+ * keyboard is still polled.
+ */
+#define IDT_ENTRIES   256
+#define ISR_STUBS     48   // Exceptions and PIC IRQs, see isr.s
+#define IDT_INTERRUPT 0x8E // Present, ring 0, 32-bit interrupt gate
+#define IDT_USER_GATE 0xEE // The same, but ring 3 may raise it with int
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+#define PIC_READ_ISR 0x0B
+
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type;
+    uint16_t offset_high;
+} __attribute__((packed)) idt_entry_t;
+
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) idt_pointer_t;
+
+void terminal_writestring(const char* data);
+
+extern const uint32_t isr_stub_table[ISR_STUBS];  // isr.s
+extern void isr_syscall();
+static idt_entry_t idt[IDT_ENTRIES];
+static interrupt_handler_t handlers[IDT_ENTRIES];
+static interrupt_handler_t user_fault_handler;
+static uint16_t irq_mask = 0xFFFF & ~(1 << 2);  // Everything but the cascade
+
+static const char* exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow", "Bound range",
+    "Invalid opcode", "Device not available", "Double fault", "Coprocessor overrun",
+    "Invalid TSS", "Segment not present", "Stack fault", "General protection",
+    "Page fault", NULL, "FPU error", "Alignment check", "Machine check", "SIMD error",
+};
+
+/* ===== IDT ===== */
+static void idt_set(uint8_t vector, uint32_t handler, uint16_t selector, uint8_t type) {
+    idt[vector].offset_low = handler & 0xFFFF;
+    idt[vector].selector = selector;
+    idt[vector].zero = 0;
+    idt[vector].type = type;
+    idt[vector].offset_high = handler >> 16;
+}
+
+void interrupt_register(uint8_t vector, interrupt_handler_t handler) {
+    handlers[vector] = handler;
+}
+
+void interrupt_set_user_fault(interrupt_handler_t handler) {
+    user_fault_handler = handler;
+}
+
+/* ===== PIC ===== */
+static void pic_write_mask() {
+    outb(PIC1_DATA, irq_mask & 0xFF);
+    outb(PIC2_DATA, irq_mask >> 8);
+}
+
+static void pic_remap() {
+    outb(PIC1_COMMAND, 0x11);  // ICW1: edge triggered, cascade, ICW4 follows
+    io_wait();
+    outb(PIC2_COMMAND, 0x11);
+    io_wait();
+    outb(PIC1_DATA, IRQ_BASE);      // ICW2: vector offsets
+    io_wait();
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    io_wait();
+    outb(PIC1_DATA, 0x04);  // ICW3: slave on IRQ2
+    io_wait();
+    outb(PIC2_DATA, 0x02);
+    io_wait();
+    outb(PIC1_DATA, 0x01);  // ICW4: 8086 mode
+    io_wait();
+    outb(PIC2_DATA, 0x01);
+    io_wait();
+    pic_write_mask();
+}
+
+void irq_register(uint8_t irq, interrupt_handler_t handler) {
+    handlers[IRQ_BASE + irq] = handler;
+    irq_mask &= ~(1 << irq);
+    pic_write_mask();
+}
+
+// IRQ 7 and 15 also fire for requests that went away; the ISR bit tells
+static bool irq_spurious(uint32_t irq) {
+    if (irq == 7) {
+        outb(PIC1_COMMAND, PIC_READ_ISR);
+        return (inb(PIC1_COMMAND) & 0x80) == 0;
+    }
+    if (irq == 15) {
+        outb(PIC2_COMMAND, PIC_READ_ISR);
+        if ((inb(PIC2_COMMAND) & 0x80) == 0) {
+            outb(PIC1_COMMAND, PIC_EOI);  // The master did see the cascade
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ===== Dispatch ===== */
+void interrupt_describe(const interrupt_frame_t* frame) {
+    char num[16];
+    const char* name = frame->vector < 32 ? exception_names[frame->vector] : NULL;
+    terminal_writestring(name ? name : "CPU exception");
+    terminal_writestring(" (vector ");
+    itoa(frame->vector, num, 10);
+    terminal_writestring(num);
+    terminal_writestring(", error 0x");
+    itoa(frame->error, num, 16);
+    terminal_writestring(num);
+    terminal_writestring(") at 0x");
+    itoa(frame->eip, num, 16);
+    terminal_writestring(num);
+    if (frame->vector == 14) {
+        uint32_t address;
+        __asm__ volatile ("mov %%cr2, %0" : "=r"(address));
+        terminal_writestring(", address 0x");
+        itoa(address, num, 16);
+        terminal_writestring(num);
+    }
+}
+
+// Ring 3 faults go to whoever runs user code; the kernel's own are fatal
+void interrupt_fault(interrupt_frame_t* frame) {
+    if ((frame->cs & 3) == 3 && user_fault_handler) {
+        user_fault_handler(frame);
+        return;
+    }
+    terminal_writestring("\n<PANIC> ");
+    interrupt_describe(frame);
+    terminal_writestring("\n");
+    for (;;) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
+
+// Called from isr_common in isr.s
+void interrupt_dispatch(interrupt_frame_t* frame) {
+    uint32_t vector = frame->vector;
+    if (vector >= IRQ_BASE && vector < IRQ_BASE + IRQ_COUNT) {
+        uint32_t irq = vector - IRQ_BASE;
+        if (irq_spurious(irq)) return;
+        if (handlers[vector]) handlers[vector](frame);
+        if (irq >= 8) outb(PIC2_COMMAND, PIC_EOI);
+        outb(PIC1_COMMAND, PIC_EOI);
+        return;
+    }
+    if (handlers[vector]) {
+        handlers[vector](frame);
+    } else if (vector < 32) {
+        interrupt_fault(frame);
+    }
+}
+
+void interrupts_init() {
+    uint16_t code_selector;
+    __asm__ volatile ("mov %%cs, %0" : "=r"(code_selector));  // Whatever the loader left us
+
+    for (uint32_t i = 0; i < ISR_STUBS; i++) {
+        idt_set(i, isr_stub_table[i], code_selector, IDT_INTERRUPT);
+    }
+    idt_set(SYSCALL_VECTOR, (uint32_t)isr_syscall, code_selector, IDT_USER_GATE);
+    pic_remap();
+
+    idt_pointer_t pointer = { sizeof(idt) - 1, (uint32_t)idt };
+    __asm__ volatile ("lidt %0" : : "m"(pointer));
+}
@@ -0,0 +1,38 @@
+#ifndef FOXOS_INTERRUPTS_H
+#define FOXOS_INTERRUPTS_H
+
+#include <stdint.h>
+
+/* Vectors: CPU exceptions 0-31, PIC IRQs remapped to 32-47, system calls */
+#define IRQ_BASE   32
+#define IRQ_TIMER  0
+#define IRQ_COUNT  16
+#define SYSCALL_VECTOR 0x80  // The only gate ring 3 may raise itself
+
+/* What the stubs in isr.s leave on the stack */
+typedef struct {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;  // pusha
+    uint32_t vector;
+    uint32_t error;     // CPU error code, 0 for vectors without one
+    uint32_t eip, cs, eflags;
+    uint32_t user_esp, user_ss;  // Only pushed when the interrupt came from ring 3
+} interrupt_frame_t;
+
+typedef void (*interrupt_handler_t)(interrupt_frame_t* frame);
+
+void interrupts_init();
+void interrupt_register(uint8_t vector, interrupt_handler_t handler);
+void irq_register(uint8_t irq, interrupt_handler_t handler);  // Also unmasks the line
+void interrupt_set_user_fault(interrupt_handler_t handler);   // Exceptions raised in ring 3
+void interrupt_fault(interrupt_frame_t* frame);   // An exception nobody handled: user fault or panic
+void interrupt_describe(const interrupt_frame_t* frame);  // "Page fault (vector 14, ...) at 0x..."
+
+static inline void interrupts_enable() {
+    __asm__ volatile ("sti");
+}
+
+static inline void interrupts_disable() {
+    __asm__ volatile ("cli");
+}
+
+#endif
@@ -0,0 +1,107 @@
+/* Interrupt entry stubs. Each pushes an error code (a dummy 0 when the CPU
+   doesn't push one) and its vector, then shares the path into
+   interrupt_dispatch(interrupt_frame_t*). */
+
+.macro ISR_NOERR num
+.global isr\num
+isr\num:
+	push $0
+	push $\num
+	jmp isr_common
+.endm
+
+.macro ISR_ERR num
+.global isr\num
+isr\num:
+	push $\num
+	jmp isr_common
+.endm
+
+.set KERNEL_DATA, 0x10
+
+.section .text
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR   8
+ISR_NOERR 9
+ISR_ERR   10
+ISR_ERR   11
+ISR_ERR   12
+ISR_ERR   13
+ISR_ERR   14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR   17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_ERR   21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_NOERR 29
+ISR_ERR   30
+ISR_NOERR 31
+
+/* PIC IRQs 0-15 */
+ISR_NOERR 32
+ISR_NOERR 33
+ISR_NOERR 34
+ISR_NOERR 35
+ISR_NOERR 36
+ISR_NOERR 37
+ISR_NOERR 38
+ISR_NOERR 39
+ISR_NOERR 40
+ISR_NOERR 41
+ISR_NOERR 42
+ISR_NOERR 43
+ISR_NOERR 44
+ISR_NOERR 45
+ISR_NOERR 46
+ISR_NOERR 47
+
+/* System calls by int; the gate is the one vector open to ring 3 */
+.global isr_syscall
+isr_syscall:
+	push $0
+	push $0x80
+	jmp isr_common
+
+/* Ring 3 arrives with its own data segments; the kernel's go in for the
+   handler and the interrupted code's come back after it */
+isr_common:
+	pusha
+	mov %esp, %ebx		/* The frame, saved by pusha */
+	push %ds
+	push %es
+	mov $KERNEL_DATA, %ax
+	mov %ax, %ds
+	mov %ax, %es
+	cld
+	push %ebx
+	call interrupt_dispatch
+	add $4, %esp
+	pop %es
+	pop %ds
+	popa
+	add $8, %esp	/* vector and error code */
+	iret
+
+/* Stub addresses for interrupts_init() */
+.section .rodata
+.global isr_stub_table
+isr_stub_table:
+.irp num, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47
+	.long isr\num
+.endr
@@ -0,0 +1,243 @@
+#include "klib.h"
+
+#ifndef FOX_HOSTED
+/* ===== Custom String Functions ===== */
+
+// Added bounds checking to prevent buffer overflows
+size_t strlen(const char* str) {
+    if (str == NULL) return 0;
+    
+    size_t len = 0;
+    while (str[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+int strcmp(const char* s1, const char* s2) {
+    if (s1 == NULL || s2 == NULL) return -1;
+    
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return (int)((unsigned char)*s1) - (int)((unsigned char)*s2);
+}
+
+int strncmp(const char* s1, const char* s2, size_t n) {
+    if (s1 == NULL || s2 == NULL || n == 0) return 0;
+    
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c1 = (unsigned char)s1[i];
+        unsigned char c2 = (unsigned char)s2[i];
+        if (c1 != c2) return (int)c1 - (int)c2;
+        if (c1 == '\0') return 0;
+    }
+    return 0;
+}
+
+char* strcpy(char* dest, const char* src) {
+    if (dest == NULL || src == NULL) return dest;
+    
+    char* original_dest = dest;
+    while ((*dest++ = *src++));
+    return original_dest;
+}
+
+char* strncpy(char* dest, const char* src, size_t n) {
+    if (dest == NULL || src == NULL || n == 0) return dest;
+    
+    char* original_dest = dest;
+    size_t i = 0;
+    for (; i < n - 1 && src[i] != '\0'; i++) dest[i] = src[i];
+    dest[i] = '\0'; // Always null-terminate
+    return original_dest;
+}
+
+void* memset(void* ptr, int value, size_t num) {
+    if (ptr == NULL) return NULL;
+    
+    unsigned char* p = ptr;
+    while (num--) {
+        *p++ = (unsigned char)value;
+    }
+    return ptr;
+}
+
+void* memcpy(void* dest, const void* src, size_t n) {
+    if (dest == NULL || src == NULL) return dest;
+    
+    char* d = dest;
+    const char* s = src;
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t n) {
+    if (dest == NULL || src == NULL) return dest;
+    
+    char* d = dest;
+    const char* s = src;
+    
+    if (d < s) {
+        while (n--) *d++ = *s++;
+    } else {
+        d += n;
+        s += n;
+        while (n--) *--d = *--s;
+    }
+    return dest;
+}
+
+// Implement strchr function
+char* strchr(const char* s, int c) {
+    if (s == NULL) return NULL;
+    
+    while (*s != '\0') {
+        if (*s == (char)c) {
+            return (char*)s;
+        }
+        s++;
+    }
+    return NULL;
+}
+
+// Implement strrchr function
+char* strrchr(const char* s, int c) {
+    if (s == NULL) return NULL;
+    
+    const char *found = NULL;
+    while (*s != '\0') {
+        if (*s == (char)c) {
+            found = s;
+        }
+        s++;
+    }
+    return (char*)found;
+}
+
+// Implement strcat function
+char* strcat(char* dest, const char* src) {
+    if (dest == NULL || src == NULL) return dest;
+    
+    char* ptr = dest + strlen(dest);
+    while (*src != '\0') {
+        *ptr++ = *src++;
+    }
+    *ptr = '\0';
+    return dest;
+}
+
+// Implement tolower function
+int tolower(int c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c + ('a' - 'A');
+    }
+    return c;
+}
+
+// Implement strcasecmp function
+int strcasecmp(const char* s1, const char* s2) {
+    if (s1 == NULL || s2 == NULL) return -1;
+    
+    while (*s1 && *s2) {
+        int diff = tolower(*s1) - tolower(*s2);
+        if (diff != 0) return diff;
+        s1++;
+        s2++;
+    }
+    return tolower(*s1) - tolower(*s2);
+}
+#endif
+
+/* ===== Utility Functions ===== */
+void itoa(int value, char* str, int base) {
+    if (str == NULL) return;
+    
+    char* ptr = str;
+    bool negative = false;
+    unsigned int u;
+    if (value == 0) {
+        *ptr++ = '0';
+        *ptr = '\0';
+        return;
+    }
+    if (value < 0 && base == 10) {
+        negative = true;
+        u = 0u - (unsigned int)value;  // Also right for INT_MIN
+    } else {
+        u = (unsigned int)value;
+    }
+
+    while (u) {
+        unsigned int digit = u % base;
+        *ptr++ = "0123456789abcdef"[digit];
+        u /= base;
+    }
+    if (negative) *ptr++ = '-';
+    *ptr = '\0';
+
+    // Reverse
+    char *p1 = str, *p2 = ptr - 1;
+    while (p1 < p2) {
+        char tmp = *p1;
+        *p1 = *p2;
+        *p2 = tmp;
+        p1++; p2--;
+    }
+}
+
+// 64-by-32-bit division without pulling in libgcc's __udivdi3
+uint64_t udiv64(uint64_t value, uint32_t divisor) {
+#if defined(__i386__) && !defined(FOX_HOSTED)
+    uint32_t hi = value >> 32;
+    uint32_t q_hi = hi / divisor;
+    uint32_t rem = hi % divisor;
+    uint32_t q_lo;
+    __asm__ ("divl %2" : "=a"(q_lo), "+d"(rem) : "rm"(divisor), "a"((uint32_t)value));
+    return ((uint64_t)q_hi << 32) | q_lo;
+#else
+    return value / divisor;
+#endif
+}
+
+/* ===== UTF-8 ===== */
+int utf8_decode(utf8_decoder_t* decoder, uint8_t byte, uint32_t out[2]) {
+    int count = 0;
+    if (decoder->needed > 0) {
+        if ((byte & 0xC0) == 0x80) {
+            decoder->code_point = decoder->code_point << 6 | (byte & 0x3F);
+            if (--decoder->needed > 0) return 0;
+            uint32_t code_point = decoder->code_point;
+            if (code_point < decoder->minimum || code_point > 0x10FFFF ||
+                (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+                code_point = UTF8_REPLACEMENT;
+            }
+            out[0] = code_point;
+            return 1;
+        }
+        // Cut short: the sequence so far is one bad character, and this byte starts over
+        decoder->needed = 0;
+        out[count++] = UTF8_REPLACEMENT;
+    }
+    if (byte < 0x80) {
+        out[count++] = byte;
+    } else if ((byte & 0xE0) == 0xC0) {
+        decoder->code_point = byte & 0x1F;
+        decoder->minimum = 0x80;
+        decoder->needed = 1;
+    } else if ((byte & 0xF0) == 0xE0) {
+        decoder->code_point = byte & 0x0F;
+        decoder->minimum = 0x800;
+        decoder->needed = 2;
+    } else if ((byte & 0xF8) == 0xF0) {
+        decoder->code_point = byte & 0x07;
+        decoder->minimum = 0x10000;
+        decoder->needed = 3;
+    } else {
+        out[count++] = UTF8_REPLACEMENT;
+    }
+    return count;
+}
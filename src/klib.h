@@ -0,0 +1,47 @@
+#ifndef FOXOS_KLIB_H
+#define FOXOS_KLIB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal C library for the kernel. Host builds (FOX_HOSTED) take the string
+ * functions from the system libc instead and only use what's missing there.
+ */
+#ifdef FOX_HOSTED
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#else
+size_t strlen(const char* str);
+int strcmp(const char* s1, const char* s2);
+int strncmp(const char* s1, const char* s2, size_t n);
+char* strcpy(char* dest, const char* src);
+char* strncpy(char* dest, const char* src, size_t n);
+void* memset(void* ptr, int value, size_t num);
+void* memcpy(void* dest, const void* src, size_t n);
+void* memmove(void* dest, const void* src, size_t n);
+char* strchr(const char* s, int c);
+char* strrchr(const char* s, int c);
+char* strcat(char* dest, const char* src);
+int tolower(int c);
+int strcasecmp(const char* s1, const char* s2);
+#endif
+
+void itoa(int value, char* str, int base);
+uint64_t udiv64(uint64_t value, uint32_t divisor);
+
+/* UTF-8 decoding a byte at a time, so a character can be split across writes */
+#define UTF8_REPLACEMENT 0xFFFD  // Stands in for malformed input
+
+typedef struct {
+    uint32_t code_point;  // So far
+    uint32_t minimum;     // Smaller is an overlong encoding
+    uint8_t needed;       // Continuation bytes still to come
+} utf8_decoder_t;
+
+// Writes the 0, 1 or 2 code points 'byte' finishes to 'out' and returns how many
+int utf8_decode(utf8_decoder_t* decoder, uint8_t byte, uint32_t out[2]);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef FOXOS_MULTIBOOT_H
+#define FOXOS_MULTIBOOT_H
+
+#include <stdint.h>
+
+/* Multiboot (version 1) boot information, see the Multiboot specification 0.6.96 */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002  // In eax when the loader jumps to _start
+
+/* multiboot_info_t.flags */
+#define MULTIBOOT_INFO_MEMORY   (1 << 0)  // mem_lower/mem_upper are valid
+#define MULTIBOOT_INFO_CMDLINE  (1 << 2)
+#define MULTIBOOT_INFO_MODS     (1 << 3)  // mods_count/mods_addr are valid
+#define MULTIBOOT_INFO_MEM_MAP  (1 << 6)
+#define MULTIBOOT_INFO_FRAMEBUFFER (1 << 12)  // framebuffer_* are valid
+
+/* multiboot_info_t.framebuffer_type */
+#define MULTIBOOT_FRAMEBUFFER_INDEXED  0
+#define MULTIBOOT_FRAMEBUFFER_RGB      1
+#define MULTIBOOT_FRAMEBUFFER_EGA_TEXT 2
+
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;     // KB below 1 MB
+    uint32_t mem_upper;     // KB above 1 MB
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+    uint32_t vbe_control_info;
+    uint32_t vbe_mode_info;
+    uint16_t vbe_mode;
+    uint16_t vbe_interface_seg;
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+    uint64_t framebuffer_addr;  // Physical
+    uint32_t framebuffer_pitch; // Bytes per row
+    uint32_t framebuffer_width;
+    uint32_t framebuffer_height;
+    uint8_t framebuffer_bpp;
+    uint8_t framebuffer_type;
+    // For MULTIBOOT_FRAMEBUFFER_RGB: where each channel's bits are in a pixel
+    uint8_t framebuffer_red_position;
+    uint8_t framebuffer_red_size;
+    uint8_t framebuffer_green_position;
+    uint8_t framebuffer_green_size;
+    uint8_t framebuffer_blue_position;
+    uint8_t framebuffer_blue_size;
+} __attribute__((packed)) multiboot_info_t;
+
+/* A file the loader placed in memory next to the kernel */
+typedef struct {
+    uint32_t mod_start;
+    uint32_t mod_end;       // One past the last byte
+    uint32_t string;        // Module command line
+    uint32_t reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+#endif
@@ -0,0 +1,129 @@
+#include "klib.h"
+#include "interrupts.h"
+#include "paging.h"
+
+#define DIRECTORY_ENTRIES 1024
+#define LARGE_PAGE_SIZE   0x400000
+#define FRAME_MASK        0xFFFFF000
+#define CR0_PAGING        0x80000000
+#define CR4_PSE           0x00000010  // 4 MB pages
+
+static uint32_t page_directory[DIRECTORY_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static uint8_t page_pool[PAGE_POOL_FRAMES][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t pool_used[PAGE_POOL_FRAMES / 32];  // Bitmap
+static uint32_t pool_free_count = PAGE_POOL_FRAMES;
+static page_fault_handler_t fault_handler;
+
+/* ===== Frame Pool ===== */
+void* page_alloc() {
+    for (uint32_t word = 0; word < PAGE_POOL_FRAMES / 32; word++) {
+        if (pool_used[word] == 0xFFFFFFFF) continue;
+        uint32_t bit = __builtin_ctz(~pool_used[word]);
+        pool_used[word] |= 1u << bit;
+        pool_free_count--;
+        void* frame = page_pool[word * 32 + bit];
+        memset(frame, 0, PAGE_SIZE);
+        return frame;
+    }
+    return NULL;
+}
+
+void page_free(void* frame) {
+    uint32_t address = (uint32_t)frame;
+    uint32_t base = (uint32_t)page_pool;
+    if (address < base || address >= base + sizeof(page_pool)) return;
+    uint32_t index = (address - base) / PAGE_SIZE;
+    if (pool_used[index / 32] & (1u << (index % 32))) {
+        pool_used[index / 32] &= ~(1u << (index % 32));
+        pool_free_count++;
+    }
+}
+
+uint32_t page_pool_free() {
+    return pool_free_count;
+}
+
+/* ===== Device Mappings ===== */
+bool paging_map_device(uint32_t physical, uint32_t size) {
+    if (size == 0 || physical + (size - 1) < physical) return false;
+    uint32_t first = physical >> 22;
+    uint32_t last = (physical + (size - 1)) >> 22;
+    if (first < USER_END >> 22 && last >= USER_BASE >> 22) return false;
+    for (uint32_t dir = first; dir <= last; dir++) {
+        if (dir < KERNEL_MAP_END >> 22) continue;  // Already there
+        page_directory[dir] = dir * LARGE_PAGE_SIZE | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE;
+    }
+    __asm__ volatile ("mov %%cr3, %%eax; mov %%eax, %%cr3" : : : "eax", "memory");
+    return true;
+}
+
+/* ===== User Mappings ===== */
+// Frames are identity mapped, so a table's physical address is also where the kernel reaches it
+static uint32_t* page_table(uint32_t address, bool create) {
+    uint32_t* pde = &page_directory[address >> 22];
+    if (!(*pde & PAGE_PRESENT)) {
+        if (!create) return NULL;
+        void* table = page_alloc();
+        if (table == NULL) return NULL;
+        // Permissions are decided per page; the directory lets everything through
+        *pde = (uint32_t)table | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    }
+    return (uint32_t*)(*pde & FRAME_MASK);
+}
+
+bool paging_map_user(uint32_t address, void* frame, bool writable) {
+    uint32_t* table = page_table(address, true);
+    if (table == NULL) return false;
+    table[(address >> 12) & 0x3FF] = (uint32_t)frame | PAGE_PRESENT | PAGE_USER | (writable ? PAGE_WRITABLE : 0);
+    return true;
+}
+
+uint32_t paging_lookup(uint32_t address) {
+    if (address < USER_BASE || address >= USER_END) return 0;
+    uint32_t* table = page_table(address, false);
+    return table ? table[(address >> 12) & 0x3FF] : 0;
+}
+
+void paging_unmap_user() {
+    for (uint32_t dir = USER_BASE >> 22; dir < USER_END >> 22; dir++) {
+        if (!(page_directory[dir] & PAGE_PRESENT)) continue;
+        uint32_t* table = (uint32_t*)(page_directory[dir] & FRAME_MASK);
+        for (uint32_t i = 0; i < DIRECTORY_ENTRIES; i++) {
+            if (table[i] & PAGE_PRESENT) page_free((void*)(table[i] & FRAME_MASK));
+        }
+        page_free(table);
+        page_directory[dir] = 0;
+    }
+    // Reloading CR3 flushes every stale translation at once
+    __asm__ volatile ("mov %%cr3, %%eax; mov %%eax, %%cr3" : : : "eax", "memory");
+}
+
+/* ===== Faults ===== */
+void paging_set_fault_handler(page_fault_handler_t handler) {
+    fault_handler = handler;
+}
+
+static void page_fault(interrupt_frame_t* frame) {
+    uint32_t address;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(address));
+    // Error bit 0 set means the page was there and the access wasn't allowed
+    bool not_present = (frame->error & 1) == 0;
+    if (not_present && address >= USER_BASE && address < USER_END && fault_handler && fault_handler(address)) {
+        return;
+    }
+    interrupt_fault(frame);
+}
+
+void paging_init() {
+    for (uint32_t dir = 0; dir < KERNEL_MAP_END >> 22; dir++) {
+        page_directory[dir] = dir * LARGE_PAGE_SIZE | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE;
+    }
+    interrupt_register(14, page_fault);
+
+    uint32_t cr0, cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4 | CR4_PSE));
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(page_directory) : "memory");
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0 | CR0_PAGING) : "memory");
+}
@@ -0,0 +1,42 @@
+#ifndef FOXOS_PAGING_H
+#define FOXOS_PAGING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * One address space. The low gigabyte is identity mapped for the kernel with
+ * 4 MB pages, supervisor only; user programs live above it in 4 KB pages
+ * whose frames come from a fixed pool, mapped one at a time as they fault.
+ */
+#define PAGE_SIZE        4096
+#define PAGE_POOL_FRAMES 256          // 1 MB for user pages and their page tables
+#define KERNEL_MAP_END   0x40000000   // Identity mapped below this
+#define USER_BASE        0x40000000
+#define USER_END         0xC0000000
+
+/* Page table entry bits */
+#define PAGE_PRESENT  0x001
+#define PAGE_WRITABLE 0x002
+#define PAGE_USER     0x004
+#define PAGE_LARGE    0x080  // 4 MB page, in a directory entry
+
+// Resolves a not-present fault at a user address; false leaves it a fault
+typedef bool (*page_fault_handler_t)(uint32_t address);
+
+void paging_init();
+void paging_set_fault_handler(page_fault_handler_t handler);
+
+void* page_alloc();   // A zeroed frame from the pool, NULL when it's empty
+void page_free(void* frame);  // Frames outside the pool are ignored
+uint32_t page_pool_free();
+
+// Identity maps device memory above the low gigabyte (a framebuffer) for the
+// kernel; false if it would overlap the user range
+bool paging_map_device(uint32_t physical, uint32_t size);
+
+bool paging_map_user(uint32_t address, void* frame, bool writable);  // False if out of frames
+uint32_t paging_lookup(uint32_t address);  // Page table entry, 0 if unmapped
+void paging_unmap_user();  // Drops every user page and returns pool frames
+
+#endif
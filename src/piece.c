@@ -0,0 +1,168 @@
+#include "klib.h"
+#include "piece.h"
+
+static const char* piece_data(const piece_table_t* table, const piece_t* piece) {
+    return (piece->source == PIECE_ORIGINAL ? table->original : table->added) + piece->start;
+}
+
+// The piece holding 'position' and where it starts; 'count' and the length at the end
+static uint32_t find_piece(const piece_table_t* table, uint32_t position, uint32_t* start) {
+    uint32_t at = 0;
+    for (uint32_t i = 0; i < table->count; i++) {
+        if (position < at + table->pieces[i].length) {
+            *start = at;
+            return i;
+        }
+        at += table->pieces[i].length;
+    }
+    *start = at;
+    return table->count;
+}
+
+// Opens 'count' empty slots at 'index'
+static void make_room(piece_table_t* table, uint32_t index, uint32_t count) {
+    memmove(&table->pieces[index + count], &table->pieces[index], (table->count - index) * sizeof(piece_t));
+    table->count += count;
+}
+
+static void remove_pieces(piece_table_t* table, uint32_t index, uint32_t count) {
+    memmove(&table->pieces[index], &table->pieces[index + count],
+            (table->count - index - count) * sizeof(piece_t));
+    table->count -= count;
+}
+
+void piece_init(piece_table_t* table, const char* original, uint32_t length,
+                char* added, uint32_t added_capacity, piece_t* pieces, uint32_t capacity) {
+    table->original = original;
+    table->added = added;
+    table->added_length = 0;
+    table->added_capacity = added_capacity;
+    table->pieces = pieces;
+    table->capacity = capacity;
+    table->count = 0;
+    table->length = length;
+    if (length > 0) {
+        pieces[0] = (piece_t){ PIECE_ORIGINAL, 0, length };
+        table->count = 1;
+    }
+}
+
+bool piece_insert(piece_table_t* table, uint32_t position, const char* text, uint32_t length) {
+    if (length == 0) return true;
+    if (position > table->length || length > table->added_capacity - table->added_length) return false;
+
+    uint32_t start;
+    uint32_t index = find_piece(table, position, &start);
+    if (position == start && index > 0) {
+        // Right after the previous piece: if that was the last thing typed, it just grows
+        piece_t* previous = &table->pieces[index - 1];
+        if (previous->source == PIECE_ADDED && previous->start + previous->length == table->added_length) {
+            memcpy(table->added + table->added_length, text, length);
+            table->added_length += length;
+            previous->length += length;
+            table->length += length;
+            return true;
+        }
+    }
+
+    piece_t inserted = { PIECE_ADDED, table->added_length, length };
+    if (position == start) {
+        if (table->count + 1 > table->capacity) return false;
+        make_room(table, index, 1);
+        table->pieces[index] = inserted;
+    } else {
+        // Inside a piece: split it around the new one
+        if (table->count + 2 > table->capacity) return false;
+        make_room(table, index + 1, 2);
+        piece_t* left = &table->pieces[index];
+        uint32_t split = position - start;
+        table->pieces[index + 2] = (piece_t){ left->source, left->start + split, left->length - split };
+        left->length = split;
+        table->pieces[index + 1] = inserted;
+    }
+    memcpy(table->added + table->added_length, text, length);
+    table->added_length += length;
+    table->length += length;
+    return true;
+}
+
+bool piece_delete(piece_table_t* table, uint32_t position, uint32_t length) {
+    if (position >= table->length) return length == 0;
+    if (length > table->length - position) length = table->length - position;
+    if (length == 0) return true;
+
+    uint32_t start;
+    uint32_t index = find_piece(table, position, &start);
+    piece_t* first = &table->pieces[index];
+    uint32_t skip = position - start;
+    if (skip > 0 && skip + length < first->length) {
+        // Out of the middle of one piece: it becomes two
+        if (table->count + 1 > table->capacity) return false;
+        make_room(table, index + 1, 1);
+        first = &table->pieces[index];
+        table->pieces[index + 1] = (piece_t){ first->source, first->start + skip + length,
+                                              first->length - skip - length };
+        first->length = skip;
+        table->length -= length;
+        return true;
+    }
+
+    table->length -= length;
+    if (skip > 0) {
+        // Keep the front of the first piece
+        length -= first->length - skip;
+        first->length = skip;
+        index++;
+    }
+    uint32_t whole = 0;
+    while (index + whole < table->count && table->pieces[index + whole].length <= length) {
+        length -= table->pieces[index + whole].length;
+        whole++;
+    }
+    if (length > 0) {
+        // Ends inside this piece: drop its front
+        piece_t* last = &table->pieces[index + whole];
+        last->start += length;
+        last->length -= length;
+    }
+    remove_pieces(table, index, whole);
+    return true;
+}
+
+void piece_copy(const piece_table_t* table, char* out) {
+    for (uint32_t i = 0; i < table->count; i++) {
+        memcpy(out, piece_data(table, &table->pieces[i]), table->pieces[i].length);
+        out += table->pieces[i].length;
+    }
+}
+
+void piece_seek(piece_iter_t* iter, const piece_table_t* table, uint32_t position) {
+    uint32_t start;
+    iter->table = table;
+    iter->piece = find_piece(table, position, &start);
+    iter->offset = position - start;
+    if (iter->piece == table->count) iter->offset = 0;
+}
+
+int piece_next(piece_iter_t* iter) {
+    const piece_table_t* table = iter->table;
+    if (iter->piece >= table->count) return -1;
+    const piece_t* piece = &table->pieces[iter->piece];
+    int c = (uint8_t)piece_data(table, piece)[iter->offset];
+    if (++iter->offset == piece->length) {
+        iter->piece++;
+        iter->offset = 0;
+    }
+    return c;
+}
+
+int piece_prev(piece_iter_t* iter) {
+    const piece_table_t* table = iter->table;
+    if (iter->offset == 0) {
+        if (iter->piece == 0) return -1;
+        iter->piece--;
+        iter->offset = table->pieces[iter->piece].length;
+    }
+    iter->offset--;
+    return (uint8_t)piece_data(table, &table->pieces[iter->piece])[iter->offset];
+}
@@ -0,0 +1,57 @@
+#ifndef FOXOS_PIECE_H
+#define FOXOS_PIECE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Piece table: a document is a list of pieces, each a run of bytes from
+ * either the original text (never changed) or the add buffer (only ever
+ * appended to). Inserting appends the new text to the add buffer and splits
+ * a piece around it; deleting trims or splits pieces. The text itself never
+ * moves, so an edit costs the same in a big file as in a small one. Typing
+ * at the end of the last insertion just grows that piece.
+ *
+ * The owner supplies all three arrays. Edits that would overflow one of
+ * them fail and leave the document as it was.
+ */
+#define PIECE_ORIGINAL 0
+#define PIECE_ADDED    1
+
+typedef struct {
+    uint8_t source;   // PIECE_ORIGINAL or PIECE_ADDED
+    uint32_t start;   // Offset into that buffer
+    uint32_t length;  // Never 0
+} piece_t;
+
+typedef struct {
+    const char* original;
+    char* added;
+    uint32_t added_length;
+    uint32_t added_capacity;
+    piece_t* pieces;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t length;  // Of the whole document
+} piece_table_t;
+
+// Position in a document for reading it a byte at a time either way
+typedef struct {
+    const piece_table_t* table;
+    uint32_t piece;   // 'count' at the end
+    uint32_t offset;  // Within the piece
+} piece_iter_t;
+
+void piece_init(piece_table_t* table, const char* original, uint32_t length,
+                char* added, uint32_t added_capacity, piece_t* pieces, uint32_t capacity);
+bool piece_insert(piece_table_t* table, uint32_t position, const char* text, uint32_t length);
+bool piece_delete(piece_table_t* table, uint32_t position, uint32_t length);
+
+// Copies the whole document to 'out', which must hold table->length bytes
+void piece_copy(const piece_table_t* table, char* out);
+
+void piece_seek(piece_iter_t* iter, const piece_table_t* table, uint32_t position);
+int piece_next(piece_iter_t* iter);  // The byte at the position, then steps past it; -1 at the end
+int piece_prev(piece_iter_t* iter);  // Steps back, then returns the byte there; -1 at the start
+
+#endif
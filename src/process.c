@@ -0,0 +1,400 @@
+#include "klib.h"
+#include "fs.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "io.h"
+#include "paging.h"
+#include "process.h"
+#include "stream.h"
+#include "syscall.h"
+#include "task.h"
+
+void terminal_writestring(const char* data);
+void terminal_write(const char* data, size_t size);
+
+/* ===== ELF ===== */
+#define ELF_MAGIC    0x464C457F  // "\x7F" "ELF"
+#define ELF_CLASS32  1
+#define ELF_DATA_LSB 1
+#define ET_EXEC      2
+#define EM_386       3
+#define PT_LOAD      1
+#define PT_DYNAMIC   2
+#define PT_INTERP    3
+#define PF_W         2
+
+typedef struct {
+    uint32_t magic;
+    uint8_t elf_class;
+    uint8_t data;
+    uint8_t ident_version;
+    uint8_t ident_pad[9];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) elf_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} __attribute__((packed)) elf_program_header_t;
+
+/* ===== Process State ===== */
+typedef struct {
+    uint32_t vaddr;
+    uint32_t memsz;
+    uint32_t offset;   // In the file
+    uint32_t filesz;   // The rest up to memsz is zero
+    bool writable;
+} process_segment_t;
+
+typedef struct {
+    bool open;
+    bool terminal;
+    bool writing;      // Contents are staged in write_buffer until close
+    char path[MAX_PATH_LEN];
+    uint32_t offset;
+} process_file_t;
+
+static struct {
+    bool running;
+    char path[MAX_PATH_LEN];   // Absolute, so pages can be read whatever the shell's directory
+    process_segment_t segments[PROCESS_MAX_SEGMENTS];
+    uint32_t segment_count;
+    process_file_t files[PROCESS_MAX_FILES];
+    uint32_t write_size;
+} process;
+
+static uint8_t write_buffer[PROCESS_WRITE_MAX];
+static uint8_t syscall_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static bool has_sysenter;
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+#define CPUID_SEP        (1 << 11)
+
+// usermode.s
+int process_enter(uint32_t entry, uint32_t user_esp);
+void process_leave(int code) __attribute__((noreturn));
+void sysenter_entry();
+extern const uint8_t syscall_stub_sysenter[], syscall_stub_sysenter_end[];
+extern const uint8_t syscall_stub_int[], syscall_stub_int_end[];
+
+// Called from usermode.s
+void process_set_kernel_stack(uint32_t esp);
+uint32_t syscall_dispatch(uint32_t number, uint32_t a, uint32_t b, uint32_t c);
+
+void process_perror(int error_code) {
+    switch (error_code) {
+        case PROCESS_NOT_EXEC: terminal_writestring("Not an executable"); break;
+        case PROCESS_UNSUPPORTED: terminal_writestring("Not a static i386 executable"); break;
+        case PROCESS_BAD_LAYOUT: terminal_writestring("Segments outside user space"); break;
+        case PROCESS_NO_MEMORY: terminal_writestring("Out of memory"); break;
+        case PROCESS_BUSY: terminal_writestring("Another program is running"); break;
+        default: fs_perror(error_code); break;
+    }
+}
+
+/* ===== Demand Paging ===== */
+// Maps the page holding 'address' if the program has anything there: file
+// contents for segment data, zeroes for bss and the stack
+static bool load_page(uint32_t address) {
+    uint32_t page = address & ~(PAGE_SIZE - 1);
+    bool stack = page >= USER_STACK_TOP - USER_STACK_MAX && page < USER_STACK_TOP;
+    bool found = stack;
+    bool writable = stack;
+    for (uint32_t i = 0; i < process.segment_count; i++) {
+        const process_segment_t* s = &process.segments[i];
+        if (page < s->vaddr + s->memsz && page + PAGE_SIZE > s->vaddr) {
+            found = true;
+            writable |= s->writable;
+        }
+    }
+    if (!found) return false;
+
+    uint8_t* frame = page_alloc();
+    if (frame == NULL) {
+        terminal_writestring("\nOut of memory for user pages");
+        return false;
+    }
+    // Segments can share a page at their edges, so each copies its own part
+    for (uint32_t i = 0; i < process.segment_count; i++) {
+        const process_segment_t* s = &process.segments[i];
+        uint32_t from = page > s->vaddr ? page : s->vaddr;
+        uint32_t to = s->vaddr + s->filesz;
+        if (to > page + PAGE_SIZE) to = page + PAGE_SIZE;
+        if (from >= to) continue;
+        int read = fs_read_at(process.path, s->offset + (from - s->vaddr), frame + (from - page), to - from);
+        if (read != (int)(to - from)) {
+            page_free(frame);
+            return false;
+        }
+    }
+    if (!paging_map_user(page, frame, writable)) {
+        page_free(frame);
+        return false;
+    }
+    return true;
+}
+
+static bool process_page_fault(uint32_t address) {
+    return process.running && load_page(address);
+}
+
+// A user buffer the kernel is about to touch: inside user space, allowed,
+// and paged in up front so the file system never faults halfway through
+static bool user_buffer(uint32_t address, uint32_t size, bool write) {
+    if (address < USER_BASE || address > USER_END || size > USER_END - address) return false;
+    for (uint32_t page = address & ~(PAGE_SIZE - 1); page < address + size; page += PAGE_SIZE) {
+        uint32_t entry = paging_lookup(page);
+        if (!(entry & PAGE_PRESENT)) {
+            if (!load_page(page)) return false;
+            entry = paging_lookup(page);
+        }
+        if (write && !(entry & PAGE_WRITABLE)) return false;
+    }
+    return true;
+}
+
+static bool user_string(uint32_t address, char* out, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        if ((i == 0 || ((address + i) & (PAGE_SIZE - 1)) == 0) && !user_buffer(address + i, 1, false)) {
+            return false;
+        }
+        out[i] = *(const char*)(address + i);
+        if (out[i] == '\0') return true;
+    }
+    return false;
+}
+
+/* ===== System Calls ===== */
+static process_file_t* file_of(uint32_t fd) {
+    if (fd >= PROCESS_MAX_FILES || !process.files[fd].open) return NULL;
+    return &process.files[fd];
+}
+
+static int sys_open(uint32_t path_address, uint32_t flags) {
+    char path[MAX_PATH_LEN];
+    if (!user_string(path_address, path, sizeof(path))) return FS_ERROR;
+    uint32_t fd = 3;
+    while (fd < PROCESS_MAX_FILES && process.files[fd].open) fd++;
+    if (fd == PROCESS_MAX_FILES) return FS_ERROR;
+
+    process_file_t* f = &process.files[fd];
+    if (flags & O_WRITE) {
+        // The file system writes whole files, so only one can be staged at a time
+        for (uint32_t i = 0; i < PROCESS_MAX_FILES; i++) {
+            if (process.files[i].open && process.files[i].writing) return FS_ERROR;
+        }
+        int result = fs_create(path, FS_ATTR_FILE);
+        if (result != FS_OK && result != FS_EXISTS) return result;
+        process.write_size = 0;
+    }
+    dir_entry_t entry;
+    int result = fs_stat(path, &entry);
+    if (result != FS_OK) return result;
+    if (entry.attributes & FS_ATTR_DIR) return FS_ERROR;
+
+    memset(f, 0, sizeof(*f));
+    f->open = true;
+    f->writing = (flags & O_WRITE) != 0;
+    strncpy(f->path, path, sizeof(f->path) - 1);
+    return fd;
+}
+
+static int sys_close(uint32_t fd) {
+    process_file_t* f = file_of(fd);
+    if (f == NULL) return FS_ERROR;
+    f->open = false;
+    return f->writing ? fs_write(f->path, write_buffer, process.write_size) : FS_OK;
+}
+
+static int sys_write(uint32_t fd, uint32_t buffer, uint32_t size) {
+    process_file_t* f = file_of(fd);
+    if (f == NULL || !user_buffer(buffer, size, false)) return FS_ERROR;
+    if (f->terminal) {
+        terminal_write((const char*)buffer, size);
+        return size;
+    }
+    if (!f->writing) return FS_ERROR;
+    if (size > PROCESS_WRITE_MAX - process.write_size) return FS_FULL;
+    memcpy(write_buffer + process.write_size, (const void*)buffer, size);
+    process.write_size += size;
+    return size;
+}
+
+static int sys_read(uint32_t fd, uint32_t buffer, uint32_t size) {
+    process_file_t* f = file_of(fd);
+    if (f == NULL || f->writing || !user_buffer(buffer, size, true)) return FS_ERROR;
+    if (f->terminal) return stream_read(task_stdin(), (char*)buffer, size);
+    int read = fs_read_at(f->path, f->offset, (void*)buffer, size);
+    if (read > 0) f->offset += read;
+    return read;
+}
+
+uint32_t syscall_dispatch(uint32_t number, uint32_t a, uint32_t b, uint32_t c) {
+    switch (number) {
+        case SYS_EXIT:
+            for (uint32_t fd = 0; fd < PROCESS_MAX_FILES; fd++) {
+                if (process.files[fd].open) sys_close(fd);
+            }
+            process_leave((int)a);
+        case SYS_WRITE: return sys_write(a, b, c);
+        case SYS_READ: return sys_read(a, b, c);
+        case SYS_OPEN: return sys_open(a, b);
+        case SYS_CLOSE: return sys_close(a);
+    }
+    return FS_ERROR;
+}
+
+static void syscall_interrupt(interrupt_frame_t* frame) {
+    // The gate turned interrupts off; the call may yield to other tasks, which need the timer
+    __asm__ volatile ("sti");
+    frame->eax = syscall_dispatch(frame->eax, frame->ebx, frame->esi, frame->edi);
+}
+
+// Exceptions in ring 3 end the program instead of the system
+static void process_fault(interrupt_frame_t* frame) {
+    terminal_writestring("\n");
+    terminal_writestring(process.path);
+    terminal_writestring(": ");
+    interrupt_describe(frame);
+    terminal_writestring("\n");
+    process_leave(PROCESS_KILLED_BASE + frame->vector);
+}
+
+/* ===== Loading and Running ===== */
+void process_set_kernel_stack(uint32_t esp) {
+    gdt_set_kernel_stack(esp);
+    if (has_sysenter) wrmsr(MSR_SYSENTER_ESP, esp);
+}
+
+static int load_headers(const char* path, uint32_t* entry) {
+    elf_header_t header;
+    int read = fs_read_at(path, 0, &header, sizeof(header));
+    if (read < 0) return read;
+    if (read != sizeof(header) || header.magic != ELF_MAGIC) return PROCESS_NOT_EXEC;
+    if (header.elf_class != ELF_CLASS32 || header.data != ELF_DATA_LSB || header.type != ET_EXEC ||
+        header.machine != EM_386 || header.phentsize != sizeof(elf_program_header_t)) {
+        return PROCESS_UNSUPPORTED;
+    }
+
+    bool entry_mapped = false;
+    process.segment_count = 0;
+    for (uint32_t i = 0; i < header.phnum; i++) {
+        elf_program_header_t ph;
+        read = fs_read_at(path, header.phoff + i * sizeof(ph), &ph, sizeof(ph));
+        if (read < 0) return read;
+        if (read != sizeof(ph)) return PROCESS_NOT_EXEC;
+        if (ph.type == PT_DYNAMIC || ph.type == PT_INTERP) return PROCESS_UNSUPPORTED;
+        if (ph.type != PT_LOAD || ph.memsz == 0) continue;
+
+        uint32_t limit = USER_STACK_TOP - USER_STACK_MAX;
+        if (ph.filesz > ph.memsz || ph.vaddr < USER_BASE || ph.vaddr > limit || ph.memsz > limit - ph.vaddr) {
+            return PROCESS_BAD_LAYOUT;
+        }
+        if (process.segment_count == PROCESS_MAX_SEGMENTS) return PROCESS_UNSUPPORTED;
+        process_segment_t* s = &process.segments[process.segment_count++];
+        s->vaddr = ph.vaddr;
+        s->memsz = ph.memsz;
+        s->offset = ph.offset;
+        s->filesz = ph.filesz;
+        s->writable = (ph.flags & PF_W) != 0;
+        if (header.entry >= ph.vaddr && header.entry - ph.vaddr < ph.memsz) entry_mapped = true;
+    }
+    if (!entry_mapped) return PROCESS_BAD_LAYOUT;
+    *entry = header.entry;
+    return PROCESS_OK;
+}
+
+// The argument strings go at the top of the stack with the usual i386 start
+// frame below them: argc, argv[0..argc-1], NULL, and an empty environment
+static uint32_t setup_stack(int argc, const char** argv) {
+    uint32_t pointers[PROCESS_MAX_ARGS];
+    uint32_t sp = USER_STACK_TOP;
+    if (argc > PROCESS_MAX_ARGS) argc = PROCESS_MAX_ARGS;
+    for (int i = argc - 1; i >= 0; i--) {
+        uint32_t len = strlen(argv[i]) + 1;
+        sp -= len;
+        if (!user_buffer(sp, len, true)) return 0;
+        memcpy((void*)sp, argv[i], len);
+        pointers[i] = sp;
+    }
+    uint32_t words = argc + 3;
+    sp = (sp - words * 4) & ~15u;
+    if (!user_buffer(sp, words * 4, true)) return 0;
+    uint32_t* frame = (uint32_t*)sp;
+    frame[0] = argc;
+    for (int i = 0; i < argc; i++) frame[1 + i] = pointers[i];
+    frame[1 + argc] = 0;
+    frame[2 + argc] = 0;
+    return sp;
+}
+
+int process_exec(const char* path, int argc, const char** argv, int* exit_code) {
+    if (process.running) return PROCESS_BUSY;  // Another stage of the same pipeline
+    if (!fs_normalize_path(current_path, path, process.path, sizeof(process.path))) return FS_INVALID_NAME;
+    uint32_t entry;
+    int result = load_headers(process.path, &entry);
+    if (result != PROCESS_OK) return result;
+
+    memset(process.files, 0, sizeof(process.files));
+    for (uint32_t fd = STDIN; fd <= STDERR; fd++) {
+        process.files[fd].open = true;
+        process.files[fd].terminal = true;
+    }
+    process.write_size = 0;
+    process.running = true;
+
+    uint32_t esp = 0;
+    if (paging_map_user(SYSCALL_ENTRY, syscall_page, false)) {
+        esp = setup_stack(argc, argv);
+    }
+    if (esp == 0) {
+        result = PROCESS_NO_MEMORY;
+    } else {
+        *exit_code = process_enter(entry, esp);
+    }
+    process.running = false;
+    paging_unmap_user();
+    return result;
+}
+
+void process_init() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    // Early Pentium Pros advertise SEP without having it
+    uint32_t family = (eax >> 8) & 0x0F, model = (eax >> 4) & 0x0F, stepping = eax & 0x0F;
+    has_sysenter = (edx & CPUID_SEP) && !(family == 6 && model < 3 && stepping < 3);
+
+    const uint8_t* stub = syscall_stub_int;
+    const uint8_t* stub_end = syscall_stub_int_end;
+    if (has_sysenter) {
+        wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+        wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+        stub = syscall_stub_sysenter;
+        stub_end = syscall_stub_sysenter_end;
+    }
+    memcpy(syscall_page, stub, stub_end - stub);
+
+    interrupt_register(SYSCALL_VECTOR, syscall_interrupt);
+    interrupt_set_user_fault(process_fault);
+    paging_set_fault_handler(process_page_fault);
+}
@@ -0,0 +1,39 @@
+#ifndef FOXOS_PROCESS_H
+#define FOXOS_PROCESS_H
+
+#include <stdint.h>
+
+/*
+ * User programs: static ELF32 executables run in ring 3, one at a time, with
+ * the shell waiting for them. Loading only reads the headers; each page of a
+ * program segment is read from the file the first time it's touched, and the
+ * stack grows the same way. System calls are in syscall.h.
+ *
+ * Address space (above USER_BASE, see paging.h):
+ *   segments       wherever the ELF file puts them, below the stack
+ *   stack          grows down from USER_STACK_TOP, up to USER_STACK_MAX
+ *   SYSCALL_ENTRY  the system call stub, one read-only page
+ */
+#define USER_STACK_TOP       0xBFFFF000
+#define USER_STACK_MAX       (256 * 1024)
+#define PROCESS_MAX_SEGMENTS 8
+#define PROCESS_MAX_FILES    8
+#define PROCESS_MAX_ARGS     8
+#define PROCESS_WRITE_MAX    32768  // Staged contents of the one file open for writing
+
+/* ===== Error Codes ===== */
+/* process_exec() also passes on FS_* codes from reading the file */
+#define PROCESS_OK            0
+#define PROCESS_NOT_EXEC    -20  // Not an ELF file
+#define PROCESS_UNSUPPORTED -21  // ELF, but not a static i386 executable
+#define PROCESS_BAD_LAYOUT  -22  // Segments outside user space or overlapping the stack
+#define PROCESS_NO_MEMORY   -23
+#define PROCESS_BUSY        -24  // There's one user address space, and a program is using it
+
+#define PROCESS_KILLED_BASE 128  // Exit code of a program killed by exception N is 128 + N
+
+void process_init();  // After gdt_init(), interrupts_init() and paging_init()
+int process_exec(const char* path, int argc, const char** argv, int* exit_code);
+void process_perror(int error_code);
+
+#endif
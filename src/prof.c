@@ -0,0 +1,183 @@
+#include "klib.h"
+#include "prof.h"
+#include "timer.h"
+
+void terminal_writestring(const char* data);
+
+/*
+ * Linked in by the second link pass; a first-pass kernel (or one built
+ * without the generator) has no table and reports raw addresses.
+ */
+extern const prof_symbol_t kernel_symbols[] __attribute__((weak));
+extern const uint32_t kernel_symbol_count __attribute__((weak));
+
+extern uint8_t stack_bottom[], stack_top[];  // boot/boot.s
+
+bool prof_running = false;
+static prof_sample_t prof_buffer[PROF_MAX_SAMPLES];
+static uint32_t prof_count = 0;
+static uint32_t prof_overflow = 0;
+
+/* ===== Sampling ===== */
+// Timer hook, runs with interrupts off
+static void prof_tick(interrupt_frame_t* frame) {
+    if (prof_count == PROF_MAX_SAMPLES) {
+        prof_overflow++;
+        return;
+    }
+    prof_sample_t* s = &prof_buffer[prof_count++];
+    s->eip = frame->eip;
+
+    // Each frame is [saved ebp][return address]; stop at anything that
+    // doesn't point further up the kernel stack
+    uint32_t ebp = frame->ebp;
+    uint32_t depth = 0;
+    while (depth < PROF_MAX_DEPTH &&
+           ebp >= (uint32_t)stack_bottom && ebp + 8 <= (uint32_t)stack_top && (ebp & 3) == 0) {
+        const uint32_t* fp = (const uint32_t*)ebp;
+        s->callers[depth++] = fp[1];
+        if (fp[0] <= ebp) break;
+        ebp = fp[0];
+    }
+    for (; depth < PROF_MAX_DEPTH; depth++) {
+        s->callers[depth] = 0;
+    }
+}
+
+void prof_start() {
+    prof_count = 0;
+    prof_overflow = 0;
+    prof_running = true;
+    timer_set_hook(prof_tick);
+}
+
+void prof_stop() {
+    timer_set_hook(NULL);
+    prof_running = false;
+}
+
+uint32_t prof_samples() {
+    return prof_count;
+}
+
+// Ticks that found the buffer full
+uint32_t prof_dropped() {
+    return prof_overflow;
+}
+
+/* ===== Symbols ===== */
+static uint32_t symbol_count() {
+    return &kernel_symbol_count ? kernel_symbol_count : 0;
+}
+
+// Index of the symbol containing 'address', or -1
+static int symbol_find(uint32_t address) {
+    uint32_t lo = 0, hi = symbol_count();
+    if (hi == 0 || address < kernel_symbols[0].address) return -1;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (kernel_symbols[mid].address <= address) lo = mid;
+        else hi = mid;
+    }
+    return (int)lo;
+}
+
+/* ===== Report ===== */
+#define PROF_SLOTS 256  // Distinct functions (or raw addresses) per report
+
+typedef struct {
+    uint32_t key;    // Symbol index, or the address when there's no table
+    uint32_t self;   // Samples with EIP inside
+    uint32_t total;  // Samples with it anywhere on the stack
+    uint32_t seen;   // Last sample counted in 'total'
+} prof_slot_t;
+
+static prof_slot_t prof_slots[PROF_SLOTS];
+static uint32_t prof_slot_count;
+
+static prof_slot_t* prof_slot(uint32_t address) {
+    int sym = symbol_find(address);
+    uint32_t key = sym >= 0 ? (uint32_t)sym : symbol_count() ? 0xFFFFFFFF : address;
+    for (uint32_t i = 0; i < prof_slot_count; i++) {
+        if (prof_slots[i].key == key) return &prof_slots[i];
+    }
+    if (prof_slot_count == PROF_SLOTS) return NULL;
+    prof_slot_t* slot = &prof_slots[prof_slot_count++];
+    slot->key = key;
+    slot->self = 0;
+    slot->total = 0;
+    slot->seen = 0xFFFFFFFF;
+    return slot;
+}
+
+static void prof_count_total(prof_slot_t* slot, uint32_t sample) {
+    if (slot && slot->seen != sample) {
+        slot->seen = sample;
+        slot->total++;
+    }
+}
+
+static void prof_column(uint32_t value, uint32_t percent_of, size_t width) {
+    char num[16];
+    itoa(value, num, 10);
+    for (size_t i = strlen(num); i < width; i++) terminal_writestring(" ");
+    terminal_writestring(num);
+    uint32_t tenths = percent_of ? value * 1000 / percent_of : 0;
+    itoa(tenths / 10, num, 10);
+    for (size_t i = strlen(num); i < 4; i++) terminal_writestring(" ");
+    terminal_writestring(num);
+    terminal_writestring(".");
+    itoa(tenths % 10, num, 10);
+    terminal_writestring(num);
+    terminal_writestring("%");
+}
+
+void prof_report(uint32_t top) {
+    prof_slot_count = 0;
+    for (uint32_t i = 0; i < prof_count; i++) {
+        const prof_sample_t* s = &prof_buffer[i];
+        prof_slot_t* slot = prof_slot(s->eip);
+        if (slot) slot->self++;
+        prof_count_total(slot, i);
+        for (uint32_t d = 0; d < PROF_MAX_DEPTH && s->callers[d]; d++) {
+            prof_count_total(prof_slot(s->callers[d]), i);  // Recursion counts once
+        }
+    }
+
+    // Selection sort by self time; the list is short
+    for (uint32_t i = 0; i < prof_slot_count; i++) {
+        uint32_t best = i;
+        for (uint32_t j = i + 1; j < prof_slot_count; j++) {
+            if (prof_slots[j].self > prof_slots[best].self ||
+                (prof_slots[j].self == prof_slots[best].self && prof_slots[j].total > prof_slots[best].total)) {
+                best = j;
+            }
+        }
+        prof_slot_t tmp = prof_slots[i];
+        prof_slots[i] = prof_slots[best];
+        prof_slots[best] = tmp;
+    }
+
+    terminal_writestring("  self  self%  total total%  function\n");
+    for (uint32_t i = 0; i < prof_slot_count && i < top; i++) {
+        const prof_slot_t* slot = &prof_slots[i];
+        if (slot->self == 0) break;
+        prof_column(slot->self, prof_count, 6);
+        prof_column(slot->total, prof_count, 7);
+        terminal_writestring("  ");
+        if (slot->key == 0xFFFFFFFF) {
+            terminal_writestring("(unknown)");
+        } else if (symbol_count()) {
+            terminal_writestring(kernel_symbols[slot->key].name);
+        } else {
+            char num[16];
+            itoa(slot->key, num, 16);
+            terminal_writestring("0x");
+            terminal_writestring(num);
+        }
+        terminal_writestring("\n");
+    }
+    if (symbol_count() == 0) {
+        terminal_writestring("No symbol table linked in; build with autobuild.sh to get names\n");
+    }
+}
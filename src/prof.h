@@ -0,0 +1,36 @@
+#ifndef FOXOS_PROF_H
+#define FOXOS_PROF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Sampling profiler. While it runs, every timer tick records the interrupted
+ * EIP and the return addresses found by following the saved frame pointers.
+ * `prof` resolves them against the symbol table the build links in (see
+ * host/gensyms.py) and prints the functions that were hot.
+ */
+
+#define PROF_MAX_SAMPLES 8192
+#define PROF_MAX_DEPTH   7   // Callers kept per sample
+
+typedef struct {
+    uint32_t eip;
+    uint32_t callers[PROF_MAX_DEPTH];  // Innermost first, 0 past the end
+} prof_sample_t;
+
+/* Generated from `nm -n bin/foxos.bin` by host/gensyms.py, sorted by address */
+typedef struct {
+    uint32_t address;
+    const char* name;
+} prof_symbol_t;
+
+extern bool prof_running;
+
+void prof_start();
+void prof_stop();
+uint32_t prof_samples();
+uint32_t prof_dropped();
+void prof_report(uint32_t top);
+
+#endif
@@ -0,0 +1,130 @@
+#include "klib.h"
+#include "fs.h"
+#include "ramdisk.h"
+#include "trace.h"
+
+/*
+ * RAM-backed disk for the kernel; the contents don't survive a reboot.
+ *
+ * It can start out as an image the boot loader put in memory (a Multiboot
+ * module). The image is used where it lies: reads come straight from it and
+ * only a page that gets written is copied into simulated_disk first, so
+ * mounting costs nothing however big the image is.
+ */
+
+/* ===== Disk Emulation ===== */
+#define RAMDISK_PAGE_BLOCKS (RAMDISK_PAGE_SIZE / FS_BLOCK_SIZE)
+#define RAMDISK_PAGES       ((FS_MAX_BLOCKS + RAMDISK_PAGE_BLOCKS - 1) / RAMDISK_PAGE_BLOCKS)
+
+// Simulated disk storage; with an image, page p holds page p once it's been copied
+static uint8_t simulated_disk[FS_MAX_BLOCKS * FS_BLOCK_SIZE];
+static bool disk_initialized = false;
+
+static const uint8_t* disk_image = NULL;
+static uint32_t image_blocks = 0;           // Blocks past the image read as zeros
+static bool page_copied[RAMDISK_PAGES];     // Only meaningful with an image
+static uint32_t copied_pages = 0;
+
+static void disk_initialize() {
+    if (!disk_initialized) {
+        memset(simulated_disk, 0, sizeof(simulated_disk));
+        disk_initialized = true;
+    }
+}
+
+bool ramdisk_attach(const void* image, uint32_t size) {
+    if (image == NULL || size < FS_BLOCK_SIZE) return false;
+    disk_initialize();
+    disk_image = image;
+    image_blocks = size / FS_BLOCK_SIZE;
+    if (image_blocks > FS_MAX_BLOCKS) image_blocks = FS_MAX_BLOCKS;  // All the filesystem can address
+    memset(page_copied, 0, sizeof(page_copied));
+    copied_pages = 0;
+    return true;
+}
+
+uint32_t ramdisk_image_blocks() {
+    return disk_image ? image_blocks : 0;
+}
+
+uint32_t ramdisk_copied_pages() {
+    return copied_pages;
+}
+
+// Where block's current contents live, NULL for an untouched block past the image
+static const uint8_t* block_source(uint32_t block) {
+    if (disk_image == NULL || page_copied[block / RAMDISK_PAGE_BLOCKS]) {
+        return simulated_disk + block * FS_BLOCK_SIZE;
+    }
+    return block < image_blocks ? disk_image + block * FS_BLOCK_SIZE : NULL;
+}
+
+// Make the page holding 'block' private before it's written
+static void page_prepare_write(uint32_t block) {
+    uint32_t page = block / RAMDISK_PAGE_BLOCKS;
+    if (disk_image == NULL || page_copied[page]) return;
+
+    uint32_t first = page * RAMDISK_PAGE_BLOCKS;
+    if (first < image_blocks) {
+        uint32_t count = image_blocks - first;
+        if (count > RAMDISK_PAGE_BLOCKS) count = RAMDISK_PAGE_BLOCKS;
+        memcpy(simulated_disk + first * FS_BLOCK_SIZE, disk_image + first * FS_BLOCK_SIZE, count * FS_BLOCK_SIZE);
+    }
+    page_copied[page] = true;
+    copied_pages++;
+}
+
+static void disk_copy_out(uint32_t block, uint32_t count, uint8_t* buffer) {
+    for (uint32_t i = 0; i < count; i++, buffer += FS_BLOCK_SIZE) {
+        const uint8_t* source = block_source(block + i);
+        if (source) memcpy(buffer, source, FS_BLOCK_SIZE);
+        else memset(buffer, 0, FS_BLOCK_SIZE);
+    }
+}
+
+static void disk_copy_in(uint32_t block, uint32_t count, const uint8_t* buffer) {
+    for (uint32_t i = 0; i < count; i++) {
+        page_prepare_write(block + i);
+    }
+    memcpy(simulated_disk + block * FS_BLOCK_SIZE, buffer, count * FS_BLOCK_SIZE);
+}
+
+/* ===== Disk Driver Interface ===== */
+bool disk_read(uint32_t block, void* buffer) {
+    if (block >= FS_MAX_BLOCKS) return false;
+    TRACE(TRACE_DISK_READ, TRACE_INSTANT, block, 1);
+    disk_initialize();
+    disk_copy_out(block, 1, buffer);
+    return true;
+}
+
+bool disk_write(uint32_t block, const void* buffer) {
+    if (block >= FS_MAX_BLOCKS) return false;
+    TRACE(TRACE_DISK_WRITE, TRACE_INSTANT, block, 1);
+    disk_initialize();
+    disk_copy_in(block, 1, buffer);
+    return true;
+}
+
+// Multi-block transfers so contiguous runs move in one request
+bool disk_read_blocks(uint32_t block, uint32_t count, void* buffer) {
+    if (block >= FS_MAX_BLOCKS || count > FS_MAX_BLOCKS - block) return false;
+    TRACE(TRACE_DISK_READ, TRACE_INSTANT, block, count);
+    disk_initialize();
+    disk_copy_out(block, count, buffer);
+    return true;
+}
+
+bool disk_write_blocks(uint32_t block, uint32_t count, const void* buffer) {
+    if (block >= FS_MAX_BLOCKS || count > FS_MAX_BLOCKS - block) return false;
+    TRACE(TRACE_DISK_WRITE, TRACE_INSTANT, block, count);
+    disk_initialize();
+    disk_copy_in(block, count, buffer);
+    return true;
+}
+
+
+
+bool disk_detected() {
+    return true;
+}
@@ -0,0 +1,14 @@
+#ifndef FOXOS_RAMDISK_H
+#define FOXOS_RAMDISK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RAMDISK_PAGE_SIZE 4096
+
+// Serve the disk from a FoxFS image in memory, copying pages on first write
+bool ramdisk_attach(const void* image, uint32_t size);
+uint32_t ramdisk_image_blocks();   // 0 when there's no image
+uint32_t ramdisk_copied_pages();   // Image pages written so far
+
+#endif
@@ -0,0 +1,51 @@
+#include "klib.h"
+#include "io.h"
+#include "serial.h"
+
+static bool serial_present = false;
+
+// 115200 8N1, FIFOs on, no interrupts; false if there is no UART
+bool serial_init() {
+    outb(SERIAL_COM1 + 1, 0x00);    // Disable interrupts
+    outb(SERIAL_COM1 + 3, 0x80);    // DLAB on to set the divisor
+    outb(SERIAL_COM1 + 0, 0x01);    // Divisor 1 = 115200 baud
+    outb(SERIAL_COM1 + 1, 0x00);
+    outb(SERIAL_COM1 + 3, 0x03);    // 8 bits, no parity, one stop bit
+    outb(SERIAL_COM1 + 2, 0xC7);    // Enable and clear FIFOs, 14-byte threshold
+    outb(SERIAL_COM1 + 4, 0x1E);    // Loopback mode to test the chip
+
+    outb(SERIAL_COM1 + 0, 0xAE);
+    if (inb(SERIAL_COM1 + 0) != 0xAE) {
+        return false;
+    }
+
+    outb(SERIAL_COM1 + 4, 0x0F);    // Normal operation, OUT1/OUT2, RTS/DSR
+    serial_present = true;
+    return true;
+}
+
+bool serial_received() {
+    return serial_present && (inb(SERIAL_COM1 + 5) & 0x01);
+}
+
+char serial_getchar() {
+    while (!serial_received());
+    return inb(SERIAL_COM1);
+}
+
+void serial_putchar(char c) {
+    if (!serial_present) return;
+    while ((inb(SERIAL_COM1 + 5) & 0x20) == 0);  // Wait for the transmit buffer
+    outb(SERIAL_COM1, c);
+}
+
+void serial_write(const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == '\n') serial_putchar('\r');
+        serial_putchar(data[i]);
+    }
+}
+
+void serial_writestring(const char* data) {
+    serial_write(data, strlen(data));
+}
@@ -0,0 +1,17 @@
+#ifndef FOXOS_SERIAL_H
+#define FOXOS_SERIAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Polled 16550 UART on COM1 */
+#define SERIAL_COM1 0x3F8
+
+bool serial_init();
+bool serial_received();
+char serial_getchar();
+void serial_putchar(char c);
+void serial_write(const char* data, size_t size);
+void serial_writestring(const char* data);
+
+#endif
@@ -0,0 +1,388 @@
+#include "klib.h"
+#include "fs.h"
+#include "shell.h"
+#include "stream.h"
+#include "task.h"
+
+/*
+ * Perfect hash, built by hash and displace: a name's first hash picks a
+ * bucket, and the bucket's displacement seeds the second hash that picks its
+ * slot. Registering searches for displacements that give every command a
+ * slot of its own, biggest buckets first while the table is emptiest.
+ */
+#define HASH_BUCKETS      32
+#define HASH_SLOTS        (SHELL_MAX_COMMANDS * 2)
+#define MAX_DISPLACEMENT  65535
+
+typedef struct {
+    const char* title;
+    const shell_command_t* commands;
+    int count;
+} command_group_t;
+
+static command_group_t groups[SHELL_MAX_GROUPS];
+static int group_count = 0;
+static const shell_command_t* commands[SHELL_MAX_COMMANDS];
+static int command_count = 0;
+
+static const shell_command_t* slots[HASH_SLOTS];
+static uint16_t displacement[HASH_BUCKETS];  // 0: empty bucket
+static bool (*fallback_handler)(int argc, char** argv);
+
+#define NAME_NODES (SHELL_MAX_COMMANDS * 8)  // Completion trie, 8 characters a command on average
+static trie_node_t name_nodes[NAME_NODES];
+static trie_t names;
+
+/* ===== Perfect Hash ===== */
+static uint32_t name_hash(const char* name, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;  // FNV-1a
+    for (; *name; name++) {
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    }
+    // FNV's low bits mix poorly and they're the ones used, so finish with a few rounds
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6B;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// Tries to give every command in 'bucket' a free slot with displacement 'd'
+static bool place_bucket(const uint8_t* bucket_of, int bucket, uint32_t d) {
+    uint32_t placed[SHELL_MAX_COMMANDS];
+    int count = 0;
+    for (int i = 0; i < command_count; i++) {
+        if (bucket_of[i] != bucket) continue;
+        uint32_t slot = name_hash(commands[i]->name, d) & (HASH_SLOTS - 1);
+        if (slots[slot] != NULL) {
+            while (count > 0) slots[placed[--count]] = NULL;
+            return false;
+        }
+        slots[slot] = commands[i];
+        placed[count++] = slot;
+    }
+    return true;
+}
+
+static bool build_hash() {
+    uint8_t bucket_of[SHELL_MAX_COMMANDS];
+    int bucket_size[HASH_BUCKETS] = {0};
+    int largest = 0;
+    for (int i = 0; i < command_count; i++) {
+        bucket_of[i] = name_hash(commands[i]->name, 0) & (HASH_BUCKETS - 1);
+        if (++bucket_size[bucket_of[i]] > largest) largest = bucket_size[bucket_of[i]];
+    }
+
+    memset(slots, 0, sizeof(slots));
+    memset(displacement, 0, sizeof(displacement));
+    for (int size = largest; size > 0; size--) {
+        for (int bucket = 0; bucket < HASH_BUCKETS; bucket++) {
+            if (bucket_size[bucket] != size) continue;
+            uint32_t d = 1;
+            while (d <= MAX_DISPLACEMENT && !place_bucket(bucket_of, bucket, d)) d++;
+            if (d > MAX_DISPLACEMENT) return false;
+            displacement[bucket] = d;
+        }
+    }
+    return true;
+}
+
+const shell_command_t* shell_find(const char* name) {
+    uint32_t d = displacement[name_hash(name, 0) & (HASH_BUCKETS - 1)];
+    if (d == 0) return NULL;
+    const shell_command_t* command = slots[name_hash(name, d) & (HASH_SLOTS - 1)];
+    return command != NULL && strcmp(command->name, name) == 0 ? command : NULL;
+}
+
+/* ===== Registry ===== */
+int shell_register(const char* group, const shell_command_t* table, int count) {
+    if (group_count == SHELL_MAX_GROUPS || command_count + count > SHELL_MAX_COMMANDS) {
+        return SHELL_TABLE_FULL;
+    }
+    // Registration happens a few times at boot, so a linear check for duplicates is fine
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < command_count + i; j++) {
+            const char* other = j < command_count ? commands[j]->name : table[j - command_count].name;
+            if (strcmp(table[i].name, other) == 0) return SHELL_EXISTS;
+        }
+    }
+
+    int previous = command_count;
+    for (int i = 0; i < count; i++) {
+        commands[command_count++] = &table[i];
+    }
+    if (!build_hash()) {
+        command_count = previous;
+        build_hash();
+        return SHELL_TABLE_FULL;
+    }
+    shell_command_names();
+    for (int i = 0; i < count; i++) {
+        trie_insert(&names, table[i].name);  // A name that doesn't fit only goes without completion
+    }
+    groups[group_count].title = group;
+    groups[group_count].commands = table;
+    groups[group_count].count = count;
+    group_count++;
+    return SHELL_OK;
+}
+
+const trie_t* shell_command_names() {
+    if (names.nodes == NULL) {
+        trie_init(&names, name_nodes, NAME_NODES);
+    }
+    return &names;
+}
+
+void shell_set_fallback(bool (*fallback)(int argc, char** argv)) {
+    fallback_handler = fallback;
+}
+
+/* ===== Tokenizer ===== */
+char shell_op_pipe[] = "|";
+char shell_op_write[] = ">";
+char shell_op_append[] = ">>";
+
+static bool is_operator(const char* token) {
+    return token == shell_op_pipe || token == shell_op_write || token == shell_op_append;
+}
+
+// Operators end a word without needing a space before them
+static bool ends_word(char c) {
+    return c == '\0' || c == ' ' || c == '\t' || c == '|' || c == '>';
+}
+
+int shell_tokenize(char* line, char** argv, int max_args) {
+    int argc = 0;
+    char* in = line;
+    while (true) {
+        while (*in == ' ' || *in == '\t') in++;
+        if (*in == '\0') break;
+        if (argc == max_args) return SHELL_TOO_MANY_ARGS;
+
+        if (*in == '|' || *in == '>') {
+            argv[argc++] = (*in == '|') ? shell_op_pipe : (in[1] == '>') ? shell_op_append : shell_op_write;
+            in += (argv[argc - 1] == shell_op_append) ? 2 : 1;
+            continue;
+        }
+
+        // Removing quotes and escapes only ever shortens an argument, so it's rewritten where it lies
+        char* out = in;
+        argv[argc++] = out;
+        char quote = 0;
+        while (quote != 0 ? *in != '\0' : !ends_word(*in)) {
+            char c = *in++;
+            if (quote == 0 && (c == '"' || c == '\'')) {
+                quote = c;
+            } else if (c == quote) {
+                quote = 0;
+            } else if (c == '\\' && quote != '\'' && *in != '\0') {
+                *out++ = *in++;
+            } else {
+                *out++ = c;
+            }
+        }
+        if (quote != 0) return SHELL_UNTERMINATED;
+
+        // Step past what ended the word before 'out' overwrites it
+        char* op = NULL;
+        if (*in == '|' || *in == '>') {
+            op = (*in == '|') ? shell_op_pipe : (in[1] == '>') ? shell_op_append : shell_op_write;
+            in += (op == shell_op_append) ? 2 : 1;
+        } else if (*in != '\0') {
+            in++;
+        }
+        *out = '\0';
+        if (op != NULL) {
+            if (argc == max_args) return SHELL_TOO_MANY_ARGS;
+            argv[argc++] = op;
+        }
+    }
+    return argc;
+}
+
+/* ===== Running Commands ===== */
+typedef struct {
+    int argc;
+    char** argv;
+    stream_t* pipe_in;   // The pipe ends this stage closes when it's done, if any
+    stream_t* pipe_out;
+} stage_t;
+
+static void run_command(int argc, char** argv) {
+    const shell_command_t* command = shell_find(argv[0]);
+    if (command == NULL) {
+        if (fallback_handler != NULL && fallback_handler(argc, argv)) return;
+        terminal_writestring("Unknown command: '");
+        terminal_writestring(argv[0]);
+        terminal_writestring("'. Type 'help' for available commands.\n");
+        return;
+    }
+    if (argc - 1 < command->min_args) {
+        shell_usage(command);
+        return;
+    }
+    if ((command->flags & SHELL_NEEDS_FS) && !fs_initialized) {
+        terminal_writestring("Filesystem not initialized. Please run 'format' first.\n");
+        return;
+    }
+    command->run(argc, argv);
+}
+
+static void stage_main(void* arg) {
+    stage_t* stage = arg;
+    run_command(stage->argc, stage->argv);
+    // The next stage sees the end of its input, the previous one stops blocking on a reader that's gone
+    stream_close(stage->pipe_out);
+    stream_close(stage->pipe_in);
+}
+
+// Each stage is a task with pipes between them; the shell waits for them all
+static int run_pipeline(stage_t* stages, int count, stream_t* out) {
+    int tasks[SHELL_MAX_STAGES];
+    int spawned = 0;
+    stream_t* in = task_stdin();
+    for (int i = 0; i < count; i++) {
+        stream_t* reader = NULL;
+        stream_t* writer = out;
+        bool piped = (i == count - 1) || stream_pipe(&reader, &writer);
+        stages[i].pipe_in = (i > 0) ? in : NULL;
+        stages[i].pipe_out = reader != NULL ? writer : NULL;
+        int id = piped ? task_spawn(stage_main, &stages[i], in, writer) : -1;
+        if (id < 0) {
+            // Nothing will read what the stages already started write
+            stream_close(stages[i].pipe_in);
+            stream_close(reader);
+            stream_close(stages[i].pipe_out);
+            break;
+        }
+        tasks[spawned++] = id;
+        in = reader;
+    }
+    for (int i = 0; i < spawned; i++) {
+        task_join(tasks[i]);
+    }
+    return spawned == count ? SHELL_OK : SHELL_NO_TASKS;
+}
+
+static void report(int error_code) {
+    terminal_writestring("shell: ");
+    shell_perror(error_code);
+    terminal_writestring("\n");
+}
+
+void shell_run(char* line) {
+    char* argv[SHELL_MAX_ARGS];
+    int argc = shell_tokenize(line, argv, SHELL_MAX_ARGS);
+    if (argc < 0) {
+        report(argc);
+        return;
+    }
+    if (argc == 0) return;
+
+    // Split at each |; a > or >> and its file name can only end the line
+    stage_t stages[SHELL_MAX_STAGES];
+    int stage_count = 0;
+    const char* redirect = NULL;
+    bool append = false;
+    int start = 0;
+    for (int i = 0; i <= argc; i++) {
+        if (i < argc && !is_operator(argv[i])) continue;
+        if (i == start) {
+            report(SHELL_SYNTAX);
+            return;
+        }
+        if (stage_count == SHELL_MAX_STAGES) {
+            report(SHELL_NO_TASKS);
+            return;
+        }
+        stages[stage_count++] = (stage_t){ i - start, &argv[start], NULL, NULL };
+        if (i < argc && argv[i] != shell_op_pipe) {
+            if (i + 2 != argc || is_operator(argv[i + 1])) {
+                report(SHELL_SYNTAX);
+                return;
+            }
+            redirect = argv[i + 1];
+            append = (argv[i] == shell_op_append);
+            break;
+        }
+        start = i + 1;
+    }
+
+    stream_t* out = task_stdout();
+    if (redirect != NULL) {
+        if (!fs_initialized) {
+            terminal_writestring("Filesystem not initialized. Please run 'format' first.\n");
+            return;
+        }
+        int result = stream_open_file(redirect, append, &out);
+        if (result != FS_OK) {
+            terminal_writestring(redirect);
+            terminal_writestring(": ");
+            fs_perror(result);
+            terminal_writestring("\n");
+            return;
+        }
+    }
+
+    if (stage_count == 1) {
+        stream_t* previous = task_set_stdout(out);
+        run_command(stages[0].argc, stages[0].argv);
+        task_set_stdout(previous);
+    } else {
+        int result = run_pipeline(stages, stage_count, out);
+        if (result != SHELL_OK) report(result);
+    }
+
+    if (redirect != NULL) {
+        int result = stream_close(out);
+        if (result != FS_OK) {
+            terminal_writestring(redirect);
+            terminal_writestring(": ");
+            fs_perror(result);
+            terminal_writestring("\n");
+        }
+    }
+}
+
+static void write_synopsis(const shell_command_t* command) {
+    terminal_writestring(command->name);
+    if (command->args != NULL) {
+        terminal_writestring(" ");
+        terminal_writestring(command->args);
+    }
+}
+
+void shell_usage(const shell_command_t* command) {
+    terminal_writestring("Usage: ");
+    write_synopsis(command);
+    terminal_writestring("\n");
+}
+
+void shell_help() {
+    for (int g = 0; g < group_count; g++) {
+        terminal_writestring(groups[g].title);
+        terminal_writestring(":\n");
+        for (int i = 0; i < groups[g].count; i++) {
+            terminal_writestring("  ");
+            write_synopsis(&groups[g].commands[i]);
+            terminal_writestring(" - ");
+            terminal_writestring(groups[g].commands[i].help);
+            terminal_writestring("\n");
+        }
+    }
+}
+
+void shell_perror(int error_code) {
+    switch (error_code) {
+        case SHELL_OK:            terminal_writestring("Success"); break;
+        case SHELL_TOO_MANY_ARGS: terminal_writestring("Too many arguments"); break;
+        case SHELL_UNTERMINATED:  terminal_writestring("Unterminated quote"); break;
+        case SHELL_EXISTS:        terminal_writestring("Command already registered"); break;
+        case SHELL_TABLE_FULL:    terminal_writestring("Command table full"); break;
+        case SHELL_SYNTAX:        terminal_writestring("Missing command or file name around | or >"); break;
+        case SHELL_NO_TASKS:      terminal_writestring("Too many commands in the pipeline"); break;
+        default:                  terminal_writestring("Unknown error"); break;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef FOXOS_SHELL_H
+#define FOXOS_SHELL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "trie.h"
+
+/*
+ * Shell command registry. Subsystems hand the shell a table of commands at
+ * boot with shell_register(); the shell keeps them in a perfect hash, so
+ * running a command costs two hashes of its name and one strcmp however many
+ * there are. Lines are split in place by shell_tokenize(): argv points into
+ * the line itself, with "double" or 'single' quotes keeping spaces inside an
+ * argument and a backslash escaping the next character outside single quotes.
+ *
+ * A line can pipe commands together (a | b | c) and send the last one's
+ * output to a file (> file, or >> file to append). Each command of a
+ * pipeline runs as a task of its own, see task.h and stream.h.
+ */
+#define SHELL_MAX_ARGS     32  // Words and operators on one line
+#define SHELL_MAX_STAGES   4   // Commands in one pipeline
+#define SHELL_MAX_COMMANDS 64
+#define SHELL_MAX_GROUPS   8
+
+/* Command flags */
+#define SHELL_NEEDS_FS 0x01  // Refused until there's a formatted filesystem
+
+typedef void (*shell_handler_t)(int argc, char** argv);  // argv[0] is the command name
+
+typedef struct {
+    const char* name;
+    const char* args;      // Shown after the name in help and usage, NULL for none
+    const char* help;
+    uint8_t min_args;      // Fewer arguments than this prints the usage instead
+    uint8_t flags;
+    shell_handler_t run;
+} shell_command_t;
+
+/* ===== Error Codes ===== */
+#define SHELL_OK                0
+#define SHELL_TOO_MANY_ARGS    -1
+#define SHELL_UNTERMINATED     -2  // A quote was never closed
+#define SHELL_EXISTS           -3  // Registering a name twice
+#define SHELL_TABLE_FULL       -4
+#define SHELL_SYNTAX           -5  // | or > with nothing on one side
+#define SHELL_NO_TASKS         -6  // No task or pipe left to run a pipeline stage
+
+// 'group' heads the commands' section in help; the table must outlive the shell
+int shell_register(const char* group, const shell_command_t* commands, int count);
+const shell_command_t* shell_find(const char* name);
+const trie_t* shell_command_names();  // Every registered name, for completion
+
+// Splits 'line' in place; returns argc, or an error code. Unquoted |, > and
+// >> come out as tokens of their own: these exact pointers, not copies.
+extern char shell_op_pipe[], shell_op_write[], shell_op_append[];
+int shell_tokenize(char* line, char** argv, int max_args);
+
+// Runs one line, tokenizing it in place
+void shell_run(char* line);
+// Tried for names that aren't registered commands; returns whether it ran something
+void shell_set_fallback(bool (*fallback)(int argc, char** argv));
+
+void shell_usage(const shell_command_t* command);
+void shell_help();
+void shell_perror(int error_code);
+
+#endif
@@ -0,0 +1,172 @@
+#include "klib.h"
+#include "fs.h"
+#include "stream.h"
+#include "task.h"
+
+void console_write(const char* data, size_t size);  // kernel.c
+
+/* ===== Console ===== */
+static int console_stream_write(stream_t* stream, const char* data, uint32_t size) {
+    (void)stream;
+    console_write(data, size);
+    return size;
+}
+
+stream_t stream_console = { console_stream_write, NULL, NULL, NULL };
+
+/* ===== Pipes ===== */
+typedef struct {
+    bool used;
+    bool writer_closed;
+    bool reader_closed;
+    uint32_t head;  // Bytes ever written; head - tail are waiting to be read
+    uint32_t tail;
+    stream_t reader;
+    stream_t writer;
+    char ring[PIPE_SIZE];
+} pipe_t;
+
+static pipe_t pipes[PIPE_MAX];
+
+static int pipe_write(stream_t* stream, const char* data, uint32_t size) {
+    pipe_t* pipe = stream->context;
+    uint32_t done = 0;
+    while (done < size && !pipe->reader_closed) {
+        uint32_t space = PIPE_SIZE - (pipe->head - pipe->tail);
+        if (space == 0) {
+            task_yield();  // Let the reader catch up
+            continue;
+        }
+        uint32_t at = pipe->head % PIPE_SIZE;
+        uint32_t chunk = size - done;
+        if (chunk > space) chunk = space;
+        if (chunk > PIPE_SIZE - at) chunk = PIPE_SIZE - at;
+        memcpy(pipe->ring + at, data + done, chunk);
+        pipe->head += chunk;
+        done += chunk;
+    }
+    // With the reader gone the rest goes nowhere, like output nobody looks at
+    return size;
+}
+
+static int pipe_read(stream_t* stream, char* data, uint32_t size) {
+    pipe_t* pipe = stream->context;
+    while (pipe->head == pipe->tail) {
+        if (pipe->writer_closed) return 0;
+        task_yield();  // Let the writer produce something
+    }
+    uint32_t done = 0;
+    while (done < size && pipe->tail != pipe->head) {
+        uint32_t at = pipe->tail % PIPE_SIZE;
+        uint32_t chunk = pipe->head - pipe->tail;
+        if (chunk > size - done) chunk = size - done;
+        if (chunk > PIPE_SIZE - at) chunk = PIPE_SIZE - at;
+        memcpy(data + done, pipe->ring + at, chunk);
+        pipe->tail += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+static int pipe_close(stream_t* stream) {
+    pipe_t* pipe = stream->context;
+    if (stream == &pipe->reader) {
+        pipe->reader_closed = true;
+    } else {
+        pipe->writer_closed = true;
+    }
+    pipe->used = !(pipe->reader_closed && pipe->writer_closed);
+    return FS_OK;
+}
+
+bool stream_pipe(stream_t** reader, stream_t** writer) {
+    for (int i = 0; i < PIPE_MAX; i++) {
+        pipe_t* pipe = &pipes[i];
+        if (pipe->used) continue;
+        pipe->used = true;
+        pipe->writer_closed = false;
+        pipe->reader_closed = false;
+        pipe->head = 0;
+        pipe->tail = 0;
+        pipe->reader = (stream_t){ NULL, pipe_read, pipe_close, pipe };
+        pipe->writer = (stream_t){ pipe_write, NULL, pipe_close, pipe };
+        *reader = &pipe->reader;
+        *writer = &pipe->writer;
+        return true;
+    }
+    return false;
+}
+
+/* ===== Files ===== */
+static struct {
+    bool open;
+    int error;      // First failure, reported by close
+    uint32_t size;
+    char path[MAX_PATH_LEN];
+    stream_t stream;
+    char buffer[FILE_STREAM_MAX];
+} file_out;
+
+static int file_write(stream_t* stream, const char* data, uint32_t size) {
+    (void)stream;
+    if (size > FILE_STREAM_MAX - file_out.size) {
+        file_out.error = FS_FULL;
+        return FS_FULL;
+    }
+    memcpy(file_out.buffer + file_out.size, data, size);
+    file_out.size += size;
+    return size;
+}
+
+static int file_close(stream_t* stream) {
+    (void)stream;
+    file_out.open = false;
+    if (file_out.error != FS_OK) return file_out.error;
+    return fs_write(file_out.path, file_out.buffer, file_out.size);
+}
+
+int stream_open_file(const char* name, bool append, stream_t** stream) {
+    if (file_out.open) return FS_ERROR;
+    // Absolute, so close writes the same file even if a cd ran in between
+    char path[MAX_PATH_LEN];
+    if (!fs_normalize_path(current_path, name, path, sizeof(path))) return FS_INVALID_NAME;
+    int result = fs_create(path, FS_ATTR_FILE);
+    if (result != FS_OK && result != FS_EXISTS) return result;
+
+    dir_entry_t entry;
+    result = fs_stat(path, &entry);
+    if (result != FS_OK) return result;
+    if (entry.attributes & FS_ATTR_DIR) return FS_ERROR;
+
+    file_out.size = 0;
+    if (append && entry.size > 0) {
+        if (entry.size > FILE_STREAM_MAX) return FS_FULL;
+        result = fs_read(path, file_out.buffer, FILE_STREAM_MAX);
+        if (result != FS_OK) return result;
+        // Text from `write` ends in a terminator; appended text goes in its place
+        file_out.size = entry.size;
+        while (file_out.size > 0 && file_out.buffer[file_out.size - 1] == '\0') file_out.size--;
+    }
+    strcpy(file_out.path, path);
+    file_out.open = true;
+    file_out.error = FS_OK;
+    file_out.stream = (stream_t){ file_write, NULL, file_close, NULL };
+    *stream = &file_out.stream;
+    return FS_OK;
+}
+
+/* ===== Access ===== */
+int stream_write(stream_t* stream, const char* data, uint32_t size) {
+    if (stream->write == NULL) return FS_ERROR;
+    return stream->write(stream, data, size);
+}
+
+int stream_read(stream_t* stream, char* data, uint32_t size) {
+    if (stream->read == NULL) return 0;
+    return stream->read(stream, data, size);
+}
+
+int stream_close(stream_t* stream) {
+    if (stream == NULL || stream->close == NULL) return FS_OK;
+    return stream->close(stream);
+}
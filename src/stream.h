@@ -0,0 +1,43 @@
+#ifndef FOXOS_STREAM_H
+#define FOXOS_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Byte streams for command input and output. Every command writes to its
+ * task's standard output (terminal_write() goes there), which is the console,
+ * a file for `cmd > file`, or a pipe to the next command of a pipeline.
+ *
+ * Pipes are fixed rings, so a producer never has its whole output held
+ * anywhere: writing to a full pipe and reading an empty one yield to the
+ * other tasks of the pipeline until there's room or data. Files are written
+ * whole by the filesystem, so a file stream collects its output and writes
+ * the file when it's closed.
+ */
+#define PIPE_SIZE        4096
+#define PIPE_MAX         4
+#define FILE_STREAM_MAX  32768  // Output one redirection can collect
+
+typedef struct stream stream_t;
+struct stream {
+    int (*write)(stream_t* stream, const char* data, uint32_t size);  // Bytes taken, or an FS_* code
+    int (*read)(stream_t* stream, char* data, uint32_t size);         // Bytes read, 0 at the end
+    int (*close)(stream_t* stream);
+    void* context;
+};
+
+extern stream_t stream_console;  // Writes to the screen, reads nothing
+
+int stream_write(stream_t* stream, const char* data, uint32_t size);
+int stream_read(stream_t* stream, char* data, uint32_t size);
+int stream_close(stream_t* stream);  // NULL and the console are left alone
+
+// A new pipe; false if all PIPE_MAX are in use. It's free again once both ends are closed.
+bool stream_pipe(stream_t** reader, stream_t** writer);
+
+// Output to 'path', resolved against the working directory now and created if
+// needed; 'append' keeps what's there. One at a time.
+int stream_open_file(const char* path, bool append, stream_t** stream);
+
+#endif
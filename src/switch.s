@@ -0,0 +1,27 @@
+/* Kernel task switch, see task.c. */
+
+.section .text
+
+/* void task_switch(uint32_t* save_esp, uint32_t esp): saves the callee-saved
+   registers and EFLAGS on this stack and its pointer in *save_esp, then
+   resumes the task whose stack 'esp' is, which is either inside its own
+   task_switch() call or a fresh frame made by task_spawn(). Each task keeps
+   its own interrupt flag, so one switching away with interrupts off doesn't
+   leave them off for the next. */
+.global task_switch
+task_switch:
+	mov 4(%esp), %eax
+	mov 8(%esp), %edx
+	push %ebp
+	push %ebx
+	push %esi
+	push %edi
+	pushf
+	mov %esp, (%eax)
+	mov %edx, %esp
+	popf
+	pop %edi
+	pop %esi
+	pop %ebx
+	pop %ebp
+	ret
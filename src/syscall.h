@@ -0,0 +1,64 @@
+#ifndef FOXOS_SYSCALL_H
+#define FOXOS_SYSCALL_H
+
+#include <stdint.h>
+
+/*
+ * System call ABI, shared by the kernel and user programs (user/).
+ *
+ * Programs call the stub the kernel maps at SYSCALL_ENTRY, which enters the
+ * kernel with sysenter where the CPU has it and int 0x80 otherwise. Either
+ * way the number goes in eax, up to three arguments in ebx, esi and edi, and
+ * the result comes back in eax; every other register is preserved. Failures
+ * are negative FS_* codes.
+ */
+#define SYSCALL_ENTRY 0xBFFFF000  // Read-only page at the top of user space
+
+#define SYS_EXIT  0   // exit(code)
+#define SYS_WRITE 1   // write(fd, buffer, size) -> bytes written
+#define SYS_READ  2   // read(fd, buffer, size) -> bytes read, 0 at the end
+#define SYS_OPEN  3   // open(path, flags) -> fd
+#define SYS_CLOSE 4   // close(fd)
+
+/* open() flags */
+#define O_READ  0
+#define O_WRITE 1     // Creates or truncates; the file is written out on close
+
+/* Open from the start: the shell's input and output, so programs work in pipelines */
+#define STDIN  0
+#define STDOUT 1
+#define STDERR 2
+
+#ifdef FOXOS_USER  // Wrappers for programs, built with -DFOXOS_USER
+static inline int syscall3(int number, int a, int b, int c) {
+    int result;
+    __asm__ volatile ("call *%5"
+                      : "=a"(result)
+                      : "a"(number), "b"(a), "S"(b), "D"(c), "r"(SYSCALL_ENTRY)
+                      : "memory");
+    return result;
+}
+
+static inline void exit(int code) {
+    syscall3(SYS_EXIT, code, 0, 0);
+    __builtin_unreachable();
+}
+
+static inline int write(int fd, const void* buffer, uint32_t size) {
+    return syscall3(SYS_WRITE, fd, (int)buffer, size);
+}
+
+static inline int read(int fd, void* buffer, uint32_t size) {
+    return syscall3(SYS_READ, fd, (int)buffer, size);
+}
+
+static inline int open(const char* path, int flags) {
+    return syscall3(SYS_OPEN, (int)path, flags, 0);
+}
+
+static inline int close(int fd) {
+    return syscall3(SYS_CLOSE, fd, 0, 0);
+}
+#endif
+
+#endif
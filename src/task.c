@@ -0,0 +1,87 @@
+#include "klib.h"
+#include "task.h"
+
+enum { TASK_FREE, TASK_READY, TASK_DONE };
+
+#define TASK_EFLAGS 0x202  // A new task starts with interrupts on
+
+typedef struct {
+    uint32_t esp;  // Saved by task_switch() while the task isn't running
+    uint8_t state;
+    task_entry_t entry;
+    void* arg;
+    stream_t* in;
+    stream_t* out;
+} task_t;
+
+void task_switch(uint32_t* save_esp, uint32_t esp);  // switch.s
+
+static task_t tasks[TASK_MAX + 1] = {
+    [0] = { .state = TASK_READY, .in = &stream_console, .out = &stream_console },
+};
+static uint8_t task_stacks[TASK_MAX][TASK_STACK_SIZE] __attribute__((aligned(16)));
+static int current = 0;
+
+// First code a new task runs; it never returns, as nothing switches back to a finished task
+static void task_start() {
+    task_t* task = &tasks[current];
+    task->entry(task->arg);
+    task->state = TASK_DONE;
+    task_yield();
+}
+
+int task_spawn(task_entry_t entry, void* arg, stream_t* in, stream_t* out) {
+    for (int id = 1; id <= TASK_MAX; id++) {
+        task_t* task = &tasks[id];
+        if (task->state != TASK_FREE) continue;
+
+        // The frame task_switch() pops: EFLAGS, edi, esi, ebx, ebp, then task_start as the return address
+        uint32_t* sp = (uint32_t*)(task_stacks[id - 1] + TASK_STACK_SIZE);
+        *--sp = 0;  // task_start's own return address, never used
+        *--sp = (uint32_t)task_start;
+        for (int i = 0; i < 4; i++) *--sp = 0;
+        *--sp = TASK_EFLAGS;
+
+        task->esp = (uint32_t)sp;
+        task->entry = entry;
+        task->arg = arg;
+        task->in = in;
+        task->out = out;
+        task->state = TASK_READY;
+        return id;
+    }
+    return -1;
+}
+
+void task_yield() {
+    for (int i = 1; i <= TASK_MAX + 1; i++) {
+        int next = (current + i) % (TASK_MAX + 1);
+        if (tasks[next].state != TASK_READY) continue;
+        if (next == current) return;
+        int previous = current;
+        current = next;
+        task_switch(&tasks[previous].esp, tasks[next].esp);
+        return;
+    }
+}
+
+void task_join(int id) {
+    while (tasks[id].state != TASK_DONE) {
+        task_yield();
+    }
+    tasks[id].state = TASK_FREE;
+}
+
+stream_t* task_stdin() {
+    return tasks[current].in;
+}
+
+stream_t* task_stdout() {
+    return tasks[current].out;
+}
+
+stream_t* task_set_stdout(stream_t* out) {
+    stream_t* previous = tasks[current].out;
+    tasks[current].out = out;
+    return previous;
+}
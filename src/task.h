@@ -0,0 +1,30 @@
+#ifndef FOXOS_TASK_H
+#define FOXOS_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stream.h"
+
+/*
+ * Cooperative kernel tasks, so the commands of a pipeline can run side by
+ * side. Each has its own stack and standard streams; a task runs until it
+ * calls task_yield() (which pipes do when they're full or empty) or returns.
+ * The shell itself is task 0, on the boot stack. Nothing preempts a task, so
+ * kernel code needs no locking against them.
+ */
+#define TASK_MAX        4      // Besides the shell
+#define TASK_STACK_SIZE 16384
+
+typedef void (*task_entry_t)(void* arg);
+
+// Returns the new task's id, or -1 if all TASK_MAX are running
+int task_spawn(task_entry_t entry, void* arg, stream_t* in, stream_t* out);
+void task_join(int id);  // Yields until task 'id' has returned
+void task_yield();
+
+stream_t* task_stdin();
+stream_t* task_stdout();
+stream_t* task_set_stdout(stream_t* out);  // Returns the one it replaces
+
+#endif
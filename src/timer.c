@@ -0,0 +1,24 @@
+#include "klib.h"
+#include "io.h"
+#include "timer.h"
+
+/* PIT channel 0 on IRQ 0, the system tick */
+volatile uint32_t timer_ticks = 0;
+static interrupt_handler_t timer_hook = NULL;
+
+static void timer_interrupt(interrupt_frame_t* frame) {
+    timer_ticks++;
+    if (timer_hook) timer_hook(frame);
+}
+
+void timer_set_hook(interrupt_handler_t hook) {
+    timer_hook = hook;
+}
+
+void timer_init() {
+    uint16_t divisor = PIT_FREQUENCY / TIMER_HZ;
+    outb(0x43, 0x34);  // Channel 0, lobyte/hibyte, mode 2 (rate generator)
+    outb(0x40, divisor & 0xFF);
+    outb(0x40, divisor >> 8);
+    irq_register(IRQ_TIMER, timer_interrupt);
+}
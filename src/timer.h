@@ -0,0 +1,16 @@
+#ifndef FOXOS_TIMER_H
+#define FOXOS_TIMER_H
+
+#include <stdint.h>
+
+#include "interrupts.h"
+
+#define PIT_FREQUENCY 1193182  // Hz
+#define TIMER_HZ      1000
+
+extern volatile uint32_t timer_ticks;  // Since timer_init(), at TIMER_HZ
+
+void timer_init();
+void timer_set_hook(interrupt_handler_t hook);  // Runs on every tick, NULL to remove
+
+#endif
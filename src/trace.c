@@ -0,0 +1,110 @@
+#include "klib.h"
+#include "io.h"
+#include "serial.h"
+#include "trace.h"
+
+/*
+ * Flight recorder: the ring keeps the newest TRACE_RING_RECORDS records and
+ * overwrites the oldest. There is one CPU and nothing traces from interrupt
+ * context, so the producer only has to publish the record before it bumps
+ * the head; no locks are needed.
+ */
+bool trace_enabled = false;
+static trace_record_t trace_ring[TRACE_RING_RECORDS];
+static uint32_t trace_head = 0;   // Records written since trace_start(), wraps the ring
+
+static const char* trace_names[TRACE_EVENT_COUNT] = {
+    [TRACE_DISK_READ] = "disk_read",
+    [TRACE_DISK_WRITE] = "disk_write",
+    [TRACE_FS_INIT] = "fs_init",
+    [TRACE_FS_FORMAT] = "fs_format",
+    [TRACE_FS_SYNC] = "fs_sync",
+    [TRACE_FS_CREATE] = "fs_create",
+    [TRACE_FS_WRITE] = "fs_write",
+    [TRACE_FS_READ] = "fs_read",
+    [TRACE_FS_STAT] = "fs_stat",
+    [TRACE_FS_LIST] = "fs_list",
+    [TRACE_FS_DELETE] = "fs_delete",
+    [TRACE_TERMINAL_WRITE] = "terminal_write",
+    [TRACE_KEY] = "key",
+};
+
+void trace_record(uint8_t event, uint8_t phase, uint32_t arg, uint16_t aux) {
+    trace_record_t* r = &trace_ring[trace_head & (TRACE_RING_RECORDS - 1)];
+    r->tsc = rdtsc();
+    r->event = event;
+    r->phase = phase;
+    r->aux = aux;
+    r->arg = arg;
+    __asm__ volatile ("" ::: "memory");  // Record is complete before it's published
+    trace_head++;
+}
+
+void trace_start() {
+    trace_head = 0;
+    trace_enabled = true;
+}
+
+void trace_stop() {
+    trace_enabled = false;
+}
+
+uint32_t trace_count() {
+    return trace_head < TRACE_RING_RECORDS ? trace_head : TRACE_RING_RECORDS;
+}
+
+// Records overwritten because the ring was full
+uint32_t trace_lost() {
+    return trace_head - trace_count();
+}
+
+static void trace_hex(uint64_t value, int digits) {
+    char buf[17];
+    for (int i = digits - 1; i >= 0; i--) {
+        buf[i] = "0123456789abcdef"[value & 0xF];
+        value >>= 4;
+    }
+    buf[digits] = '\0';
+    serial_writestring(buf);
+}
+
+/*
+ * TRACE begin <tsc MHz> <records> <lost>
+ * T <tsc> <event> <B|E|I> <arg> <aux>
+ * TRACE end
+ *
+ * Numbers other than the header's are hexadecimal.
+ */
+void trace_dump(uint32_t tsc_mhz) {
+    bool was_enabled = trace_enabled;
+    trace_enabled = false;  // Don't record the dump itself
+
+    char num[16];
+    uint32_t count = trace_count();
+    serial_writestring("TRACE begin ");
+    itoa(tsc_mhz, num, 10);
+    serial_writestring(num);
+    serial_writestring(" ");
+    itoa(count, num, 10);
+    serial_writestring(num);
+    serial_writestring(" ");
+    itoa(trace_lost(), num, 10);
+    serial_writestring(num);
+    serial_writestring("\n");
+
+    for (uint32_t i = trace_head - count; i != trace_head; i++) {
+        const trace_record_t* r = &trace_ring[i & (TRACE_RING_RECORDS - 1)];
+        serial_writestring("T ");
+        trace_hex(r->tsc, 16);
+        serial_writestring(" ");
+        serial_writestring(r->event < TRACE_EVENT_COUNT && trace_names[r->event] ? trace_names[r->event] : "unknown");
+        serial_writestring(r->phase == TRACE_BEGIN ? " B " : r->phase == TRACE_END ? " E " : " I ");
+        trace_hex(r->arg, 8);
+        serial_writestring(" ");
+        trace_hex(r->aux, 4);
+        serial_writestring("\n");
+    }
+
+    serial_writestring("TRACE end\n");
+    trace_enabled = was_enabled;
+}
@@ -0,0 +1,68 @@
+#ifndef FOXOS_TRACE_H
+#define FOXOS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Static tracepoints. Each one is a load of trace_enabled and a branch the
+ * CPU predicts as not taken, so they can stay in hot paths. `trace start`
+ * turns recording on; `trace dump` streams the ring over COM1 for
+ * host/trace_timeline.py.
+ */
+
+enum trace_event {
+    TRACE_DISK_READ = 1,     // arg: first block, aux: block count
+    TRACE_DISK_WRITE,        // arg: first block, aux: block count
+    TRACE_FS_INIT,           // END arg: result
+    TRACE_FS_FORMAT,
+    TRACE_FS_SYNC,
+    TRACE_FS_CREATE,
+    TRACE_FS_WRITE,          // BEGIN arg: size
+    TRACE_FS_READ,           // BEGIN arg: offset, aux: length (up to 65535)
+    TRACE_FS_STAT,
+    TRACE_FS_LIST,
+    TRACE_FS_DELETE,
+    TRACE_TERMINAL_WRITE,    // BEGIN arg: bytes
+    TRACE_KEY,               // arg: scancode, aux: 0xE0 for extended keys
+    TRACE_EVENT_COUNT
+};
+
+enum trace_phase {
+    TRACE_INSTANT = 0,
+    TRACE_BEGIN,
+    TRACE_END,
+};
+
+/* One record, 16 bytes */
+typedef struct {
+    uint64_t tsc;
+    uint8_t event;
+    uint8_t phase;
+    uint16_t aux;
+    uint32_t arg;
+} trace_record_t;
+
+#define TRACE_RING_RECORDS 4096  // Power of two
+
+#ifdef FOX_HOSTED
+#define TRACE(event, phase, arg, aux) do { } while (0)
+#else
+extern bool trace_enabled;
+void trace_record(uint8_t event, uint8_t phase, uint32_t arg, uint16_t aux);
+
+#define TRACE(event, phase, arg, aux) do { \
+        if (__builtin_expect(trace_enabled, 0)) trace_record((event), (phase), (arg), (aux)); \
+    } while (0)
+#endif
+
+#define TRACE_BEGIN_EVENT(event, arg, aux) TRACE(event, TRACE_BEGIN, arg, aux)
+#define TRACE_END_EVENT(event, result)     TRACE(event, TRACE_END, (uint32_t)(result), 0)
+
+void trace_start();
+void trace_stop();
+uint32_t trace_count();
+uint32_t trace_lost();
+void trace_dump(uint32_t tsc_mhz);
+
+#endif
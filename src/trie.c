@@ -0,0 +1,170 @@
+#include "klib.h"
+#include "trie.h"
+
+/* ===== Nodes ===== */
+static uint16_t node_alloc(trie_t* trie, char c) {
+    uint16_t index = trie->free_list;
+    trie_node_t* node = &trie->nodes[index];
+    trie->free_list = node->sibling;
+    trie->used++;
+    node->child = TRIE_NONE;
+    node->sibling = TRIE_NONE;
+    node->words = 0;
+    node->c = c;
+    node->terminal = false;
+    return index;
+}
+
+static void node_free(trie_t* trie, uint16_t index) {
+    trie->nodes[index].sibling = trie->free_list;
+    trie->free_list = index;
+    trie->used--;
+}
+
+// Children are kept in byte order, so trie_each() lists names sorted
+static uint16_t find_child(const trie_t* trie, uint16_t parent, char c) {
+    for (uint16_t i = trie->nodes[parent].child; i != TRIE_NONE; i = trie->nodes[i].sibling) {
+        if ((uint8_t)trie->nodes[i].c >= (uint8_t)c) {
+            return trie->nodes[i].c == c ? i : TRIE_NONE;
+        }
+    }
+    return TRIE_NONE;
+}
+
+static uint16_t add_child(trie_t* trie, uint16_t parent, char c) {
+    uint16_t index = node_alloc(trie, c);
+    uint16_t* link = &trie->nodes[parent].child;
+    while (*link != TRIE_NONE && (uint8_t)trie->nodes[*link].c < (uint8_t)c) {
+        link = &trie->nodes[*link].sibling;
+    }
+    trie->nodes[index].sibling = *link;
+    *link = index;
+    return index;
+}
+
+static uint16_t find(const trie_t* trie, const char* prefix, size_t length) {
+    uint16_t node = 0;
+    for (size_t i = 0; i < length && node != TRIE_NONE; i++) {
+        node = find_child(trie, node, prefix[i]);
+    }
+    return node;
+}
+
+/* ===== Updates ===== */
+void trie_init(trie_t* trie, trie_node_t* nodes, uint16_t capacity) {
+    trie->nodes = nodes;
+    trie->capacity = capacity;
+    trie_clear(trie);
+}
+
+void trie_clear(trie_t* trie) {
+    // Node 0 is the root; the rest start out on the free list
+    for (uint16_t i = 1; i < trie->capacity; i++) {
+        trie->nodes[i].sibling = (i + 1 < trie->capacity) ? i + 1 : TRIE_NONE;
+    }
+    trie->free_list = trie->capacity > 1 ? 1 : TRIE_NONE;
+    trie->used = 1;
+    trie_node_t* root = &trie->nodes[0];
+    root->child = TRIE_NONE;
+    root->sibling = TRIE_NONE;
+    root->words = 0;
+    root->c = '\0';
+    root->terminal = false;
+}
+
+bool trie_insert(trie_t* trie, const char* name) {
+    size_t length = strlen(name);
+    uint16_t node = find(trie, name, length);
+    if (node != TRIE_NONE && trie->nodes[node].terminal) return true;
+
+    // Whatever part of the name isn't there yet needs a node per character
+    size_t shared = 0;
+    node = 0;
+    while (shared < length) {
+        uint16_t next = find_child(trie, node, name[shared]);
+        if (next == TRIE_NONE) break;
+        node = next;
+        shared++;
+    }
+    if (length - shared > (size_t)(trie->capacity - trie->used)) return false;
+
+    node = 0;
+    trie->nodes[0].words++;
+    for (size_t i = 0; i < length; i++) {
+        uint16_t next = find_child(trie, node, name[i]);
+        node = (next != TRIE_NONE) ? next : add_child(trie, node, name[i]);
+        trie->nodes[node].words++;
+    }
+    trie->nodes[node].terminal = true;
+    return true;
+}
+
+void trie_remove(trie_t* trie, const char* name) {
+    size_t length = strlen(name);
+    uint16_t node = find(trie, name, length);
+    if (node == TRIE_NONE || !trie->nodes[node].terminal) return;
+    trie->nodes[node].terminal = false;
+
+    node = 0;
+    trie->nodes[0].words--;
+    for (size_t i = 0; i < length; i++) {
+        uint16_t child = find_child(trie, node, name[i]);
+        if (--trie->nodes[child].words == 0) {
+            // Nothing else passes through here: unlink the rest of the name, a plain chain
+            uint16_t* link = &trie->nodes[node].child;
+            while (*link != child) link = &trie->nodes[*link].sibling;
+            *link = trie->nodes[child].sibling;
+            while (child != TRIE_NONE) {
+                uint16_t next = trie->nodes[child].child;
+                node_free(trie, child);
+                child = next;
+            }
+            return;
+        }
+        node = child;
+    }
+}
+
+/* ===== Queries ===== */
+uint32_t trie_count(const trie_t* trie, const char* prefix, size_t length) {
+    uint16_t node = find(trie, prefix, length);
+    return node == TRIE_NONE ? 0 : trie->nodes[node].words;
+}
+
+uint32_t trie_extend(const trie_t* trie, const char* prefix, size_t length, char* out, size_t max) {
+    uint16_t node = find(trie, prefix, length);
+    size_t n = 0;
+    if (node != TRIE_NONE) {
+        // Follow the path while it doesn't branch and no name ends along it
+        while (!trie->nodes[node].terminal && trie->nodes[node].child != TRIE_NONE && n + 1 < max) {
+            uint16_t child = trie->nodes[node].child;
+            if (trie->nodes[child].sibling != TRIE_NONE) break;
+            out[n++] = trie->nodes[child].c;
+            node = child;
+        }
+    }
+    if (max > 0) out[n] = '\0';
+    return node == TRIE_NONE ? 0 : trie->nodes[node].words;
+}
+
+static void visit_below(const trie_t* trie, uint16_t node, char* name, size_t length,
+                        void (*visit)(const char* name, void* context), void* context) {
+    if (trie->nodes[node].terminal) {
+        name[length] = '\0';
+        visit(name, context);
+    }
+    if (length + 1 >= TRIE_MAX_NAME) return;
+    for (uint16_t i = trie->nodes[node].child; i != TRIE_NONE; i = trie->nodes[i].sibling) {
+        name[length] = trie->nodes[i].c;
+        visit_below(trie, i, name, length + 1, visit, context);
+    }
+}
+
+void trie_each(const trie_t* trie, const char* prefix, size_t length,
+               void (*visit)(const char* name, void* context), void* context) {
+    char name[TRIE_MAX_NAME];
+    uint16_t node = find(trie, prefix, length);
+    if (node == TRIE_NONE || length >= TRIE_MAX_NAME) return;
+    memcpy(name, prefix, length);
+    visit_below(trie, node, name, length, visit, context);
+}
@@ -0,0 +1,49 @@
+#ifndef FOXOS_TRIE_H
+#define FOXOS_TRIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Prefix tree of short names, for completion. Nodes come from an array the
+ * owner supplies, with children kept as sibling lists, so a trie costs 8
+ * bytes a character and nothing is allocated. Every node counts the names
+ * that pass through it, which answers "how many names start with this?"
+ * without walking below it.
+ */
+#define TRIE_NONE     0xFFFF
+#define TRIE_MAX_NAME 64      // Longest name trie_each() reports
+
+typedef struct {
+    uint16_t child;    // First child, TRIE_NONE for a leaf
+    uint16_t sibling;  // Next child of the same parent; free nodes chain through it
+    uint16_t words;    // Names ending at or below this node
+    char c;
+    bool terminal;     // A name ends here
+} trie_node_t;
+
+typedef struct {
+    trie_node_t* nodes;  // nodes[0] is the root
+    uint16_t capacity;
+    uint16_t free_list;
+    uint16_t used;
+} trie_t;
+
+void trie_init(trie_t* trie, trie_node_t* nodes, uint16_t capacity);
+void trie_clear(trie_t* trie);
+bool trie_insert(trie_t* trie, const char* name);  // False if out of nodes (the trie is left unchanged)
+void trie_remove(trie_t* trie, const char* name);
+
+// How many names start with 'prefix'
+uint32_t trie_count(const trie_t* trie, const char* prefix, size_t length);
+
+// Writes to 'out' the characters every name starting with 'prefix' shares
+// beyond it, up to max - 1 of them; returns how many names start with it
+uint32_t trie_extend(const trie_t* trie, const char* prefix, size_t length, char* out, size_t max);
+
+// Calls 'visit' with each name starting with 'prefix', in byte order
+void trie_each(const trie_t* trie, const char* prefix, size_t length,
+               void (*visit)(const char* name, void* context), void* context);
+
+#endif
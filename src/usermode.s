@@ -0,0 +1,120 @@
+/* Ring 3 entry and exit, and the sysenter path into the kernel. */
+
+.set KERNEL_DATA, 0x10
+.set USER_CODE,   0x1B
+.set USER_DATA,   0x23
+.set EFLAGS_IF,   0x202
+
+.section .bss
+.align 4
+process_kernel_esp:
+.skip 4
+
+.section .text
+
+/* int process_enter(uint32_t entry, uint32_t user_esp): runs the program in
+   ring 3 and returns the code process_leave() was given. Interrupts and
+   system calls from ring 3 land on this stack, just below the saved state. */
+.global process_enter
+process_enter:
+	push %ebp
+	push %ebx
+	push %esi
+	push %edi
+	pushf
+	mov %esp, process_kernel_esp
+	push %esp
+	call process_set_kernel_stack
+	add $4, %esp
+
+	mov 24(%esp), %eax	/* entry */
+	mov 28(%esp), %ecx	/* user_esp */
+	mov $USER_DATA, %dx
+	mov %dx, %ds
+	mov %dx, %es
+	mov %dx, %fs
+	mov %dx, %gs
+	push $USER_DATA
+	push %ecx
+	push $EFLAGS_IF
+	push $USER_CODE
+	push %eax
+	/* Nothing of the kernel's leaks into the program's registers */
+	xor %eax, %eax
+	xor %ebx, %ebx
+	xor %ecx, %ecx
+	xor %edx, %edx
+	xor %esi, %esi
+	xor %edi, %edi
+	xor %ebp, %ebp
+	iret
+
+/* void process_leave(int code): abandons whatever kernel path the program
+   was on (a system call or a fault) and returns from process_enter(). */
+.global process_leave
+process_leave:
+	mov 4(%esp), %eax
+	mov process_kernel_esp, %esp
+	mov $KERNEL_DATA, %dx
+	mov %dx, %ds
+	mov %dx, %es
+	mov %dx, %fs
+	mov %dx, %gs
+	popf
+	pop %edi
+	pop %esi
+	pop %ebx
+	pop %ebp
+	ret
+
+/* sysenter lands here in ring 0 with interrupts off, on the stack from
+   IA32_SYSENTER_ESP, but with the program's data segments. The user stub
+   left its return address in edx and its stack pointer in ecx, which is
+   what sysexit wants back. Interrupts go back on for the call itself: it
+   may block on a pipe and yield to other tasks, which need the timer. */
+.global sysenter_entry
+sysenter_entry:
+	push %ecx
+	push %edx
+	push %ds
+	push %es
+	mov $KERNEL_DATA, %cx
+	mov %cx, %ds
+	mov %cx, %es
+	sti
+	push %edi
+	push %esi
+	push %ebx
+	push %eax
+	call syscall_dispatch	/* (number, a, b, c) */
+	add $16, %esp
+	cli
+	pop %es
+	pop %ds
+	pop %edx
+	pop %ecx
+	sti			/* Takes effect after sysexit */
+	sysexit
+
+/* The two flavours of the stub mapped at SYSCALL_ENTRY; the kernel copies
+   one of them there. Both preserve everything but eax. */
+.section .rodata
+.global syscall_stub_sysenter, syscall_stub_sysenter_end
+syscall_stub_sysenter:
+	push %ecx
+	push %edx
+	mov %esp, %ecx
+	call 1f
+1:	pop %edx
+	add $(2f - 1b), %edx
+	sysenter
+2:	pop %edx
+	pop %ecx
+	ret
+syscall_stub_sysenter_end:
+
+.global syscall_stub_int, syscall_stub_int_end
+syscall_stub_int:
+	int $0x80
+	ret
+syscall_stub_int_end:
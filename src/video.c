@@ -0,0 +1,48 @@
+#include "klib.h"
+#include "video.h"
+
+// A LEB128 number at *at, moving past it; false if it runs off the end or past 32 bits
+static bool read_number(const uint8_t** at, const uint8_t* end, uint32_t* value) {
+    *value = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 7) {
+        if (*at == end) return false;
+        uint8_t byte = *(*at)++;
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool video_apply(const uint8_t* ops, uint32_t length, uint16_t* cells, uint32_t count) {
+    const uint8_t* at = ops;
+    const uint8_t* end = ops + length;
+    uint32_t cell = 0;
+    while (at < end) {
+        uint32_t op;
+        if (!read_number(&at, end, &op)) return false;
+        uint32_t run = op >> 2;
+        if (run > count - cell) return false;
+
+        switch (op & 3) {
+            case VIDEO_OP_SKIP:
+                break;
+            case VIDEO_OP_COPY:
+                if ((uint32_t)(end - at) < run * 2) return false;
+                for (uint32_t i = 0; i < run; i++, at += 2) {
+                    cells[cell + i] = at[0] | at[1] << 8;
+                }
+                break;
+            case VIDEO_OP_FILL: {
+                if (end - at < 2) return false;
+                uint16_t value = at[0] | at[1] << 8;
+                at += 2;
+                for (uint32_t i = 0; i < run; i++) cells[cell + i] = value;
+                break;
+            }
+            default:
+                return false;
+        }
+        cell += run;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef FOXOS_VIDEO_H
+#define FOXOS_VIDEO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Text-mode video: each frame is the 80x25 VGA cells (CP437 character |
+ * attribute << 8) that changed since the one before, which starts from a
+ * screen of VIDEO_BLANK. host/mkvideo.py makes them.
+ *
+ * A file is a video_header_t, then each frame as a 16-bit little-endian
+ * byte count and that many bytes of operations. An operation is a LEB128
+ * number, (cells << 2) | VIDEO_OP_*, and its data:
+ *
+ *   VIDEO_OP_SKIP  nothing; the cells stay as they are
+ *   VIDEO_OP_COPY  one 16-bit cell for each
+ *   VIDEO_OP_FILL  one 16-bit cell for all of them
+ *
+ * Unchanged stretches cost a byte or two and flat areas two or three more,
+ * so a frame where little moves is a few dozen bytes.
+ */
+#define VIDEO_MAGIC     0x44495646  // "FVID"
+#define VIDEO_VERSION   1
+#define VIDEO_BLANK     0x0020      // Space, black on black
+#define VIDEO_FRAME_MAX 8192        // No frame's operations are bigger than this
+
+#define VIDEO_OP_SKIP 0
+#define VIDEO_OP_COPY 1
+#define VIDEO_OP_FILL 2
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t columns;
+    uint8_t rows;
+    uint8_t fps;
+    uint32_t frames;
+    uint32_t reserved;
+} __attribute__((packed)) video_header_t;
+
+// Applies one frame's operations to 'cells'; false if they're malformed or run past 'count'
+bool video_apply(const uint8_t* ops, uint32_t length, uint16_t* cells, uint32_t count);
+
+#endif
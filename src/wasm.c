@@ -0,0 +1,1145 @@
+#include "klib.h"
+#include "wasm.h"
+#include "wasm_internal.h"
+
+void terminal_writestring(const char* data);
+
+/* ===== Module State ===== */
+wasm_module_t wasm_module;
+wasm_insn_t wasm_code[WASM_MAX_CODE];
+uint8_t wasm_memory[WASM_MAX_PAGES * WASM_PAGE_SIZE];
+uint32_t wasm_stack[WASM_STACK_SLOTS];
+static const char* wasm_detail = "";
+
+int wasm_fail(int code, const char* detail) {
+    wasm_detail = detail;
+    return code;
+}
+
+const char* wasm_error_detail() {
+    return wasm_detail;
+}
+
+void wasm_perror(int error_code) {
+    switch (error_code) {
+        case WASM_OK: terminal_writestring("Success"); break;
+        case WASM_MALFORMED: terminal_writestring("Malformed module"); break;
+        case WASM_INVALID: terminal_writestring("Invalid module"); break;
+        case WASM_UNSUPPORTED: terminal_writestring("Unsupported feature"); break;
+        case WASM_TOO_BIG: terminal_writestring("Module too big"); break;
+        case WASM_LINK_ERROR: terminal_writestring("Link error"); break;
+        case WASM_TRAP: terminal_writestring("Trap"); break;
+        case WASM_NO_MODULE: terminal_writestring("No module loaded"); break;
+    }
+    if (error_code != WASM_OK && wasm_detail[0] != '\0') {
+        terminal_writestring(": ");
+        terminal_writestring(wasm_detail);
+    }
+}
+
+/* ===== Host Imports ===== */
+static int host_print(const uint32_t* args, uint32_t* result) {
+    (void)result;
+    uint32_t address = args[0];
+    if (!wasm_module.has_memory || address >= wasm_module.memory_pages * WASM_PAGE_SIZE) {
+        return wasm_fail(WASM_TRAP, "print: pointer outside memory");
+    }
+    // Print in chunks; the string needn't end before memory does
+    uint32_t end = wasm_module.memory_pages * WASM_PAGE_SIZE;
+    char chunk[65];
+    uint32_t len = 0;
+    while (address < end && wasm_memory[address] != '\0') {
+        chunk[len++] = wasm_memory[address++];
+        if (len == sizeof(chunk) - 1) {
+            chunk[len] = '\0';
+            terminal_writestring(chunk);
+            len = 0;
+        }
+    }
+    chunk[len] = '\0';
+    terminal_writestring(chunk);
+    terminal_writestring("\n");
+    return WASM_OK;
+}
+
+static int host_print_i32(const uint32_t* args, uint32_t* result) {
+    (void)result;
+    char num[16];
+    itoa((int)args[0], num, 10);
+    terminal_writestring(num);
+    terminal_writestring("\n");
+    return WASM_OK;
+}
+
+static const struct {
+    const char* module;
+    const char* name;
+    wasm_type_t type;
+    wasm_host_fn_t fn;
+} wasm_host_imports[] = {
+    {"env", "print", {1, 0}, host_print},
+    {"env", "print_i32", {1, 0}, host_print_i32},
+};
+
+/* ===== Binary Reader ===== */
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool error;
+} wasm_reader_t;
+
+static uint8_t read_byte(wasm_reader_t* r) {
+    if (r->p >= r->end) {
+        r->error = true;
+        return 0;
+    }
+    return *r->p++;
+}
+
+static uint32_t read_u32(wasm_reader_t* r) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte = read_byte(r);
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            if (shift == 28 && byte > 0x0F) r->error = true;  // More than 32 bits
+            return value;
+        }
+    }
+    r->error = true;
+    return 0;
+}
+
+static int32_t read_i32(wasm_reader_t* r) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte = read_byte(r);
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            if (shift < 25 && (byte & 0x40)) value |= 0xFFFFFFFF << (shift + 7);  // Sign extend
+            return (int32_t)value;
+        }
+    }
+    r->error = true;
+    return 0;
+}
+
+// Points 'name' at a length-prefixed string inside the binary
+static uint32_t read_name(wasm_reader_t* r, const uint8_t** name) {
+    uint32_t len = read_u32(r);
+    *name = r->p;
+    if (len > (uint32_t)(r->end - r->p)) {
+        r->error = true;
+        return 0;
+    }
+    r->p += len;
+    return len;
+}
+
+static bool name_equals(const uint8_t* name, uint32_t len, const char* str) {
+    return strlen(str) == len && strncmp((const char*)name, str, len) == 0;
+}
+
+/* ===== Function Validation and Predecoding ===== */
+/*
+ * Everything is i32, so validating the operand stack only means tracking its
+ * height. The same pass emits the predecoded instructions: block, loop and
+ * nop disappear, forward branches are chained through their 'a' field until
+ * the end of their block patches them.
+ */
+typedef struct {
+    uint8_t kind;         // OP_BLOCK, OP_LOOP or OP_IF
+    uint8_t results;
+    bool unreachable;     // Rest of the block can't run; the stack is polymorphic
+    uint32_t height;      // Operand count when the block began
+    uint32_t start;       // Loops: where branches go
+    uint32_t fixups;      // Forward branches waiting for the end
+    uint32_t if_insn;     // If: the IF instruction, until else or end patches it
+} wasm_ctrl_t;
+
+typedef struct {
+    wasm_ctrl_t ctrl[WASM_MAX_NESTING];
+    uint32_t depth;
+    uint32_t height;
+    uint32_t max_height;
+} wasm_validator_t;
+
+static wasm_validator_t validator;
+
+static int emit(uint8_t op, uint32_t a, uint32_t b, uint8_t arity) {
+    if (wasm_module.code_size == WASM_MAX_CODE) {
+        return wasm_fail(WASM_TOO_BIG, "too much code");
+    }
+    wasm_insn_t* insn = &wasm_code[wasm_module.code_size];
+    insn->op = op;
+    insn->arity = arity;
+    insn->height = 0;
+    insn->a = a;
+    insn->b = b;
+    return (int)wasm_module.code_size++;
+}
+
+static bool pop(uint32_t count) {
+    wasm_ctrl_t* c = &validator.ctrl[validator.depth - 1];
+    while (count--) {
+        if (validator.height == c->height) {
+            if (!c->unreachable) return false;
+        } else {
+            validator.height--;
+        }
+    }
+    return true;
+}
+
+static void push(uint32_t count) {
+    validator.height += count;
+    if (validator.height > validator.max_height) {
+        validator.max_height = validator.height;
+    }
+}
+
+static void set_unreachable() {
+    wasm_ctrl_t* c = &validator.ctrl[validator.depth - 1];
+    validator.height = c->height;
+    c->unreachable = true;
+}
+
+static int read_block_type(wasm_reader_t* r, uint8_t* results) {
+    uint8_t type = read_byte(r);
+    if (type == WASM_BLOCK_VOID) *results = 0;
+    else if (type == WASM_TYPE_I32) *results = 1;
+    else return wasm_fail(WASM_UNSUPPORTED, "block type other than [] or [i32]");
+    return WASM_OK;
+}
+
+static int open_block(uint8_t kind, uint8_t results) {
+    if (validator.depth == WASM_MAX_NESTING) {
+        return wasm_fail(WASM_TOO_BIG, "blocks nested too deeply");
+    }
+    wasm_ctrl_t* c = &validator.ctrl[validator.depth++];
+    c->kind = kind;
+    c->results = results;
+    c->unreachable = false;
+    c->height = validator.height;
+    c->start = wasm_module.code_size;
+    c->fixups = WASM_NO_FIXUP;
+    c->if_insn = WASM_NO_FIXUP;
+    return WASM_OK;
+}
+
+// Emit a branch (or a br_table entry) to the label 'depth' blocks out
+static int emit_branch(uint8_t op, uint32_t depth, uint32_t* arity_out) {
+    if (depth >= validator.depth) {
+        return wasm_fail(WASM_INVALID, "branch to an unknown label");
+    }
+    wasm_ctrl_t* label = &validator.ctrl[validator.depth - 1 - depth];
+    uint8_t arity = label->kind == OP_LOOP ? 0 : label->results;
+    if (arity_out) *arity_out = arity;
+
+    // The values it carries have to be there (pop and push them back)
+    if (!pop(arity)) return wasm_fail(WASM_INVALID, "branch without its value");
+    push(arity);
+
+    int at;
+    if (label->kind == OP_LOOP) {
+        at = emit(op, label->start, label->height, arity);
+    } else {
+        at = emit(op, label->fixups, label->height, arity);
+        if (at >= 0) label->fixups = at;
+    }
+    return at < 0 ? at : WASM_OK;
+}
+
+static void patch_chain(uint32_t chain, uint32_t target) {
+    while (chain != WASM_NO_FIXUP) {
+        uint32_t next = wasm_code[chain].a;
+        wasm_code[chain].a = target;
+        chain = next;
+    }
+}
+
+static int close_block() {
+    wasm_ctrl_t* c = &validator.ctrl[validator.depth - 1];
+    if (!pop(c->results) || validator.height != c->height) {
+        return wasm_fail(WASM_INVALID, "block leaves the wrong number of values");
+    }
+    if (c->kind == OP_IF && c->if_insn != WASM_NO_FIXUP) {
+        // No else arm: the false path skips straight here
+        if (c->results) return wasm_fail(WASM_INVALID, "if with a result needs an else");
+        wasm_code[c->if_insn].a = wasm_module.code_size;
+    }
+    patch_chain(c->fixups, wasm_module.code_size);
+    validator.depth--;
+    push(c->results);
+    return WASM_OK;
+}
+
+// Memory instructions: alignment (checked, then unused) and offset
+static int read_memarg(wasm_reader_t* r, uint32_t natural_align, uint32_t* offset) {
+    if (!wasm_module.has_memory) return wasm_fail(WASM_INVALID, "memory access without a memory");
+    uint32_t align = read_u32(r);
+    *offset = read_u32(r);
+    if (align > natural_align) return wasm_fail(WASM_INVALID, "alignment larger than the access");
+    return WASM_OK;
+}
+
+// Stack effect of the instructions without immediates: pops << 4 | pushes
+static uint8_t simple_effect(uint8_t op) {
+    if (op == OP_DROP) return 0x10;
+    if (op == OP_SELECT) return 0x31;
+    if (op == OP_I32_EQZ || op == OP_I32_CLZ || op == OP_I32_CTZ || op == OP_I32_POPCNT) return 0x11;
+    if ((op >= OP_I32_EQ && op <= OP_I32_GE_U) || (op >= OP_I32_ADD && op <= OP_I32_ROTR)) return 0x21;
+    return 0;
+}
+
+static int compile_body(wasm_reader_t* r, wasm_function_t* f) {
+    validator.depth = 0;
+    validator.height = 0;
+    validator.max_height = 0;
+    const wasm_type_t* type = &wasm_module.types[f->type];
+    int result = open_block(OP_BLOCK, type->results);
+    if (result != WASM_OK) return result;
+
+    while (validator.depth > 0) {
+        if (r->error) return wasm_fail(WASM_MALFORMED, "function body ends early");
+        uint8_t op = read_byte(r);
+        uint32_t a, b;
+        int at = 0;
+        uint32_t first = wasm_module.code_size;
+        uint32_t before = validator.height;
+
+        switch (op) {
+        case OP_NOP:
+            break;
+        case OP_UNREACHABLE:
+            at = emit(op, 0, 0, 0);
+            set_unreachable();
+            break;
+        case OP_BLOCK:
+        case OP_LOOP: {
+            uint8_t results;
+            if ((result = read_block_type(r, &results)) != WASM_OK) return result;
+            if ((result = open_block(op, results)) != WASM_OK) return result;
+            break;
+        }
+        case OP_IF: {
+            uint8_t results;
+            if ((result = read_block_type(r, &results)) != WASM_OK) return result;
+            if (!pop(1)) return wasm_fail(WASM_INVALID, "if without a condition");
+            at = emit(OP_IF, 0, 0, 0);
+            if (at < 0) return at;
+            if ((result = open_block(OP_IF, results)) != WASM_OK) return result;
+            validator.ctrl[validator.depth - 1].if_insn = at;
+            break;
+        }
+        case OP_ELSE: {
+            wasm_ctrl_t* c = &validator.ctrl[validator.depth - 1];
+            if (c->kind != OP_IF || c->if_insn == WASM_NO_FIXUP) {
+                return wasm_fail(WASM_INVALID, "else without if");
+            }
+            if (!pop(c->results) || validator.height != c->height) {
+                return wasm_fail(WASM_INVALID, "then arm leaves the wrong number of values");
+            }
+            at = emit(OP_JUMP, c->fixups, 0, 0);
+            if (at < 0) return at;
+            c->fixups = at;
+            wasm_code[c->if_insn].a = wasm_module.code_size;
+            c->if_insn = WASM_NO_FIXUP;
+            c->unreachable = false;
+            break;
+        }
+        case OP_END:
+            if (validator.depth == 1) {
+                // End of the function: the implicit return
+                if (!pop(type->results) || validator.height != 0) {
+                    return wasm_fail(WASM_INVALID, "function leaves the wrong number of values");
+                }
+                patch_chain(validator.ctrl[0].fixups, wasm_module.code_size);
+                at = emit(OP_RETURN, 0, 0, type->results);
+                validator.depth = 0;
+            } else if ((result = close_block()) != WASM_OK) {
+                return result;
+            }
+            break;
+        case OP_BR:
+            if ((result = emit_branch(OP_BR, read_u32(r), NULL)) != WASM_OK) return result;
+            set_unreachable();
+            break;
+        case OP_BR_IF:
+            if (!pop(1)) return wasm_fail(WASM_INVALID, "br_if without a condition");
+            if ((result = emit_branch(OP_BR_IF, read_u32(r), NULL)) != WASM_OK) return result;
+            break;
+        case OP_BR_TABLE: {
+            uint32_t count = read_u32(r);
+            if (!pop(1)) return wasm_fail(WASM_INVALID, "br_table without an index");
+            if (count >= WASM_MAX_CODE) return wasm_fail(WASM_TOO_BIG, "br_table too large");
+            at = emit(OP_BR_TABLE, count, 0, 0);
+            if (at < 0) return at;
+            // count + 1 entries (the last is the default), each a branch
+            uint32_t arity = 0, first_arity = 0;
+            for (uint32_t i = 0; i <= count; i++) {
+                if ((result = emit_branch(OP_BR, read_u32(r), &arity)) != WASM_OK) return result;
+                if (i == 0) first_arity = arity;
+                else if (arity != first_arity) return wasm_fail(WASM_INVALID, "br_table labels disagree");
+            }
+            set_unreachable();
+            break;
+        }
+        case OP_RETURN:
+            if (!pop(type->results)) return wasm_fail(WASM_INVALID, "return without its value");
+            at = emit(OP_RETURN, 0, 0, type->results);
+            set_unreachable();
+            break;
+        case OP_CALL: {
+            a = read_u32(r);
+            if (a >= wasm_module.function_count) return wasm_fail(WASM_INVALID, "call to an unknown function");
+            const wasm_type_t* callee = &wasm_module.types[wasm_module.functions[a].type];
+            if (!pop(callee->params)) return wasm_fail(WASM_INVALID, "call with too few arguments");
+            push(callee->results);
+            at = emit(a < wasm_module.import_count ? OP_CALL_HOST : OP_CALL, a, 0, 0);
+            break;
+        }
+        case OP_LOCAL_GET:
+        case OP_LOCAL_SET:
+        case OP_LOCAL_TEE:
+            a = read_u32(r);
+            if (a >= f->local_count) return wasm_fail(WASM_INVALID, "unknown local");
+            if (op != OP_LOCAL_GET && !pop(1)) return wasm_fail(WASM_INVALID, "operand stack underflow");
+            if (op != OP_LOCAL_SET) push(1);
+            at = emit(op, a, 0, 0);
+            break;
+        case OP_GLOBAL_GET:
+        case OP_GLOBAL_SET:
+            a = read_u32(r);
+            if (a >= wasm_module.global_count) return wasm_fail(WASM_INVALID, "unknown global");
+            if (op == OP_GLOBAL_SET) {
+                if (!wasm_module.global_mutable[a]) return wasm_fail(WASM_INVALID, "global is immutable");
+                if (!pop(1)) return wasm_fail(WASM_INVALID, "operand stack underflow");
+            } else {
+                push(1);
+            }
+            at = emit(op, a, 0, 0);
+            break;
+        case OP_I32_LOAD:
+        case OP_I32_LOAD8_S:
+        case OP_I32_LOAD8_U:
+        case OP_I32_LOAD16_S:
+        case OP_I32_LOAD16_U:
+            a = op == OP_I32_LOAD ? 2 : op >= OP_I32_LOAD16_S ? 1 : 0;
+            if ((result = read_memarg(r, a, &b)) != WASM_OK) return result;
+            if (!pop(1)) return wasm_fail(WASM_INVALID, "load without an address");
+            push(1);
+            at = emit(op, 0, b, 0);
+            break;
+        case OP_I32_STORE:
+        case OP_I32_STORE8:
+        case OP_I32_STORE16:
+            a = op == OP_I32_STORE ? 2 : op == OP_I32_STORE16 ? 1 : 0;
+            if ((result = read_memarg(r, a, &b)) != WASM_OK) return result;
+            if (!pop(2)) return wasm_fail(WASM_INVALID, "store without an address and value");
+            at = emit(op, 0, b, 0);
+            break;
+        case OP_MEMORY_SIZE:
+        case OP_MEMORY_GROW:
+            if (read_byte(r) != 0) return wasm_fail(WASM_MALFORMED, "memory index isn't 0");
+            if (!wasm_module.has_memory) return wasm_fail(WASM_INVALID, "no memory");
+            if (op == OP_MEMORY_GROW && !pop(1)) return wasm_fail(WASM_INVALID, "operand stack underflow");
+            push(1);
+            at = emit(op, 0, 0, 0);
+            break;
+        case OP_I32_CONST:
+            push(1);
+            at = emit(op, (uint32_t)read_i32(r), 0, 0);
+            break;
+        default: {
+            uint8_t effect = simple_effect(op);
+            if (effect == 0) return wasm_fail(WASM_UNSUPPORTED, "opcode outside the i32 subset");
+            if (!pop(effect >> 4)) return wasm_fail(WASM_INVALID, "operand stack underflow");
+            push(effect & 0xF);
+            at = emit(op, 0, 0, 0);
+            break;
+        }
+        }
+        if (at < 0) return at;
+        if (wasm_module.code_size > first) {
+            wasm_code[first].height = before;
+        }
+    }
+
+    if (validator.max_height >= WASM_STACK_SLOTS) return wasm_fail(WASM_TOO_BIG, "operand stack too deep");
+    f->max_height = validator.max_height;
+    return r->error ? wasm_fail(WASM_MALFORMED, "function body ends early") : WASM_OK;
+}
+
+/* ===== Module Decoding ===== */
+static int read_const_expr(wasm_reader_t* r, uint32_t* value) {
+    uint8_t op = read_byte(r);
+    if (op == OP_I32_CONST) {
+        *value = (uint32_t)read_i32(r);
+    } else if (op == OP_GLOBAL_GET) {
+        uint32_t index = read_u32(r);
+        if (index >= wasm_module.global_count) return wasm_fail(WASM_INVALID, "unknown global in initializer");
+        *value = wasm_module.globals[index];
+    } else {
+        return wasm_fail(WASM_UNSUPPORTED, "initializer other than i32.const");
+    }
+    if (read_byte(r) != OP_END) return wasm_fail(WASM_MALFORMED, "initializer doesn't end");
+    return WASM_OK;
+}
+
+static int decode_types(wasm_reader_t* r) {
+    uint32_t count = read_u32(r);
+    if (count > WASM_MAX_TYPES) return wasm_fail(WASM_TOO_BIG, "too many types");
+    for (uint32_t i = 0; i < count && !r->error; i++) {
+        if (read_byte(r) != 0x60) return wasm_fail(WASM_MALFORMED, "bad function type");
+        uint32_t params = read_u32(r);
+        if (params > 255) return wasm_fail(WASM_TOO_BIG, "too many parameters");
+        for (uint32_t p = 0; p < params; p++) {
+            if (read_byte(r) != WASM_TYPE_I32) return wasm_fail(WASM_UNSUPPORTED, "parameter type other than i32");
+        }
+        uint32_t results = read_u32(r);
+        if (results > 1) return wasm_fail(WASM_UNSUPPORTED, "multiple results");
+        if (results == 1 && read_byte(r) != WASM_TYPE_I32) {
+            return wasm_fail(WASM_UNSUPPORTED, "result type other than i32");
+        }
+        wasm_module.types[i].params = params;
+        wasm_module.types[i].results = results;
+    }
+    wasm_module.type_count = count;
+    return WASM_OK;
+}
+
+static int decode_imports(wasm_reader_t* r) {
+    uint32_t count = read_u32(r);
+    if (count > WASM_MAX_FUNCTIONS) return wasm_fail(WASM_TOO_BIG, "too many imports");
+    for (uint32_t i = 0; i < count && !r->error; i++) {
+        const uint8_t *mod_name, *name;
+        uint32_t mod_len = read_name(r, &mod_name);
+        uint32_t name_len = read_name(r, &name);
+        if (read_byte(r) != 0) return wasm_fail(WASM_UNSUPPORTED, "import of something other than a function");
+        uint32_t type = read_u32(r);
+        if (type >= wasm_module.type_count) return wasm_fail(WASM_INVALID, "import with an unknown type");
+
+        wasm_function_t* f = &wasm_module.functions[wasm_module.function_count];
+        f->host = NULL;
+        for (size_t h = 0; h < sizeof(wasm_host_imports) / sizeof(wasm_host_imports[0]); h++) {
+            if (name_equals(mod_name, mod_len, wasm_host_imports[h].module) &&
+                name_equals(name, name_len, wasm_host_imports[h].name)) {
+                f->host = wasm_host_imports[h].fn;
+                if (wasm_module.types[type].params != wasm_host_imports[h].type.params ||
+                    wasm_module.types[type].results != wasm_host_imports[h].type.results) {
+                    return wasm_fail(WASM_LINK_ERROR, "import has the wrong type");
+                }
+            }
+        }
+        if (f->host == NULL) return wasm_fail(WASM_LINK_ERROR, "unknown import");
+        f->type = type;
+        f->param_count = wasm_module.types[type].params;
+        f->local_count = f->param_count;
+        wasm_module.function_count++;
+    }
+    wasm_module.import_count = wasm_module.function_count;
+    return WASM_OK;
+}
+
+static int decode_functions(wasm_reader_t* r) {
+    uint32_t count = read_u32(r);
+    if (count > WASM_MAX_FUNCTIONS - wasm_module.function_count) return wasm_fail(WASM_TOO_BIG, "too many functions");
+    for (uint32_t i = 0; i < count && !r->error; i++) {
+        uint32_t type = read_u32(r);
+        if (type >= wasm_module.type_count) return wasm_fail(WASM_INVALID, "function with an unknown type");
+        wasm_function_t* f = &wasm_module.functions[wasm_module.function_count++];
+        f->type = type;
+        f->param_count = wasm_module.types[type].params;
+        f->local_count = f->param_count;
+        f->code = WASM_NO_FIXUP;  // Until the code section
+        f->host = NULL;
+    }
+    return WASM_OK;
+}
+
+static int decode_memory(wasm_reader_t* r) {
+    uint32_t count = read_u32(r);
+    if (count > 1) return wasm_fail(WASM_INVALID, "more than one memory");
+    if (count == 0) return WASM_OK;
+    uint8_t flags = read_byte(r);
+    wasm_module.memory_pages = read_u32(r);
+    wasm_module.memory_max_pages = flags & 1 ? read_u32(r) : WASM_MAX_PAGES;
+    if (flags > 1) return wasm_fail(WASM_UNSUPPORTED, "shared or 64-bit memory");
+    if (wasm_module.memory_max_pages < wasm_module.memory_pages) return wasm_fail(WASM_INVALID, "memory max below min");
+    if (wasm_module.memory_pages > WASM_MAX_PAGES) return wasm_fail(WASM_TOO_BIG, "memory larger than the runtime allows");
+    if (wasm_module.memory_max_pages > WASM_MAX_PAGES) wasm_module.memory_max_pages = WASM_MAX_PAGES;
+    wasm_module.has_memory = true;
+    return WASM_OK;
+}
+
+static int decode_globals(wasm_reader_t* r) {
+    uint32_t count = read_u32(r);
+    if (count > WASM_MAX_GLOBALS) return wasm_fail(WASM_TOO_BIG, "too many globals");
+    for (uint32_t i = 0; i < count && !r->error; i++) {
+        if (read_byte(r) != WASM_TYPE_I32) return wasm_fail(WASM_UNSUPPORTED, "global type other than i32");
+        uint8_t mut = read_byte(r);
+        if (mut > 1) return wasm_fail(WASM_MALFORMED, "bad global mutability");
+        int result = read_const_expr(r, &wasm_module.globals[i]);
+        if (result != WASM_OK) return result;
+        wasm_module.global_mutable[i] = mut;
+        wasm_module.global_count++;
+    }
+    return WASM_OK;
+}
+
+static int decode_exports(wasm_reader_t* r) {
+    uint32_t count = read_u32(r);
+    if (count > WASM_MAX_EXPORTS) return wasm_fail(WASM_TOO_BIG, "too many exports");
+    for (uint32_t i = 0; i < count && !r->error; i++) {
+        wasm_export_t* e = &wasm_module.exports[i];
+        e->name_len = read_name(r, &e->name);
+        e->kind = read_byte(r);
+        e->index = read_u32(r);
+        if (e->kind == 0 && e->index >= wasm_module.function_count) {
+            return wasm_fail(WASM_INVALID, "export of an unknown function");
+        }
+    }
+    wasm_module.export_count = count;
+    return WASM_OK;
+}
+
+static int decode_code(wasm_reader_t* r) {
+    uint32_t count = read_u32(r);
+    if (count != wasm_module.function_count - wasm_module.import_count) {
+        return wasm_fail(WASM_MALFORMED, "function and code counts differ");
+    }
+    for (uint32_t i = 0; i < count && !r->error; i++) {
+        wasm_function_t* f = &wasm_module.functions[wasm_module.import_count + i];
+        uint32_t size = read_u32(r);
+        if (size > (uint32_t)(r->end - r->p)) return wasm_fail(WASM_MALFORMED, "function body past the end");
+        wasm_reader_t body = { r->p, r->p + size, false };
+        r->p += size;
+
+        uint32_t groups = read_u32(&body);
+        uint32_t locals = f->param_count;
+        for (uint32_t g = 0; g < groups && !body.error; g++) {
+            uint32_t n = read_u32(&body);
+            if (read_byte(&body) != WASM_TYPE_I32) return wasm_fail(WASM_UNSUPPORTED, "local type other than i32");
+            if (n > WASM_MAX_LOCALS - locals) return wasm_fail(WASM_TOO_BIG, "too many locals");
+            locals += n;
+        }
+        f->local_count = locals;
+        f->code = wasm_module.code_size;
+
+        int result = compile_body(&body, f);
+        if (result != WASM_OK) return result;
+        if (body.p != body.end) return wasm_fail(WASM_MALFORMED, "code after the end of a function");
+    }
+    return WASM_OK;
+}
+
+static int decode_data(wasm_reader_t* r) {
+    uint32_t count = read_u32(r);
+    for (uint32_t i = 0; i < count && !r->error; i++) {
+        if (read_u32(r) != 0) return wasm_fail(WASM_UNSUPPORTED, "passive data segment");
+        if (!wasm_module.has_memory) return wasm_fail(WASM_INVALID, "data without a memory");
+        uint32_t offset;
+        int result = read_const_expr(r, &offset);
+        if (result != WASM_OK) return result;
+        uint32_t size = read_u32(r);
+        if (size > (uint32_t)(r->end - r->p)) return wasm_fail(WASM_MALFORMED, "data past the end");
+        uint32_t memory_size = wasm_module.memory_pages * WASM_PAGE_SIZE;
+        if (offset > memory_size || size > memory_size - offset) {
+            return wasm_fail(WASM_TRAP, "data segment outside memory");
+        }
+        memcpy(wasm_memory + offset, r->p, size);
+        r->p += size;
+    }
+    return WASM_OK;
+}
+
+static int wasm_invoke(uint32_t index, uint32_t* result);
+
+int wasm_load(const uint8_t* binary, uint32_t size) {
+    memset(&wasm_module, 0, sizeof(wasm_module));
+    wasm_module.start_function = -1;
+    wasm_detail = "";
+
+    // FNV-1a and djb2, so a cached translation is only reused for the same binary
+    wasm_module.binary_size = size;
+    wasm_module.hash[0] = 2166136261u;
+    wasm_module.hash[1] = 5381;
+    for (uint32_t i = 0; i < size; i++) {
+        wasm_module.hash[0] = (wasm_module.hash[0] ^ binary[i]) * 16777619u;
+        wasm_module.hash[1] = wasm_module.hash[1] * 33 + binary[i];
+    }
+
+    wasm_reader_t r = { binary, binary + size, false };
+    if (size < 8 || binary[0] != 0 || binary[1] != 'a' || binary[2] != 's' || binary[3] != 'm') {
+        return wasm_fail(WASM_MALFORMED, "no \\0asm header");
+    }
+    if (binary[4] != 1 || binary[5] != 0 || binary[6] != 0 || binary[7] != 0) {
+        return wasm_fail(WASM_UNSUPPORTED, "binary format version isn't 1");
+    }
+    r.p += 8;
+
+    uint8_t last_id = 0;
+    while (r.p < r.end) {
+        uint8_t id = read_byte(&r);
+        uint32_t len = read_u32(&r);
+        if (r.error || len > (uint32_t)(r.end - r.p)) return wasm_fail(WASM_MALFORMED, "section past the end");
+        wasm_reader_t section = { r.p, r.p + len, false };
+        r.p += len;
+
+        if (id != 0) {
+            if (id <= last_id && id != 12) return wasm_fail(WASM_MALFORMED, "sections out of order");
+            last_id = id == 12 ? last_id : id;
+        }
+
+        int result = WASM_OK;
+        switch (id) {
+        case 1: result = decode_types(&section); break;
+        case 2: result = decode_imports(&section); break;
+        case 3: result = decode_functions(&section); break;
+        case 5:
+            result = decode_memory(&section);
+            if (result == WASM_OK) memset(wasm_memory, 0, wasm_module.memory_pages * WASM_PAGE_SIZE);
+            break;
+        case 6: result = decode_globals(&section); break;
+        case 7: result = decode_exports(&section); break;
+        case 8:
+            wasm_module.start_function = read_u32(&section);
+            if ((uint32_t)wasm_module.start_function >= wasm_module.function_count) {
+                result = wasm_fail(WASM_INVALID, "unknown start function");
+            }
+            break;
+        case 10: result = decode_code(&section); break;
+        case 11: result = decode_data(&section); break;
+        case 0:    // Custom: names, producers, ...
+        case 4:    // Tables and elements only matter to call_indirect,
+        case 9:    // which validation rejects
+        case 12:   // Data count
+            section.p = section.end;
+            break;
+        default:
+            result = wasm_fail(WASM_MALFORMED, "unknown section");
+        }
+        if (result != WASM_OK) return result;
+        if (section.error || section.p != section.end) return wasm_fail(WASM_MALFORMED, "section size mismatch");
+    }
+
+    for (uint32_t i = wasm_module.import_count; i < wasm_module.function_count; i++) {
+        if (wasm_module.functions[i].code == WASM_NO_FIXUP) return wasm_fail(WASM_MALFORMED, "function without code");
+    }
+    wasm_module.loaded = true;
+
+    if (wasm_module.start_function >= 0) {
+        uint32_t ignored;
+        const wasm_type_t* type = &wasm_module.types[wasm_module.functions[wasm_module.start_function].type];
+        if (type->params || type->results) return wasm_fail(WASM_INVALID, "start function takes or returns values");
+        return wasm_invoke(wasm_module.start_function, &ignored);
+    }
+    return WASM_OK;
+}
+
+/* ===== Interpreter ===== */
+/*
+ * Threaded dispatch: each handler jumps straight to the next one through a
+ * table of label addresses. The top of the operand stack lives in 'tos', a
+ * register, and only spills to memory when something is pushed on top of
+ * it; sp points at the value below it.
+ *
+ * Each call's slice of wasm_stack is [locals][spare][operands...], and 'base'
+ * points at the spare slot, so with n operands sp == base + n - 1 and the
+ * i-th operand (1-based) below the top is at base[i].
+ */
+uint32_t wasm_memory_grow(uint32_t delta) {
+    uint32_t old = wasm_module.memory_pages;
+    if (delta > wasm_module.memory_max_pages - old) {
+        return 0xFFFFFFFF;
+    }
+    memset(wasm_memory + old * WASM_PAGE_SIZE, 0, delta * WASM_PAGE_SIZE);
+    wasm_module.memory_pages += delta;
+    return old;
+}
+
+typedef struct {
+    const wasm_insn_t* return_pc;
+    uint32_t* locals;
+    uint32_t* base;
+} wasm_frame_t;
+
+static wasm_frame_t wasm_frames[WASM_MAX_CALL_DEPTH];
+
+typedef uint32_t wasm_unaligned_u32 __attribute__((aligned(1), may_alias));
+typedef uint16_t wasm_unaligned_u16 __attribute__((aligned(1), may_alias));
+
+static uint32_t rotl32(uint32_t x, uint32_t n) {
+    n &= 31;
+    return n ? (x << n) | (x >> (32 - n)) : x;
+}
+
+static uint32_t popcount32(uint32_t x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (x * 0x01010101) >> 24;
+}
+
+static int wasm_invoke(uint32_t index, uint32_t* result) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"  // Everything defaults to op_invalid
+    static const void* const dispatch[256] = {
+        [0 ... 255] = &&op_invalid,
+        [OP_UNREACHABLE] = &&op_unreachable,
+        [OP_IF] = &&op_if,
+        [OP_BR] = &&op_br,
+        [OP_BR_IF] = &&op_br_if,
+        [OP_BR_TABLE] = &&op_br_table,
+        [OP_RETURN] = &&op_return,
+        [OP_CALL] = &&op_call,
+        [OP_DROP] = &&op_drop,
+        [OP_SELECT] = &&op_select,
+        [OP_LOCAL_GET] = &&op_local_get,
+        [OP_LOCAL_SET] = &&op_local_set,
+        [OP_LOCAL_TEE] = &&op_local_tee,
+        [OP_GLOBAL_GET] = &&op_global_get,
+        [OP_GLOBAL_SET] = &&op_global_set,
+        [OP_I32_LOAD] = &&op_i32_load,
+        [OP_I32_LOAD8_S] = &&op_i32_load8_s,
+        [OP_I32_LOAD8_U] = &&op_i32_load8_u,
+        [OP_I32_LOAD16_S] = &&op_i32_load16_s,
+        [OP_I32_LOAD16_U] = &&op_i32_load16_u,
+        [OP_I32_STORE] = &&op_i32_store,
+        [OP_I32_STORE8] = &&op_i32_store8,
+        [OP_I32_STORE16] = &&op_i32_store16,
+        [OP_MEMORY_SIZE] = &&op_memory_size,
+        [OP_MEMORY_GROW] = &&op_memory_grow,
+        [OP_I32_CONST] = &&op_i32_const,
+        [OP_I32_EQZ] = &&op_i32_eqz,
+        [OP_I32_EQ] = &&op_i32_eq,
+        [OP_I32_NE] = &&op_i32_ne,
+        [OP_I32_LT_S] = &&op_i32_lt_s,
+        [OP_I32_LT_U] = &&op_i32_lt_u,
+        [OP_I32_GT_S] = &&op_i32_gt_s,
+        [OP_I32_GT_U] = &&op_i32_gt_u,
+        [OP_I32_LE_S] = &&op_i32_le_s,
+        [OP_I32_LE_U] = &&op_i32_le_u,
+        [OP_I32_GE_S] = &&op_i32_ge_s,
+        [OP_I32_GE_U] = &&op_i32_ge_u,
+        [OP_I32_CLZ] = &&op_i32_clz,
+        [OP_I32_CTZ] = &&op_i32_ctz,
+        [OP_I32_POPCNT] = &&op_i32_popcnt,
+        [OP_I32_ADD] = &&op_i32_add,
+        [OP_I32_SUB] = &&op_i32_sub,
+        [OP_I32_MUL] = &&op_i32_mul,
+        [OP_I32_DIV_S] = &&op_i32_div_s,
+        [OP_I32_DIV_U] = &&op_i32_div_u,
+        [OP_I32_REM_S] = &&op_i32_rem_s,
+        [OP_I32_REM_U] = &&op_i32_rem_u,
+        [OP_I32_AND] = &&op_i32_and,
+        [OP_I32_OR] = &&op_i32_or,
+        [OP_I32_XOR] = &&op_i32_xor,
+        [OP_I32_SHL] = &&op_i32_shl,
+        [OP_I32_SHR_S] = &&op_i32_shr_s,
+        [OP_I32_SHR_U] = &&op_i32_shr_u,
+        [OP_I32_ROTL] = &&op_i32_rotl,
+        [OP_I32_ROTR] = &&op_i32_rotr,
+        [OP_JUMP] = &&op_jump,
+        [OP_CALL_HOST] = &&op_call_host,
+    };
+#pragma GCC diagnostic pop
+
+    const wasm_insn_t* code = wasm_code;
+    const wasm_insn_t* pc;
+    uint8_t* memory = wasm_memory;
+    uint32_t memory_size = wasm_module.memory_pages * WASM_PAGE_SIZE;
+    uint32_t* stack_end = wasm_stack + WASM_STACK_SLOTS;
+    uint32_t depth = 0;
+    uint32_t tos = 0;
+    uint32_t* locals;
+    uint32_t* base;
+    uint32_t* sp;
+    const wasm_function_t* f = &wasm_module.functions[index];
+
+#define NEXT()      goto *dispatch[(++pc)->op]
+#define DISPATCH()  goto *dispatch[pc->op]
+#define PUSH(v)     do { *++sp = tos; tos = (v); } while (0)
+#define POP()       (tos = *sp--)
+#define BINARY(expr) do { uint32_t y = tos; uint32_t x = *sp--; (void)x; (void)y; tos = (expr); } while (0)
+// Effective address of a 'size'-byte access at tos + offset, or a trap
+#define ADDRESS(size) ({ \
+        uint32_t offset_ = pc->b; \
+        if (memory_size < (size) || offset_ > memory_size - (size) || tos > memory_size - (size) - offset_) \
+            goto trap_memory; \
+        tos + offset_; })
+
+    // The host's call: wasm_stack[0] is its spare slot
+    locals = wasm_stack + 1;
+    if (locals + f->local_count + 1 + f->max_height >= stack_end) goto trap_stack;
+    memset(locals, 0, f->local_count * sizeof(uint32_t));
+    base = locals + f->local_count;
+    sp = base - 1;
+    pc = code + f->code;
+    DISPATCH();
+
+op_invalid:
+    return wasm_fail(WASM_TRAP, "bad predecoded instruction");
+op_unreachable:
+    return wasm_fail(WASM_TRAP, "unreachable executed");
+trap_memory:
+    return wasm_fail(WASM_TRAP, "out of bounds memory access");
+trap_stack:
+    return wasm_fail(WASM_TRAP, "call stack exhausted");
+trap_divide:
+    return wasm_fail(WASM_TRAP, "integer divide by zero");
+trap_overflow:
+    return wasm_fail(WASM_TRAP, "integer overflow");
+
+    /* Control */
+op_jump:
+    pc = code + pc->a;
+    DISPATCH();
+op_if: {
+    uint32_t condition = tos;
+    POP();
+    if (condition) NEXT();
+    pc = code + pc->a;
+    DISPATCH();
+}
+op_br_if: {
+    uint32_t condition = tos;
+    POP();
+    if (!condition) NEXT();
+    goto op_br;
+}
+op_br_table: {
+    uint32_t i = tos;
+    POP();
+    pc += 1 + (i < pc->a ? i : pc->a);
+    goto op_br;
+}
+op_br:
+    // Keep the label's operands (and the carried value, already in tos)
+    if (pc->arity) {
+        sp = base + pc->b;
+    } else if (sp != base + pc->b - 1) {
+        tos = base[pc->b];
+        sp = base + pc->b - 1;
+    }
+    pc = code + pc->a;
+    DISPATCH();
+op_return: {
+    uint32_t* caller_top = locals - 1;
+    if (depth == 0) {
+        *result = tos;
+        return WASM_OK;
+    }
+    const wasm_frame_t* frame = &wasm_frames[--depth];
+    if (pc->arity) {
+        sp = caller_top;
+    } else {
+        tos = *caller_top;
+        sp = caller_top - 1;
+    }
+    pc = frame->return_pc;
+    locals = frame->locals;
+    base = frame->base;
+    DISPATCH();
+}
+op_call: {
+    f = &wasm_module.functions[pc->a];
+    *++sp = tos;  // Arguments all in memory, they become the callee's first locals
+    uint32_t* callee_locals = sp - f->param_count + 1;
+    if (depth == WASM_MAX_CALL_DEPTH ||
+        callee_locals + f->local_count + 1 + f->max_height >= stack_end) {
+        goto trap_stack;
+    }
+    wasm_frames[depth].return_pc = pc + 1;
+    wasm_frames[depth].locals = locals;
+    wasm_frames[depth].base = base;
+    depth++;
+    for (uint32_t i = f->param_count; i < f->local_count; i++) {
+        callee_locals[i] = 0;
+    }
+    locals = callee_locals;
+    base = locals + f->local_count;
+    sp = base - 1;
+    pc = code + f->code;
+    DISPATCH();
+}
+op_call_host: {
+    f = &wasm_module.functions[pc->a];
+    *++sp = tos;
+    uint32_t* args = sp - f->param_count + 1;
+    uint32_t value = 0;
+    int status = f->host(args, &value);
+    if (status != WASM_OK) return status;
+    sp = args - 1;
+    if (wasm_module.types[f->type].results) {
+        tos = value;
+    } else {
+        POP();
+    }
+    NEXT();
+}
+
+    /* Parametric */
+op_drop:
+    POP();
+    NEXT();
+op_select: {
+    uint32_t condition = tos;
+    uint32_t second = *sp--;
+    uint32_t first = *sp--;
+    tos = condition ? first : second;
+    NEXT();
+}
+
+    /* Variables */
+op_local_get:
+    PUSH(locals[pc->a]);
+    NEXT();
+op_local_set:
+    locals[pc->a] = tos;
+    POP();
+    NEXT();
+op_local_tee:
+    locals[pc->a] = tos;
+    NEXT();
+op_global_get:
+    PUSH(wasm_module.globals[pc->a]);
+    NEXT();
+op_global_set:
+    wasm_module.globals[pc->a] = tos;
+    POP();
+    NEXT();
+
+    /* Memory */
+op_i32_load:
+    tos = *(wasm_unaligned_u32*)(memory + ADDRESS(4));
+    NEXT();
+op_i32_load8_s:
+    tos = (uint32_t)(int32_t)(int8_t)memory[ADDRESS(1)];
+    NEXT();
+op_i32_load8_u:
+    tos = memory[ADDRESS(1)];
+    NEXT();
+op_i32_load16_s:
+    tos = (uint32_t)(int32_t)(int16_t)*(wasm_unaligned_u16*)(memory + ADDRESS(2));
+    NEXT();
+op_i32_load16_u:
+    tos = *(wasm_unaligned_u16*)(memory + ADDRESS(2));
+    NEXT();
+op_i32_store: {
+    uint32_t value = tos;
+    POP();
+    *(wasm_unaligned_u32*)(memory + ADDRESS(4)) = value;
+    POP();
+    NEXT();
+}
+op_i32_store8: {
+    uint32_t value = tos;
+    POP();
+    memory[ADDRESS(1)] = (uint8_t)value;
+    POP();
+    NEXT();
+}
+op_i32_store16: {
+    uint32_t value = tos;
+    POP();
+    *(wasm_unaligned_u16*)(memory + ADDRESS(2)) = (uint16_t)value;
+    POP();
+    NEXT();
+}
+op_memory_size:
+    PUSH(wasm_module.memory_pages);
+    NEXT();
+op_memory_grow:
+    tos = wasm_memory_grow(tos);
+    memory_size = wasm_module.memory_pages * WASM_PAGE_SIZE;
+    NEXT();
+
+    /* Numeric */
+op_i32_const:
+    PUSH(pc->a);
+    NEXT();
+op_i32_eqz:
+    tos = tos == 0;
+    NEXT();
+op_i32_eq:   BINARY(x == y); NEXT();
+op_i32_ne:   BINARY(x != y); NEXT();
+op_i32_lt_s: BINARY((int32_t)x < (int32_t)y); NEXT();
+op_i32_lt_u: BINARY(x < y); NEXT();
+op_i32_gt_s: BINARY((int32_t)x > (int32_t)y); NEXT();
+op_i32_gt_u: BINARY(x > y); NEXT();
+op_i32_le_s: BINARY((int32_t)x <= (int32_t)y); NEXT();
+op_i32_le_u: BINARY(x <= y); NEXT();
+op_i32_ge_s: BINARY((int32_t)x >= (int32_t)y); NEXT();
+op_i32_ge_u: BINARY(x >= y); NEXT();
+op_i32_clz:
+    tos = tos ? (uint32_t)__builtin_clz(tos) : 32;
+    NEXT();
+op_i32_ctz:
+    tos = tos ? (uint32_t)__builtin_ctz(tos) : 32;
+    NEXT();
+op_i32_popcnt:
+    tos = popcount32(tos);
+    NEXT();
+op_i32_add: BINARY(x + y); NEXT();
+op_i32_sub: BINARY(x - y); NEXT();
+op_i32_mul: BINARY(x * y); NEXT();
+op_i32_div_s:
+    if (tos == 0) goto trap_divide;
+    if (tos == 0xFFFFFFFF && *sp == 0x80000000) goto trap_overflow;
+    BINARY((uint32_t)((int32_t)x / (int32_t)y));
+    NEXT();
+op_i32_div_u:
+    if (tos == 0) goto trap_divide;
+    BINARY(x / y);
+    NEXT();
+op_i32_rem_s:
+    if (tos == 0) goto trap_divide;
+    BINARY(y == 0xFFFFFFFF ? 0 : (uint32_t)((int32_t)x % (int32_t)y));
+    NEXT();
+op_i32_rem_u:
+    if (tos == 0) goto trap_divide;
+    BINARY(x % y);
+    NEXT();
+op_i32_and:   BINARY(x & y); NEXT();
+op_i32_or:    BINARY(x | y); NEXT();
+op_i32_xor:   BINARY(x ^ y); NEXT();
+op_i32_shl:   BINARY(x << (y & 31)); NEXT();
+op_i32_shr_s: BINARY((uint32_t)((int32_t)x >> (y & 31))); NEXT();
+op_i32_shr_u: BINARY(x >> (y & 31)); NEXT();
+op_i32_rotl:  BINARY(rotl32(x, y)); NEXT();
+op_i32_rotr:  BINARY(rotl32(x, 32 - (y & 31))); NEXT();
+
+#undef NEXT
+#undef DISPATCH
+#undef PUSH
+#undef POP
+#undef BINARY
+#undef ADDRESS
+}
+
+/* ===== Running ===== */
+int wasm_run(const char* export_name, bool jit, bool* has_result, uint32_t* result) {
+    if (!wasm_module.loaded) return wasm_fail(WASM_NO_MODULE, "");
+
+    for (uint32_t i = 0; i < wasm_module.export_count; i++) {
+        const wasm_export_t* e = &wasm_module.exports[i];
+        if (e->kind != 0) continue;
+        bool match = export_name ? name_equals(e->name, e->name_len, export_name)
+                                 : name_equals(e->name, e->name_len, "main") ||
+                                   name_equals(e->name, e->name_len, "_start");
+        if (!match) continue;
+
+        const wasm_function_t* f = &wasm_module.functions[e->index];
+        const wasm_type_t* type = &wasm_module.types[f->type];
+        if (type->params != 0) return wasm_fail(WASM_LINK_ERROR, "export takes parameters");
+        if (f->host) return wasm_fail(WASM_UNSUPPORTED, "exported import");
+
+        *has_result = type->results != 0;
+        *result = 0;
+        wasm_detail = "";
+        return jit ? wasm_jit_invoke(e->index, result) : wasm_invoke(e->index, result);
+    }
+    return wasm_fail(WASM_LINK_ERROR, export_name ? "no such export" : "no main or _start export");
+}
@@ -0,0 +1,53 @@
+#ifndef FOXOS_WASM_H
+#define FOXOS_WASM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * WebAssembly runtime. wasm_load() decodes and validates a binary module and
+ * translates every function body into a predecoded form with resolved
+ * branch targets; wasm_run() interprets that, or compiles it to x86 first
+ * (wasm_jit.c). Only i32 is supported, which covers the MVP integer subset,
+ * and one module is loaded at a time.
+ *
+ * Host imports live in the "env" module:
+ *   print(i32 ptr)       - NUL-terminated string in linear memory
+ *   print_i32(i32 value) - decimal
+ */
+
+/* ===== Limits ===== */
+#define WASM_MAX_BINARY     65536
+#define WASM_MAX_TYPES      64
+#define WASM_MAX_FUNCTIONS  256   // Imports included
+#define WASM_MAX_GLOBALS    64
+#define WASM_MAX_EXPORTS    64
+#define WASM_MAX_LOCALS     1024  // Per function, parameters included
+#define WASM_MAX_CODE       16384 // Predecoded instructions for the whole module
+#define WASM_MAX_NESTING    256   // Blocks open in one function
+#define WASM_MAX_PAGES      16    // 64 KB pages of linear memory
+#define WASM_STACK_SLOTS    16384 // Locals and operands of every active call
+#define WASM_MAX_CALL_DEPTH 512
+
+#define WASM_JIT_BUFFER     262144  // Machine code for all cached modules
+#define WASM_JIT_CACHE      8       // Modules whose code is kept
+
+#define WASM_PAGE_SIZE 65536
+
+/* ===== Error Codes ===== */
+#define WASM_OK           0
+#define WASM_MALFORMED   -1  // Not a well-formed binary module
+#define WASM_INVALID     -2  // Fails validation
+#define WASM_UNSUPPORTED -3  // Valid, but needs something this runtime lacks
+#define WASM_TOO_BIG     -4  // Over one of the limits above
+#define WASM_LINK_ERROR  -5  // Unknown import or missing export
+#define WASM_TRAP        -6  // Trapped while running
+#define WASM_NO_MODULE   -7
+
+int wasm_load(const uint8_t* binary, uint32_t size);
+// NULL runs "main" or "_start"; 'jit' compiles it to x86 instead of interpreting
+int wasm_run(const char* export_name, bool jit, bool* has_result, uint32_t* result);
+const char* wasm_error_detail();  // What exactly went wrong in the last failure
+void wasm_perror(int error_code);
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef FOXOS_WASM_INTERNAL_H
+#define FOXOS_WASM_INTERNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "wasm.h"
+
+/* Shared by the loader and interpreter (wasm.c) and the compiler (wasm_jit.c) */
+
+/* ===== Opcodes ===== */
+enum {
+    OP_UNREACHABLE = 0x00,
+    OP_NOP = 0x01,
+    OP_BLOCK = 0x02,
+    OP_LOOP = 0x03,
+    OP_IF = 0x04,
+    OP_ELSE = 0x05,
+    OP_END = 0x0B,
+    OP_BR = 0x0C,
+    OP_BR_IF = 0x0D,
+    OP_BR_TABLE = 0x0E,
+    OP_RETURN = 0x0F,
+    OP_CALL = 0x10,
+    OP_DROP = 0x1A,
+    OP_SELECT = 0x1B,
+    OP_LOCAL_GET = 0x20,
+    OP_LOCAL_SET = 0x21,
+    OP_LOCAL_TEE = 0x22,
+    OP_GLOBAL_GET = 0x23,
+    OP_GLOBAL_SET = 0x24,
+    OP_I32_LOAD = 0x28,
+    OP_I32_LOAD8_S = 0x2C,
+    OP_I32_LOAD8_U = 0x2D,
+    OP_I32_LOAD16_S = 0x2E,
+    OP_I32_LOAD16_U = 0x2F,
+    OP_I32_STORE = 0x36,
+    OP_I32_STORE8 = 0x3A,
+    OP_I32_STORE16 = 0x3B,
+    OP_MEMORY_SIZE = 0x3F,
+    OP_MEMORY_GROW = 0x40,
+    OP_I32_CONST = 0x41,
+    OP_I32_EQZ = 0x45,
+    OP_I32_EQ = 0x46,
+    OP_I32_NE = 0x47,
+    OP_I32_LT_S = 0x48,
+    OP_I32_LT_U = 0x49,
+    OP_I32_GT_S = 0x4A,
+    OP_I32_GT_U = 0x4B,
+    OP_I32_LE_S = 0x4C,
+    OP_I32_LE_U = 0x4D,
+    OP_I32_GE_S = 0x4E,
+    OP_I32_GE_U = 0x4F,
+    OP_I32_CLZ = 0x67,
+    OP_I32_CTZ = 0x68,
+    OP_I32_POPCNT = 0x69,
+    OP_I32_ADD = 0x6A,
+    OP_I32_SUB = 0x6B,
+    OP_I32_MUL = 0x6C,
+    OP_I32_DIV_S = 0x6D,
+    OP_I32_DIV_U = 0x6E,
+    OP_I32_REM_S = 0x6F,
+    OP_I32_REM_U = 0x70,
+    OP_I32_AND = 0x71,
+    OP_I32_OR = 0x72,
+    OP_I32_XOR = 0x73,
+    OP_I32_SHL = 0x74,
+    OP_I32_SHR_S = 0x75,
+    OP_I32_SHR_U = 0x76,
+    OP_I32_ROTL = 0x77,
+    OP_I32_ROTR = 0x78,
+
+    // Only in predecoded code, in encodings Wasm leaves unused
+    OP_JUMP = 0xF0,       // Unconditional, no stack change (end of a then-arm)
+    OP_CALL_HOST = 0xF1,  // Call to an import
+};
+
+#define WASM_TYPE_I32   0x7F
+#define WASM_BLOCK_VOID 0x40
+#define WASM_NO_FIXUP   0xFFFFFFFF
+
+/* ===== Module ===== */
+/*
+ * Predecoded instruction. Branches carry the label's target instruction in
+ * 'a', the operand count below the label in 'b' and how many values they
+ * take along in 'arity', so neither the interpreter nor the compiler needs a
+ * control stack.
+ */
+typedef struct {
+    uint8_t op;
+    uint8_t arity;
+    uint16_t height;  // Operands on the stack before it runs
+    uint32_t a;   // Immediate, index or branch target
+    uint32_t b;   // Memory offset or branch height
+} wasm_insn_t;
+
+typedef struct {
+    uint8_t params;
+    uint8_t results;  // 0 or 1
+} wasm_type_t;
+
+typedef int (*wasm_host_fn_t)(const uint32_t* args, uint32_t* result);
+
+typedef struct {
+    uint32_t type;
+    uint32_t code;          // First predecoded instruction
+    uint16_t param_count;
+    uint16_t local_count;   // Parameters included
+    uint32_t max_height;    // Deepest the operand stack gets
+    wasm_host_fn_t host;    // Imports only
+} wasm_function_t;
+
+typedef struct {
+    const uint8_t* name;
+    uint32_t name_len;
+    uint8_t kind;
+    uint32_t index;
+} wasm_export_t;
+
+typedef struct {
+    bool loaded;
+    wasm_type_t types[WASM_MAX_TYPES];
+    uint32_t type_count;
+    wasm_function_t functions[WASM_MAX_FUNCTIONS];
+    uint32_t import_count;
+    uint32_t function_count;
+    uint32_t globals[WASM_MAX_GLOBALS];
+    bool global_mutable[WASM_MAX_GLOBALS];
+    uint32_t global_count;
+    wasm_export_t exports[WASM_MAX_EXPORTS];
+    uint32_t export_count;
+    bool has_memory;
+    uint32_t memory_pages;
+    uint32_t memory_max_pages;
+    int32_t start_function;   // -1 if none
+    uint32_t code_size;
+    uint32_t binary_size;
+    uint32_t hash[2];         // Two independent hashes of the binary, for the JIT cache
+} wasm_module_t;
+
+extern wasm_module_t wasm_module;
+extern wasm_insn_t wasm_code[WASM_MAX_CODE];
+extern uint8_t wasm_memory[WASM_MAX_PAGES * WASM_PAGE_SIZE];
+extern uint32_t wasm_stack[WASM_STACK_SLOTS];
+
+int wasm_fail(int code, const char* detail);
+uint32_t wasm_memory_grow(uint32_t delta);  // Old size in pages, or 0xFFFFFFFF
+int wasm_jit_invoke(uint32_t index, uint32_t* result);
+
+#endif
@@ -0,0 +1,1072 @@
+#include "klib.h"
+#include "wasm.h"
+#include "wasm_internal.h"
+
+/*
+ * Baseline compiler: one pass over a function's predecoded instructions,
+ * emitting 32-bit x86 straight into a static buffer (segments are flat and
+ * 32-bit paging has no no-execute bit, so any memory can run code).
+ *
+ * Register use inside compiled code:
+ *   ebx      the frame: local i at [ebx + 4i], operand k at [ebx + 4(locals + k)]
+ *   eax      usually the top of the operand stack
+ *   ecx edx  scratch
+ * The other operands live in their frame slots. The top can also stay
+ * unmaterialized as a constant, a copy of a local or global, or a pending
+ * comparison in the flags, so "i32.const 1; i32.add" becomes one add and a
+ * compare followed by br_if becomes cmp/jcc. At every branch target the
+ * state is canonical: top in eax, everything else in memory.
+ *
+ * Linear memory accesses are checked explicitly against jit_memory_size;
+ * guard pages could replace the checks if linear memory moved out of the
+ * identity-mapped kernel region.
+ *
+ * A module's code stays in the buffer, keyed by the binary's size and
+ * hashes, so running it again skips compilation. When the buffer fills up,
+ * everything is thrown away and compilation starts over.
+ */
+
+/* ===== Code Buffer ===== */
+enum { REG_EAX, REG_ECX, REG_EDX, REG_EBX, REG_ESP, REG_EBP, REG_ESI, REG_EDI };
+#define REG_ABSOLUTE 0xFF  // Memory operand base for [disp32]
+
+// Condition codes, as in jcc/setcc; cc ^ 1 is the opposite condition
+enum {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+    CC_S = 0x8, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF,
+    CC_ALWAYS = 0x10,
+};
+
+// ALU operations (the /digit of opcodes 0x81/0x83, and op * 8 + 3 for reg, r/m)
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+
+// Shift group (0xC1/0xD3 /digit)
+enum { SHIFT_ROL = 0, SHIFT_ROR = 1, SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7 };
+
+static uint8_t jit_buffer[WASM_JIT_BUFFER] __attribute__((aligned(16)));
+static uint32_t jit_used;
+static bool jit_overflow;     // Ran out of buffer; the output is garbage
+
+static void emit8(uint8_t byte) {
+    if (jit_used < WASM_JIT_BUFFER) {
+        jit_buffer[jit_used++] = byte;
+    } else {
+        jit_overflow = true;
+    }
+}
+
+static void emit32(uint32_t value) {
+    emit8(value);
+    emit8(value >> 8);
+    emit8(value >> 16);
+    emit8(value >> 24);
+}
+
+static void patch32(uint32_t at, uint32_t value) {
+    if (jit_overflow) return;
+    memcpy(jit_buffer + at, &value, 4);
+}
+
+static uint32_t read32(uint32_t at) {
+    uint32_t value;
+    memcpy(&value, jit_buffer + at, 4);
+    return value;
+}
+
+static bool fits8(uint32_t value) {
+    return (int32_t)value >= -128 && (int32_t)value <= 127;
+}
+
+// ModRM (and displacement) for reg, [base + disp]; base is never esp or ebp
+static void emit_modrm(uint8_t reg, uint8_t base, uint32_t disp) {
+    if (base == REG_ABSOLUTE) {
+        emit8(0x05 | reg << 3);
+        emit32(disp);
+    } else if (disp == 0) {
+        emit8(reg << 3 | base);
+    } else if (fits8(disp)) {
+        emit8(0x40 | reg << 3 | base);
+        emit8(disp);
+    } else {
+        emit8(0x80 | reg << 3 | base);
+        emit32(disp);
+    }
+}
+
+static void emit_rm(uint8_t opcode, uint8_t reg, uint8_t base, uint32_t disp) {
+    emit8(opcode);
+    emit_modrm(reg, base, disp);
+}
+
+static void emit_rr(uint8_t opcode, uint8_t reg, uint8_t rm) {
+    emit8(opcode);
+    emit8(0xC0 | reg << 3 | rm);
+}
+
+static void emit_mov_imm(uint8_t reg, uint32_t value) {
+    emit8(0xB8 + reg);
+    emit32(value);
+}
+
+// rel32 of a jump or call at the end of the code so far, to an absolute address
+static void emit_rel32_to(const void* target) {
+    emit32((uint32_t)target - (uint32_t)(jit_buffer + jit_used + 4));
+}
+
+static void emit_call(const void* target) {
+    emit8(0xE8);
+    emit_rel32_to(target);
+}
+
+// jmp or jcc rel32 to an address already known
+static void emit_jump(uint8_t cc, const void* target) {
+    if (cc == CC_ALWAYS) {
+        emit8(0xE9);
+    } else {
+        emit8(0x0F);
+        emit8(0x80 | cc);
+    }
+    emit_rel32_to(target);
+}
+
+// Short forward jump over code not emitted yet: returns where to patch
+static uint32_t emit_skip(uint8_t cc) {
+    emit8(cc == CC_ALWAYS ? 0xEB : 0x70 | cc);
+    emit8(0);
+    return jit_used;
+}
+
+static void land_skip(uint32_t from) {
+    if (jit_overflow) return;
+    jit_buffer[from - 1] = jit_used - from;
+}
+
+/* ===== Operands ===== */
+typedef struct {
+    uint8_t kind;     // OPERAND_*
+    uint8_t base;     // Memory: base register or REG_ABSOLUTE
+    uint32_t value;   // Immediate, register or displacement
+} jit_operand_t;
+
+enum { OPERAND_IMM, OPERAND_REG, OPERAND_MEM };
+
+static jit_operand_t operand_reg(uint8_t reg) {
+    return (jit_operand_t){ OPERAND_REG, 0, reg };
+}
+
+static jit_operand_t operand_mem(uint8_t base, uint32_t disp) {
+    return (jit_operand_t){ OPERAND_MEM, base, disp };
+}
+
+static void emit_mov_load(uint8_t reg, jit_operand_t src) {
+    if (src.kind == OPERAND_IMM) emit_mov_imm(reg, src.value);
+    else if (src.kind == OPERAND_REG) { if (src.value != reg) emit_rr(0x8B, reg, src.value); }
+    else emit_rm(0x8B, reg, src.base, src.value);
+}
+
+static void emit_mov_store(jit_operand_t dst, uint8_t reg) {
+    emit_rm(0x89, reg, dst.base, dst.value);
+}
+
+static void emit_alu(uint8_t alu, uint8_t reg, jit_operand_t src) {
+    if (src.kind == OPERAND_IMM) {
+        emit8(fits8(src.value) ? 0x83 : 0x81);
+        emit8(0xC0 | alu << 3 | reg);
+        if (fits8(src.value)) emit8(src.value);
+        else emit32(src.value);
+    } else if (src.kind == OPERAND_REG) {
+        emit_rr(alu * 8 + 3, reg, src.value);
+    } else {
+        emit_rm(alu * 8 + 3, reg, src.base, src.value);
+    }
+}
+
+static void emit_imul(uint8_t reg, jit_operand_t src) {
+    if (src.kind == OPERAND_IMM) {
+        emit_rr(fits8(src.value) ? 0x6B : 0x69, reg, reg);
+        if (fits8(src.value)) emit8(src.value);
+        else emit32(src.value);
+    } else {
+        emit8(0x0F);
+        if (src.kind == OPERAND_REG) emit_rr(0xAF, reg, src.value);
+        else emit_rm(0xAF, reg, src.base, src.value);
+    }
+}
+
+// cmp dword [mem], 0
+static void emit_test_mem(jit_operand_t mem) {
+    emit_rm(0x83, ALU_CMP, mem.base, mem.value);
+    emit8(0);
+}
+
+// setcc al; movzx eax, al
+static void emit_materialize_flags(uint8_t cc) {
+    emit8(0x0F);
+    emit_rr(0x90 | cc, 0, REG_EAX);
+    emit8(0x0F);
+    emit_rr(0xB6, REG_EAX, REG_EAX);
+}
+
+/* ===== Runtime Support ===== */
+enum {
+    JIT_TRAP_NONE,
+    JIT_TRAP_UNREACHABLE,
+    JIT_TRAP_MEMORY,
+    JIT_TRAP_STACK,
+    JIT_TRAP_DIVIDE,
+    JIT_TRAP_OVERFLOW,
+    JIT_TRAP_HOST,        // The import already said why
+    JIT_TRAP_COUNT,
+};
+
+static const char* const jit_trap_detail[JIT_TRAP_COUNT] = {
+    "",
+    "unreachable executed",
+    "out of bounds memory access",
+    "call stack exhausted",
+    "integer divide by zero",
+    "integer overflow",
+    "",
+};
+
+// Read and written by compiled code
+static uint32_t jit_memory_size;   // Bytes of linear memory
+static uint32_t jit_depth;         // Calls left before the stack is exhausted
+static uint32_t jit_saved_esp;     // To unwind from a trap
+static uint32_t jit_result;
+
+static uint32_t jit_stubs_end;     // Code below here survives a flush
+static uint32_t jit_trap_stub[JIT_TRAP_COUNT];
+
+typedef int (*jit_entry_t)(const uint8_t* code, uint32_t* frame);
+
+static int jit_call_host(uint32_t index, uint32_t* args) {
+    const wasm_function_t* f = &wasm_module.functions[index];
+    uint32_t value = 0;
+    int status = f->host(args, &value);
+    if (wasm_module.types[f->type].results) {
+        args[0] = value;  // Where the result goes on the operand stack
+    }
+    return status;
+}
+
+static uint32_t jit_memory_grow(uint32_t delta) {
+    uint32_t old = wasm_memory_grow(delta);
+    jit_memory_size = wasm_module.memory_pages * WASM_PAGE_SIZE;
+    return old;
+}
+
+/*
+ * Buffer offset 0 holds the entry, jit_entry_t: save the C callee-saved
+ * registers, point ebx at the frame and call the function. Its result goes
+ * to jit_result and the return value is a JIT_TRAP_* code. Then one stub per
+ * trap, which unwinds the machine stack and returns through the same exit.
+ */
+static void jit_emit_runtime() {
+    jit_used = 0;
+    jit_overflow = false;
+
+    emit8(0x55);                                   // push ebp
+    emit8(0x53);                                   // push ebx
+    emit8(0x56);                                   // push esi
+    emit8(0x57);                                   // push edi
+    emit_rm(0x89, REG_ESP, REG_ABSOLUTE, (uint32_t)&jit_saved_esp);
+    emit8(0x8B); emit8(0x5C); emit8(0x24); emit8(24);  // mov ebx, [esp + 24]
+    emit8(0xFF); emit8(0x54); emit8(0x24); emit8(20);  // call [esp + 20]
+    emit_rm(0x89, REG_EAX, REG_ABSOLUTE, (uint32_t)&jit_result);
+    emit_rr(0x31, REG_EAX, REG_EAX);               // xor eax, eax
+    uint32_t exit = jit_used;
+    emit8(0x5F);                                   // pop edi
+    emit8(0x5E);                                   // pop esi
+    emit8(0x5B);                                   // pop ebx
+    emit8(0x5D);                                   // pop ebp
+    emit8(0xC3);                                   // ret
+
+    uint32_t unwind = jit_used;
+    emit_rm(0x8B, REG_ESP, REG_ABSOLUTE, (uint32_t)&jit_saved_esp);
+    emit_jump(CC_ALWAYS, jit_buffer + exit);
+
+    for (uint32_t trap = 1; trap < JIT_TRAP_COUNT; trap++) {
+        jit_trap_stub[trap] = jit_used;
+        emit_mov_imm(REG_EAX, trap);
+        emit_jump(CC_ALWAYS, jit_buffer + unwind);
+    }
+    jit_stubs_end = jit_used;
+}
+
+static void emit_trap(uint8_t cc, uint32_t trap) {
+    emit_jump(cc, jit_buffer + jit_trap_stub[trap]);
+}
+
+/* ===== Labels ===== */
+/*
+ * Every branch target in the function being compiled gets a label. Until
+ * the label is placed, the rel32 fields jumping to it form a chain through
+ * themselves, headed in jit_label.
+ */
+#define LABEL_TARGET  0x01  // Something branches here
+#define LABEL_REACHED 0x02  // ... from code that can run
+#define LABEL_PLACED  0x04  // jit_label is its code offset, not a chain
+
+static uint8_t jit_label_flags[WASM_MAX_CODE];
+static uint32_t jit_label[WASM_MAX_CODE];
+
+// Calls to functions not compiled yet, chained the same way
+static uint32_t jit_function_code[WASM_MAX_FUNCTIONS];
+static uint32_t jit_call_chain[WASM_MAX_FUNCTIONS];
+
+static void link_chain(uint32_t chain, uint32_t target) {
+    while (chain != WASM_NO_FIXUP && !jit_overflow) {
+        uint32_t next = read32(chain);
+        patch32(chain, target - (chain + 4));
+        chain = next;
+    }
+}
+
+static void emit_jump_to_insn(uint8_t cc, uint32_t insn) {
+    if (cc == CC_ALWAYS) {
+        emit8(0xE9);
+    } else {
+        emit8(0x0F);
+        emit8(0x80 | cc);
+    }
+    jit_label_flags[insn] |= LABEL_REACHED;
+    if (jit_label_flags[insn] & LABEL_PLACED) {
+        emit32(jit_label[insn] - (jit_used + 4));
+    } else {
+        uint32_t at = jit_used;
+        emit32(jit_label[insn]);
+        jit_label[insn] = at;
+    }
+}
+
+static void place_label(uint32_t insn) {
+    link_chain(jit_label[insn], jit_used);
+    jit_label[insn] = jit_used;
+    jit_label_flags[insn] |= LABEL_PLACED;
+}
+
+/* ===== Operand Stack ===== */
+enum {
+    TOP_SLOT,   // In its frame slot (also the state of an empty stack)
+    TOP_EAX,
+    TOP_CONST,  // Not materialized: 'value'
+    TOP_MEM,    // Not materialized: a copy of a local or global
+    TOP_FLAGS,  // Not materialized: condition code 'value' after a compare
+};
+
+static struct {
+    uint32_t height;
+    uint8_t top;
+    bool below_in_eax;    // Unmaterialized top: eax holds the operand under it,
+                          // and its slot is stale
+    uint8_t mem_base;     // TOP_MEM
+    uint32_t value;       // TOP_CONST, TOP_MEM displacement or TOP_FLAGS condition
+    uint32_t locals;      // Of the function being compiled
+} jit;
+
+static jit_operand_t slot(uint32_t k) {
+    return operand_mem(REG_EBX, 4 * (jit.locals + k));
+}
+
+static void set_canonical(uint32_t height) {
+    jit.height = height;
+    jit.top = height ? TOP_EAX : TOP_SLOT;
+    jit.below_in_eax = false;
+}
+
+static jit_operand_t top_operand() {
+    switch (jit.top) {
+        case TOP_EAX: return operand_reg(REG_EAX);
+        case TOP_CONST: return (jit_operand_t){ OPERAND_IMM, 0, jit.value };
+        case TOP_MEM: return operand_mem(jit.mem_base, jit.value);
+        default: return slot(jit.height - 1);
+    }
+}
+
+static void flush_below() {
+    if (jit.below_in_eax) {
+        emit_mov_store(slot(jit.height - 2), REG_EAX);
+        jit.below_in_eax = false;
+    }
+}
+
+// Top into eax and everything else into memory: the canonical state
+static void flush_top() {
+    if (jit.height == 0 || jit.top == TOP_EAX) return;
+    if (jit.top == TOP_FLAGS) {
+        emit_materialize_flags(jit.value);
+    } else {
+        flush_below();
+        emit_mov_load(REG_EAX, top_operand());
+    }
+    jit.top = TOP_EAX;
+}
+
+// Every operand in its slot, before calls
+static void spill_all() {
+    flush_top();
+    if (jit.height > 0) {
+        emit_mov_store(slot(jit.height - 1), REG_EAX);
+        jit.top = TOP_SLOT;
+    }
+}
+
+static void push_deferred(uint8_t top, uint8_t mem_base, uint32_t value) {
+    bool in_eax = jit.height > 0 && jit.top != TOP_SLOT;
+    if (in_eax) flush_top();
+    jit.below_in_eax = in_eax;
+    jit.top = top;
+    jit.mem_base = mem_base;
+    jit.value = value;
+    jit.height++;
+}
+
+// The top was used up; what's under it becomes the top
+static void drop_top() {
+    jit.height--;
+    jit.top = jit.below_in_eax ? TOP_EAX : TOP_SLOT;
+    jit.below_in_eax = false;
+}
+
+/*
+ * Binary operators: x (under the top) into eax, and y (the top) as an
+ * operand that isn't eax. Commutative ones may get them the other way round.
+ */
+static jit_operand_t take_operands(bool commutative) {
+    jit_operand_t y;
+    if (jit.top == TOP_FLAGS) flush_top();
+    if (jit.top == TOP_EAX && commutative) {
+        y = slot(jit.height - 2);
+    } else if (jit.top == TOP_EAX) {
+        emit_rr(0x8B, REG_ECX, REG_EAX);
+        emit_mov_load(REG_EAX, slot(jit.height - 2));
+        y = operand_reg(REG_ECX);
+    } else {
+        y = top_operand();
+        if (!jit.below_in_eax) emit_mov_load(REG_EAX, slot(jit.height - 2));
+    }
+    jit.height--;
+    jit.top = TOP_EAX;
+    jit.below_in_eax = false;
+    return y;
+}
+
+/* ===== Instructions ===== */
+static uint32_t function_end(uint32_t index) {
+    return index + 1 < wasm_module.function_count ? wasm_module.functions[index + 1].code : wasm_module.code_size;
+}
+
+// Whether a comparison should leave its result in the flags for the next instruction
+static bool next_takes_flags(uint32_t next, uint32_t end) {
+    if (next >= end || (jit_label_flags[next] & LABEL_TARGET)) return false;
+    uint8_t op = wasm_code[next].op;
+    return op == OP_BR_IF || op == OP_IF || op == OP_I32_EQZ;
+}
+
+static uint8_t compare_condition(uint8_t op) {
+    switch (op) {
+        case OP_I32_EQ: return CC_E;
+        case OP_I32_NE: return CC_NE;
+        case OP_I32_LT_S: return CC_L;
+        case OP_I32_LT_U: return CC_B;
+        case OP_I32_GT_S: return CC_G;
+        case OP_I32_GT_U: return CC_A;
+        case OP_I32_LE_S: return CC_LE;
+        case OP_I32_LE_U: return CC_BE;
+        case OP_I32_GE_S: return CC_GE;
+        default: return CC_AE;
+    }
+}
+
+/*
+ * Branch to a label, from the canonical state. Like the interpreter, a
+ * branch keeps the label's 'b' operands plus the value it carries; with no
+ * value the new top is the operand at b - 1, the only one that moves.
+ */
+static void emit_branch(const wasm_insn_t* br, uint8_t cc) {
+    bool reload = !br->arity && br->b > 0 && br->b < jit.height;
+    if (!reload) {
+        emit_jump_to_insn(cc, br->a);
+        return;
+    }
+    uint32_t skip = 0;
+    if (cc != CC_ALWAYS) skip = emit_skip(cc ^ 1);
+    emit_mov_load(REG_EAX, slot(br->b - 1));
+    emit_jump_to_insn(CC_ALWAYS, br->a);
+    if (cc != CC_ALWAYS) land_skip(skip);
+}
+
+/*
+ * Pop a condition for br_if, if or br_table: set the flags from it and leave
+ * the rest canonical (mov doesn't touch the flags). Returns the condition
+ * under which it was non-zero.
+ */
+static uint8_t pop_condition() {
+    uint8_t cc = CC_NE;
+    if (jit.top == TOP_FLAGS) {
+        cc = jit.value;
+    } else if (jit.top == TOP_EAX) {
+        emit_rr(0x85, REG_EAX, REG_EAX);  // test eax, eax
+    } else {
+        emit_test_mem(top_operand());
+    }
+    jit.height--;
+    if (jit.height > 0 && !jit.below_in_eax) {
+        emit_mov_load(REG_EAX, slot(jit.height - 1));
+    }
+    set_canonical(jit.height);
+    return cc;
+}
+
+// Effective address check: reg + offset + size must fit in jit_memory_size
+static void emit_bounds_check(uint8_t reg, uint8_t scratch, uint32_t offset, uint32_t size) {
+    if (offset > WASM_MAX_PAGES * WASM_PAGE_SIZE) {
+        emit_trap(CC_ALWAYS, JIT_TRAP_MEMORY);
+        return;
+    }
+    emit_rr(0x8B, scratch, reg);
+    emit_alu(ALU_ADD, scratch, (jit_operand_t){ OPERAND_IMM, 0, offset + size });
+    emit_trap(CC_B, JIT_TRAP_MEMORY);  // Carry: wrapped around
+    emit_alu(ALU_CMP, scratch, operand_mem(REG_ABSOLUTE, (uint32_t)&jit_memory_size));
+    emit_trap(CC_A, JIT_TRAP_MEMORY);
+}
+
+static void compile_load(const wasm_insn_t* insn) {
+    static const uint8_t size[] = { 4, 0, 0, 0, 1, 1, 2, 2 };
+    // i32.load is a plain mov; the narrow ones movsx/movzx
+    static const uint8_t extend[] = { 0, 0, 0, 0, 0xBE, 0xB6, 0xBF, 0xB7 };
+    uint8_t kind = insn->op - OP_I32_LOAD;
+
+    flush_top();
+    emit_bounds_check(REG_EAX, REG_EDX, insn->b, size[kind]);
+    uint32_t address = (uint32_t)wasm_memory + insn->b;
+    if (kind == 0) {
+        emit_rm(0x8B, REG_EAX, REG_EAX, address);
+    } else {
+        emit8(0x0F);
+        emit_rm(extend[kind], REG_EAX, REG_EAX, address);
+    }
+}
+
+static void compile_store(const wasm_insn_t* insn) {
+    uint32_t size = insn->op == OP_I32_STORE ? 4 : insn->op == OP_I32_STORE16 ? 2 : 1;
+
+    // Value into edx (unless it's a constant), address into ecx; eax is then free
+    jit_operand_t value = top_operand();
+    if (jit.top == TOP_FLAGS) {
+        emit8(0x0F);
+        emit_rr(0x90 | jit.value, 0, REG_EDX);
+        emit8(0x0F);
+        emit_rr(0xB6, REG_EDX, REG_EDX);
+        value = operand_reg(REG_EDX);
+    } else if (jit.top != TOP_CONST) {
+        emit_mov_load(REG_EDX, value);
+        value = operand_reg(REG_EDX);
+    }
+    if (jit.below_in_eax) emit_rr(0x8B, REG_ECX, REG_EAX);
+    else emit_mov_load(REG_ECX, slot(jit.height - 2));
+
+    emit_bounds_check(REG_ECX, REG_EAX, insn->b, size);
+    uint32_t address = (uint32_t)wasm_memory + insn->b;
+    if (size == 2) emit8(0x66);  // Operand size prefix
+    if (value.kind == OPERAND_IMM) {
+        emit_rm(size == 1 ? 0xC6 : 0xC7, 0, REG_ECX, address);
+        emit8(value.value);
+        if (size >= 2) emit8(value.value >> 8);
+        if (size == 4) { emit8(value.value >> 16); emit8(value.value >> 24); }
+    } else {
+        emit_rm(size == 1 ? 0x88 : 0x89, REG_EDX, REG_ECX, address);
+    }
+    jit.height -= 2;
+    jit.top = TOP_SLOT;
+    jit.below_in_eax = false;
+}
+
+static void compile_set(uint8_t base, uint32_t disp) {
+    jit_operand_t dst = operand_mem(base, disp);
+    if (jit.top == TOP_FLAGS) flush_top();
+    if (jit.top == TOP_CONST) {
+        emit_rm(0xC7, 0, base, disp);
+        emit32(jit.value);
+    } else if (jit.top == TOP_EAX) {
+        emit_mov_store(dst, REG_EAX);
+    } else {
+        emit_mov_load(REG_ECX, top_operand());
+        emit_mov_store(dst, REG_ECX);
+    }
+}
+
+static void compile_divide(uint8_t op) {
+    bool is_signed = op == OP_I32_DIV_S || op == OP_I32_REM_S;
+    bool remainder = op == OP_I32_REM_S || op == OP_I32_REM_U;
+    jit_operand_t y = take_operands(false);
+    bool known = y.kind == OPERAND_IMM;
+    emit_mov_load(REG_ECX, y);
+
+    if (!known || y.value == 0) {
+        emit_rr(0x85, REG_ECX, REG_ECX);
+        emit_trap(CC_E, JIT_TRAP_DIVIDE);
+    }
+    uint32_t skip = 0;
+    bool minus_one = is_signed && (!known || y.value == 0xFFFFFFFF);
+    if (minus_one) {
+        // INT_MIN / -1 overflows, and idiv would fault on it
+        emit_alu(ALU_CMP, REG_ECX, (jit_operand_t){ OPERAND_IMM, 0, 0xFFFFFFFF });
+        uint32_t not_minus_one = emit_skip(CC_NE);
+        if (remainder) {
+            emit_rr(0x31, REG_EDX, REG_EDX);
+        } else {
+            emit_alu(ALU_CMP, REG_EAX, (jit_operand_t){ OPERAND_IMM, 0, 0x80000000 });
+            emit_trap(CC_E, JIT_TRAP_OVERFLOW);
+            emit_rr(0xF7, 3, REG_EAX);  // neg eax
+        }
+        skip = emit_skip(CC_ALWAYS);
+        land_skip(not_minus_one);
+    }
+    if (is_signed) {
+        emit8(0x99);                     // cdq
+        emit_rr(0xF7, 7, REG_ECX);       // idiv ecx
+    } else {
+        emit_rr(0x31, REG_EDX, REG_EDX);
+        emit_rr(0xF7, 6, REG_ECX);       // div ecx
+    }
+    if (minus_one) land_skip(skip);
+    if (remainder) emit_rr(0x8B, REG_EAX, REG_EDX);
+}
+
+static void compile_shift(uint8_t op) {
+    static const uint8_t digit[] = { SHIFT_SHL, SHIFT_SAR, SHIFT_SHR, SHIFT_ROL, SHIFT_ROR };
+    uint8_t shift = digit[op - OP_I32_SHL];
+    jit_operand_t y = take_operands(false);
+    if (y.kind == OPERAND_IMM) {
+        if ((y.value & 31) == 0) return;
+        emit_rr(0xC1, shift, REG_EAX);
+        emit8(y.value & 31);
+    } else {
+        emit_mov_load(REG_ECX, y);
+        emit_rr(0xD3, shift, REG_EAX);  // The CPU masks cl to 5 bits, as Wasm does
+    }
+}
+
+static void compile_unary_bits(uint8_t op) {
+    flush_top();
+    if (op == OP_I32_CLZ) {
+        // bsr gives 31 - clz, and nothing for 0; 63 ^ 31 = 32
+        emit8(0x0F); emit_rr(0xBD, REG_EAX, REG_EAX);
+        uint32_t skip = emit_skip(CC_NE);
+        emit_mov_imm(REG_EAX, 63);
+        land_skip(skip);
+        emit_alu(ALU_XOR, REG_EAX, (jit_operand_t){ OPERAND_IMM, 0, 31 });
+    } else if (op == OP_I32_CTZ) {
+        emit8(0x0F); emit_rr(0xBC, REG_EAX, REG_EAX);
+        uint32_t skip = emit_skip(CC_NE);
+        emit_mov_imm(REG_EAX, 32);
+        land_skip(skip);
+    } else {
+        // No popcnt on i686: the same bit trick as the interpreter's popcount32
+        static const uint32_t mask[] = { 0x55555555, 0x33333333 };
+        for (uint32_t i = 0; i < 2; i++) {
+            emit_rr(0x8B, REG_ECX, REG_EAX);
+            emit_rr(0xC1, SHIFT_SHR, REG_ECX);
+            emit8(1 << i);
+            emit_alu(ALU_AND, REG_ECX, (jit_operand_t){ OPERAND_IMM, 0, mask[i] });
+            if (i == 0) {
+                emit_alu(ALU_SUB, REG_EAX, operand_reg(REG_ECX));
+            } else {
+                emit_alu(ALU_AND, REG_EAX, (jit_operand_t){ OPERAND_IMM, 0, mask[i] });
+                emit_alu(ALU_ADD, REG_EAX, operand_reg(REG_ECX));
+            }
+        }
+        emit_rr(0x8B, REG_ECX, REG_EAX);
+        emit_rr(0xC1, SHIFT_SHR, REG_ECX);
+        emit8(4);
+        emit_alu(ALU_ADD, REG_EAX, operand_reg(REG_ECX));
+        emit_alu(ALU_AND, REG_EAX, (jit_operand_t){ OPERAND_IMM, 0, 0x0F0F0F0F });
+        emit_imul(REG_EAX, (jit_operand_t){ OPERAND_IMM, 0, 0x01010101 });
+        emit_rr(0xC1, SHIFT_SHR, REG_EAX);
+        emit8(24);
+    }
+}
+
+static void compile_br_table(uint32_t at) {
+    const wasm_insn_t* insn = &wasm_code[at];
+    const wasm_insn_t* entries = insn + 1;
+    uint32_t count = insn->a;
+
+    if (jit.top == TOP_CONST) {
+        uint32_t i = jit.value < count ? jit.value : count;
+        drop_top();
+        flush_top();
+        emit_branch(&entries[i], CC_ALWAYS);
+        return;
+    }
+    flush_top();
+    emit_rr(0x8B, REG_ECX, REG_EAX);
+    jit.height--;
+    if (jit.height > 0) emit_mov_load(REG_EAX, slot(jit.height - 1));
+    set_canonical(jit.height);
+
+    // Out of range takes the default, the last entry
+    emit_alu(ALU_CMP, REG_ECX, (jit_operand_t){ OPERAND_IMM, 0, count });
+    uint32_t in_range = emit_skip(CC_B);
+    emit_mov_imm(REG_ECX, count);
+    land_skip(in_range);
+
+    // jmp [table + ecx * 4], then the table, then one stub per entry
+    emit8(0xFF); emit8(0x24); emit8(0x8D);
+    uint32_t table_field = jit_used;
+    emit32(0);
+    while (jit_used % 4) emit8(0xCC);
+    uint32_t table = jit_used;
+    patch32(table_field, (uint32_t)(jit_buffer + table));
+    for (uint32_t i = 0; i <= count; i++) emit32(0);
+    for (uint32_t i = 0; i <= count; i++) {
+        patch32(table + 4 * i, (uint32_t)(jit_buffer + jit_used));
+        emit_branch(&entries[i], CC_ALWAYS);
+    }
+}
+
+static void compile_call(const wasm_insn_t* insn) {
+    const wasm_function_t* callee = &wasm_module.functions[insn->a];
+    const wasm_type_t* type = &wasm_module.types[callee->type];
+    uint32_t args = jit.height - type->params;
+    spill_all();
+
+    if (insn->op == OP_CALL_HOST) {
+        emit_rm(0x8D, REG_EAX, REG_EBX, 4 * (jit.locals + args));  // lea
+        emit8(0x50);                                               // push eax
+        emit8(0x68);                                               // push index
+        emit32(insn->a);
+        emit_call(jit_call_host);
+        emit8(0x83); emit8(0xC4); emit8(8);                        // add esp, 8
+        emit_rr(0x85, REG_EAX, REG_EAX);
+        emit_trap(CC_NE, JIT_TRAP_HOST);
+        jit.height = args + type->results;
+        jit.top = TOP_SLOT;
+        return;
+    }
+
+    // The arguments become the callee's first locals
+    uint32_t shift = 4 * (jit.locals + args);
+    if (shift) emit_rm(0x8D, REG_EBX, REG_EBX, shift);
+    emit8(0xE8);
+    if (jit_call_chain[insn->a] == 0) {
+        emit_rel32_to(jit_buffer + jit_function_code[insn->a]);
+    } else {
+        uint32_t here = jit_used;
+        emit32(jit_call_chain[insn->a]);
+        jit_call_chain[insn->a] = here;
+    }
+    if (shift) emit_rm(0x8D, REG_EBX, REG_EBX, -shift);
+    jit.height = args + type->results;
+    jit.top = type->results ? TOP_EAX : TOP_SLOT;
+}
+
+static void compile_function(uint32_t index) {
+    const wasm_function_t* f = &wasm_module.functions[index];
+    uint32_t start = f->code;
+    uint32_t end = function_end(index);
+
+    jit_function_code[index] = jit_used;
+    link_chain(jit_call_chain[index], jit_used);
+    jit_call_chain[index] = 0;  // Compiled: calls can go straight there
+
+    for (uint32_t i = start; i < end; i++) {
+        jit_label_flags[i] = 0;
+        jit_label[i] = WASM_NO_FIXUP;
+    }
+    for (uint32_t i = start; i < end; i++) {
+        uint8_t op = wasm_code[i].op;
+        if (op == OP_BR || op == OP_BR_IF || op == OP_IF || op == OP_JUMP) {
+            jit_label_flags[wasm_code[i].a] |= LABEL_TARGET;
+        }
+    }
+
+    // Prologue: call depth, room on wasm_stack, zeroed locals
+    emit_rm(0xFF, 1, REG_ABSOLUTE, (uint32_t)&jit_depth);  // dec
+    emit_trap(CC_S, JIT_TRAP_STACK);
+    emit_rm(0x8D, REG_ECX, REG_EBX, 4 * (f->local_count + 1 + f->max_height));
+    emit_alu(ALU_CMP, REG_ECX, (jit_operand_t){ OPERAND_IMM, 0, (uint32_t)(wasm_stack + WASM_STACK_SLOTS) });
+    emit_trap(CC_AE, JIT_TRAP_STACK);
+    uint32_t zeroed = f->local_count - f->param_count;
+    if (zeroed > 0) {
+        emit_rr(0x31, REG_EAX, REG_EAX);
+        if (zeroed <= 8) {
+            for (uint32_t i = f->param_count; i < f->local_count; i++) {
+                emit_mov_store(operand_mem(REG_EBX, 4 * i), REG_EAX);
+            }
+        } else {
+            emit_rm(0x8D, REG_EDI, REG_EBX, 4 * f->param_count);
+            emit_mov_imm(REG_ECX, zeroed);
+            emit8(0xF3); emit8(0xAB);  // rep stosd
+        }
+    }
+
+    jit.locals = f->local_count;
+    set_canonical(0);
+    bool live = true;
+
+    for (uint32_t i = start; i < end; i++) {
+        const wasm_insn_t* insn = &wasm_code[i];
+        if (jit_label_flags[i] & LABEL_TARGET) {
+            if (live) flush_top();
+            if (live || (jit_label_flags[i] & LABEL_REACHED)) {
+                live = true;
+                set_canonical(insn->height);
+                place_label(i);
+            }
+        }
+        // Code after an unconditional transfer that nothing branches to
+        if (!live) continue;
+
+        uint8_t op = insn->op;
+        switch (op) {
+        /* Control */
+        case OP_UNREACHABLE:
+            emit_trap(CC_ALWAYS, JIT_TRAP_UNREACHABLE);
+            live = false;
+            break;
+        case OP_JUMP:
+        case OP_BR:
+            flush_top();
+            emit_branch(insn, CC_ALWAYS);
+            live = false;
+            break;
+        case OP_BR_IF:
+            if (jit.top == TOP_CONST) {
+                bool taken = jit.value != 0;
+                drop_top();
+                flush_top();
+                if (taken) {
+                    emit_branch(insn, CC_ALWAYS);
+                    live = false;
+                }
+            } else {
+                emit_branch(insn, pop_condition());
+            }
+            break;
+        case OP_IF:
+            if (jit.top == TOP_CONST) {
+                bool taken = jit.value != 0;
+                drop_top();
+                flush_top();
+                if (!taken) {
+                    emit_jump_to_insn(CC_ALWAYS, insn->a);
+                    live = false;
+                }
+            } else {
+                emit_jump_to_insn(pop_condition() ^ 1, insn->a);
+            }
+            break;
+        case OP_BR_TABLE:
+            compile_br_table(i);
+            i += insn->a + 1;
+            live = false;
+            break;
+        case OP_RETURN:
+            if (insn->arity) flush_top();
+            emit_rm(0xFF, 0, REG_ABSOLUTE, (uint32_t)&jit_depth);  // inc
+            emit8(0xC3);
+            live = false;
+            break;
+        case OP_CALL:
+        case OP_CALL_HOST:
+            compile_call(insn);
+            break;
+
+        /* Parametric */
+        case OP_DROP:
+            drop_top();
+            break;
+        case OP_SELECT: {
+            spill_all();
+            uint32_t h = jit.height;
+            emit_mov_load(REG_EAX, slot(h - 3));
+            emit_test_mem(slot(h - 1));
+            uint32_t skip = emit_skip(CC_NE);
+            emit_mov_load(REG_EAX, slot(h - 2));
+            land_skip(skip);
+            set_canonical(h - 2);
+            break;
+        }
+
+        /* Variables */
+        case OP_LOCAL_GET:
+            push_deferred(TOP_MEM, REG_EBX, 4 * insn->a);
+            break;
+        case OP_LOCAL_SET:
+        case OP_LOCAL_TEE:
+            compile_set(REG_EBX, 4 * insn->a);
+            if (op == OP_LOCAL_SET) drop_top();
+            break;
+        case OP_GLOBAL_GET:
+            push_deferred(TOP_MEM, REG_ABSOLUTE, (uint32_t)&wasm_module.globals[insn->a]);
+            break;
+        case OP_GLOBAL_SET:
+            compile_set(REG_ABSOLUTE, (uint32_t)&wasm_module.globals[insn->a]);
+            drop_top();
+            break;
+
+        /* Memory */
+        case OP_I32_LOAD:
+        case OP_I32_LOAD8_S:
+        case OP_I32_LOAD8_U:
+        case OP_I32_LOAD16_S:
+        case OP_I32_LOAD16_U:
+            compile_load(insn);
+            break;
+        case OP_I32_STORE:
+        case OP_I32_STORE8:
+        case OP_I32_STORE16:
+            compile_store(insn);
+            break;
+        case OP_MEMORY_SIZE:
+            push_deferred(TOP_MEM, REG_ABSOLUTE, (uint32_t)&wasm_module.memory_pages);
+            break;
+        case OP_MEMORY_GROW:
+            flush_top();
+            emit8(0x50);                         // push eax
+            emit_call(jit_memory_grow);
+            emit8(0x83); emit8(0xC4); emit8(4);  // add esp, 4
+            break;
+
+        /* Numeric */
+        case OP_I32_CONST:
+            push_deferred(TOP_CONST, 0, insn->a);
+            break;
+        case OP_I32_EQZ:
+            if (jit.top == TOP_CONST) {
+                jit.value = jit.value == 0;
+                break;
+            }
+            if (jit.top == TOP_FLAGS) {
+                jit.value ^= 1;
+            } else {
+                flush_below();
+                if (jit.top == TOP_EAX) emit_rr(0x85, REG_EAX, REG_EAX);
+                else emit_test_mem(top_operand());
+                jit.top = TOP_FLAGS;
+                jit.value = CC_E;
+            }
+            if (!next_takes_flags(i + 1, end)) flush_top();
+            break;
+        case OP_I32_EQ: case OP_I32_NE:
+        case OP_I32_LT_S: case OP_I32_LT_U: case OP_I32_GT_S: case OP_I32_GT_U:
+        case OP_I32_LE_S: case OP_I32_LE_U: case OP_I32_GE_S: case OP_I32_GE_U:
+            emit_alu(ALU_CMP, REG_EAX, take_operands(false));
+            jit.top = TOP_FLAGS;
+            jit.value = compare_condition(op);
+            if (!next_takes_flags(i + 1, end)) flush_top();
+            break;
+        case OP_I32_CLZ:
+        case OP_I32_CTZ:
+        case OP_I32_POPCNT:
+            compile_unary_bits(op);
+            break;
+        case OP_I32_ADD: emit_alu(ALU_ADD, REG_EAX, take_operands(true)); break;
+        case OP_I32_SUB: emit_alu(ALU_SUB, REG_EAX, take_operands(false)); break;
+        case OP_I32_AND: emit_alu(ALU_AND, REG_EAX, take_operands(true)); break;
+        case OP_I32_OR:  emit_alu(ALU_OR, REG_EAX, take_operands(true)); break;
+        case OP_I32_XOR: emit_alu(ALU_XOR, REG_EAX, take_operands(true)); break;
+        case OP_I32_MUL: emit_imul(REG_EAX, take_operands(true)); break;
+        case OP_I32_DIV_S:
+        case OP_I32_DIV_U:
+        case OP_I32_REM_S:
+        case OP_I32_REM_U:
+            compile_divide(op);
+            break;
+        case OP_I32_SHL:
+        case OP_I32_SHR_S:
+        case OP_I32_SHR_U:
+        case OP_I32_ROTL:
+        case OP_I32_ROTR:
+            compile_shift(op);
+            break;
+        default:
+            // The validator let through something this compiler doesn't know
+            emit_trap(CC_ALWAYS, JIT_TRAP_UNREACHABLE);
+            live = false;
+            break;
+        }
+    }
+}
+
+/* ===== Module Cache ===== */
+typedef struct {
+    bool used;
+    uint32_t size;
+    uint32_t hash[2];
+    uint32_t function_code[WASM_MAX_FUNCTIONS];
+} jit_cached_t;
+
+static jit_cached_t jit_cache[WASM_JIT_CACHE];
+static uint32_t jit_cache_next;   // Round robin
+static bool jit_ready;
+
+static void jit_flush() {
+    memset(jit_cache, 0, sizeof(jit_cache));
+    jit_cache_next = 0;
+    jit_used = jit_stubs_end;
+    jit_overflow = false;
+}
+
+static jit_cached_t* jit_lookup() {
+    for (uint32_t i = 0; i < WASM_JIT_CACHE; i++) {
+        jit_cached_t* c = &jit_cache[i];
+        if (c->used && c->size == wasm_module.binary_size &&
+            c->hash[0] == wasm_module.hash[0] && c->hash[1] == wasm_module.hash[1]) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static int jit_compile_module(jit_cached_t** out) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool fresh = jit_used == jit_stubs_end;
+        jit_cached_t* c = &jit_cache[jit_cache_next];
+        c->used = false;
+        for (uint32_t i = 0; i < wasm_module.function_count; i++) {
+            jit_call_chain[i] = WASM_NO_FIXUP;
+        }
+        for (uint32_t i = wasm_module.import_count; i < wasm_module.function_count; i++) {
+            compile_function(i);
+        }
+        if (!jit_overflow) {
+            c->used = true;
+            c->size = wasm_module.binary_size;
+            c->hash[0] = wasm_module.hash[0];
+            c->hash[1] = wasm_module.hash[1];
+            memcpy(c->function_code, jit_function_code, sizeof(c->function_code));
+            jit_cache_next = (jit_cache_next + 1) % WASM_JIT_CACHE;
+            *out = c;
+            return WASM_OK;
+        }
+        jit_flush();
+        if (fresh) break;  // Doesn't fit even in an empty buffer
+    }
+    return wasm_fail(WASM_TOO_BIG, "compiled code doesn't fit the JIT buffer");
+}
+
+int wasm_jit_invoke(uint32_t index, uint32_t* result) {
+    if (!jit_ready) {
+        jit_emit_runtime();
+        jit_ready = true;
+    }
+    jit_cached_t* c = jit_lookup();
+    if (!c) {
+        int status = jit_compile_module(&c);
+        if (status != WASM_OK) return status;
+    }
+
+    jit_memory_size = wasm_module.memory_pages * WASM_PAGE_SIZE;
+    jit_depth = WASM_MAX_CALL_DEPTH + 1;  // The export's own frame, plus as many calls as the interpreter allows
+    jit_entry_t entry = (jit_entry_t)(void*)jit_buffer;
+    // wasm_stack[0] is the host's spare slot, as in the interpreter
+    int trap = entry(jit_buffer + c->function_code[index], wasm_stack + 1);
+    if (trap == JIT_TRAP_HOST) return WASM_TRAP;
+    if (trap != JIT_TRAP_NONE) return wasm_fail(WASM_TRAP, jit_trap_detail[trap]);
+    *result = jit_result;
+    return WASM_OK;
+}
@@ -0,0 +1,1375 @@
+#include "klib.h"
+#include "wasm.h"
+#include "wat.h"
+
+void terminal_writestring(const char* data);
+
+/* ===== Errors ===== */
+static int wat_error;              // First failure wins; later ones are usually fallout
+static const char* wat_detail = "";
+static uint32_t wat_error_line;
+static uint32_t wat_line;          // Line of the last token read
+
+static int wat_fail(int code, const char* detail) {
+    if (wat_error == WAT_OK) {
+        wat_error = code;
+        wat_detail = detail;
+        wat_error_line = wat_line;
+    }
+    return wat_error;
+}
+
+void wat_perror(int error_code) {
+    switch (error_code) {
+        case WAT_OK: terminal_writestring("Success"); return;
+        case WAT_SYNTAX: terminal_writestring("Syntax error"); break;
+        case WAT_UNKNOWN: terminal_writestring("Unknown name"); break;
+        case WAT_UNSUPPORTED: terminal_writestring("Unsupported"); break;
+        case WAT_TOO_BIG: terminal_writestring("Too big"); break;
+    }
+    char num[12];
+    itoa((int)wat_error_line, num, 10);
+    terminal_writestring(" on line ");
+    terminal_writestring(num);
+    if (wat_detail[0] != '\0') {
+        terminal_writestring(": ");
+        terminal_writestring(wat_detail);
+    }
+}
+
+/* ===== Lexer ===== */
+enum { TOK_EOF, TOK_OPEN, TOK_CLOSE, TOK_ATOM, TOK_STRING };
+
+typedef struct {
+    uint8_t type;
+    const char* text;   // Strings without their quotes, escapes left in
+    uint32_t len;
+} wat_token_t;
+
+typedef struct {
+    const char* p;
+    const char* end;
+    uint32_t line;
+} wat_lexer_t;
+
+static const char* wat_source;
+static uint32_t wat_source_size;
+static wat_lexer_t lex;
+
+static void lex_rewind() {
+    lex.p = wat_source;
+    lex.end = wat_source + wat_source_size;
+    lex.line = 1;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Whitespace, ";; line" and nested "(; block ;)" comments
+static void skip_space() {
+    while (lex.p < lex.end) {
+        char c = *lex.p;
+        bool two = lex.p + 1 < lex.end;
+        if (c == '\n') {
+            lex.line++;
+            lex.p++;
+        } else if (is_space(c)) {
+            lex.p++;
+        } else if (c == ';' && two && lex.p[1] == ';') {
+            while (lex.p < lex.end && *lex.p != '\n') lex.p++;
+        } else if (c == '(' && two && lex.p[1] == ';') {
+            uint32_t depth = 1;
+            lex.p += 2;
+            while (lex.p < lex.end && depth > 0) {
+                if (lex.p + 1 < lex.end && lex.p[0] == '(' && lex.p[1] == ';') {
+                    depth++;
+                    lex.p += 2;
+                } else if (lex.p + 1 < lex.end && lex.p[0] == ';' && lex.p[1] == ')') {
+                    depth--;
+                    lex.p += 2;
+                } else {
+                    if (*lex.p == '\n') lex.line++;
+                    lex.p++;
+                }
+            }
+            if (depth > 0) wat_fail(WAT_SYNTAX, "unterminated block comment");
+        } else {
+            break;
+        }
+    }
+}
+
+// A bad token reads as TOK_EOF after recording the error, so callers only
+// need to handle running out of input
+static wat_token_t next() {
+    skip_space();
+    wat_line = lex.line;
+    wat_token_t t = { TOK_EOF, lex.p, 0 };
+    if (lex.p >= lex.end || wat_error != WAT_OK) return t;
+
+    char c = *lex.p;
+    if (c == '(' || c == ')') {
+        t.type = c == '(' ? TOK_OPEN : TOK_CLOSE;
+        t.len = 1;
+        lex.p++;
+    } else if (c == '"') {
+        t.text = ++lex.p;
+        while (lex.p < lex.end && *lex.p != '"') {
+            if (*lex.p == '\n') break;
+            if (*lex.p == '\\' && lex.p + 1 < lex.end) lex.p++;
+            lex.p++;
+        }
+        if (lex.p >= lex.end || *lex.p != '"') {
+            wat_fail(WAT_SYNTAX, "unterminated string");
+            return t;
+        }
+        t.type = TOK_STRING;
+        t.len = lex.p - t.text;
+        lex.p++;
+    } else {
+        while (lex.p < lex.end && !is_space(*lex.p) && *lex.p != '(' && *lex.p != ')' &&
+               *lex.p != '"' && *lex.p != ';') {
+            lex.p++;
+        }
+        if (lex.p == t.text) {
+            // Only a ';' that starts no comment gets here, and it would never be consumed
+            wat_fail(WAT_SYNTAX, "unexpected ';'");
+            return t;
+        }
+        t.type = TOK_ATOM;
+        t.len = lex.p - t.text;
+    }
+    return t;
+}
+
+static wat_token_t peek() {
+    wat_lexer_t saved = lex;
+    uint32_t line = wat_line;
+    wat_token_t t = next();
+    lex = saved;
+    wat_line = line;
+    return t;
+}
+
+static bool token_is(const wat_token_t* t, const char* atom) {
+    return t->type == TOK_ATOM && strlen(atom) == t->len && strncmp(t->text, atom, t->len) == 0;
+}
+
+static bool token_starts(const wat_token_t* t, const char* prefix) {
+    uint32_t len = strlen(prefix);
+    return t->type == TOK_ATOM && t->len >= len && strncmp(t->text, prefix, len) == 0;
+}
+
+static bool is_id(const wat_token_t* t) {
+    return t->type == TOK_ATOM && t->len > 1 && t->text[0] == '$';
+}
+
+// Consumes "(keyword" if that's what comes next
+static bool accept_open(const char* keyword) {
+    wat_lexer_t saved = lex;
+    uint32_t line = wat_line;
+    wat_token_t t = next();
+    if (t.type == TOK_OPEN) {
+        t = next();
+        if (token_is(&t, keyword)) return true;
+    }
+    lex = saved;
+    wat_line = line;
+    return false;
+}
+
+// True if the next form is "(keyword"; nothing is consumed
+static bool peek_open(const char* keyword) {
+    wat_lexer_t saved = lex;
+    uint32_t line = wat_line;
+    bool found = accept_open(keyword);
+    lex = saved;
+    wat_line = line;
+    return found;
+}
+
+static int expect(uint8_t type, const char* detail) {
+    wat_token_t t = next();
+    if (t.type != type) return wat_fail(WAT_SYNTAX, detail);
+    return WAT_OK;
+}
+
+static int expect_close() {
+    return expect(TOK_CLOSE, "expected ')'");
+}
+
+// Skips the rest of a form whose '(' has been read, including its ')'
+static int skip_form() {
+    uint32_t depth = 1;
+    while (depth > 0) {
+        wat_token_t t = next();
+        if (t.type == TOK_EOF) return wat_fail(WAT_SYNTAX, "unbalanced parentheses");
+        if (t.type == TOK_OPEN) depth++;
+        if (t.type == TOK_CLOSE) depth--;
+    }
+    return WAT_OK;
+}
+
+// Optional $id
+static wat_token_t accept_id() {
+    wat_token_t t = peek();
+    if (is_id(&t)) return next();
+    t.type = TOK_EOF;
+    t.len = 0;
+    return t;
+}
+
+/* ===== Numbers and Strings ===== */
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decimal or 0x hex, '_' allowed between digits
+static bool parse_u32(const char* s, uint32_t len, uint32_t* value) {
+    uint32_t base = 10;
+    if (len > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+        len -= 2;
+    }
+    uint64_t acc = 0;
+    bool digit = false;
+    for (uint32_t i = 0; i < len; i++) {
+        if (s[i] == '_' && digit && i + 1 < len) continue;
+        int d = hex_digit(s[i]);
+        if (d < 0 || (uint32_t)d >= base) return false;
+        acc = acc * base + d;
+        if (acc > 0xFFFFFFFFu) return false;
+        digit = true;
+    }
+    *value = (uint32_t)acc;
+    return digit;
+}
+
+// Signed or unsigned; i32 constants take either, so -1 and 0xFFFFFFFF agree
+static bool parse_i32(const wat_token_t* t, uint32_t* value) {
+    if (t->type != TOK_ATOM || t->len == 0) return false;
+    const char* s = t->text;
+    uint32_t len = t->len;
+    bool negative = s[0] == '-';
+    if (s[0] == '-' || s[0] == '+') {
+        s++;
+        len--;
+    }
+    uint32_t magnitude;
+    if (!parse_u32(s, len, &magnitude)) return false;
+    if (negative && magnitude > 0x80000000u) return false;
+    *value = negative ? 0u - magnitude : magnitude;
+    return true;
+}
+
+static bool parse_index(const wat_token_t* t, uint32_t* value) {
+    return t->type == TOK_ATOM && parse_u32(t->text, t->len, value);
+}
+
+// Decodes a string token's escapes into 'out', or only measures it when 'out'
+// is NULL. Returns the decoded length, or -1 for a bad escape.
+static int32_t decode_string(const wat_token_t* t, uint8_t* out) {
+    const char* s = t->text;
+    const char* end = s + t->len;
+    int32_t n = 0;
+    while (s < end) {
+        char c = *s++;
+        if (c != '\\') {
+            if (out) out[n] = c;
+            n++;
+            continue;
+        }
+        if (s >= end) return -1;
+        char e = *s++;
+        uint32_t byte;
+        switch (e) {
+            case 'n': byte = '\n'; break;
+            case 't': byte = '\t'; break;
+            case 'r': byte = '\r'; break;
+            case '"': case '\'': case '\\': byte = e; break;
+            case 'u': {
+                // \u{hex}: the code point goes in as UTF-8
+                if (s >= end || *s++ != '{') return -1;
+                uint32_t cp = 0;
+                uint32_t digits = 0;
+                while (s < end && *s != '}') {
+                    int d = hex_digit(*s++);
+                    if (d < 0 || cp > 0x10FFFF) return -1;
+                    cp = cp * 16 + d;
+                    digits++;
+                }
+                if (s >= end || digits == 0 || cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000)) return -1;
+                s++;
+                uint8_t utf8[4];
+                uint32_t bytes;
+                if (cp < 0x80) {
+                    utf8[0] = cp;
+                    bytes = 1;
+                } else if (cp < 0x800) {
+                    utf8[0] = 0xC0 | (cp >> 6);
+                    utf8[1] = 0x80 | (cp & 0x3F);
+                    bytes = 2;
+                } else if (cp < 0x10000) {
+                    utf8[0] = 0xE0 | (cp >> 12);
+                    utf8[1] = 0x80 | ((cp >> 6) & 0x3F);
+                    utf8[2] = 0x80 | (cp & 0x3F);
+                    bytes = 3;
+                } else {
+                    utf8[0] = 0xF0 | (cp >> 18);
+                    utf8[1] = 0x80 | ((cp >> 12) & 0x3F);
+                    utf8[2] = 0x80 | ((cp >> 6) & 0x3F);
+                    utf8[3] = 0x80 | (cp & 0x3F);
+                    bytes = 4;
+                }
+                for (uint32_t i = 0; i < bytes; i++) {
+                    if (out) out[n] = utf8[i];
+                    n++;
+                }
+                continue;
+            }
+            default: {
+                // \hh
+                int hi = hex_digit(e);
+                int lo = s < end ? hex_digit(*s) : -1;
+                if (hi < 0 || lo < 0) return -1;
+                s++;
+                byte = hi * 16 + lo;
+            }
+        }
+        if (out) out[n] = byte;
+        n++;
+    }
+    return n;
+}
+
+/* ===== Output ===== */
+static uint8_t* out_buf;
+static uint32_t out_max;
+static uint32_t out_used;
+
+// NULL once the buffer is full; the assembly carries on and fails at the end
+static uint8_t* emit_space(uint32_t n) {
+    if (out_used > out_max || n > out_max - out_used) {
+        out_used = out_max + 1;
+        return NULL;
+    }
+    uint8_t* p = out_buf + out_used;
+    out_used += n;
+    return p;
+}
+
+static void emit_byte(uint8_t byte) {
+    uint8_t* p = emit_space(1);
+    if (p) *p = byte;
+}
+
+static void emit_u32(uint32_t value) {
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        emit_byte(value ? byte | 0x80 : byte);
+    } while (value);
+}
+
+static void emit_i32(uint32_t bits) {
+    int32_t value = (int32_t)bits;
+    for (;;) {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;  // Arithmetic
+        bool done = (value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40));
+        emit_byte(done ? byte : byte | 0x80);
+        if (done) return;
+    }
+}
+
+// Sizes come before what they measure, so five bytes are kept for a padded
+// LEB128 that end_size() fills in
+static uint32_t begin_size() {
+    uint32_t at = out_used;
+    for (int i = 0; i < 5; i++) emit_byte(0);
+    return at;
+}
+
+static void end_size(uint32_t at) {
+    if (out_used > out_max) return;
+    uint32_t value = out_used - at - 5;
+    for (int i = 0; i < 4; i++) {
+        out_buf[at + i] = ((value >> (7 * i)) & 0x7F) | 0x80;
+    }
+    out_buf[at + 4] = value >> 28;
+}
+
+static uint32_t begin_section(uint8_t id) {
+    emit_byte(id);
+    return begin_size();
+}
+
+static int emit_string(const wat_token_t* t) {
+    int32_t len = decode_string(t, NULL);
+    if (len < 0) return wat_fail(WAT_SYNTAX, "bad escape in string");
+    emit_u32(len);
+    uint8_t* p = emit_space(len);
+    if (p) decode_string(t, p);
+    return WAT_OK;
+}
+
+/* ===== Symbol Tables ===== */
+typedef struct {
+    const char* text;   // Including the '$'; NULL if unnamed
+    uint32_t len;
+} wat_name_t;
+
+typedef struct {
+    uint8_t params;
+    uint8_t results;
+} wat_type_t;
+
+static struct {
+    wat_type_t types[WASM_MAX_TYPES];
+    wat_name_t type_names[WASM_MAX_TYPES];
+    uint32_t type_count;
+
+    wat_name_t func_names[WASM_MAX_FUNCTIONS];
+    uint32_t func_types[WASM_MAX_FUNCTIONS];
+    wat_token_t import_module[WASM_MAX_FUNCTIONS];
+    wat_token_t import_name[WASM_MAX_FUNCTIONS];
+    uint32_t func_count;
+    uint32_t import_count;
+
+    wat_name_t global_names[WASM_MAX_GLOBALS];
+    bool global_mutable[WASM_MAX_GLOBALS];
+    uint32_t global_init[WASM_MAX_GLOBALS];
+    uint32_t global_count;
+
+    bool has_memory;
+    wat_name_t memory_name;
+    uint32_t memory_min;
+    uint32_t memory_max;
+    bool memory_has_max;
+
+    wat_token_t export_names[WASM_MAX_EXPORTS];
+    uint8_t export_kinds[WASM_MAX_EXPORTS];
+    uint32_t export_indices[WASM_MAX_EXPORTS];
+    wat_token_t export_refs[WASM_MAX_EXPORTS];  // Resolved once every name is known
+    uint32_t export_count;
+
+    bool has_start;
+    wat_token_t start_ref;
+    uint32_t start_index;
+    uint32_t data_count;
+} wat;
+
+// Per function
+static wat_name_t wat_locals[WASM_MAX_LOCALS];
+static uint32_t wat_local_count;
+
+static wat_name_t name_of(const wat_token_t* id) {
+    wat_name_t name = { NULL, 0 };
+    if (id->type == TOK_ATOM && id->len > 0) {
+        name.text = id->text;
+        name.len = id->len;
+    }
+    return name;
+}
+
+// An $id looked up in 'names', or a plain index below 'count'
+static int resolve(const wat_token_t* t, const wat_name_t* names, uint32_t count, uint32_t* index) {
+    if (is_id(t)) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (names[i].text && names[i].len == t->len && strncmp(names[i].text, t->text, t->len) == 0) {
+                *index = i;
+                return WAT_OK;
+            }
+        }
+        return wat_fail(WAT_UNKNOWN, "unknown identifier");
+    }
+    if (!parse_index(t, index)) return wat_fail(WAT_SYNTAX, "expected an identifier or index");
+    if (*index >= count) return wat_fail(WAT_UNKNOWN, "index out of range");
+    return WAT_OK;
+}
+
+static int add_type(wat_type_t type, wat_token_t id, uint32_t* index) {
+    if (wat.type_count >= WASM_MAX_TYPES) return wat_fail(WAT_TOO_BIG, "too many types");
+    wat.types[wat.type_count] = type;
+    wat.type_names[wat.type_count] = name_of(&id);
+    *index = wat.type_count++;
+    return WAT_OK;
+}
+
+// Inline signatures share the first matching (type), as the spec asks
+static int find_or_add_type(wat_type_t type, uint32_t* index) {
+    for (uint32_t i = 0; i < wat.type_count; i++) {
+        if (wat.types[i].params == type.params && wat.types[i].results == type.results) {
+            *index = i;
+            return WAT_OK;
+        }
+    }
+    wat_token_t none = { TOK_EOF, NULL, 0 };
+    return add_type(type, none, index);
+}
+
+/* ===== Types and Signatures ===== */
+// Value types up to the ')' of a param, result or local list, which is consumed
+static int parse_value_types(uint32_t* count, uint32_t limit, bool named, wat_name_t* names) {
+    wat_token_t id = accept_id();
+    if (id.len > 0 && !named) return wat_fail(WAT_SYNTAX, "unexpected identifier");
+    uint32_t types = 0;
+    for (;;) {
+        wat_token_t t = next();
+        if (t.type == TOK_CLOSE) break;
+        if (t.type != TOK_ATOM) return wat_fail(WAT_SYNTAX, "expected a value type");
+        if (!token_is(&t, "i32")) {
+            if (token_is(&t, "i64") || token_is(&t, "f32") || token_is(&t, "f64") ||
+                token_is(&t, "v128") || token_is(&t, "funcref") || token_is(&t, "externref")) {
+                return wat_fail(WAT_UNSUPPORTED, "only i32 values are supported");
+            }
+            return wat_fail(WAT_SYNTAX, "expected a value type");
+        }
+        if (*count >= limit) return wat_fail(WAT_TOO_BIG, "too many values");
+        if (names) names[*count] = name_of(&id);
+        (*count)++;
+        types++;
+    }
+    if (id.len > 0 && types != 1) return wat_fail(WAT_SYNTAX, "a named value has exactly one type");
+    return WAT_OK;
+}
+
+/*
+ * (type $t)? (param ...)* (result ...)*, as in a function or import. Parameter
+ * names go to wat_locals when 'names' is set. Declarations (types_fixed false)
+ * may add a type for an inline signature; the code pass finds the same one.
+ */
+static int parse_typeuse(uint32_t* type_index, bool names) {
+    bool has_index = false;
+    uint32_t index = 0;
+    if (accept_open("type")) {
+        wat_token_t t = next();
+        if (resolve(&t, wat.type_names, wat.type_count, &index) != WAT_OK) return wat_error;
+        if (expect_close() != WAT_OK) return wat_error;
+        has_index = true;
+    }
+
+    uint32_t params = 0;
+    uint32_t results = 0;
+    bool has_inline = false;
+    while (accept_open("param")) {
+        if (parse_value_types(&params, 255, true, names ? wat_locals : NULL) != WAT_OK) return wat_error;
+        has_inline = true;
+    }
+    while (accept_open("result")) {
+        if (parse_value_types(&results, 255, false, NULL) != WAT_OK) return wat_error;
+        has_inline = true;
+    }
+    if (results > 1) return wat_fail(WAT_UNSUPPORTED, "more than one result");
+
+    wat_type_t type = { params, results };
+    if (has_index) {
+        if (has_inline && (wat.types[index].params != params || wat.types[index].results != results)) {
+            return wat_fail(WAT_SYNTAX, "signature doesn't match its (type)");
+        }
+        if (names && !has_inline) {
+            for (uint32_t i = 0; i < wat.types[index].params; i++) wat_locals[i] = (wat_name_t){ NULL, 0 };
+        }
+        *type_index = index;
+        return WAT_OK;
+    }
+    return find_or_add_type(type, type_index);
+}
+
+/* ===== Module Fields ===== */
+// Positions the lexer on the first field, past "(module $name?" if the
+// fields are wrapped in one
+static bool begin_fields() {
+    lex_rewind();
+    if (accept_open("module")) {
+        accept_id();
+        return true;
+    }
+    return false;
+}
+
+// Reads the "(keyword" of the next field; TOK_EOF after the last one
+static int next_field(bool wrapped, wat_token_t* keyword) {
+    wat_token_t t = next();
+    keyword->type = TOK_EOF;
+    if (wrapped && t.type == TOK_CLOSE) {
+        if (next().type != TOK_EOF) return wat_fail(WAT_SYNTAX, "text after the module");
+        return WAT_OK;
+    }
+    if (t.type == TOK_EOF) {
+        if (wrapped) return wat_fail(WAT_SYNTAX, "module is missing its ')'");
+        return wat_error;
+    }
+    if (t.type != TOK_OPEN) return wat_fail(WAT_SYNTAX, "expected a module field");
+    *keyword = next();
+    if (keyword->type != TOK_ATOM) return wat_fail(WAT_SYNTAX, "expected a module field");
+    return WAT_OK;
+}
+
+static int add_export(const wat_token_t* name, uint8_t kind, const wat_token_t* ref, uint32_t index) {
+    if (wat.export_count >= WASM_MAX_EXPORTS) return wat_fail(WAT_TOO_BIG, "too many exports");
+    uint32_t e = wat.export_count++;
+    wat.export_names[e] = *name;
+    wat.export_kinds[e] = kind;
+    wat.export_indices[e] = index;
+    if (ref) wat.export_refs[e] = *ref;
+    else wat.export_refs[e].type = TOK_EOF;
+    return WAT_OK;
+}
+
+// (export "name")* inside a func, memory or global, exporting item 'index'
+static int parse_inline_exports(uint8_t kind, uint32_t index) {
+    while (accept_open("export")) {
+        wat_token_t name = next();
+        if (name.type != TOK_STRING) return wat_fail(WAT_SYNTAX, "expected an export name");
+        if (add_export(&name, kind, NULL, index) != WAT_OK) return wat_error;
+        if (expect_close() != WAT_OK) return wat_error;
+    }
+    return WAT_OK;
+}
+
+// "module" "name", then the import's own form is up to the caller
+static int parse_import_names(wat_token_t* module, wat_token_t* name) {
+    *module = next();
+    *name = next();
+    if (module->type != TOK_STRING || name->type != TOK_STRING) {
+        return wat_fail(WAT_SYNTAX, "expected the import's module and name");
+    }
+    if (wat.func_count > wat.import_count) {
+        return wat_fail(WAT_UNSUPPORTED, "imports must come before function definitions");
+    }
+    return WAT_OK;
+}
+
+static int add_function(const wat_token_t* id, bool import, const wat_token_t* module, const wat_token_t* name) {
+    if (wat.func_count >= WASM_MAX_FUNCTIONS) return wat_fail(WAT_TOO_BIG, "too many functions");
+    uint32_t f = wat.func_count;
+    wat.func_names[f] = name_of(id);
+    if (import) {
+        wat.import_module[f] = *module;
+        wat.import_name[f] = *name;
+        wat.import_count++;
+    }
+    if (parse_typeuse(&wat.func_types[f], false) != WAT_OK) return wat_error;
+    wat.func_count++;
+    return WAT_OK;
+}
+
+static int parse_import() {
+    wat_token_t module, name;
+    if (parse_import_names(&module, &name) != WAT_OK) return wat_error;
+    if (!accept_open("func")) return wat_fail(WAT_UNSUPPORTED, "only functions can be imported");
+    wat_token_t id = accept_id();
+    if (add_function(&id, true, &module, &name) != WAT_OK) return wat_error;
+    if (expect_close() != WAT_OK) return wat_error;
+    return expect_close();
+}
+
+static int parse_func_decl() {
+    wat_token_t id = accept_id();
+    if (parse_inline_exports(0, wat.func_count) != WAT_OK) return wat_error;
+    if (accept_open("import")) {
+        wat_token_t module, name;
+        if (parse_import_names(&module, &name) != WAT_OK) return wat_error;
+        if (expect_close() != WAT_OK) return wat_error;
+        if (add_function(&id, true, &module, &name) != WAT_OK) return wat_error;
+        return expect_close();
+    }
+    if (add_function(&id, false, NULL, NULL) != WAT_OK) return wat_error;
+    return skip_form();  // The body is the code pass's business
+}
+
+static int parse_memory() {
+    if (wat.has_memory) return wat_fail(WAT_UNSUPPORTED, "more than one memory");
+    wat_token_t id = accept_id();
+    wat.memory_name = name_of(&id);
+    if (parse_inline_exports(2, 0) != WAT_OK) return wat_error;
+    if (peek_open("import")) return wat_fail(WAT_UNSUPPORTED, "imported memory");
+    if (peek_open("data")) return wat_fail(WAT_UNSUPPORTED, "inline data; use a data field");
+    wat_token_t t = next();
+    if (!parse_index(&t, &wat.memory_min)) return wat_fail(WAT_SYNTAX, "expected the memory's size in pages");
+    t = peek();
+    wat.memory_has_max = t.type == TOK_ATOM;
+    if (wat.memory_has_max) {
+        next();
+        if (!parse_index(&t, &wat.memory_max)) return wat_fail(WAT_SYNTAX, "expected the memory's maximum");
+        if (wat.memory_max < wat.memory_min) return wat_fail(WAT_SYNTAX, "memory maximum below its minimum");
+    }
+    wat.has_memory = true;
+    return expect_close();
+}
+
+static int parse_global() {
+    if (wat.global_count >= WASM_MAX_GLOBALS) return wat_fail(WAT_TOO_BIG, "too many globals");
+    uint32_t g = wat.global_count;
+    wat_token_t id = accept_id();
+    wat.global_names[g] = name_of(&id);
+    if (parse_inline_exports(3, g) != WAT_OK) return wat_error;
+    if (peek_open("import")) return wat_fail(WAT_UNSUPPORTED, "only functions can be imported");
+
+    uint32_t count = 0;
+    wat.global_mutable[g] = accept_open("mut");
+    if (wat.global_mutable[g]) {
+        if (parse_value_types(&count, 1, false, NULL) != WAT_OK) return wat_error;
+    } else {
+        wat_token_t t = next();
+        if (token_is(&t, "i32")) count = 1;
+        else if (t.type == TOK_ATOM && t.len == 3 && (t.text[0] == 'i' || t.text[0] == 'f')) {
+            return wat_fail(WAT_UNSUPPORTED, "only i32 values are supported");
+        }
+    }
+    if (count != 1) return wat_fail(WAT_SYNTAX, "expected the global's type");
+
+    if (!accept_open("i32.const")) return wat_fail(WAT_UNSUPPORTED, "global initializer other than i32.const");
+    wat_token_t value = next();
+    if (!parse_i32(&value, &wat.global_init[g])) return wat_fail(WAT_SYNTAX, "expected an i32 constant");
+    if (expect_close() != WAT_OK) return wat_error;
+    wat.global_count++;
+    return expect_close();
+}
+
+static int parse_export() {
+    wat_token_t name = next();
+    if (name.type != TOK_STRING) return wat_fail(WAT_SYNTAX, "expected an export name");
+    uint8_t kind;
+    if (accept_open("func")) kind = 0;
+    else if (accept_open("memory")) kind = 2;
+    else if (accept_open("global")) kind = 3;
+    else if (accept_open("table")) return wat_fail(WAT_UNSUPPORTED, "tables");
+    else return wat_fail(WAT_SYNTAX, "expected func, memory or global");
+    wat_token_t ref = next();
+    if (ref.type != TOK_ATOM) return wat_fail(WAT_SYNTAX, "expected what to export");
+    if (add_export(&name, kind, &ref, 0) != WAT_OK) return wat_error;
+    if (expect_close() != WAT_OK) return wat_error;
+    return expect_close();
+}
+
+// Export and start fields may name things declared after them
+static int resolve_references() {
+    for (uint32_t e = 0; e < wat.export_count; e++) {
+        const wat_token_t* ref = &wat.export_refs[e];
+        if (ref->type == TOK_EOF) continue;
+        uint32_t* index = &wat.export_indices[e];
+        if (wat.export_kinds[e] == 0) {
+            if (resolve(ref, wat.func_names, wat.func_count, index) != WAT_OK) return wat_error;
+        } else if (wat.export_kinds[e] == 3) {
+            if (resolve(ref, wat.global_names, wat.global_count, index) != WAT_OK) return wat_error;
+        } else {
+            if (!wat.has_memory) return wat_fail(WAT_UNKNOWN, "export of a missing memory");
+            if (resolve(ref, &wat.memory_name, 1, index) != WAT_OK) return wat_error;
+        }
+    }
+    if (wat.has_start) {
+        if (resolve(&wat.start_ref, wat.func_names, wat.func_count, &wat.start_index) != WAT_OK) return wat_error;
+    }
+    return WAT_OK;
+}
+
+static int declare_types() {
+    bool wrapped = begin_fields();
+    for (;;) {
+        wat_token_t keyword;
+        if (next_field(wrapped, &keyword) != WAT_OK) return wat_error;
+        if (keyword.type == TOK_EOF) return WAT_OK;
+        if (!token_is(&keyword, "type")) {
+            if (skip_form() != WAT_OK) return wat_error;
+            continue;
+        }
+        wat_token_t id = accept_id();
+        if (!accept_open("func")) return wat_fail(WAT_SYNTAX, "expected (func ...)");
+        wat_type_t type = { 0, 0 };
+        uint32_t params = 0, results = 0, index;
+        while (accept_open("param")) {
+            if (parse_value_types(&params, 255, true, NULL) != WAT_OK) return wat_error;
+        }
+        while (accept_open("result")) {
+            if (parse_value_types(&results, 255, false, NULL) != WAT_OK) return wat_error;
+        }
+        if (results > 1) return wat_fail(WAT_UNSUPPORTED, "more than one result");
+        type.params = params;
+        type.results = results;
+        if (add_type(type, id, &index) != WAT_OK) return wat_error;
+        if (expect_close() != WAT_OK || expect_close() != WAT_OK) return wat_error;
+    }
+}
+
+static int declare_fields() {
+    bool wrapped = begin_fields();
+    for (;;) {
+        wat_token_t keyword;
+        if (next_field(wrapped, &keyword) != WAT_OK) return wat_error;
+        if (keyword.type == TOK_EOF) break;
+
+        int result;
+        if (token_is(&keyword, "import")) result = parse_import();
+        else if (token_is(&keyword, "func")) result = parse_func_decl();
+        else if (token_is(&keyword, "memory")) result = parse_memory();
+        else if (token_is(&keyword, "global")) result = parse_global();
+        else if (token_is(&keyword, "export")) result = parse_export();
+        else if (token_is(&keyword, "type")) result = skip_form();
+        else if (token_is(&keyword, "data")) {
+            wat.data_count++;
+            result = skip_form();
+        } else if (token_is(&keyword, "start")) {
+            if (wat.has_start) return wat_fail(WAT_SYNTAX, "more than one start function");
+            wat.has_start = true;
+            wat.start_ref = next();
+            result = expect_close();
+        } else if (token_is(&keyword, "table") || token_is(&keyword, "elem")) {
+            return wat_fail(WAT_UNSUPPORTED, "tables");
+        } else {
+            return wat_fail(WAT_SYNTAX, "unknown module field");
+        }
+        if (result != WAT_OK) return wat_error;
+    }
+    return resolve_references();
+}
+
+static void emit_declarations() {
+    if (wat.type_count > 0) {
+        uint32_t at = begin_section(1);
+        emit_u32(wat.type_count);
+        for (uint32_t i = 0; i < wat.type_count; i++) {
+            emit_byte(0x60);
+            emit_u32(wat.types[i].params);
+            for (uint32_t p = 0; p < wat.types[i].params; p++) emit_byte(0x7F);
+            emit_u32(wat.types[i].results);
+            for (uint32_t r = 0; r < wat.types[i].results; r++) emit_byte(0x7F);
+        }
+        end_size(at);
+    }
+    if (wat.import_count > 0) {
+        // Imports are numbered first, so they're the first functions declared
+        uint32_t at = begin_section(2);
+        emit_u32(wat.import_count);
+        for (uint32_t f = 0; f < wat.import_count; f++) {
+            emit_string(&wat.import_module[f]);
+            emit_string(&wat.import_name[f]);
+            emit_byte(0x00);
+            emit_u32(wat.func_types[f]);
+        }
+        end_size(at);
+    }
+    if (wat.func_count > wat.import_count) {
+        uint32_t at = begin_section(3);
+        emit_u32(wat.func_count - wat.import_count);
+        for (uint32_t f = wat.import_count; f < wat.func_count; f++) emit_u32(wat.func_types[f]);
+        end_size(at);
+    }
+    if (wat.has_memory) {
+        uint32_t at = begin_section(5);
+        emit_u32(1);
+        emit_byte(wat.memory_has_max ? 1 : 0);
+        emit_u32(wat.memory_min);
+        if (wat.memory_has_max) emit_u32(wat.memory_max);
+        end_size(at);
+    }
+    if (wat.global_count > 0) {
+        uint32_t at = begin_section(6);
+        emit_u32(wat.global_count);
+        for (uint32_t g = 0; g < wat.global_count; g++) {
+            emit_byte(0x7F);
+            emit_byte(wat.global_mutable[g] ? 1 : 0);
+            emit_byte(0x41);
+            emit_i32(wat.global_init[g]);
+            emit_byte(0x0B);
+        }
+        end_size(at);
+    }
+    if (wat.export_count > 0) {
+        uint32_t at = begin_section(7);
+        emit_u32(wat.export_count);
+        for (uint32_t e = 0; e < wat.export_count; e++) {
+            emit_string(&wat.export_names[e]);
+            emit_byte(wat.export_kinds[e]);
+            emit_u32(wat.export_indices[e]);
+        }
+        end_size(at);
+    }
+    if (wat.has_start) {
+        uint32_t at = begin_section(8);
+        emit_u32(wat.start_index);
+        end_size(at);
+    }
+}
+
+/* ===== Instructions ===== */
+enum {
+    IMM_NONE,
+    IMM_BLOCK,     // block, loop, if: label and block type
+    IMM_LABEL,
+    IMM_LABELS,    // br_table
+    IMM_FUNC,
+    IMM_LOCAL,
+    IMM_GLOBAL,
+    IMM_MEMARG,
+    IMM_MEMORY,    // Memory index, always 0
+    IMM_I32,
+    IMM_ELSE,
+    IMM_END,
+};
+
+typedef struct {
+    const char* name;
+    uint8_t opcode;
+    uint8_t immediate;
+} wat_instr_t;
+
+static const wat_instr_t wat_instrs[] = {
+    {"unreachable", 0x00, IMM_NONE}, {"nop", 0x01, IMM_NONE},
+    {"block", 0x02, IMM_BLOCK}, {"loop", 0x03, IMM_BLOCK}, {"if", 0x04, IMM_BLOCK},
+    {"else", 0x05, IMM_ELSE}, {"end", 0x0B, IMM_END},
+    {"br", 0x0C, IMM_LABEL}, {"br_if", 0x0D, IMM_LABEL}, {"br_table", 0x0E, IMM_LABELS},
+    {"return", 0x0F, IMM_NONE}, {"call", 0x10, IMM_FUNC},
+    {"drop", 0x1A, IMM_NONE}, {"select", 0x1B, IMM_NONE},
+    {"local.get", 0x20, IMM_LOCAL}, {"local.set", 0x21, IMM_LOCAL}, {"local.tee", 0x22, IMM_LOCAL},
+    {"global.get", 0x23, IMM_GLOBAL}, {"global.set", 0x24, IMM_GLOBAL},
+    {"i32.load", 0x28, IMM_MEMARG}, {"i32.load8_s", 0x2C, IMM_MEMARG}, {"i32.load8_u", 0x2D, IMM_MEMARG},
+    {"i32.load16_s", 0x2E, IMM_MEMARG}, {"i32.load16_u", 0x2F, IMM_MEMARG},
+    {"i32.store", 0x36, IMM_MEMARG}, {"i32.store8", 0x3A, IMM_MEMARG}, {"i32.store16", 0x3B, IMM_MEMARG},
+    {"memory.size", 0x3F, IMM_MEMORY}, {"memory.grow", 0x40, IMM_MEMORY},
+    {"i32.const", 0x41, IMM_I32},
+    {"i32.eqz", 0x45, IMM_NONE}, {"i32.eq", 0x46, IMM_NONE}, {"i32.ne", 0x47, IMM_NONE},
+    {"i32.lt_s", 0x48, IMM_NONE}, {"i32.lt_u", 0x49, IMM_NONE}, {"i32.gt_s", 0x4A, IMM_NONE},
+    {"i32.gt_u", 0x4B, IMM_NONE}, {"i32.le_s", 0x4C, IMM_NONE}, {"i32.le_u", 0x4D, IMM_NONE},
+    {"i32.ge_s", 0x4E, IMM_NONE}, {"i32.ge_u", 0x4F, IMM_NONE},
+    {"i32.clz", 0x67, IMM_NONE}, {"i32.ctz", 0x68, IMM_NONE}, {"i32.popcnt", 0x69, IMM_NONE},
+    {"i32.add", 0x6A, IMM_NONE}, {"i32.sub", 0x6B, IMM_NONE}, {"i32.mul", 0x6C, IMM_NONE},
+    {"i32.div_s", 0x6D, IMM_NONE}, {"i32.div_u", 0x6E, IMM_NONE},
+    {"i32.rem_s", 0x6F, IMM_NONE}, {"i32.rem_u", 0x70, IMM_NONE},
+    {"i32.and", 0x71, IMM_NONE}, {"i32.or", 0x72, IMM_NONE}, {"i32.xor", 0x73, IMM_NONE},
+    {"i32.shl", 0x74, IMM_NONE}, {"i32.shr_s", 0x75, IMM_NONE}, {"i32.shr_u", 0x76, IMM_NONE},
+    {"i32.rotl", 0x77, IMM_NONE}, {"i32.rotr", 0x78, IMM_NONE},
+};
+
+// Labels of the blocks open in the current function, innermost last
+static struct {
+    wat_name_t name;
+    uint8_t kind;
+    bool folded;     // Closed by its ')', not by end
+    bool in_else;
+} wat_labels[WASM_MAX_NESTING];
+static uint32_t wat_label_count;
+
+static int lookup_instr(const wat_token_t* t, const wat_instr_t** instr) {
+    if (t->type != TOK_ATOM) return wat_fail(WAT_SYNTAX, "expected an instruction");
+    for (size_t i = 0; i < sizeof(wat_instrs) / sizeof(wat_instrs[0]); i++) {
+        if (token_is(t, wat_instrs[i].name)) {
+            *instr = &wat_instrs[i];
+            return WAT_OK;
+        }
+    }
+    if (token_starts(t, "i64.") || token_starts(t, "f32.") || token_starts(t, "f64.") ||
+        token_starts(t, "v128.") || token_starts(t, "table.") || token_starts(t, "ref.") ||
+        token_starts(t, "call_indirect") || token_starts(t, "memory.")) {
+        return wat_fail(WAT_UNSUPPORTED, "instruction the runtime doesn't support");
+    }
+    return wat_fail(WAT_UNKNOWN, "unknown instruction");
+}
+
+static int push_label(const wat_token_t* id, uint8_t kind, bool folded) {
+    if (wat_label_count >= WASM_MAX_NESTING) return wat_fail(WAT_TOO_BIG, "blocks nested too deeply");
+    wat_labels[wat_label_count].name = name_of(id);
+    wat_labels[wat_label_count].kind = kind;
+    wat_labels[wat_label_count].folded = folded;
+    wat_labels[wat_label_count].in_else = false;
+    wat_label_count++;
+    return WAT_OK;
+}
+
+// Branch depth of a $label, or a plain depth; the loader checks the range
+static int emit_label(const wat_token_t* t) {
+    if (is_id(t)) {
+        for (uint32_t i = wat_label_count; i-- > 0;) {
+            const wat_name_t* name = &wat_labels[i].name;
+            if (name->text && name->len == t->len && strncmp(name->text, t->text, t->len) == 0) {
+                emit_u32(wat_label_count - 1 - i);
+                return WAT_OK;
+            }
+        }
+        return wat_fail(WAT_UNKNOWN, "unknown label");
+    }
+    uint32_t depth;
+    if (!parse_index(t, &depth)) return wat_fail(WAT_SYNTAX, "expected a label");
+    emit_u32(depth);
+    return WAT_OK;
+}
+
+static bool is_label(const wat_token_t* t) {
+    return is_id(t) || (t->type == TOK_ATOM && t->text[0] >= '0' && t->text[0] <= '9');
+}
+
+// Label and block type of block, loop and if: $label? (result i32)?
+static int parse_block_header(uint8_t opcode, bool folded) {
+    wat_token_t id = accept_id();
+    if (peek_open("param") || peek_open("type")) return wat_fail(WAT_UNSUPPORTED, "block with parameters");
+    uint32_t results = 0;
+    while (accept_open("result")) {
+        if (parse_value_types(&results, 255, false, NULL) != WAT_OK) return wat_error;
+    }
+    if (results > 1) return wat_fail(WAT_UNSUPPORTED, "block with more than one result");
+    if (opcode != 0x04) {
+        // if is emitted after its folded condition, by the caller
+        emit_byte(opcode);
+        emit_byte(results ? 0x7F : 0x40);
+    }
+    if (push_label(&id, opcode, folded) != WAT_OK) return wat_error;
+    return results ? 0x7F : 0x40;
+}
+
+// Immediates of a plain instruction whose keyword has been read
+static int parse_immediates(const wat_instr_t* instr) {
+    wat_token_t t;
+    uint32_t value;
+    switch (instr->immediate) {
+        case IMM_NONE:
+            emit_byte(instr->opcode);
+            break;
+        case IMM_LABEL:
+            emit_byte(instr->opcode);
+            t = next();
+            return emit_label(&t);
+        case IMM_LABELS: {
+            // The count comes first, so count the labels and then go back
+            wat_lexer_t start = lex;
+            uint32_t count = 0;
+            for (t = peek(); is_label(&t); t = peek()) {
+                next();
+                count++;
+            }
+            if (count == 0) return wat_fail(WAT_SYNTAX, "br_table needs a default label");
+            lex = start;
+            emit_byte(instr->opcode);
+            emit_u32(count - 1);
+            for (uint32_t i = 0; i < count; i++) {
+                t = next();
+                if (emit_label(&t) != WAT_OK) return wat_error;
+            }
+            break;
+        }
+        case IMM_FUNC:
+            t = next();
+            if (resolve(&t, wat.func_names, wat.func_count, &value) != WAT_OK) return wat_error;
+            emit_byte(instr->opcode);
+            emit_u32(value);
+            break;
+        case IMM_LOCAL:
+            t = next();
+            if (resolve(&t, wat_locals, wat_local_count, &value) != WAT_OK) return wat_error;
+            emit_byte(instr->opcode);
+            emit_u32(value);
+            break;
+        case IMM_GLOBAL:
+            t = next();
+            if (resolve(&t, wat.global_names, wat.global_count, &value) != WAT_OK) return wat_error;
+            emit_byte(instr->opcode);
+            emit_u32(value);
+            break;
+        case IMM_MEMARG: {
+            // offset=N align=N, both optional; alignment defaults to the access size
+            uint8_t op = instr->opcode;
+            uint32_t natural = (op == 0x28 || op == 0x36) ? 4 : (op == 0x2E || op == 0x2F || op == 0x3B) ? 2 : 1;
+            uint32_t offset = 0;
+            uint32_t align = natural;
+            t = peek();
+            if (token_starts(&t, "offset=")) {
+                next();
+                if (!parse_u32(t.text + 7, t.len - 7, &offset)) return wat_fail(WAT_SYNTAX, "bad offset");
+                t = peek();
+            }
+            if (token_starts(&t, "align=")) {
+                next();
+                if (!parse_u32(t.text + 6, t.len - 6, &align) || align == 0 || (align & (align - 1))) {
+                    return wat_fail(WAT_SYNTAX, "alignment must be a power of two");
+                }
+            }
+            uint32_t log2 = 0;
+            while ((1u << log2) < align) log2++;
+            emit_byte(op);
+            emit_u32(log2);
+            emit_u32(offset);
+            break;
+        }
+        case IMM_MEMORY:
+            t = peek();
+            if (t.type == TOK_ATOM && (is_id(&t) || parse_index(&t, &value))) {
+                next();
+                if (resolve(&t, &wat.memory_name, wat.has_memory ? 1 : 0, &value) != WAT_OK) return wat_error;
+            }
+            emit_byte(instr->opcode);
+            emit_byte(0x00);
+            break;
+        case IMM_I32:
+            t = next();
+            if (!parse_i32(&t, &value)) return wat_fail(WAT_SYNTAX, "expected an i32 constant");
+            emit_byte(instr->opcode);
+            emit_i32(value);
+            break;
+    }
+    return WAT_OK;
+}
+
+// Optional label repeated after else or end; it has to match the block's
+static int check_trailing_label(uint32_t label) {
+    wat_token_t id = accept_id();
+    if (id.len == 0) return WAT_OK;
+    const wat_name_t* name = &wat_labels[label].name;
+    if (!name->text || name->len != id.len || strncmp(name->text, id.text, id.len) != 0) {
+        return wat_fail(WAT_SYNTAX, "label doesn't match its block");
+    }
+    return WAT_OK;
+}
+
+// Flat syntax: one instruction whose keyword has been read
+static int parse_plain(const wat_token_t* keyword) {
+    const wat_instr_t* instr;
+    if (lookup_instr(keyword, &instr) != WAT_OK) return wat_error;
+
+    if (instr->immediate == IMM_BLOCK) {
+        int type = parse_block_header(instr->opcode, false);
+        if (type < 0) return type;
+        if (instr->opcode == 0x04) {
+            emit_byte(0x04);
+            emit_byte(type);
+        }
+        return WAT_OK;
+    }
+    if (instr->immediate == IMM_ELSE || instr->immediate == IMM_END) {
+        if (wat_label_count == 0 || wat_labels[wat_label_count - 1].folded) {
+            return wat_fail(WAT_SYNTAX, instr->opcode == 0x05 ? "else outside an if" : "end without a block");
+        }
+        uint32_t label = wat_label_count - 1;
+        if (instr->opcode == 0x05) {
+            if (wat_labels[label].kind != 0x04 || wat_labels[label].in_else) {
+                return wat_fail(WAT_SYNTAX, "else outside an if");
+            }
+            wat_labels[label].in_else = true;
+        } else {
+            wat_label_count--;
+        }
+        emit_byte(instr->opcode);
+        return check_trailing_label(label);
+    }
+    return parse_immediates(instr);
+}
+
+static int parse_instrs();
+
+// Folded syntax: "(op immediates (operand)...)" with the '(' read. The
+// operands are emitted first, then the lexer goes back for the instruction.
+static int parse_folded() {
+    wat_token_t keyword = next();
+    const wat_instr_t* instr;
+    if (lookup_instr(&keyword, &instr) != WAT_OK) return wat_error;
+
+    switch (instr->immediate) {
+        case IMM_BLOCK: {
+            int type = parse_block_header(instr->opcode, true);
+            if (type < 0) return type;
+            if (instr->opcode == 0x04) {
+                // (if label? type? (condition)... (then ...) (else ...)?)
+                while (peek().type == TOK_OPEN && !peek_open("then")) {
+                    next();
+                    if (parse_folded() != WAT_OK) return wat_error;
+                }
+                if (!accept_open("then")) return wat_fail(WAT_SYNTAX, "if needs a (then ...)");
+                emit_byte(0x04);
+                emit_byte(type);
+                if (parse_instrs() != WAT_OK || expect_close() != WAT_OK) return wat_error;
+                if (accept_open("else")) {
+                    emit_byte(0x05);
+                    if (parse_instrs() != WAT_OK || expect_close() != WAT_OK) return wat_error;
+                }
+            } else if (parse_instrs() != WAT_OK) {
+                return wat_error;
+            }
+            if (!wat_labels[wat_label_count - 1].folded) return wat_fail(WAT_SYNTAX, "block without an end");
+            wat_label_count--;
+            emit_byte(0x0B);
+            return expect_close();
+        }
+        case IMM_ELSE:
+        case IMM_END:
+            return wat_fail(WAT_SYNTAX, "else or end in a folded instruction");
+        default: {
+            wat_lexer_t immediates = lex;
+            while (peek().type == TOK_ATOM) next();
+            while (peek().type == TOK_OPEN) {
+                next();
+                if (parse_folded() != WAT_OK) return wat_error;
+            }
+            if (expect_close() != WAT_OK) return wat_error;
+            wat_lexer_t after = lex;
+            lex = immediates;
+            if (parse_immediates(instr) != WAT_OK) return wat_error;
+            if (peek().type != TOK_OPEN && peek().type != TOK_CLOSE) {
+                return wat_fail(WAT_SYNTAX, "too many immediates");
+            }
+            lex = after;
+            return WAT_OK;
+        }
+    }
+}
+
+// Instructions up to the ')' that closes the enclosing form, not consumed
+static int parse_instrs() {
+    for (;;) {
+        wat_token_t t = peek();
+        if (t.type == TOK_CLOSE || t.type == TOK_EOF) return wat_error;
+        next();
+        int result;
+        if (t.type == TOK_OPEN) result = parse_folded();
+        else if (t.type == TOK_ATOM) result = parse_plain(&t);
+        else result = wat_fail(WAT_SYNTAX, "expected an instruction");
+        if (result != WAT_OK) return wat_error;
+    }
+}
+
+/* ===== Code and Data ===== */
+// A defined function, from just after its (export ...)s
+static int emit_body() {
+    uint32_t type;
+    if (parse_typeuse(&type, true) != WAT_OK) return wat_error;
+    wat_local_count = wat.types[type].params;
+    while (accept_open("local")) {
+        if (parse_value_types(&wat_local_count, WASM_MAX_LOCALS, true, wat_locals) != WAT_OK) return wat_error;
+    }
+
+    uint32_t at = begin_size();
+    uint32_t locals = wat_local_count - wat.types[type].params;
+    if (locals > 0) {
+        emit_u32(1);
+        emit_u32(locals);
+        emit_byte(0x7F);
+    } else {
+        emit_u32(0);
+    }
+    wat_label_count = 0;
+    if (parse_instrs() != WAT_OK) return wat_error;
+    if (wat_label_count > 0) return wat_fail(WAT_SYNTAX, "block without an end");
+    emit_byte(0x0B);
+    end_size(at);
+    return expect_close();
+}
+
+static int emit_code() {
+    if (wat.func_count == wat.import_count) return WAT_OK;
+    uint32_t section = begin_section(10);
+    emit_u32(wat.func_count - wat.import_count);
+    bool wrapped = begin_fields();
+    for (;;) {
+        wat_token_t keyword;
+        if (next_field(wrapped, &keyword) != WAT_OK) return wat_error;
+        if (keyword.type == TOK_EOF) break;
+        if (!token_is(&keyword, "func")) {
+            if (skip_form() != WAT_OK) return wat_error;
+            continue;
+        }
+        accept_id();
+        while (accept_open("export")) {
+            if (skip_form() != WAT_OK) return wat_error;
+        }
+        if (accept_open("import")) {
+            if (skip_form() != WAT_OK || skip_form() != WAT_OK) return wat_error;
+            continue;
+        }
+        if (emit_body() != WAT_OK) return wat_error;
+    }
+    end_size(section);
+    return WAT_OK;
+}
+
+// (data $id? (memory 0)? (i32.const N)|(offset (i32.const N)) "bytes"...)
+static int emit_data_segment() {
+    accept_id();
+    if (accept_open("memory")) {
+        wat_token_t t = next();
+        uint32_t index;
+        if (resolve(&t, &wat.memory_name, wat.has_memory ? 1 : 0, &index) != WAT_OK) return wat_error;
+        if (expect_close() != WAT_OK) return wat_error;
+    }
+    bool wrapped = accept_open("offset");
+    if (!accept_open("i32.const")) {
+        if (peek().type == TOK_STRING || peek().type == TOK_CLOSE) {
+            return wat_fail(WAT_UNSUPPORTED, "passive data segment");
+        }
+        return wat_fail(WAT_UNSUPPORTED, "data offset other than i32.const");
+    }
+    wat_token_t t = next();
+    uint32_t offset;
+    if (!parse_i32(&t, &offset)) return wat_fail(WAT_SYNTAX, "expected an i32 constant");
+    if (expect_close() != WAT_OK) return wat_error;
+    if (wrapped && expect_close() != WAT_OK) return wat_error;
+
+    // Measure the strings, then go back and copy them
+    wat_lexer_t strings = lex;
+    uint32_t total = 0;
+    for (t = next(); t.type == TOK_STRING; t = next()) {
+        int32_t len = decode_string(&t, NULL);
+        if (len < 0) return wat_fail(WAT_SYNTAX, "bad escape in string");
+        total += len;
+    }
+    if (t.type != TOK_CLOSE) return wat_fail(WAT_SYNTAX, "expected a string");
+    wat_lexer_t after = lex;
+    lex = strings;
+
+    emit_byte(0x00);
+    emit_byte(0x41);
+    emit_i32(offset);
+    emit_byte(0x0B);
+    emit_u32(total);
+    for (t = next(); t.type == TOK_STRING; t = next()) {
+        uint8_t* p = emit_space(decode_string(&t, NULL));
+        if (p) decode_string(&t, p);
+    }
+    lex = after;
+    return WAT_OK;
+}
+
+static int emit_data() {
+    if (wat.data_count == 0) return WAT_OK;
+    uint32_t section = begin_section(11);
+    emit_u32(wat.data_count);
+    bool wrapped = begin_fields();
+    for (;;) {
+        wat_token_t keyword;
+        if (next_field(wrapped, &keyword) != WAT_OK) return wat_error;
+        if (keyword.type == TOK_EOF) break;
+        int result = token_is(&keyword, "data") ? emit_data_segment() : skip_form();
+        if (result != WAT_OK) return wat_error;
+    }
+    end_size(section);
+    return WAT_OK;
+}
+
+/* ===== Assembler ===== */
+int wat_assemble(const char* source, uint32_t size, uint8_t* out, uint32_t max, uint32_t* out_size) {
+    memset(&wat, 0, sizeof(wat));
+    wat_error = WAT_OK;
+    wat_detail = "";
+    wat_line = 0;
+    wat_source = source;
+    wat_source_size = size;
+    out_buf = out;
+    out_max = max;
+    out_used = 0;
+
+    static const uint8_t header[8] = { 0x00, 'a', 's', 'm', 0x01, 0x00, 0x00, 0x00 };
+    uint8_t* p = emit_space(sizeof(header));
+    if (p) memcpy(p, header, sizeof(header));
+
+    if (declare_types() != WAT_OK || declare_fields() != WAT_OK) return wat_error;
+    emit_declarations();
+    if (wat_error != WAT_OK || emit_code() != WAT_OK || emit_data() != WAT_OK) return wat_error;
+    if (out_used > out_max) {
+        wat_line = lex.line;
+        return wat_fail(WAT_TOO_BIG, "binary doesn't fit the output buffer");
+    }
+    *out_size = out_used;
+    return WAT_OK;
+}
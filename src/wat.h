@@ -0,0 +1,27 @@
+#ifndef FOXOS_WAT_H
+#define FOXOS_WAT_H
+
+#include <stdint.h>
+
+/*
+ * WebAssembly text format assembler. wat_assemble() turns a .wat module into
+ * the binary format wasm_load() takes. It streams over the source a few
+ * times (declarations, then code, then data) instead of building a syntax
+ * tree, so the only state is the module's symbol tables. It covers what the
+ * runtime can run: i32 functions, imports of functions, one memory, globals,
+ * exports, start and active data, in both flat and folded instruction syntax.
+ */
+
+#define WAT_MAX_SOURCE 65536
+
+/* ===== Error Codes ===== */
+#define WAT_OK           0
+#define WAT_SYNTAX      -1
+#define WAT_UNKNOWN     -2  // Unknown instruction, identifier or index
+#define WAT_UNSUPPORTED -3  // Valid text, but nothing the runtime could run
+#define WAT_TOO_BIG     -4  // Binary doesn't fit the output buffer, or a table is full
+
+int wat_assemble(const char* source, uint32_t size, uint8_t* out, uint32_t max, uint32_t* out_size);
+void wat_perror(int error_code);  // Includes the line it went wrong on
+
+#endif
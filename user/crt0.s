@@ -0,0 +1,20 @@
+/* Program entry. The kernel leaves argc, then argv and an empty environment,
+   on the stack; main's return value goes to exit. */
+
+.set SYS_EXIT, 0
+.set SYSCALL_ENTRY, 0xBFFFF000
+
+.section .text.start
+.global _start
+_start:
+	xor %ebp, %ebp
+	mov (%esp), %eax
+	lea 4(%esp), %ecx
+	push %ecx
+	push %eax
+	call main
+	mov %eax, %ebx
+	mov $SYS_EXIT, %eax
+	mov $SYSCALL_ENTRY, %ecx
+	call *%ecx
+1:	jmp 1b
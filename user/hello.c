@@ -0,0 +1,42 @@
+#include "syscall.h"
+
+/* Greets from ring 3, echoes its arguments and round-trips a file */
+
+static uint32_t length(const char* s) {
+    uint32_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+static void print(const char* s) {
+    write(STDOUT, s, length(s));
+}
+
+int main(int argc, char** argv) {
+    print("Hello from ring 3!\n");
+    for (int i = 1; i < argc; i++) {
+        print("  argument: ");
+        print(argv[i]);
+        print("\n");
+    }
+
+    static const char message[] = "written and read back through system calls\n";
+    int fd = open("/tmp/hello.txt", O_WRITE);
+    if (fd < 0) {
+        print("hello: can't create /tmp/hello.txt\n");
+        return 1;
+    }
+    write(fd, message, sizeof(message) - 1);
+    close(fd);
+
+    static char buffer[128];
+    fd = open("/tmp/hello.txt", O_READ);
+    int n = fd < 0 ? -1 : read(fd, buffer, sizeof(buffer));
+    close(fd);
+    if (n < 0) {
+        print("hello: can't read /tmp/hello.txt\n");
+        return 1;
+    }
+    write(STDOUT, buffer, n);
+    return 0;
+}